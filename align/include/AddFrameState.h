@@ -9,9 +9,18 @@
 #include "Application.h"
 
 #include <functional>
+#include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
+
+#include "Filmstrip.h"
+#include "FrameCatalog.h"
+#include "FramePrefetcher.h"
+#include "KeyframeScorer.h"
+#include "ThumbnailAtlas.h"
 
 class AddFrameState : public AppState {
 public:
@@ -46,10 +55,19 @@ private:
   void listFrames();
   bool updateTexture();
   void showFrame();
+  void showFrameInfo();
+  void showFilmstrip();
+  void showKeyframes();
+  void addSuggested();
+  void selectFrame(const std::string &stem);
   void prevFrame();
   void nextFrame();
+  void prefetch();
+  void updatePreviewScale(float displayWidth);
+  static FramePrefetcher::Request makeRequest(const FramePair &fp);
 
   Application &mApp;
+  std::unique_ptr<FrameCatalog> mCatalog;
   FrameSet mFrames;
   FrameSet::const_iterator mCurrentFrame;
   std::unordered_set<std::filesystem::path> mAlreadyUsed;
@@ -58,9 +76,26 @@ private:
   int mWidth;
   int mHeight;
 
-  std::string mLastLoaded;
-  open3d::geometry::Image mLastRgb;
-  open3d::geometry::Image mLastDepth;
+  std::unique_ptr<FramePrefetcher> mPrefetcher;
+  std::shared_ptr<const FramePrefetcher::Frame> mLastFrame;
+  // 1 when browsing forward, -1 when browsing backward.
+  int mDirection = 1;
+  // Frames are decoded at 1/mPreviewScale of their resolution.
+  int mPreviewScale = 1;
+  // The atlas has all the frames we listed, in the same order, even after we
+  // remove them from mFrames.
+  std::unique_ptr<ThumbnailAtlas> mAtlas;
+  std::unique_ptr<Filmstrip> mFilmstrip;
+  // Also the indices of the keyframe scorer, which uses the same sources.
+  std::unordered_map<std::string, size_t> mAtlasIndices;
+  std::vector<size_t> mFilmstripItems;
+  std::string mFilmstripFrame;
+  std::vector<ThumbnailAtlas::Source> mSources;
+  std::unique_ptr<KeyframeScorer> mScorer;
+  std::vector<size_t> mSuggested;
+  bool mSuggestionsDirty = true;
+  int mMaxKeyframes = 12;
+  float mMinKeyframeAngle = 15.0f;
   float mBlend = 0.5f;
   float mTrunc = 1.5f;
 };
@@ -20,8 +20,12 @@ public:
 private:
   void runIcp();
   void voxelDown();
-  void estimateNormals();
-  void refreshBuffer();
+  void prepareIcp();
+  /**
+   * Upload the clouds that we render, which change only when we toggle the
+   * voxelized rendering or we down sample them.
+   */
+  void refreshGeometries();
 
   Application &mApp;
 
@@ -33,8 +37,15 @@ private:
   open3d::geometry::KDTreeSearchParamKNN mNormalsParam;
   bool mRenderVoxelized = false;
 
-  std::shared_ptr<open3d::geometry::PointCloud> mReference;
-  std::shared_ptr<open3d::geometry::PointCloud> mAlign;
+  // Shared with the scene, so entering this state does not copy them.
+  std::shared_ptr<const CompactCloud> mReference;
+  std::shared_ptr<const CompactCloud> mAlign;
+  // Converted to Open3D and with normals only when we run ICP.
+  std::shared_ptr<open3d::geometry::PointCloud> mReferenceIcp;
+  std::shared_ptr<open3d::geometry::PointCloud> mAlignIcp;
+  // Swapped with the clouds, so swapping does not upload anything.
+  std::unique_ptr<Renderer::Geometry> mReferenceGeometry;
+  std::unique_ptr<Renderer::Geometry> mAlignGeometry;
 
   double mMaxDistance = 0.01;
   open3d::pipelines::registration::ICPConvergenceCriteria mCriteria;
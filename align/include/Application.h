@@ -6,10 +6,16 @@
 
 #pragma once
 
+#include <future>
 #include <memory>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
 
 #include "BaseApplication.h"
 
+#include "FrameWatcher.h"
 #include "Renderer.h"
 #include "Scene.h"
 
@@ -41,8 +47,40 @@ public:
   Scene &getScene();
   const Scene &getScene() const;
 
+  /**
+   * Make sure that the clouds of the scene are on the GPU, and clear the main
+   * buffer of the renderer.
+   *
+   * The clouds stay resident across the states: we upload only the ones that
+   * have been added or that changed (e.g., their trunc, or the voxel size),
+   * and we release the ones that have been removed.
+   */
   void refreshBuffer(std::optional<double> voxelSize = std::nullopt);
+  /**
+   * Reload in background the clouds whose files changed on the disk, and
+   * update only their slices of the render buffer when they are ready.
+   *
+   * States that fill the buffer with refreshBuffer should call this every
+   * frame, since it assumes that the buffer contains the clouds of the scene.
+   */
+  void reloadChangedClouds();
+  /**
+   * Reload all the clouds on the next call to reloadChangedClouds.
+   */
+  void reloadAllClouds() { mReloadAll = true; }
   void renderScene(const glm::mat4 &pv, bool paintUniform = false) const;
+  /**
+   * Render a cloud of the scene with another matrix, between
+   * Renderer::beginRendering and Renderer::endRendering.
+   */
+  void renderSceneCloud(
+      size_t idx, const glm::mat4 &model,
+      std::optional<glm::vec3> uniformColor = std::nullopt) const;
+  /**
+   * Show the window with the memory used by each subsystem and frame (also
+   * toggled with F9).
+   */
+  void showMemoryWindow() { mShowMemory = true; }
 
 protected:
   void beginFrame() override;
@@ -50,10 +88,48 @@ protected:
   void render() override;
   void keyCallback(int key, int scancode, int action, int mods) override;
 
+  using ReloadResult = std::vector<
+      std::pair<std::string, std::shared_ptr<PointCloud::FrameData>>>;
+
+  /**
+   * The GPU copy of a cloud of the scene, with the parameters that we used to
+   * create it.
+   */
+  struct ResidentCloud {
+    bool isCurrent(const PointCloud &pcd,
+                   std::optional<double> voxelSize) const;
+
+    std::string name;
+    uint64_t version = 0;
+    double trunc = 0.0;
+    DepthFilter filter;
+    std::optional<double> voxelSize;
+    std::unique_ptr<Renderer::Geometry> geometry;
+  };
+
+  void syncClouds();
+  void watchFrames();
+  bool isChanged(const PointCloud &pcd) const;
+  void applyReload(ReloadResult &result);
+  void createMemoryGui();
+
   // We need to defer the renderer initialization until we have loaded OpenGL.
   std::optional<Renderer> mRenderer;
 
   std::unique_ptr<AppState> mCurrentState;
   std::unique_ptr<AppState> mPendingState;
   std::unique_ptr<Scene> mScene;
+  std::optional<double> mVoxelSize;
+  // In the same order as the clouds of the scene, after syncClouds.
+  std::vector<ResidentCloud> mResidentClouds;
+
+  bool mShowMemory = false;
+  std::string mMemoryDumpStatus;
+
+  std::unique_ptr<FrameWatcher> mWatcher;
+  const Scene *mWatchedScene = nullptr;
+  std::unordered_set<std::string> mChangedFrames;
+  bool mReloadAll = false;
+  // Declared after the scene, as it uses it.
+  std::future<ReloadResult> mReloading;
 };
@@ -0,0 +1,112 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "open3d/geometry/Image.h"
+
+/**
+ * A mask with a bit for each pixel of an image, in row-major order, and a
+ * min/max pyramid to check whether rectangles are entirely kept or removed.
+ *
+ * Bits are packed in 64-bit words without padding between the rows, so that
+ * the index of a pixel is the same as in the images. A set bit means that we
+ * keep the pixel.
+ *
+ * The pyramid is not updated automatically, since we usually edit a mask and
+ * then only query it: call updatePyramid after the changes. Queries still
+ * work without it, but they need to check all the bits.
+ */
+class BitMask {
+public:
+  BitMask() = default;
+  BitMask(int width, int height, bool value = false);
+  /**
+   * Create a mask from an image: its alpha if it has one (RGBA or gray-alpha)
+   * or its value for grayscale images. Pixels are kept when they are at least
+   * half of the maximum.
+   *
+   * Throws if the image cannot be used as a mask.
+   */
+  static BitMask fromImage(const open3d::geometry::Image &img);
+  /**
+   * Create a mask from packed words, in the format of getWords.
+   */
+  static BitMask fromWords(int width, int height, const uint64_t *words);
+
+  int getWidth() const { return mWidth; }
+  int getHeight() const { return mHeight; }
+  // The number of pixels.
+  size_t size() const { return static_cast<size_t>(mWidth) * mHeight; }
+  bool empty() const { return !size(); }
+
+  bool test(size_t i) const { return (mWords[i >> 6] >> (i & 63)) & 1; }
+  bool test(int x, int y) const {
+    return test(static_cast<size_t>(y) * mWidth + x);
+  }
+  void set(size_t i, bool value = true);
+  void set(int x, int y, bool value = true) {
+    set(static_cast<size_t>(y) * mWidth + x, value);
+  }
+  /**
+   * Keep only the pixels kept also by the other mask, which must have the
+   * same size.
+   */
+  BitMask &operator&=(const BitMask &other);
+  // The number of pixels we keep.
+  size_t count() const;
+
+  /**
+   * Check whether all the pixels, or any of them, in a rectangle are kept.
+   *
+   * The rectangle is clipped to the mask. An empty rectangle is all set and
+   * does not have any pixel set.
+   */
+  bool isAllSet(int x, int y, int width, int height) const;
+  bool isAnySet(int x, int y, int width, int height) const;
+
+  void updatePyramid();
+  bool hasPyramid() const { return mPyramidValid; }
+
+  /**
+   * The packed bits: pixel i is bit i % 64 of word i / 64. The unused bits of
+   * the last word are 0.
+   */
+  const std::vector<uint64_t> &getWords() const { return mWords; }
+  size_t getBytes() const;
+
+private:
+  struct Level {
+    int width = 0;
+    int height = 0;
+    // anyBit | allBit for each cell, i.e., the max and the min of the bits.
+    std::vector<uint8_t> cells;
+  };
+  static constexpr uint8_t anyBit = 1;
+  static constexpr uint8_t allBit = 2;
+  // The side of the cells of the first level, so that they have 64 pixels.
+  static constexpr int tileSize = 8;
+
+  struct Rect {
+    int x0, y0, x1, y1;
+  };
+  bool isRangeSet(size_t first, size_t last, bool all) const;
+  bool scan(const Rect &r, bool all) const;
+  bool query(size_t level, int cx, int cy, const Rect &r, bool all) const;
+  bool check(int x, int y, int width, int height, bool all) const;
+
+  int mWidth = 0;
+  int mHeight = 0;
+  std::vector<uint64_t> mWords;
+  // From the finest level to a single cell.
+  std::vector<Level> mLevels;
+  bool mPyramidValid = false;
+};
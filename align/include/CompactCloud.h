@@ -0,0 +1,69 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <cstdint>
+
+#include "Eigen/Core"
+
+#include "open3d/geometry/PointCloud.h"
+
+/**
+ * A point cloud with float32 positions in separate arrays, RGB8 colors and
+ * optional packed normals.
+ *
+ * It takes about a quarter of the memory of open3d::geometry::PointCloud, so
+ * we use it for the data we keep, and we convert it to Open3D only to call
+ * its algorithms.
+ */
+class CompactCloud {
+public:
+  CompactCloud() = default;
+  /**
+   * Convert an Open3D cloud, keeping its colors and normals if it has them.
+   */
+  explicit CompactCloud(const open3d::geometry::PointCloud &pcd);
+
+  size_t size() const { return x.size(); }
+  bool empty() const { return x.empty(); }
+  /**
+   * Resize the positions, and also the colors and the normals, if the cloud
+   * has them.
+   */
+  void resize(size_t n);
+  bool hasColors() const { return !empty() && colors.size() == 3 * size(); }
+  bool hasNormals() const { return !empty() && normals.size() == size(); }
+
+  Eigen::Vector3f getPoint(size_t i) const { return {x[i], y[i], z[i]}; }
+  Eigen::Vector3f getNormal(size_t i) const;
+  void setNormal(size_t i, const Eigen::Vector3f &normal);
+
+  CompactCloud select(const std::vector<size_t> &indices) const;
+  /**
+   * Move the point order[i] to the position i, e.g., with the permutation
+   * returned by getMortonOrder.
+   */
+  void reorder(const std::vector<uint32_t> &order);
+  /**
+   * Average the points, the colors and the normals in each voxel, like
+   * open3d::geometry::PointCloud::VoxelDownSample.
+   */
+  CompactCloud voxelDownSample(double voxelSize) const;
+  std::shared_ptr<open3d::geometry::PointCloud> toOpen3D() const;
+  size_t getBytes() const;
+
+  std::vector<float> x;
+  std::vector<float> y;
+  std::vector<float> z;
+  // 3 bytes for each point, or empty.
+  std::vector<uint8_t> colors;
+  // Unit vectors with the octahedral encoding (2 snorm16), or empty.
+  std::vector<uint32_t> normals;
+};
@@ -26,6 +26,7 @@ private:
   };
 
   void createMain();
+  void createMemoryGui();
   void createEdit();
   void createMultiEdit();
   glm::mat4 multiTransformUi();
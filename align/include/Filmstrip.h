@@ -0,0 +1,60 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+#include "glad/glad.h"
+
+class ThumbnailAtlas;
+
+/**
+ * A scrollable list of thumbnails, that draws only the visible rows.
+ *
+ * The tiles are uploaded to a single texture with a fixed number of slots,
+ * which are recycled in LRU order, so neither the GPU memory nor the cost of
+ * a frame depend on the number of frames.
+ */
+class Filmstrip {
+public:
+  Filmstrip(const ThumbnailAtlas &atlas);
+  Filmstrip(const Filmstrip &other) = delete;
+  Filmstrip(Filmstrip &&other) = delete;
+  Filmstrip &operator=(const Filmstrip &other) = delete;
+  Filmstrip &operator=(Filmstrip &&other) = delete;
+  ~Filmstrip();
+
+  /**
+   * Draw the given atlas tiles in a child window that fills the available
+   * space.
+   *
+   * Return the index of the tile that has been clicked, if any.
+   */
+  std::optional<size_t> draw(const std::vector<size_t> &items,
+                             std::optional<size_t> current,
+                             bool scrollToCurrent);
+
+private:
+  struct Slot {
+    size_t tile = SIZE_MAX;
+    uint64_t lastUse = 0;
+  };
+
+  std::optional<int> getSlot(size_t tile, int &uploadBudget);
+
+  const ThumbnailAtlas &mAtlas;
+  GLuint mTexture = 0;
+  int mTextureWidth;
+  int mTextureHeight;
+  std::vector<Slot> mSlots;
+  std::unordered_map<size_t, int> mTileSlots;
+  uint64_t mFrameCounter = 0;
+};
@@ -0,0 +1,113 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include "open3d/geometry/Image.h"
+
+/**
+ * A single file that contains all the frames of a scan, to avoid opening
+ * thousands of small files on slow storage.
+ *
+ * Color images and masks are stored with their original encoding (they are
+ * already compressed, and JPEG is lossy), whereas depth images are stored as
+ * raw planes compressed with zstd, which decodes much faster than PNG.
+ * An index table at the end of the file allows random access to the frames.
+ */
+class FrameArchive {
+public:
+  using ProgressCallback = std::function<void(size_t done, size_t total)>;
+
+  FrameArchive(const FrameArchive &other) = delete;
+  FrameArchive(FrameArchive &&other) = delete;
+  FrameArchive &operator=(const FrameArchive &other) = delete;
+  FrameArchive &operator=(FrameArchive &&other) = delete;
+  ~FrameArchive();
+
+  /**
+   * Map an archive and read its index.
+   *
+   * Throws if the file cannot be opened or it is not a valid archive.
+   */
+  static std::unique_ptr<FrameArchive>
+  open(const std::filesystem::path &path);
+  /**
+   * Pack all the frames of a data directory into a new archive.
+   *
+   * Frames that cannot be read are skipped, and the returned vector contains
+   * a warning for each of them.
+   */
+  static std::vector<std::string>
+  pack(const std::filesystem::path &dataDirectory,
+       const std::filesystem::path &output,
+       const ProgressCallback &progress = nullptr);
+
+  const std::filesystem::path &getPath() const { return mPath; }
+  /**
+   * Return the paths of the RGB and depth images of all the frames, relative
+   * to the data directory, as they were before packing them.
+   */
+  std::vector<std::pair<std::string, std::string>> listFrames() const;
+  bool contains(const std::string &depth) const;
+  /**
+   * Decode the RGB and depth images of a frame, given the original path of its
+   * depth image.
+   *
+   * The color image can be decoded at a reduced resolution (see decodeJpeg),
+   * whereas the depth image is always returned at full resolution.
+   */
+  std::pair<open3d::geometry::Image, open3d::geometry::Image>
+  readFrame(const std::string &depth, int colorScale = 1) const;
+  /**
+   * Return the meters of a unit of the depth of a frame, when its file
+   * specified it (see readDepth), or 0 if the scene scale applies.
+   */
+  double getDepthUnit(const std::string &depth) const;
+  /**
+   * Decode the mask of a frame, if the archive has it.
+   */
+  bool readMask(const std::string &name, open3d::geometry::Image &mask) const;
+
+private:
+  struct Blob {
+    uint64_t offset = 0;
+    uint64_t size = 0;
+  };
+  struct Entry {
+    std::string name;
+    std::string rgb;
+    std::string depth;
+    Blob color;
+    Blob depthPlanes;
+    Blob mask;
+    int32_t width = 0;
+    int32_t height = 0;
+    int32_t depthChannels = 0;
+    int32_t depthBytesPerChannel = 0;
+    double depthUnit = 0.0;
+  };
+
+  FrameArchive() = default;
+  void readIndex(uint64_t offset, uint64_t size);
+  const uint8_t *getBlob(const Blob &blob) const;
+
+  std::filesystem::path mPath;
+  const uint8_t *mData = nullptr;
+  size_t mSize = 0;
+  std::vector<Entry> mEntries;
+  std::unordered_map<std::string, size_t> mByDepth;
+  std::unordered_map<std::string, size_t> mByName;
+};
@@ -0,0 +1,90 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <cstddef>
+
+/**
+ * Keeps track of the memory used by the materialized frames of a scene, and
+ * evicts the least recently used ones when a budget is exceeded.
+ *
+ * The cache does not own the frames: it keeps only weak references to them,
+ * and it asks them to release their data when they are evicted.
+ * All the methods are thread-safe.
+ */
+class FrameCache {
+public:
+  class Evictable {
+  public:
+    virtual ~Evictable() = default;
+    /**
+     * Release all the data that can be created again.
+     *
+     * The cache calls this method without holding its lock, so
+     * implementations can take their own locks.
+     */
+    virtual void evict() = 0;
+  };
+
+  FrameCache(size_t budget = defaultBudget());
+  FrameCache(const FrameCache &other) = delete;
+  FrameCache(FrameCache &&other) = delete;
+  FrameCache &operator=(const FrameCache &other) = delete;
+  FrameCache &operator=(FrameCache &&other) = delete;
+
+  /**
+   * Half of the physical memory, or 4GiB if it is not possible to query it.
+   */
+  static size_t defaultBudget();
+
+  /**
+   * Mark an item as the most recently used one, and update the memory it
+   * uses.
+   *
+   * Then, evict other items until we are within the budget again, or until
+   * this is the only resident item. Callers must not hold any lock that an
+   * evict implementation might take.
+   */
+  void touch(const std::shared_ptr<Evictable> &item, size_t bytes);
+  /**
+   * Forget an item, without evicting it.
+   *
+   * Items must call it on destruction.
+   */
+  void remove(const Evictable *item);
+
+  void setBudget(size_t budget);
+  size_t getBudget() const;
+  size_t getUsage() const;
+  size_t getNumResident() const;
+
+private:
+  struct Entry {
+    // We cannot get the pointer back from expired weak_ptrs.
+    const Evictable *key;
+    std::weak_ptr<Evictable> item;
+    size_t bytes;
+  };
+  using List = std::list<Entry>;
+
+  std::vector<std::shared_ptr<Evictable>>
+  collectVictims(const Evictable *keep = nullptr);
+  void evict(std::vector<std::shared_ptr<Evictable>> &victims);
+
+  mutable std::mutex mMutex;
+  size_t mBudget;
+  size_t mUsage = 0;
+  // Front is the most recently used.
+  List mLru;
+  std::unordered_map<const Evictable *, List::iterator> mEntries;
+};
@@ -0,0 +1,124 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <cstdint>
+
+class Scene;
+
+/**
+ * The list of all the frames of a scan with some metadata, saved in the cache
+ * directory, so that we do not need to scan the directories every time.
+ *
+ * The catalog is scanned again only when the modification time of the rgb or
+ * depth directories, or of the archive changes. In that case, the metadata of
+ * the frames whose files have not changed is reused.
+ *
+ * Listing the frames only needs to stat their files, but reading the metadata
+ * needs to decode them, so we do it in a background thread. The list is
+ * complete as soon as the constructor returns, and the metadata of each frame
+ * becomes available as soon as the thread has read it.
+ */
+class FrameCatalog {
+public:
+  struct Entry {
+    std::string stem;
+    // Relative to the data directory.
+    std::string rgb;
+    std::string depth;
+    // Plain comparisons of keys sort frames like strnatcasecmp.
+    std::string sortKey;
+    // Of the source files (i.e., the archive for packed frames), in
+    // nanoseconds since the Unix epoch.
+    int64_t rgbTime = 0;
+    int64_t depthTime = 0;
+    uint64_t rgbSize = 0;
+    uint64_t depthSize = 0;
+    // The full resolution of the frame, 0 if we could not read it.
+    int32_t width = 0;
+    int32_t height = 0;
+    // The fraction of pixels with a valid depth.
+    float coverage = 0.0f;
+    bool packed = false;
+  };
+
+  /**
+   * Load the catalog of a scene and start updating it if needed.
+   *
+   * Problems with the cache file are not fatal, the catalog is just created
+   * again.
+   */
+  FrameCatalog(const Scene &scene);
+  FrameCatalog(const FrameCatalog &other) = delete;
+  FrameCatalog(FrameCatalog &&other) = delete;
+  FrameCatalog &operator=(const FrameCatalog &other) = delete;
+  FrameCatalog &operator=(FrameCatalog &&other) = delete;
+  ~FrameCatalog();
+
+  /**
+   * Return the frames, already in natural order.
+   *
+   * Their names and paths never change, but their metadata is valid only
+   * after wait returns.
+   */
+  const std::vector<Entry> &getEntries() const { return mEntries; }
+  /**
+   * Return a frame, or nullptr if it does not exist or if we have not read its
+   * metadata yet.
+   */
+  const Entry *find(const std::string &stem) const;
+  /**
+   * Wait until we have read the metadata of all the frames.
+   */
+  void wait();
+  size_t getNumScanned() const { return mNumScanned; }
+  size_t size() const { return mEntries.size(); }
+
+  /**
+   * Create a key that sorts like strnatcasecmp with plain comparisons.
+   *
+   * Numbers are padded with zeros, and letters are converted to lowercase.
+   * Numbers with only different leading zeros have the same key.
+   */
+  static std::string makeSortKey(const std::string &stem);
+
+private:
+  struct Header;
+  struct Stamps {
+    int64_t rgbDirectory = 0;
+    int64_t depthDirectory = 0;
+    int64_t archive = 0;
+
+    bool operator==(const Stamps &other) const;
+  };
+
+  bool load(Stamps &stamps);
+  void save(const Stamps &stamps) const;
+  void scan(const Stamps &stamps);
+  void work(std::vector<size_t> missing, Stamps stamps);
+  void readMetadata(Entry &e) const;
+  void indexEntries();
+
+  const Scene &mScene;
+  std::filesystem::path mPath;
+  // Never resized after the constructor, so that the thread can write the
+  // metadata of an entry while the UI reads the other ones.
+  std::vector<Entry> mEntries;
+  std::unordered_map<std::string, size_t> mByStem;
+  std::unique_ptr<std::atomic<bool>[]> mScanned;
+  std::atomic<size_t> mNumScanned = 0;
+  std::atomic<bool> mStop = false;
+  std::thread mWorker;
+};
@@ -0,0 +1,98 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include "open3d/geometry/Image.h"
+
+class Scene;
+
+/**
+ * Decodes frames in background threads, and keeps a bounded ring of the most
+ * recent ones, so that browsing them does not stall the UI.
+ */
+class FramePrefetcher {
+public:
+  struct Request {
+    std::string stem;
+    std::string rgb;
+    std::string depth;
+  };
+
+  struct Frame {
+    std::string stem;
+    open3d::geometry::Image rgb;
+    open3d::geometry::Image depth;
+    // Created with the blend and the truncation of the request.
+    open3d::geometry::Image colormap;
+    float blend;
+    float trunc;
+    // The images are decoded at 1/scale of the full resolution.
+    int scale;
+  };
+
+  FramePrefetcher(const Scene &scene, size_t capacity,
+                  size_t numThreads = 2);
+  FramePrefetcher(const FramePrefetcher &other) = delete;
+  FramePrefetcher(FramePrefetcher &&other) = delete;
+  FramePrefetcher &operator=(const FramePrefetcher &other) = delete;
+  FramePrefetcher &operator=(FramePrefetcher &&other) = delete;
+  ~FramePrefetcher();
+
+  /**
+   * Replace the pending requests with new ones, in order of priority.
+   *
+   * Frames in the ring that are not requested are the first to be evicted
+   * when the ring is full.
+   */
+  void prefetch(std::vector<Request> requests, float blend, float trunc,
+                int scale);
+  /**
+   * Return a decoded frame if it is in the ring with the requested scale, or
+   * nullptr.
+   */
+  std::shared_ptr<const Frame> get(const std::string &stem, int scale) const;
+  /**
+   * Decode a frame on the calling thread and add it to the ring.
+   *
+   * Throws if the frame cannot be decoded.
+   */
+  std::shared_ptr<const Frame> load(const Request &request, float blend,
+                                    float trunc, int scale);
+
+private:
+  void work();
+  std::shared_ptr<const Frame> decode(const Request &request, float blend,
+                                      float trunc, int scale) const;
+  std::shared_ptr<const Frame> find(const std::string &stem, int scale) const;
+  void insert(std::shared_ptr<const Frame> frame);
+
+  const Scene &mScene;
+  const size_t mCapacity;
+
+  mutable std::mutex mMutex;
+  std::condition_variable mCondition;
+  bool mStop = false;
+  std::deque<Request> mQueue;
+  float mBlend = 0.0f;
+  float mTrunc = 0.0f;
+  int mScale = 1;
+  std::unordered_set<std::string> mWanted;
+  std::unordered_set<std::string> mInProgress;
+  // Front is the oldest.
+  std::deque<std::shared_ptr<const Frame>> mRing;
+
+  std::vector<std::thread> mThreads;
+};
@@ -0,0 +1,116 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include <cstdint>
+
+#include "open3d/geometry/Image.h"
+
+#include "BitMask.h"
+#include "CompactCloud.h"
+#include "depthfilter.h"
+
+/**
+ * A binary file with the decoded data of a frame, so that we can skip the
+ * decoding and the unprojection when we open a frame again.
+ *
+ * The file contains a fixed header followed by raw arrays (aligned to 64
+ * bytes), so we can just map it and copy the arrays to the Open3D objects.
+ * The images are stored in their native format, like PointCloud keeps them.
+ * It is only a cache: every failure to read or write it is not fatal, and
+ * callers should fall back to the source files.
+ */
+class FrameSidecar {
+public:
+  /**
+   * Everything that changes the content of a sidecar.
+   *
+   * Sizes and times are 0 for files that do not exist (e.g., the mask).
+   */
+  struct Key {
+    uint64_t rgbSize;
+    int64_t rgbTime;
+    uint64_t depthSize;
+    int64_t depthTime;
+    uint64_t maskSize;
+    int64_t maskTime;
+    double trunc;
+    double depthScale;
+    double fx;
+    double fy;
+    double cx;
+    double cy;
+    int64_t width;
+    int64_t height;
+    // The sidecar stores the filtered depth.
+    DepthFilter depthFilter;
+    // Whether the points are sorted (int64_t, not to add padding).
+    int64_t sortPoints;
+
+    bool operator==(const Key &other) const;
+    bool operator!=(const Key &other) const { return !(*this == other); }
+  };
+
+  FrameSidecar(const FrameSidecar &other) = delete;
+  FrameSidecar(FrameSidecar &&other) = delete;
+  FrameSidecar &operator=(const FrameSidecar &other) = delete;
+  FrameSidecar &operator=(FrameSidecar &&other) = delete;
+  ~FrameSidecar();
+
+  /**
+   * Map a sidecar file and validate it against the key.
+   *
+   * Returns nullptr if the file does not exist, is stale or is corrupted.
+   */
+  static std::unique_ptr<FrameSidecar> open(const std::filesystem::path &path,
+                                            const Key &key);
+  /**
+   * Write a sidecar, replacing any existing one atomically.
+   *
+   * Points are in camera space, and pixels are their coordinates on the
+   * image. The mask is nullptr if the frame does not have one. Returns false
+   * in case of failure.
+   */
+  static bool write(const std::filesystem::path &path, const Key &key,
+                    const open3d::geometry::Image &color,
+                    const open3d::geometry::Image &depth,
+                    const BitMask *mask,
+                    const CompactCloud &points,
+                    const std::vector<Eigen::Vector2<unsigned int>> &pixels);
+
+  /**
+   * Return the color and the depth images, as Scene::openFrame.
+   */
+  std::pair<open3d::geometry::Image, open3d::geometry::Image>
+  getImages() const;
+  /**
+   * Return the mask of the frame, or an empty mask if it does not have one.
+   */
+  BitMask getMask() const;
+  /**
+   * Return the positions of the points, without colors.
+   */
+  CompactCloud getPoints() const;
+  std::vector<Eigen::Vector2<unsigned int>> getPixels() const;
+
+private:
+  struct Header;
+
+  FrameSidecar() = default;
+  const Header &header() const;
+  template <typename T> const T *array(uint64_t offset) const {
+    return reinterpret_cast<const T *>(mData + offset);
+  }
+
+  const uint8_t *mData = nullptr;
+  size_t mSize = 0;
+};
@@ -0,0 +1,47 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+/**
+ * Watches the rgb, depth and mask directories of a scan with inotify, to know
+ * which frames have been changed on the disk.
+ */
+class FrameWatcher {
+public:
+  FrameWatcher(const std::filesystem::path &dataDirectory);
+  FrameWatcher(const FrameWatcher &other) = delete;
+  FrameWatcher(FrameWatcher &&other) = delete;
+  FrameWatcher &operator=(const FrameWatcher &other) = delete;
+  FrameWatcher &operator=(FrameWatcher &&other) = delete;
+  ~FrameWatcher();
+
+  /**
+   * Read the pending events without blocking, and add the stems of the files
+   * that have changed to the set.
+   *
+   * Returns false if the kernel dropped some events, in which case any frame
+   * might have changed.
+   */
+  bool poll(std::unordered_set<std::string> &changed);
+
+  const std::filesystem::path &getDataDirectory() const {
+    return mDataDirectory;
+  }
+
+private:
+  void addWatch(const std::string &subdirectory);
+
+  std::filesystem::path mDataDirectory;
+  int mFd = -1;
+  int mBaseWatch = -1;
+  std::unordered_map<int, std::string> mWatches;
+};
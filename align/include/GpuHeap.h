@@ -0,0 +1,68 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <map>
+
+#include <cstddef>
+
+#include "glad/glad.h"
+
+/**
+ * Sub-allocates ranges of elements of a fixed size in a GL buffer, so that
+ * many geometries can share it and each of them can be replaced without
+ * uploading the others.
+ *
+ * When there is not a free range large enough, the buffer grows
+ * geometrically. It keeps its name, so the vertex arrays that use it do not
+ * need to be set up again. All the methods must be called on the thread of
+ * the GL context.
+ */
+class GpuHeap {
+public:
+  /**
+   * The heap does not own the buffer, which must outlive it.
+   */
+  GpuHeap(GLuint buffer, size_t elementSize);
+  GpuHeap(const GpuHeap &other) = delete;
+  GpuHeap(GpuHeap &&other) = delete;
+  GpuHeap &operator=(const GpuHeap &other) = delete;
+  GpuHeap &operator=(GpuHeap &&other) = delete;
+
+  /**
+   * Return the offset of a free range of count elements.
+   */
+  size_t allocate(size_t count);
+  void release(size_t offset, size_t count);
+  /**
+   * Change the size of a range, keeping it in place when it shrinks.
+   *
+   * The content of the range is not preserved when it moves.
+   */
+  void resize(size_t &offset, size_t &count, size_t newCount);
+  void upload(size_t offset, size_t count, const void *data);
+  /**
+   * Grow the buffer at once, if needed, so that count more elements fit in
+   * the free space, instead of growing it several times while allocating
+   * them.
+   */
+  void reserve(size_t count);
+
+  size_t getCapacityBytes() const { return mCapacity * mElementSize; }
+  size_t getUsedBytes() const { return mUsed * mElementSize; }
+
+private:
+  void grow(size_t minCapacity);
+  void insertFree(size_t offset, size_t count);
+
+  GLuint mBuffer;
+  size_t mElementSize;
+  size_t mCapacity = 0;
+  size_t mUsed = 0;
+  // Offset to size of the free ranges, which are never adjacent.
+  std::map<size_t, size_t> mFree;
+};
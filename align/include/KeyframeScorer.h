@@ -0,0 +1,108 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Eigen/Core"
+
+#include "open3d/geometry/PointCloud.h"
+
+#include "ThumbnailAtlas.h"
+#include "unproject.h"
+
+class Scene;
+
+/**
+ * Score all the candidate frames of a scan, to suggest a set of keyframes
+ * instead of picking them by hand.
+ *
+ * Every frame is decoded at half resolution and cropped to the face with
+ * findFaceRoi. Then, we measure its sharpness (the variance of the Laplacian
+ * of the luma), the coverage of the valid depth in the bounding box of the
+ * face and the noise of the depth (the mean distance from the average of the
+ * four neighbors). These are combined with their percentile ranks, so that
+ * we do not need to weight quantities with different units.
+ *
+ * Consecutive frames are registered with a coarse ICP on downsampled clouds
+ * and the steps are chained, to know the pose of each frame relative to the
+ * first one. When a registration fails, we start a new segment, whose poses
+ * cannot be compared with the previous ones.
+ *
+ * Everything is done in background and in parallel, like for the thumbnails.
+ */
+class KeyframeScorer {
+public:
+  struct Score {
+    // Whether we found the face and we could compute the other values.
+    bool valid = false;
+    float sharpness = 0.0f;
+    float coverage = 0.0f;
+    // In meters.
+    float noise = 0.0f;
+    // The combined score, between 0 and 1.
+    float quality = 0.0f;
+    // Frames of the same segment have poses in the same space.
+    int segment = -1;
+    Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+  };
+
+  KeyframeScorer(const Scene &scene, std::vector<ThumbnailAtlas::Source> frames,
+                 float trunc);
+  KeyframeScorer(const KeyframeScorer &other) = delete;
+  KeyframeScorer(KeyframeScorer &&other) = delete;
+  KeyframeScorer &operator=(const KeyframeScorer &other) = delete;
+  KeyframeScorer &operator=(KeyframeScorer &&other) = delete;
+  ~KeyframeScorer();
+
+  size_t size() const { return mFrames.size(); }
+  const std::string &getStem(size_t idx) const { return mFrames.at(idx).stem; }
+  size_t getNumScored() const { return mNumScored; }
+  size_t getNumRegistered() const { return mNumRegistered; }
+  bool isDone() const { return mDone; }
+  /**
+   * Return the scores, in the same order as the frames. They can be used
+   * only after isDone returns true.
+   */
+  const std::vector<Score> &getScores() const;
+
+  /**
+   * Choose up to maxCount frames, starting from the best ones, and skipping
+   * the ones that are within minAngle (in degrees) from a frame we already
+   * took, so that the set covers the face from different views.
+   *
+   * The accepted frames (e.g., the ones already in the scene) are considered
+   * for the angles, but they are not returned.
+   */
+  std::vector<size_t> suggest(size_t maxCount, double minAngle,
+                              const std::vector<size_t> &accepted = {}) const;
+
+private:
+  void work();
+  void scoreFrame(size_t idx);
+  void registerFrames();
+  void rankQuality();
+
+  const Scene &mScene;
+  std::vector<ThumbnailAtlas::Source> mFrames;
+  const float mTrunc;
+  // For the resolution of the previews we score.
+  CameraRays mRays;
+
+  std::vector<Score> mScores;
+  // Only between the scoring and the registration.
+  std::vector<std::shared_ptr<open3d::geometry::PointCloud>> mClouds;
+  std::atomic<size_t> mNumScored = 0;
+  std::atomic<size_t> mNumRegistered = 0;
+  std::atomic<bool> mDone = false;
+  std::atomic<bool> mStop = false;
+  std::thread mWorker;
+};
@@ -6,8 +6,11 @@
 
 #pragma once
 
+#include <atomic>
+#include <future>
 #include <memory>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "Application.h"
@@ -20,7 +23,12 @@ public:
   void createGui() override;
 
 private:
+  using LoadResult =
+      std::pair<std::unique_ptr<Scene>, std::vector<std::string>>;
+
   void load();
+  void createProgressGui();
+  void finishLoading();
   void switchToEditor();
 
   Application &mApp;
@@ -29,4 +37,10 @@ private:
   std::string mDirectory;
   std::string mError;
   std::vector<std::string> mWarnings;
+
+  std::atomic<size_t> mLoadedFrames = 0;
+  std::atomic<size_t> mTotalFrames = 0;
+  // Keep this as the last member: the destructor of a future returned by
+  // std::async waits for the task, which uses the counters above.
+  std::future<LoadResult> mLoading;
 };
@@ -0,0 +1,114 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "nlohmann/json.hpp"
+
+#include "open3d/geometry/PointCloud.h"
+#include "open3d/geometry/TriangleMesh.h"
+
+/**
+ * Collects the memory used by the big owners of the application (frames,
+ * render buffers, textures, volumes, etc.), to find out which one is
+ * responsible when we run out of RAM or VRAM.
+ *
+ * The owners do not push their usage: they register a reporter, which we call
+ * only when somebody asks for the usage, so keeping it up to date costs
+ * nothing. We call the reporters on the thread that calls collect (usually
+ * the main one, every frame), so they can read the state that the GUI owns,
+ * but they must lock the data that they share with worker threads, without
+ * waiting for long operations (e.g., with try_lock).
+ */
+class MemoryRegistry {
+public:
+  struct Entry {
+    // E.g., "Frames" or "Renderer".
+    std::string subsystem;
+    // The frame that owns the item, or empty if it does not belong to a
+    // frame.
+    std::string owner;
+    // What the memory is used for, e.g., "color image".
+    std::string item;
+    size_t bytes = 0;
+    bool gpu = false;
+  };
+  using Reporter = std::function<void(std::vector<Entry> &entries)>;
+
+  /**
+   * Removes its reporter when destroyed.
+   *
+   * Declare it after the members that the reporter reads, so that it is
+   * destroyed before them: the destructor waits for a collect in progress.
+   */
+  class Registration {
+  public:
+    Registration() = default;
+    Registration(const Registration &other) = delete;
+    Registration(Registration &&other) noexcept;
+    Registration &operator=(const Registration &other) = delete;
+    Registration &operator=(Registration &&other) noexcept;
+    ~Registration();
+
+    void reset();
+
+  private:
+    friend class MemoryRegistry;
+    Registration(uint64_t id) : mId(id) {}
+
+    uint64_t mId = 0;
+  };
+
+  static MemoryRegistry &get();
+
+  MemoryRegistry(const MemoryRegistry &other) = delete;
+  MemoryRegistry(MemoryRegistry &&other) = delete;
+  MemoryRegistry &operator=(const MemoryRegistry &other) = delete;
+  MemoryRegistry &operator=(MemoryRegistry &&other) = delete;
+
+  /**
+   * Register a reporter, that must not call the registry.
+   */
+  [[nodiscard]] Registration add(Reporter reporter);
+  /**
+   * Call all the reporters, in the order they have been registered.
+   */
+  std::vector<Entry> collect() const;
+
+  /**
+   * Create a machine-readable report, with the totals by subsystem and by
+   * frame, and all the entries.
+   */
+  static nlohmann::json toJson(const std::vector<Entry> &entries);
+  void dump(const std::filesystem::path &path) const;
+
+  /**
+   * The memory allocated for the attributes of Open3D's geometries.
+   */
+  static size_t getBytes(const open3d::geometry::PointCloud &pcd);
+  static size_t getBytes(const open3d::geometry::TriangleMesh &mesh);
+
+private:
+  MemoryRegistry() = default;
+  void remove(uint64_t id);
+
+  // Held while we call the reporters, so that removing one waits for them.
+  mutable std::mutex mCallMutex;
+  // Protects the fields below.
+  mutable std::mutex mMutex;
+  uint64_t mNextId = 1;
+  std::map<uint64_t, Reporter> mReporters;
+};
@@ -40,6 +40,7 @@ private:
   void alignFrame(size_t idx);
   void updateGraphics();
   void integrateNext();
+  size_t getVolumeBytes() const;
 
   void createExportGui();
   void createInteractiveGui();
@@ -78,11 +79,16 @@ private:
 
   glm::mat4 mMatrix{1.0f};
   int mRenderMode = RM_Mesh;
-  size_t mTempCloud = std::numeric_limits<size_t>::max();
 
   std::string mPcdFilename;
   std::string mMeshFilename;
 
   std::shared_ptr<open3d::geometry::PointCloud> mPointCloud;
   std::shared_ptr<open3d::geometry::TriangleMesh> mMesh;
+  std::unique_ptr<Renderer::Geometry> mCloudGeometry;
+  std::unique_ptr<Renderer::Geometry> mMeshGeometry;
+  // The frame that the interactive merge integrates next.
+  std::unique_ptr<Renderer::Geometry> mNextGeometry;
+
+  MemoryRegistry::Registration mMemory;
 };
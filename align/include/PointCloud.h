@@ -6,7 +6,11 @@
 
 #pragma once
 
+#include <memory>
 #include <optional>
+#include <vector>
+
+#include <cstdint>
 
 #include "glm/glm.hpp"
 
@@ -15,26 +19,144 @@
 #include "open3d/geometry/PointCloud.h"
 #include "open3d/geometry/RGBDImage.h"
 
+#include "CompactCloud.h"
+#include "FrameSidecar.h"
+#include "MemoryRegistry.h"
+#include "depthfilter.h"
+#include "roi.h"
+
 class Scene;
 
 class PointCloud {
 public:
+  // Opaque outside of PointCloud.
+  struct FrameData;
+
   PointCloud(const Scene &scene, const std::string &name, double trunc);
   PointCloud(const Scene &scene, const std::string &name,
              const std::string &rgb, const std::string depth, double trunc);
+  /**
+   * Create a cloud from images that have already been decoded with
+   * Scene::openFrame, instead of reading them again.
+   */
+  PointCloud(
+      const Scene &scene, const std::string &name, const std::string &rgb,
+      const std::string depth, double trunc,
+      std::pair<open3d::geometry::Image, open3d::geometry::Image> images);
   PointCloud(const Scene &scene, const nlohmann::json &j);
 
   Eigen::Matrix4d getMatrixEigen() const;
   nlohmann::json toJson() const;
+  /**
+   * Read the frame from the disk again, and check it is valid.
+   *
+   * If the sidecar cache has a valid entry for the frame, we use it instead of
+   * decoding the source images.
+   *
+   * The other data are created lazily when requested, and they might be
+   * evicted by the scene's frame cache at any time. Therefore, the getters
+   * return shared pointers, that keep the data alive as long as they are in
+   * use, even if the frame is evicted meanwhile.
+   * Also, they automatically create the data again when trunc changes.
+   */
   void loadData(const Scene &scene);
+  /**
+   * Read the frame from the disk again and create its data, but without
+   * changing this point cloud, so that it can be done in a background thread
+   * on a copy of it.
+   *
+   * Install the result with setData.
+   */
+  std::shared_ptr<FrameData> reloadData() const;
+  void setData(std::shared_ptr<FrameData> data);
+  /**
+   * Return a value that changes whenever the data is replaced, e.g., by
+   * loadData or setData, but not when it is evicted and created again.
+   *
+   * Together with trunc and depthFilter, it tells whether a copy of the
+   * cloud (e.g., on the GPU) is still current, without materializing it.
+   */
+  uint64_t getDataVersion() const;
 
-  const open3d::geometry::PointCloud &getPointCloud() const;
+  /**
+   * Return the cloud of the frame.
+   *
+   * It is shared with the other users of the frame (a reference count, no
+   * copy), so it is never changed in place: callers that need to modify it
+   * must copy it first.
+   */
+  std::shared_ptr<const CompactCloud> getPointCloud() const;
+  /**
+   * Return the cloud converted to Open3D, e.g., to run its algorithms.
+   */
   std::shared_ptr<open3d::geometry::PointCloud> getPointCloudCopy() const;
-  const open3d::geometry::RGBDImage &getRgbdImage() const;
-  std::shared_ptr<const open3d::geometry::RGBDImage> getMaskedRgbd() const;
-  bool hasMaskedRgbd() const { return static_cast<bool>(mMaskedRgbd); }
-  const open3d::geometry::PointCloud &
+  /**
+   * Return the cloud downsampled with CompactCloud::voxelDownSample.
+   *
+   * The result for the last voxel size is kept with the other data of the
+   * frame, so the renderer and the states that use the same size share it.
+   * If masked is true, we downsample the masked cloud (if we have it).
+   */
+  std::shared_ptr<const CompactCloud>
+  getDownsampledCloud(double voxelSize, bool masked = false) const;
+  /**
+   * Return the color image as it has been read from the disk (uint8, with 1,
+   * 3 or 4 channels).
+   */
+  std::shared_ptr<const open3d::geometry::Image> getColorImage() const;
+  /**
+   * Return the depth image in its native format (uint16 or float32), or
+   * float32 in the same unit when the depth filter is enabled.
+   *
+   * Multiply it by Scene::getDepthScale to get meters. It is not truncated.
+   */
+  std::shared_ptr<const open3d::geometry::Image> getDepthImage() const;
+  /**
+   * Create a temporary RGBD image in the format that Open3D expects (float32
+   * depth in meters, truncated to trunc), e.g., for the TSDF integration.
+   *
+   * It is not kept: callers should drop it as soon as they are done with it.
+   * If useMask is true and the frame has a mask, the depth of the masked
+   * pixels is set to 0.
+   */
+  std::shared_ptr<open3d::geometry::RGBDImage>
+  createRgbdImage(bool useMask = true) const;
+  /**
+   * Like the other overload, but write the image in place, e.g., in a vector
+   * of images for Open3D, which would copy them otherwise.
+   */
+  void createRgbdImage(open3d::geometry::RGBDImage &rgbd,
+                       bool useMask = true) const;
+  /**
+   * The masked cloud is created from the unmasked one when requested, so
+   * prefer hasMask to check if a cloud has a mask.
+   */
+  std::shared_ptr<const CompactCloud>
   getMaskedPointCloud(bool allowFallback = true) const;
+  bool hasMask() const;
+  /**
+   * Return the mask of the pixels to keep, with its pyramid, or nullptr if the
+   * cloud does not have a mask.
+   *
+   * This is the mask file combined with the region of interest, if autoRoi is
+   * enabled, and all the functions that use a mask use this one.
+   */
+  std::shared_ptr<const BitMask> getMask() const;
+  /**
+   * Return the region of the face that we found automatically, or nullptr if
+   * autoRoi is disabled or we could not find it.
+   *
+   * It is computed again when trunc or autoRoi change.
+   */
+  std::shared_ptr<const FaceRoi> getRoi() const;
+  /**
+   * Add the memory used by the data of the frame, one entry for each
+   * component, without materializing it.
+   *
+   * While a worker is creating the data, we do not wait for it, and we add
+   * only the total of the last time the data was touched.
+   */
+  void reportMemory(std::vector<MemoryRegistry::Entry> &entries) const;
 
   std::string name;
   std::string rgb;
@@ -43,15 +165,52 @@ public:
   glm::mat4 matrix;
   bool hidden;
   double trunc;
+  // Restrict the mask to the face found with findFaceRoi, so that the heavy
+  // stages process only its points.
+  bool autoRoi = true;
+  // Applied to the depth when we read the frame, before anything else uses
+  // it. Changing it reads the frame again.
+  DepthFilter depthFilter;
+  // Sort the points by their Morton code, so that the KD-trees and the draws
+  // touch nearby memory. It costs a sort every time we unproject the frame,
+  // which is not worth it for the frames that we query only once.
+  bool sortPoints = true;
 
 private:
-  void makeMasked(const Scene &scene);
+  /**
+   * Make sure that the point cloud has been created with the current trunc,
+   * decoding the frame again if it has been evicted.
+   * The data lock must be held.
+   */
+  void materialize(FrameData &data) const;
+  /**
+   * Make sure that the images are available, reading them from the sidecar or
+   * decoding them again if they have been evicted.
+   * The data lock must be held.
+   */
+  void loadImages(FrameData &data) const;
+  bool isMaskCurrent(const FrameData &data) const;
+  bool isFilterCurrent(const FrameData &data) const;
+  /**
+   * Find the region of interest and combine it with the mask, if they are
+   * not current. Returns whether they changed.
+   * The data lock must be held, and the images must be available.
+   */
+  bool refreshMask(FrameData &data) const;
+  void decode(FrameData &data) const;
+  void setImages(
+      FrameData &data,
+      std::pair<open3d::geometry::Image, open3d::geometry::Image> images) const;
+  void touch() const;
+  std::pair<std::filesystem::path, std::filesystem::path>
+  getSourcePaths() const;
+  std::optional<FrameSidecar::Key> getSidecarKey() const;
+  bool readSidecar(FrameData &data) const;
 
+  const Scene *mScene = nullptr;
+  // Shared with the frame cache, which might evict it at any time.
   // Open3D uses shared_ptrs, but we throw when we create them they are nullptr.
-  // So, they will never be nullptr and you can dereference them without further
-  // checks.
-  std::shared_ptr<open3d::geometry::RGBDImage> mRGBD;
-  std::shared_ptr<open3d::geometry::PointCloud> mPointCloud;
-  std::shared_ptr<open3d::geometry::RGBDImage> mMaskedRgbd;
-  std::shared_ptr<open3d::geometry::PointCloud> mMaskedCloud;
+  // So, the getters never return nullptr (except for the masked data when
+  // there is not a mask) and you can dereference them without further checks.
+  std::shared_ptr<FrameData> mData;
 };
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include <memory>
 #include <optional>
 #include <vector>
 
@@ -17,6 +18,9 @@
 
 #include "GLObjects.h"
 
+#include "CompactCloud.h"
+#include "GpuHeap.h"
+#include "MemoryRegistry.h"
 #include "PointCloud.h"
 #include "shaders.h"
 
@@ -45,6 +49,60 @@ public:
       Eigen::Matrix<float, Eigen::Dynamic, VA_MAX, Eigen::RowMajor>;
   using Vertex = Eigen::Vector<float, VA_MAX>;
 
+  /**
+   * Points with their own GPU buffer, that can be created and destroyed
+   * without touching the main one, e.g., to stream the chunks of an octree.
+   */
+  class PointChunk {
+  public:
+    PointChunk(const PointChunk &other) = delete;
+    PointChunk(PointChunk &&other) = delete;
+    PointChunk &operator=(const PointChunk &other) = delete;
+    PointChunk &operator=(PointChunk &&other) = delete;
+
+    size_t size() const { return static_cast<size_t>(mCount); }
+    /**
+     * The size of the GPU buffer of the chunk.
+     */
+    size_t getBytes() const { return size() * VA_MAX * sizeof(float); }
+
+  private:
+    friend class Renderer;
+    PointChunk() = default;
+
+    GLObjects mGlObjects;
+    GLsizei mCount = 0;
+  };
+
+  /**
+   * A geometry that stays on the GPU until it is destroyed, independently of
+   * the main buffer (clearBuffer does not affect it), e.g., to keep the
+   * clouds of the scene across the states.
+   *
+   * All the geometries share a heap, so creating, replacing or destroying one
+   * uploads only its own ranges. It must not outlive the renderer.
+   */
+  class Geometry {
+  public:
+    Geometry(const Geometry &other) = delete;
+    Geometry(Geometry &&other) = delete;
+    Geometry &operator=(const Geometry &other) = delete;
+    Geometry &operator=(Geometry &&other) = delete;
+    ~Geometry();
+
+    size_t size() const { return mNumVertices; }
+
+  private:
+    friend class Renderer;
+    Geometry(Renderer &renderer) : mRenderer(renderer) {}
+
+    Renderer &mRenderer;
+    size_t mFirstVertex = 0;
+    size_t mNumVertices = 0;
+    size_t mFirstIndex = 0;
+    size_t mNumIndices = 0;
+  };
+
   Renderer();
   Renderer(const Renderer &other) = delete;
   Renderer(Renderer &&other) = delete;
@@ -55,19 +113,56 @@ public:
   Renderer &operator=(Renderer &&other) = delete;
   ~Renderer();
 
-  size_t addPointCloud(const PointCloud &pcd,
-                       std::optional<double> voxelSize = std::nullopt);
+  size_t addPointCloud(const CompactCloud &pcd);
   size_t addPointCloud(const open3d::geometry::PointCloud &pcd);
   size_t addTriangleMesh(const open3d::geometry::TriangleMesh &mesh);
   size_t addTriangleMesh(const VertexMatrix &vertices,
                          const std::vector<uint32_t> &indices);
   void uploadBuffer() const;
+  /**
+   * Remove all the geometries, but keep the memory of the buffers, to fill
+   * them again.
+   */
   void clearBuffer();
+  std::unique_ptr<PointChunk> createChunk(const CompactCloud &pcd) const;
+  /**
+   * Create an empty geometry, to fill with setGeometry.
+   */
+  std::unique_ptr<Geometry> createGeometry();
+  /**
+   * Replace the content of a geometry.
+   *
+   * Only its ranges of the heap are uploaded, in place if the new data fits
+   * in them.
+   */
+  void setGeometry(Geometry &geometry, const CompactCloud &pcd);
+  void setGeometry(Geometry &geometry,
+                   const open3d::geometry::PointCloud &pcd);
+  void setGeometry(Geometry &geometry,
+                   const open3d::geometry::TriangleMesh &mesh);
+  /**
+   * Make room for numVertices more vertices of geometries, before setting
+   * many of them.
+   */
+  void reserveVertices(size_t numVertices);
 
   void beginRendering(const glm::mat4 &pv) const;
   void
   renderPointCloud(size_t idx, const glm::mat4 &model = glm::mat4(1.0f),
                    std::optional<glm::vec3> uniformColor = std::nullopt) const;
+  /**
+   * Render a chunk, between beginRendering and endRendering.
+   */
+  void renderChunk(const PointChunk &chunk,
+                   const glm::mat4 &model = glm::mat4(1.0f)) const;
+  /**
+   * Render a geometry, between beginRendering and endRendering, as points if
+   * it does not have indices, or as triangles otherwise.
+   */
+  void
+  renderGeometry(const Geometry &geometry,
+                 const glm::mat4 &model = glm::mat4(1.0f),
+                 std::optional<glm::vec3> uniformColor = std::nullopt) const;
   void
   renderIndexedMesh(size_t idx, const glm::mat4 &model = glm::mat4(1.0f),
                     bool textured = false, GLsizei offset = 0,
@@ -88,16 +183,44 @@ private:
     U_Texture,
     U_Max,
   };
-  void addVertices(const VertexMatrix &vertices);
+  static void setupVertexArray(const GLObjects &objects);
+  GLsizei getNumVertices() const;
+  /**
+   * Make room for n vertices at the end of the buffer, and return a pointer to
+   * them, to write them in place.
+   */
+  float *appendVertices(size_t n);
   void addPoints(const std::vector<Eigen::Vector3d> &points,
                  const std::vector<Eigen::Vector3d> &colors);
+  /**
+   * Convert points to vertices, writing VA_MAX floats for each of them.
+   */
+  static void writeVertices(const std::vector<Eigen::Vector3d> &points,
+                            const std::vector<Eigen::Vector3d> &colors,
+                            float *dst);
+  static void writeVertices(const CompactCloud &pcd, float *dst);
+  void setGeometry(Geometry &geometry, const std::vector<float> &vertices,
+                   const uint32_t *indices, size_t numIndices);
+  void releaseGeometry(Geometry &geometry);
 
   GLObjects mGlObjects;
   ShaderProgram mShader;
   GLint mUniforms[U_Max];
 
-  VertexMatrix mBuffer;
+  // The heap of the geometries, with its own vertex array.
+  GLObjects mHeapObjects;
+  GpuHeap mVertexHeap;
+  GpuHeap mIndexHeap;
+
+  // VA_MAX floats for each vertex, like the rows of a VertexMatrix.
+  std::vector<float> mVertices;
   std::vector<GLsizei> mOffsets;
   std::vector<uint32_t> mIndices;
   std::vector<GLsizei> mIndexOffsets;
+  // The sizes of the GPU buffers, which might not match the ones above until
+  // we upload them again.
+  mutable size_t mUploadedVertexBytes = 0;
+  mutable size_t mUploadedIndexBytes = 0;
+
+  MemoryRegistry::Registration mMemory;
 };
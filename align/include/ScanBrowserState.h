@@ -0,0 +1,72 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include "Application.h"
+#include "ScanOctree.h"
+
+/**
+ * Show all the frames of the scan at once, through the octree, rather than
+ * only the ones added to the scene.
+ */
+class ScanBrowserState : public AppState {
+public:
+  ScanBrowserState(Application &app);
+  ~ScanBrowserState();
+  void start() override;
+  void createGui() override;
+  void render(const glm::mat4 &pv) override;
+
+private:
+  struct GpuChunk {
+    std::unique_ptr<Renderer::PointChunk> chunk;
+    std::list<uint32_t>::iterator lru;
+  };
+
+  void build();
+  void finishBuilding();
+  void createProgressGui();
+  void createExportGui();
+  void releaseGpuChunks(size_t budget);
+
+  Application &mApp;
+  const Scene &mScene;
+
+  float mTrunc = 1.5f;
+  float mSpacing = 0.002f;
+  int mPointBudget = 3'000'000;
+  int mCacheBudgetMiB = 0;
+
+  float mExportMin[3] = {-0.5f, -0.5f, -0.5f};
+  float mExportMax[3] = {0.5f, 0.5f, 0.5f};
+  float mExportSpacing = 0.002f;
+  std::string mExportFilename;
+  std::string mError;
+
+  std::unordered_map<uint32_t, GpuChunk> mGpuChunks;
+  // The least recently rendered chunk is at the front.
+  std::list<uint32_t> mGpuLru;
+  size_t mGpuPoints = 0;
+  size_t mRenderedPoints = 0;
+
+  std::unique_ptr<ScanOctree> mOctree;
+  std::atomic<const char *> mPhase = nullptr;
+  std::atomic<size_t> mDone = 0;
+  std::atomic<size_t> mTotal = 0;
+  std::atomic<bool> mStop = false;
+  MemoryRegistry::Registration mMemory;
+  // Keep this as the last member: the destructor of a future returned by
+  // std::async waits for the task, which uses the members above.
+  std::future<std::unique_ptr<ScanOctree>> mBuilding;
+};
@@ -0,0 +1,162 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+#include <cstdint>
+
+#include "Eigen/Core"
+#include "Eigen/Geometry"
+
+#include "glm/glm.hpp"
+
+#include "CompactCloud.h"
+#include "FrameCache.h"
+
+class Scene;
+
+/**
+ * All the frames of a scan, merged in an octree of point chunks saved in the
+ * cache directory, so that we can show and query a whole scan without keeping
+ * it in memory.
+ *
+ * Every node has a cube with a grid of gridSize^3 cells, and it keeps at most
+ * a point for each of them. The points that do not fit go to its children, so
+ * a node and its ancestors together have the points of the region at the
+ * resolution of the node (like Potree does). Leaves have the points at the
+ * full resolution of the octree.
+ *
+ * The octree is built out of core, and only the chunks that are requested are
+ * read from the disk. They are kept within a memory budget, with their own
+ * FrameCache.
+ */
+class ScanOctree {
+public:
+  struct Frame {
+    std::string name;
+    // Relative to the data directory.
+    std::string rgb;
+    std::string depth;
+    // Frames that are not in the scene yet are put in the camera space.
+    Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+  };
+
+  struct Node {
+    // The origin of the cube and the length of its sides.
+    float min[3];
+    float size;
+    // 0 for missing children, the root is never a child.
+    std::array<uint32_t, 8> children;
+    uint64_t offset;
+    uint32_t count;
+    uint32_t level;
+  };
+
+  using ProgressCallback =
+      std::function<void(const char *phase, size_t done, size_t total)>;
+
+  static constexpr uint32_t gridSize = 128;
+
+  /**
+   * Open the octree of a scan, building it first if it is missing or if the
+   * frames or the parameters changed. The octree contains only the points
+   * closer than trunc to the camera, and its leaves have a point every
+   * spacing meters.
+   *
+   * The build can take some time, so this should be called in a background
+   * thread. If stop becomes true, the constructor throws.
+   */
+  ScanOctree(const Scene &scene, std::vector<Frame> frames, float trunc,
+             float spacing, const ProgressCallback &progress = nullptr,
+             const std::atomic<bool> *stop = nullptr);
+  ScanOctree(const ScanOctree &other) = delete;
+  ScanOctree(ScanOctree &&other) = delete;
+  ScanOctree &operator=(const ScanOctree &other) = delete;
+  ScanOctree &operator=(ScanOctree &&other) = delete;
+  ~ScanOctree();
+
+  const std::vector<Node> &getNodes() const { return mNodes; }
+  size_t getNumFrames() const { return mFrames.size(); }
+  uint64_t getNumPoints() const { return mNumPoints; }
+  float getSpacing() const { return mSpacing; }
+  FrameCache &getCache() { return *mCache; }
+  const FrameCache &getCache() const { return *mCache; }
+
+  /**
+   * Choose the nodes to show with a view-projection matrix, from the most to
+   * the least important, until the budget of points is exhausted.
+   *
+   * Nodes outside of the view are skipped, and the ones that look larger on
+   * the screen come first.
+   */
+  std::vector<uint32_t> selectNodes(const glm::mat4 &pv,
+                                    size_t pointBudget) const;
+  /**
+   * Return the points of a node if they are in memory, or nullptr.
+   */
+  std::shared_ptr<const CompactCloud> findChunk(uint32_t node) const;
+  /**
+   * Return the points of a node, reading them from the disk if needed.
+   */
+  std::shared_ptr<const CompactCloud> getChunk(uint32_t node) const;
+  /**
+   * Replace the chunks that the background thread reads, in order of
+   * priority. The ones already in memory are ignored.
+   */
+  void request(const std::vector<uint32_t> &nodes);
+
+  /**
+   * Gather the points inside a box, with at least the given resolution (or
+   * the full one, if it is smaller than the spacing of the leaves).
+   *
+   * The chunks are read only while we need them, so this works also on
+   * regions that do not fit in the memory budget.
+   */
+  CompactCloud collect(const Eigen::AlignedBox3f &box, float spacing) const;
+
+private:
+  struct Header;
+  struct Chunk;
+  class Builder;
+
+  bool load(uint64_t key);
+  uint64_t computeKey() const;
+  void work();
+  std::shared_ptr<const CompactCloud> readChunk(uint32_t node) const;
+
+  const Scene &mScene;
+  std::vector<Frame> mFrames;
+  const float mTrunc;
+  const float mSpacing;
+  std::filesystem::path mPath;
+
+  std::vector<Node> mNodes;
+  uint64_t mNumPoints = 0;
+  int mFd = -1;
+
+  std::shared_ptr<FrameCache> mCache;
+  // One for each node, the cache keeps only weak references to them.
+  std::vector<std::shared_ptr<Chunk>> mChunks;
+
+  std::mutex mMutex;
+  std::condition_variable mCondition;
+  bool mStop = false;
+  std::deque<uint32_t> mQueue;
+  std::thread mWorker;
+};
@@ -7,6 +7,7 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
 #include <memory>
 #include <string>
 #include <utility>
@@ -14,13 +15,27 @@
 
 #include "open3d/camera/PinholeCameraIntrinsic.h"
 
+#include "FrameArchive.h"
+#include "FrameCache.h"
+#include "MemoryRegistry.h"
 #include "PointCloud.h"
+#include "SidecarWriter.h"
+#include "StereoRegistration.h"
 #include "shaders.h"
+#include "unproject.h"
 
 class Scene {
 public:
+  /**
+   * Called every time a frame has been loaded (or failed to load).
+   *
+   * Frames are loaded in parallel, so this is called from worker threads.
+   */
+  using ProgressCallback = std::function<void(size_t done, size_t total)>;
+
   static std::pair<std::unique_ptr<Scene>, std::vector<std::string>>
-  load(const std::filesystem::path &dataDirectory);
+  load(const std::filesystem::path &dataDirectory,
+       const ProgressCallback &progress = nullptr);
   void save() const;
 
   const std::filesystem::path &getDataDirectory() const {
@@ -29,33 +44,146 @@ public:
   const open3d::camera::PinholeCameraIntrinsic &getCameraIntrinsic() const {
     return mIntrinsic;
   }
+  /**
+   * The factor to convert the values of the depth images to meters.
+   *
+   * We keep the depth images in their native format (usually uint16, or
+   * float32 for PFM), and convert them only when we use them.
+   * Frames that specify their own scale (PFM files and PNGs with a
+   * depth-scale chunk) are converted to this one when we open them, which is
+   * free when the scales match, e.g., PFM files with a scale of 1.
+   */
   double getDepthScale() const { return mDepthScale; }
+  const std::shared_ptr<FrameCache> &getFrameCache() const {
+    return mFrameCache;
+  }
+  SidecarWriter &getSidecarWriter() const { return *mSidecarWriter; }
+
+  /**
+   * Return the paths of the RGB and depth images of a frame that does not
+   * specify them explicitly, relative to the data directory.
+   */
+  static std::pair<std::string, std::string>
+  getFrameFiles(const std::filesystem::path &basename);
+  std::filesystem::path getMaskPath(const std::string &name) const;
+  std::filesystem::path getSidecarPath(const std::string &name) const;
+  static std::filesystem::path
+  getArchivePath(const std::filesystem::path &dataDirectory);
+  const FrameArchive *getArchive() const { return mArchive.get(); }
+  /**
+   * Return the files that contain the RGB and the depth images of a frame.
+   *
+   * They are the archive when the frame is packed, or the loose images, also
+   * when the latter have been changed after packing (see isPacked).
+   */
+  std::pair<std::filesystem::path, std::filesystem::path>
+  getSourcePaths(const std::string &rgb, const std::string &depth) const;
+
+  /**
+   * List the pairs of RGB and depth images in the rgb and depth directories of
+   * a scan, as paths relative to the data directory.
+   */
+  static std::vector<std::pair<std::filesystem::path, std::filesystem::path>>
+  listFrameFiles(const std::filesystem::path &dataDirectory);
+  /**
+   * Returns the extension of a path converted to lowercase.
+   *
+   * For our purposes, we accept only ASCII extensions, which simplifies this
+   * function.
+   */
+  static std::string lowercaseExtension(const std::filesystem::path &p);
 
   std::pair<open3d::geometry::Image, open3d::geometry::Image>
   openFrame(const std::filesystem::path &basename) const;
   std::pair<open3d::geometry::Image, open3d::geometry::Image>
   openFrame(std::string rgb, std::string depth) const;
+  /**
+   * Open a frame at a reduced resolution, for previews.
+   *
+   * JPEG color images are decoded directly at the reduced resolution, whereas
+   * the other images are subsampled. The scale must be 1, 2, 4 or 8.
+   */
+  std::pair<open3d::geometry::Image, open3d::geometry::Image>
+  openFramePreview(const std::string &rgb, const std::string &depth,
+                   int scale) const;
+  /**
+   * Open the mask of a frame, from the mask directory or from the archive.
+   *
+   * Returns false if the frame does not have a mask.
+   */
+  bool openMask(const std::string &name, open3d::geometry::Image &mask) const;
 
+  /**
+   * Unproject a depth image in its native format (see getDepthScale),
+   * ignoring the pixels farther than trunc.
+   */
   std::pair<std::vector<Eigen::Vector3d>,
             std::vector<Eigen::Vector2<unsigned int>>>
   unprojectDepth(
-      const open3d::geometry::Image &depth,
-      const Eigen::Matrix4d &transform = Eigen::Matrix4d::Identity()) const;
+      const open3d::geometry::Image &depth, double trunc,
+      const Eigen::Matrix4d &transform = Eigen::Matrix4d::Identity(),
+      const BitMask *mask = nullptr) const;
   std::pair<std::vector<Eigen::Vector3d>,
             std::vector<Eigen::Vector2<unsigned int>>>
   unprojectDepth(const PointCloud &pcd, bool useMask = true) const;
+  /**
+   * Unproject a depth image without colors, by default in the camera space.
+   */
+  std::pair<CompactCloud, std::vector<Eigen::Vector2<unsigned int>>>
+  unprojectCompact(
+      const open3d::geometry::Image &depth, double trunc,
+      const Eigen::Matrix4d &transform = Eigen::Matrix4d::Identity()) const;
 
   std::vector<PointCloud> clouds;
 
 private:
   Scene() = default;
   Scene(const std::filesystem::path &dataDirectory,
-        std::vector<std::string> &warnings);
+        std::vector<std::string> &warnings, const ProgressCallback &progress);
+  void loadClouds(const nlohmann::json &j, std::vector<std::string> &warnings,
+                  const ProgressCallback &progress);
   open3d::geometry::Image openImage(const std::string &path) const;
+  open3d::geometry::Image openDepth(const std::string &path) const;
+  std::pair<open3d::geometry::Image, open3d::geometry::Image>
+  openStereoFrame(const std::string &rgb, const std::string &disparity) const;
+  /**
+   * Whether we read a frame from the archive.
+   *
+   * Packing keeps the loose files, so, like for the masks, they take the
+   * precedence when they are newer than the archive, so that they can still
+   * be edited.
+   */
+  bool isPacked(const std::string &rgb, const std::string &depth) const;
+  /**
+   * Convert a depth image whose values are in the given unit (in meters) to
+   * the scale of the scene. A unit of 0 means that it already uses it.
+   */
+  void applyDepthUnit(open3d::geometry::Image &depth, double unit) const;
+  void checkImageSize(const open3d::geometry::Image &img,
+                      const std::string &path, int scale = 1) const;
+  static void
+  checkFrameFormat(const std::pair<open3d::geometry::Image,
+                                   open3d::geometry::Image> &frame);
   std::filesystem::path getDataFile() const;
 
   std::filesystem::path mDataDirectory;
 
   open3d::camera::PinholeCameraIntrinsic mIntrinsic;
+  // Computed once, since we unproject frames often.
+  CameraRays mRays;
   double mDepthScale;
+
+  // Optional, frames that are not in the archive are read from the loose files.
+  std::unique_ptr<FrameArchive> mArchive;
+  std::filesystem::file_time_type mArchiveTime;
+  // Only for stereo datasets, whose frames we create from the disparity.
+  std::unique_ptr<StereoRegistration> mStereo;
+
+  // Shared with the frame data, so that it can outlive the scene if needed.
+  std::shared_ptr<FrameCache> mFrameCache = std::make_shared<FrameCache>();
+  std::unique_ptr<SidecarWriter> mSidecarWriter =
+      std::make_unique<SidecarWriter>();
+
+  // Keep it last, as it reads the clouds.
+  MemoryRegistry::Registration mMemory;
 };
@@ -0,0 +1,72 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "open3d/geometry/Image.h"
+
+#include "BitMask.h"
+#include "CompactCloud.h"
+#include "FrameSidecar.h"
+
+/**
+ * Writes the sidecars in a background thread, so that creating the clouds
+ * does not wait for the disk.
+ *
+ * The images are shared with the frame data rather than copied. The queue is
+ * bounded, because each job keeps also a copy of the points: when it is full,
+ * write waits for the oldest job to complete.
+ */
+class SidecarWriter {
+public:
+  struct Job {
+    std::filesystem::path path;
+    FrameSidecar::Key key = {};
+    std::shared_ptr<const open3d::geometry::Image> color;
+    std::shared_ptr<const open3d::geometry::Image> depth;
+    // nullptr if the frame does not have a mask.
+    std::shared_ptr<const BitMask> mask;
+    CompactCloud points;
+    std::vector<Eigen::Vector2<unsigned int>> pixels;
+  };
+
+  SidecarWriter(size_t capacity = 8);
+  SidecarWriter(const SidecarWriter &other) = delete;
+  SidecarWriter(SidecarWriter &&other) = delete;
+  SidecarWriter &operator=(const SidecarWriter &other) = delete;
+  SidecarWriter &operator=(SidecarWriter &&other) = delete;
+  /**
+   * Complete the write in progress, but drop the pending ones: the sidecars
+   * are only a cache, and we will create them the next time.
+   */
+  ~SidecarWriter();
+
+  /**
+   * Queue a sidecar, replacing a pending job for the same path, if any.
+   */
+  void write(Job job);
+
+private:
+  void work();
+
+  const size_t mCapacity;
+  std::mutex mMutex;
+  // Signaled when a job is added, or when we stop.
+  std::condition_variable mAdded;
+  // Signaled when a job is taken from the queue.
+  std::condition_variable mTaken;
+  bool mStop = false;
+  std::deque<Job> mQueue;
+  std::thread mThread;
+};
@@ -0,0 +1,104 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Eigen/Core"
+
+#include "open3d/camera/PinholeCameraIntrinsic.h"
+#include "open3d/geometry/Image.h"
+
+/**
+ * Create RGBD frames from the disparity maps of a stereo camera, like
+ * camera-tools/stereo-make-depth.py does, but in memory, when we open them.
+ *
+ * The calibration is read from stereo.json, which stereo-calibrate.py writes
+ * together with calibration.npz (stereo-export-calibration.py converts older
+ * calibrations). The disparity maps are float PFM files in the disparity
+ * directory, whose names end with _disp.pfm, and color frames are matched to
+ * them with the part of the name before the first dash.
+ *
+ * For every pixel of the disparity, we compute the depth and the position on
+ * the color camera in a single pass, and then we resample the color with a
+ * Lanczos filter on 8x8 pixels (like OpenCV's INTER_LANCZOS4), in parallel.
+ */
+class StereoRegistration {
+public:
+  StereoRegistration(const StereoRegistration &other) = delete;
+  StereoRegistration(StereoRegistration &&other) = delete;
+  StereoRegistration &operator=(const StereoRegistration &other) = delete;
+  StereoRegistration &operator=(StereoRegistration &&other) = delete;
+
+  /**
+   * Read the calibration of a dataset, or return nullptr if it does not have
+   * one. Throws if the calibration is invalid.
+   */
+  static std::unique_ptr<StereoRegistration>
+  load(const std::filesystem::path &dataDirectory);
+  static std::filesystem::path
+  getCalibrationPath(const std::filesystem::path &dataDirectory);
+  static bool isDisparityFile(const std::filesystem::path &path);
+  /**
+   * List the pairs of color frames and disparity maps of a dataset, as paths
+   * relative to the data directory.
+   */
+  static std::vector<std::pair<std::filesystem::path, std::filesystem::path>>
+  listFrameFiles(const std::filesystem::path &dataDirectory);
+
+  /**
+   * The intrinsic parameters of the rectified camera, which are also the ones
+   * of the frames we create.
+   */
+  const open3d::camera::PinholeCameraIntrinsic &getIntrinsic() const {
+    return mIntrinsic;
+  }
+
+  /**
+   * Create a frame from a disparity map and the color image of the same
+   * instant: the color is registered to the depth, and the depth is float32
+   * in meters.
+   *
+   * Unless the calibration says otherwise, the depth of the pixels that the
+   * color camera does not see is set to 0.
+   */
+  std::pair<open3d::geometry::Image, open3d::geometry::Image>
+  registerFrame(const open3d::geometry::Image &disparity,
+                const open3d::geometry::Image &color) const;
+
+private:
+  // The Lanczos weights are tabulated on this many subdivisions of a pixel,
+  // like OpenCV does.
+  static constexpr int tableSize = 32;
+
+  StereoRegistration() = default;
+  void computeRows(const open3d::geometry::Image &disparity,
+                   const open3d::geometry::Image &color, size_t first,
+                   size_t last, open3d::geometry::Image &depth,
+                   open3d::geometry::Image &registered) const;
+
+  open3d::camera::PinholeCameraIntrinsic mIntrinsic;
+  // [R | t] Q, so that it maps (x, y, disparity, 1) to the homogeneous
+  // coordinates of the point in the space of the color camera, in row-major
+  // order.
+  std::array<float, 12> mToColor;
+  // The last row of Q, whose sign tells whether a point is in front of the
+  // camera.
+  std::array<float, 4> mW;
+  // fx, skew, cx, fy, cy of the color camera.
+  std::array<float, 5> mColorK;
+  // k1, k2, p1, p2, k3, k4, k5, k6 (OpenCV's order), 0 for the missing ones.
+  std::array<float, 8> mDistortion;
+  // The baseline times the focal length, to convert disparity to depth.
+  float mBf = 0.0f;
+  bool mKeepInvalidColor = false;
+  std::vector<std::array<float, 8>> mLanczos;
+};
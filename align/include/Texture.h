@@ -19,8 +19,13 @@ public:
   ~Texture();
 
   void bind() const;
+  /**
+   * The memory that we requested on the GPU, including the mipmaps.
+   */
+  size_t getBytes() const { return mBytes; }
 
 private:
   // https://stackoverflow.com/questions/1108589/is-0-a-valid-opengl-texture-id
   GLuint mTexture = 0;
+  size_t mBytes = 0;
 };
@@ -36,6 +36,7 @@ public:
 
 private:
   void update();
+  void reportMemory(std::vector<MemoryRegistry::Entry> &entries) const;
   void fileModal(const char *title, const char *button, std::string &filename,
                  const std::function<bool()> &func);
   bool loadMesh();
@@ -57,4 +58,6 @@ private:
   std::string mSaveFilename;
   std::string mTextureFilename;
   std::string mErrorDesc;
+
+  MemoryRegistry::Registration mMemory;
 };
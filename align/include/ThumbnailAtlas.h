@@ -0,0 +1,98 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <filesystem>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <cstdint>
+
+#include "MemoryRegistry.h"
+
+class Scene;
+
+/**
+ * Small previews of all the candidate frames of a scan, saved in a single
+ * file in the cache directory.
+ *
+ * Every tile contains the RGB thumbnail on the left, and the depth colormap on
+ * the right, as packed RGB8 pixels.
+ * Missing or outdated tiles are created in background, in parallel, and the
+ * file is saved again when they are all ready.
+ */
+class ThumbnailAtlas {
+public:
+  struct Source {
+    std::string stem;
+    std::string rgb;
+    std::string depth;
+  };
+
+  static constexpr int thumbnailWidth = 80;
+
+  ThumbnailAtlas(const Scene &scene, std::vector<Source> frames, float trunc);
+  ThumbnailAtlas(const ThumbnailAtlas &other) = delete;
+  ThumbnailAtlas(ThumbnailAtlas &&other) = delete;
+  ThumbnailAtlas &operator=(const ThumbnailAtlas &other) = delete;
+  ThumbnailAtlas &operator=(ThumbnailAtlas &&other) = delete;
+  /**
+   * Stop the creation of the tiles, and save the ones that are ready.
+   */
+  ~ThumbnailAtlas();
+
+  size_t size() const { return mFrames.size(); }
+  const std::string &getStem(size_t idx) const { return mFrames.at(idx).stem; }
+  int getTileWidth() const { return mTileWidth; }
+  int getTileHeight() const { return mTileHeight; }
+  /**
+   * Return the pixels of a tile, or nullptr if it is not ready yet.
+   *
+   * It is safe to call it while the tiles are being created.
+   */
+  const uint8_t *getTile(size_t idx) const;
+  size_t getNumReady() const { return mNumReady; }
+
+private:
+  struct Header;
+  // The modification times of the source files, both 0 if we could not read
+  // them.
+  struct Stamp {
+    int64_t rgbTime = 0;
+    int64_t depthTime = 0;
+
+    bool isValid() const { return rgbTime || depthTime; }
+    bool operator==(const Stamp &other) const;
+  };
+
+  void work();
+  void load(const std::vector<Stamp> &stamps);
+  void save(const std::vector<Stamp> &stamps) const;
+  void createTile(size_t idx);
+  Stamp getStamp(const Source &source) const;
+  size_t getTileBytes() const;
+
+  const Scene &mScene;
+  std::vector<Source> mFrames;
+  const float mTrunc;
+  int mTileWidth;
+  int mTileHeight;
+  std::filesystem::path mPath;
+
+  // Allocated once in the constructor, so that we can give pointers to the
+  // tiles to the UI while the worker is writing the other ones.
+  std::vector<uint8_t> mPixels;
+  std::unique_ptr<std::atomic<bool>[]> mReady;
+  std::atomic<size_t> mNumReady = 0;
+  std::atomic<bool> mStop = false;
+  std::thread mWorker;
+
+  MemoryRegistry::Registration mMemory;
+};
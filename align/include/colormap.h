@@ -8,6 +8,12 @@
 
 #include "open3d/geometry/Image.h"
 
+/**
+ * Blend an RGB image with the plasma colormap of a depth image.
+ *
+ * The depth is in its native format (uint16 or float32): scale converts it to
+ * meters, and trunc is the depth at the end of the colormap.
+ */
 open3d::geometry::Image createColormap(const open3d::geometry::Image &rgb,
                                        const open3d::geometry::Image &depth,
                                        float blend, float scale, float trunc);
@@ -0,0 +1,65 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <cstdint>
+
+#include "nlohmann/json.hpp"
+
+#include "open3d/geometry/Image.h"
+
+/**
+ * The parameters of the preprocessing of the depth of a frame, before we
+ * create its cloud.
+ *
+ * It is part of the key of the sidecar cache, so it must stay trivially
+ * copyable, without padding. Every stage is disabled by a 0 radius or count.
+ */
+struct DepthFilter {
+  // Flying pixels: a pixel is kept only if at least minSupport of its 8
+  // neighbors have a depth within flyingThreshold times its own.
+  int32_t minSupport = 3;
+  float flyingThreshold = 0.02f;
+  // Holes up to 2 * holeRadius pixels wide are filled with the average of
+  // their neighbors, but only when they have neighbors on opposite sides, and
+  // on the same surface (within flyingThreshold).
+  int32_t holeRadius = 1;
+  // Edge-preserving smoothing, on a (2 * bilateralRadius + 1)^2 window.
+  int32_t bilateralRadius = 2;
+  // In pixels.
+  float sigmaSpace = 1.5f;
+  // In meters.
+  float sigmaDepth = 0.005f;
+
+  /**
+   * The parameters of the frames of the scenes created before we had the
+   * filter, which we keep as they were.
+   */
+  static DepthFilter disabled();
+  bool isEnabled() const;
+  bool operator==(const DepthFilter &other) const;
+  bool operator!=(const DepthFilter &other) const { return !(*this == other); }
+};
+
+void to_json(nlohmann::json &j, const DepthFilter &filter);
+void from_json(const nlohmann::json &j, DepthFilter &filter);
+
+/**
+ * Apply the enabled stages to a depth image in its native format (uint16 or
+ * float32), in this order: flying pixels, holes and bilateral filter.
+ *
+ * The result is a float32 image in the same unit as the input (i.e., it must
+ * still be multiplied by depthScale to get meters), since the smoothed values
+ * do not fit the integers. If nothing is enabled, the image is copied as it
+ * is.
+ *
+ * The image is processed in bands of rows in parallel, with AVX2 or NEON when
+ * available.
+ */
+open3d::geometry::Image filterDepth(const open3d::geometry::Image &depth,
+                                    float depthScale,
+                                    const DepthFilter &filter);
@@ -0,0 +1,94 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <filesystem>
+
+#include <cstddef>
+#include <cstdint>
+
+#include "open3d/geometry/Image.h"
+
+#include "BitMask.h"
+
+/**
+ * Decode a JPEG image at a reduced resolution, using libjpeg's scaling in the
+ * DCT domain, which is much faster than decoding all the pixels and then
+ * resizing the image.
+ *
+ * The scale is the denominator of the resolution and it must be 1, 2, 4 or 8.
+ * Color images have 3 channels and grayscale images 1, like Open3D's.
+ * Throws if the image cannot be decoded.
+ */
+open3d::geometry::Image decodeJpeg(const uint8_t *data, size_t size,
+                                   int scale = 1);
+open3d::geometry::Image readJpeg(const std::filesystem::path &path,
+                                 int scale = 1);
+
+/**
+ * Return whether a file has the .jpg or .jpeg extension (case insensitive).
+ */
+bool isJpeg(const std::filesystem::path &path);
+
+/**
+ * Read a depth image in one of the formats we support for the depth:
+ * - PNG, usually uint16, optionally with a "depth-scale" tEXt chunk, like the
+ *   ones written by stereo-make-depth.py: meters are value / depth-scale;
+ * - grayscale PFM, which is float32 in meters, read without any conversion
+ *   except the vertical flip (PFM starts from the bottom row).
+ *
+ * unit is set to the meters of a unit of the image when the file specifies
+ * it, or to 0 when the scale of the scene applies.
+ * Throws if the file cannot be read.
+ */
+open3d::geometry::Image readDepth(const std::filesystem::path &path,
+                                  double &unit);
+
+/**
+ * Return whether a file has the extension of a depth format that readDepth
+ * supports (case insensitive).
+ */
+bool isDepthFile(const std::filesystem::path &path);
+
+/**
+ * Read a grayscale PFM image as float32, flipped so that it starts from the
+ * top row. Throws if the file cannot be read or it is a color PFM.
+ */
+open3d::geometry::Image readPfm(const std::filesystem::path &path);
+
+/**
+ * Return the value of the "depth-scale" text chunk of a PNG file, or 0 if it
+ * does not have it. We only scan the chunks before the image data, without
+ * decoding anything.
+ */
+double readPngDepthScale(const std::filesystem::path &path);
+
+/**
+ * Write a mask as a 1-bit grayscale PNG, with white for the pixels we keep.
+ *
+ * It is much smaller and faster to write than an RGBA image, and
+ * BitMask::fromImage reads it back, since Open3D expands it to 8 bits.
+ * Returns false in case of failure.
+ */
+bool writeMaskPng(const std::filesystem::path &path, const BitMask &mask);
+
+/**
+ * Keep only one pixel every scale pixels, in both directions.
+ *
+ * The size of the result is rounded up, like libjpeg does, so that it matches
+ * the one of JPEG images decoded with the same scale. It works also for depth
+ * images, because it never mixes pixels.
+ */
+open3d::geometry::Image subsampleImage(const open3d::geometry::Image &img,
+                                       int scale);
+
+/**
+ * The size of an image dimension after scaling it, rounded up.
+ */
+inline int getScaledSize(int size, int scale) {
+  return (size + scale - 1) / scale;
+}
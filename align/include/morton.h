@@ -0,0 +1,61 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <cstdint>
+
+#include "Eigen/Core"
+
+class CompactCloud;
+
+/**
+ * Interleave the bits of three 21-bit coordinates, with x in the lowest bit of
+ * each group of three.
+ *
+ * Sorting by this code visits the cells of an octree in depth-first order, so
+ * points that are close in the space are usually close also in memory.
+ */
+uint64_t encodeMorton(uint32_t x, uint32_t y, uint32_t z);
+
+/**
+ * Return the permutation that sorts the points by their Morton code, on a grid
+ * of 2^21 cells for each axis fitted to the bounding box of the points.
+ *
+ * order[i] is the index of the point that goes in the position i.
+ */
+std::vector<uint32_t> getMortonOrder(const CompactCloud &points);
+std::vector<uint32_t>
+getMortonOrder(const std::vector<Eigen::Vector3d> &points);
+
+/**
+ * Reorder an array with a permutation returned by getMortonOrder.
+ */
+template <typename T>
+void applyOrder(std::vector<T> &values, const std::vector<uint32_t> &order) {
+  std::vector<T> sorted;
+  sorted.reserve(order.size());
+  for (uint32_t i : order) {
+    sorted.push_back(values[i]);
+  }
+  values.swap(sorted);
+}
+
+/**
+ * Sort unprojected points by their Morton code, and their pixels in the same
+ * way, so that the pixels keep mapping the points back to the image.
+ *
+ * The scanline order of the unprojection is bad for the memory accesses of the
+ * KD-trees and of the vertex cache of the GPU, because neighbors in the space
+ * are a whole row apart. We do it only for the clouds we keep or query many
+ * times, since the sort is not free.
+ */
+void sortMorton(CompactCloud &points,
+                std::vector<Eigen::Vector2<unsigned int>> &pixels);
+void sortMorton(std::vector<Eigen::Vector3d> &points,
+                std::vector<Eigen::Vector2<unsigned int>> &pixels);
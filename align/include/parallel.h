@@ -0,0 +1,28 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <functional>
+
+#include <cstddef>
+
+/**
+ * Returns the number of threads we use for parallel work, i.e., the number of
+ * hardware threads, or 1 if it cannot be determined.
+ */
+size_t getNumWorkers();
+
+/**
+ * Calls func for every index in [0, count), distributing the calls on up to
+ * getNumWorkers() threads (the calling one included).
+ *
+ * Indices are handed out in increasing order, but they might complete in any
+ * order, so func must take care of synchronizing any shared state.
+ * If any call throws, the remaining indices are skipped and the first
+ * exception is rethrown on the calling thread after all workers have joined.
+ */
+void parallelFor(size_t count, const std::function<void(size_t)> &func);
@@ -0,0 +1,47 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <optional>
+
+#include "open3d/geometry/Image.h"
+
+#include "BitMask.h"
+
+/**
+ * The region of a frame that contains the face.
+ */
+struct FaceRoi {
+  // The bounding box of the region, in pixels.
+  int x = 0;
+  int y = 0;
+  int width = 0;
+  int height = 0;
+  // The pixels of the region, with the size of the whole image.
+  BitMask mask;
+  // The number of pixels in the region, and of the valid ones in the whole
+  // frame, e.g., to show how much we crop.
+  size_t numPixels = 0;
+  size_t numValid = 0;
+};
+
+/**
+ * Find the face in a depth image, assuming it is the nearest large surface to
+ * the camera.
+ *
+ * We separate the foreground with the histogram of the depth: we start from
+ * the nearest peak and we stop at the first gap, or at a maximum distance
+ * from the nearest surface. Then, we keep the largest connected component of
+ * the foreground pixels, which drops the small bits of background (e.g., the
+ * hands or the shoulders when they are separated by a gap).
+ *
+ * The depth image is in its native format (uint16 or float32), like for
+ * unprojectRays. Returns std::nullopt if there are too few valid pixels to
+ * find a region.
+ */
+std::optional<FaceRoi> findFaceRoi(const open3d::geometry::Image &depth,
+                                   float depthScale, float trunc);
@@ -0,0 +1,36 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+/**
+ * On x86, we do not build the whole program for AVX2, so that it still runs on
+ * the CPUs without it. Instead, we compile only the kernels for it, as
+ * functions marked with SIMD_AVX2_TARGET, and we call them only when
+ * isSimdEnabled() says that the CPU supports them.
+ *
+ * NEON is always available on the ARM CPUs we build for, so the NEON kernels
+ * are still selected at compile time. We also include the header of the
+ * intrinsics of the target.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_AVX2 1
+#define SIMD_AVX2_TARGET __attribute__((target("avx2,fma")))
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Whether the kernels should use SIMD instructions: by default, when the CPU
+ * supports them.
+ */
+bool isSimdEnabled();
+/**
+ * Force the scalar kernels, e.g., to compare their results with the SIMD
+ * ones. SIMD cannot be enabled on a CPU that does not support it.
+ */
+void setSimdEnabled(bool enabled);
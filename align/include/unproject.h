@@ -0,0 +1,76 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#pragma once
+
+#include <vector>
+
+#include <cstdint>
+
+#include "Eigen/Core"
+
+#include "open3d/camera/PinholeCameraIntrinsic.h"
+#include "open3d/geometry/Image.h"
+
+#include "BitMask.h"
+#include "CompactCloud.h"
+
+/**
+ * The direction of the rays of a camera, i.e., the points at depth 1.
+ *
+ * The rays of a pinhole camera are separable, so we keep only a value for
+ * each column and one for each row.
+ */
+struct CameraRays {
+  CameraRays() = default;
+  CameraRays(const open3d::camera::PinholeCameraIntrinsic &intrinsic);
+
+  // (x - cx) / fx for every column.
+  std::vector<float> x;
+  // (y - cy) / fy for every row.
+  std::vector<float> y;
+};
+
+/**
+ * Unproject the pixels of a depth image and apply a transform to them.
+ *
+ * The depth image is in its native format (uint16 or float32): we convert it
+ * to meters on the fly, multiplying it by depthScale, and we consider valid
+ * only the pixels whose depth is positive and less than trunc, like Open3D
+ * does when it creates its float depth images.
+ *
+ * The computation is done in single precision, with AVX2 or NEON when they
+ * are available. The output vectors are resized to the number of valid
+ * pixels.
+ * If a mask is passed, only the pixels it keeps are valid, and we skip the
+ * rows it removes entirely without decoding them.
+ */
+void unprojectRays(const open3d::geometry::Image &depth, float depthScale,
+                   float trunc, const CameraRays &rays,
+                   const Eigen::Matrix4d &transform,
+                   CompactCloud &points,
+                   std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                   const BitMask *mask = nullptr);
+/**
+ * Like the other overload, but for callers that need Open3D's types.
+ */
+void unprojectRays(const open3d::geometry::Image &depth, float depthScale,
+                   float trunc, const CameraRays &rays,
+                   const Eigen::Matrix4d &transform,
+                   std::vector<Eigen::Vector3d> &points,
+                   std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                   const BitMask *mask = nullptr);
+
+/**
+ * Set the colors of unprojected points from the pixels they come from, like
+ * open3d::geometry::PointCloud::CreateFromRGBDImage does: RGB images are
+ * copied, and grayscale ones are used for all the channels.
+ *
+ * The color image must be uint8, with 1, 3 or 4 channels.
+ */
+void gatherColors(const open3d::geometry::Image &color,
+                  const std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                  CompactCloud &points);
@@ -6,7 +6,14 @@
 
 #include "AddFrameState.h"
 
+#include <optional>
+#include <string>
+#include <vector>
+
 #include <cstdio>
+#include <ctime>
+
+#include "glm/gtc/type_ptr.hpp"
 
 #include "imgui.h"
 #include "imgui_stdlib.h"
@@ -17,16 +24,13 @@
 
 #include "EditorState.h"
 #include "colormap.h"
+#include "imageutils.h"
+#include "parallel.h"
 
 namespace fs = std::filesystem;
 
-/**
- * Returns the extension of a path converted to lowercase.
- *
- * For our purposes, we accept only ASCII extensions, which simplifies this
- * function.
- */
-static std::string lowercaseExtension(const fs::path &p);
+// How many frames we decode in advance in the direction of browsing.
+static constexpr size_t prefetchCount = 4;
 
 AddFrameState::AddFrameState(Application &app) : mApp(app) {
   const open3d::camera::PinholeCameraIntrinsic &intr =
@@ -47,6 +51,9 @@ AddFrameState::AddFrameState(Application &app) : mApp(app) {
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, mWidth, mHeight, 0, GL_RGBA,
                GL_UNSIGNED_BYTE, nullptr);
 
+  // Keep also some frames behind us, in case we go back.
+  mPrefetcher =
+      std::make_unique<FramePrefetcher>(app.getScene(), prefetchCount * 3);
   listFrames();
 }
 
@@ -57,56 +64,27 @@ AddFrameState::~AddFrameState() {
 
 void AddFrameState::listFrames() {
   Scene &scene = mApp.getScene();
-
-  const fs::path &base = scene.getDataDirectory();
-  const fs::path rgbPath = base / "rgb";
-  const fs::path depthPath = base / "depth";
-  // directory_iterator throws if the directory isn't valid, so we need to check
-  // before calling it.
-  if (!fs::exists(rgbPath) || !fs::is_directory(rgbPath) ||
-      !fs::exists(depthPath) || !fs::is_directory(depthPath)) {
-    return;
-  }
-
   for (const PointCloud &pcd : scene.clouds) {
     mAlreadyUsed.insert(pcd.name);
   }
 
-  // The following steps should not hurt a healthy dataset: we enable
-  // case-insensitivity on the extension (and maybe also on the stem, in the
-  // future), which however means that some frames might be discarded (and the
-  // one that will be taken depends on the order on which we iterate).
-  std::unordered_map<fs::path, fs::path> depthStems;
-  for (const fs::directory_entry &entry : fs::directory_iterator(depthPath)) {
-    fs::path p = entry.path().lexically_proximate(base);
-    if (lowercaseExtension(p) != ".png") {
-      continue;
-    }
-    auto res = depthStems.insert(std::make_pair(p.stem(), p));
-    // In debug mode, assert about unhealthy datasets.
-    assert(res.second && "Duplicated depth stem.");
-  }
-
-  // We support mulitple extensions (jpg, png and various variants in
-  // case-sensitive filesystems), so multiple color frames could be associated
-  // to the same depth frame.
-  // However, the FrameSet class checks only the depth name (which has already
-  // been forced to be unique), so only the first entry will be taken into
-  // account. However, which one will be taken depends on the order of
-  // iteration.
-  // This should not be a problem for healthy dataset, but not a completely
-  // correct solution either.
-  for (const fs::directory_entry &entry : fs::directory_iterator(rgbPath)) {
-    fs::path p = entry.path().lexically_proximate(base);
-    std::string ext = lowercaseExtension(p);
-    if (ext != ".jpg" && ext != ".png") {
-      continue;
-    }
-    auto maybeDepth = depthStems.find(p.stem());
-    if (maybeDepth != depthStems.end()) {
-      mFrames.emplace(p, maybeDepth->second);
-    }
+  // The catalog is already sorted, so the hint makes insertions constant.
+  // It lists the frames immediately, and it reads their metadata in the
+  // background, so we can show them already.
+  mCatalog = std::make_unique<FrameCatalog>(scene);
+  for (const FrameCatalog::Entry &e : mCatalog->getEntries()) {
+    mFrames.emplace_hint(mFrames.end(), e.rgb, e.depth);
+  }
+
+  std::vector<ThumbnailAtlas::Source> sources;
+  sources.reserve(mFrames.size());
+  for (const FramePair &fp : mFrames) {
+    mAtlasIndices[fp.stem] = sources.size();
+    sources.push_back({fp.stem, fp.rgb, fp.d});
   }
+  mSources = sources;
+  mAtlas = std::make_unique<ThumbnailAtlas>(scene, std::move(sources), mTrunc);
+  mFilmstrip = std::make_unique<Filmstrip>(*mAtlas);
 
   mCurrentFrame = mFrames.begin();
   while (!mFrames.empty() && !updateTexture())
@@ -119,15 +97,25 @@ bool AddFrameState::updateTexture() {
   }
   const Scene &scene = mApp.getScene();
   open3d::geometry::Image colormap;
+  const open3d::geometry::Image *colormapPtr = &colormap;
   try {
-    if (*mCurrentFrame != mLastLoaded) {
-      std::tie(mLastRgb, mLastDepth) =
-          scene.openFrame(mCurrentFrame->rgb, mCurrentFrame->d);
+    if (!mLastFrame || *mCurrentFrame != mLastFrame->stem ||
+        mLastFrame->scale != mPreviewScale) {
+      std::shared_ptr<const FramePrefetcher::Frame> frame =
+          mPrefetcher->get(mCurrentFrame->stem, mPreviewScale);
+      if (!frame) {
+        frame = mPrefetcher->load(makeRequest(*mCurrentFrame), mBlend, mTrunc,
+                                  mPreviewScale);
+      }
+      mLastFrame = std::move(frame);
+    }
+    if (mLastFrame->blend == mBlend && mLastFrame->trunc == mTrunc) {
+      colormapPtr = &mLastFrame->colormap;
+    } else {
+      colormap =
+          createColormap(mLastFrame->rgb, mLastFrame->depth, mBlend,
+                         static_cast<float>(scene.getDepthScale()), mTrunc);
     }
-    colormap =
-        createColormap(mLastRgb, mLastDepth, mBlend,
-                       static_cast<float>(scene.getDepthScale()), mTrunc);
-    mLastLoaded = mCurrentFrame->stem;
   } catch (std::exception &e) {
     fprintf(stderr, "Cannot load %s: %s\n", mCurrentFrame->stem.c_str(),
             e.what());
@@ -136,11 +124,57 @@ bool AddFrameState::updateTexture() {
   }
 
   glBindTexture(GL_TEXTURE_2D, mTexture);
-  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mWidth, mHeight, GL_RGB, GL_FLOAT,
-                  colormap.data_.data());
+  // Previews use only the top-left part of the texture.
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, colormapPtr->width_,
+                  colormapPtr->height_, GL_RGB, GL_FLOAT,
+                  colormapPtr->data_.data());
+  prefetch();
   return true;
 }
 
+void AddFrameState::prefetch() {
+  assert(mCurrentFrame != mFrames.end());
+  // The current frame is the first, so that it is not evicted.
+  std::vector<FramePrefetcher::Request> requests = {
+      makeRequest(*mCurrentFrame)};
+  FrameSet::const_iterator it = mCurrentFrame;
+  while (requests.size() <= prefetchCount && requests.size() < mFrames.size()) {
+    if (mDirection > 0) {
+      if (++it == mFrames.end()) {
+        it = mFrames.begin();
+      }
+    } else {
+      if (it == mFrames.begin()) {
+        it = mFrames.end();
+      }
+      --it;
+    }
+    requests.push_back(makeRequest(*it));
+  }
+  mPrefetcher->prefetch(std::move(requests), mBlend, mTrunc, mPreviewScale);
+}
+
+void AddFrameState::updatePreviewScale(float displayWidth) {
+  // Use the smallest resolution that is still at least as large as the
+  // displayed image, so the preview does not lose any detail.
+  int scale = 1;
+  while (scale < 8 && mWidth / (scale * 2) >= displayWidth) {
+    scale *= 2;
+  }
+  if (scale != mPreviewScale) {
+    mPreviewScale = scale;
+    while (!mFrames.empty() && !updateTexture()) {
+      if (mCurrentFrame == mFrames.end()) {
+        mCurrentFrame = mFrames.begin();
+      }
+    }
+  }
+}
+
+FramePrefetcher::Request AddFrameState::makeRequest(const FramePair &fp) {
+  return {fp.stem, fp.rgb, fp.d};
+}
+
 void AddFrameState::createGui() {
   ImGui::Begin("Add frame");
   if (mFrames.empty()) {
@@ -152,6 +186,11 @@ void AddFrameState::createGui() {
     mApp.setState(std::make_unique<EditorState>(mApp));
   }
   ImGui::End();
+
+  if (!mFrames.empty() && mCurrentFrame != mFrames.end()) {
+    showFilmstrip();
+    showKeyframes();
+  }
 }
 
 void AddFrameState::render(const glm::mat4 &pv) { mApp.renderScene(pv); }
@@ -178,27 +217,27 @@ void AddFrameState::showFrame() {
   if (ImGui::DragFloat("Truncate", &mTrunc, 0.01f, 0.0f, 20.0f)) {
     updateTexture();
   }
-  float width = std::max<float>(mWidth, ImGui::GetWindowWidth());
+  float width = ImGui::GetWindowWidth();
   float ratio = static_cast<float>(mHeight) / mWidth;
   float height = width * ratio;
+  updatePreviewScale(width);
+  if (mFrames.empty() || mCurrentFrame == mFrames.end()) {
+    // updateTexture failed and there are no more frames.
+    return;
+  }
+  ImVec2 uv(
+      static_cast<float>(getScaledSize(mWidth, mPreviewScale)) / mWidth,
+      static_cast<float>(getScaledSize(mHeight, mPreviewScale)) / mHeight);
   // Sigh. This is the official way of showing an image with ImGui.
   // https://github.com/ocornut/imgui/wiki/Image-Loading-and-Displaying-Examples#example-for-opengl-users
-  ImGui::Image((void *)(intptr_t)mTexture, ImVec2(width, height));
+  ImGui::Image((void *)(intptr_t)mTexture, ImVec2(width, height), ImVec2(0, 0),
+               uv);
 
   std::string filename = mCurrentFrame->stem;
   if (ImGui::InputText("Filename", &filename)) {
-    const std::string &current = mCurrentFrame->stem;
-    FrameSet::const_iterator maybeNew = mFrames.find(filename);
-    if (maybeNew != mFrames.end()) {
-      mCurrentFrame = maybeNew;
-      if (!updateTexture()) {
-        // updateTexture deletes invalid entries, so find a new iterator.
-        // The old iterator should be still valid according to the
-        // documentation, but we prefer a safer approach and get a new one.
-        mCurrentFrame = mFrames.find(current);
-      }
-    }
+    selectFrame(filename);
   }
+  showFrameInfo();
 
   ImGui::PushButtonRepeat(true);
   if (ImGui::Button("Previous")) {
@@ -214,8 +253,18 @@ void AddFrameState::showFrame() {
   ImGui::BeginDisabled(inScene);
   if (ImGui::Button(inScene ? "Already added" : "Add", ImVec2(120, 0))) {
     Scene &scene = mApp.getScene();
-    scene.clouds.emplace_back(scene, mCurrentFrame->stem, mCurrentFrame->rgb,
-                              mCurrentFrame->d, mTrunc);
+    // updateTexture always decodes the current frame, so we can give its
+    // images to the cloud, instead of decoding them again, unless they are
+    // only a preview or they belong to another frame.
+    if (mLastFrame && mLastFrame->stem == mCurrentFrame->stem &&
+        mLastFrame->scale == 1) {
+      scene.clouds.emplace_back(
+          scene, mCurrentFrame->stem, mCurrentFrame->rgb, mCurrentFrame->d,
+          mTrunc, std::make_pair(mLastFrame->rgb, mLastFrame->depth));
+    } else {
+      scene.clouds.emplace_back(scene, mCurrentFrame->stem, mCurrentFrame->rgb,
+                                mCurrentFrame->d, mTrunc);
+    }
     mAlreadyUsed.insert(mCurrentFrame->stem);
     mApp.refreshBuffer();
     mCurrentFrame = mFrames.erase(mCurrentFrame);
@@ -229,7 +278,238 @@ void AddFrameState::showFrame() {
   ImGui::EndDisabled();
 }
 
+void AddFrameState::showFrameInfo() {
+  const FrameCatalog::Entry *e = mCatalog->find(mCurrentFrame->stem);
+  if (!e) {
+    if (mCatalog->getNumScanned() < mCatalog->size()) {
+      ImGui::TextUnformatted("Depth coverage: reading the frames...");
+    }
+    return;
+  }
+  char date[32] = "unknown";
+  time_t time = static_cast<time_t>(e->depthTime / 1000000000);
+  struct tm tm;
+  if (e->depthTime && localtime_r(&time, &tm)) {
+    strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+  }
+  ImGui::Text("Depth coverage: %.1f%%, modified: %s%s", e->coverage * 100.0f,
+              date, e->packed ? " (packed)" : "");
+
+  auto it = mAtlasIndices.find(mCurrentFrame->stem);
+  if (mScorer && mScorer->isDone() && it != mAtlasIndices.end()) {
+    const KeyframeScorer::Score &score = mScorer->getScores()[it->second];
+    if (score.valid) {
+      ImGui::Text("Keyframe score: %.2f (sharpness %.0f, face coverage "
+                  "%.1f%%, noise %.1fmm)",
+                  score.quality, score.sharpness, score.coverage * 100.0f,
+                  score.noise * 1000.0f);
+    } else {
+      ImGui::Text("Keyframe score: face not found");
+    }
+  }
+}
+
+void AddFrameState::showFilmstrip() {
+  ImGui::SetNextWindowSize(ImVec2(320, 480), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Frames")) {
+    ImGui::End();
+    return;
+  }
+  ImGui::Text("Thumbnails: %zu/%zu", mAtlas->getNumReady(), mAtlas->size());
+  if (mCatalog->getNumScanned() < mCatalog->size()) {
+    ImGui::Text("Catalog: %zu/%zu", mCatalog->getNumScanned(),
+                mCatalog->size());
+  }
+
+  // We only remove frames, so the size is enough to know when to update.
+  if (mFilmstripItems.size() != mFrames.size()) {
+    mFilmstripItems.clear();
+    for (const FramePair &fp : mFrames) {
+      auto it = mAtlasIndices.find(fp.stem);
+      if (it != mAtlasIndices.end()) {
+        mFilmstripItems.push_back(it->second);
+      }
+    }
+  }
+  std::optional<size_t> current;
+  auto it = mAtlasIndices.find(mCurrentFrame->stem);
+  if (it != mAtlasIndices.end()) {
+    current = it->second;
+  }
+  // Follow the current frame only when it changes, to let the user scroll.
+  bool scroll = mFilmstripFrame != mCurrentFrame->stem;
+  mFilmstripFrame = mCurrentFrame->stem;
+  std::optional<size_t> clicked =
+      mFilmstrip->draw(mFilmstripItems, current, scroll);
+  ImGui::End();
+
+  if (clicked) {
+    selectFrame(mAtlas->getStem(*clicked));
+    // The user has just clicked it, so it is visible already.
+    mFilmstripFrame = mCurrentFrame->stem;
+  }
+}
+
+void AddFrameState::showKeyframes() {
+  ImGui::SetNextWindowSize(ImVec2(320, 400), ImGuiCond_FirstUseEver);
+  if (!ImGui::Begin("Keyframes")) {
+    ImGui::End();
+    return;
+  }
+  if (!mScorer) {
+    ImGui::TextWrapped("Score all the frames to find a set of sharp frames "
+                       "with a good depth, from different views.");
+  } else if (!mScorer->isDone()) {
+    ImGui::Text("Scored: %zu/%zu", mScorer->getNumScored(), mScorer->size());
+    ImGui::Text("Registered: %zu", mScorer->getNumRegistered());
+  }
+  if ((!mScorer || mScorer->isDone()) &&
+      ImGui::Button(mScorer ? "Score again" : "Score frames")) {
+    // The scorer decodes the frames with the current truncation.
+    mScorer.reset();
+    mScorer = std::make_unique<KeyframeScorer>(mApp.getScene(), mSources,
+                                               mTrunc);
+    mSuggested.clear();
+    mSuggestionsDirty = true;
+  }
+  if (!mScorer || !mScorer->isDone()) {
+    ImGui::End();
+    return;
+  }
+
+  mSuggestionsDirty |= ImGui::SliderInt("Max keyframes", &mMaxKeyframes, 1, 64);
+  mSuggestionsDirty |= ImGui::SliderFloat("Min angle", &mMinKeyframeAngle,
+                                          0.0f, 90.0f, "%.0f deg");
+  if (mSuggestionsDirty) {
+    // The frames already in the scene count for the angles.
+    std::vector<size_t> accepted;
+    for (const fs::path &stem : mAlreadyUsed) {
+      auto it = mAtlasIndices.find(stem.string());
+      if (it != mAtlasIndices.end()) {
+        accepted.push_back(it->second);
+      }
+    }
+    mSuggested =
+        mScorer->suggest(static_cast<size_t>(std::max(mMaxKeyframes, 1)),
+                         mMinKeyframeAngle, accepted);
+    mSuggestionsDirty = false;
+  }
+
+  ImGui::BeginDisabled(mSuggested.empty());
+  if (ImGui::Button("Add suggested")) {
+    addSuggested();
+  }
+  ImGui::EndDisabled();
+  const std::vector<KeyframeScorer::Score> &scores = mScorer->getScores();
+  std::string selected;
+  for (size_t idx : mSuggested) {
+    const std::string &stem = mScorer->getStem(idx);
+    char label[300];
+    snprintf(label, sizeof(label), "%s (%.2f)", stem.c_str(),
+             scores[idx].quality);
+    if (ImGui::Selectable(label, stem == mCurrentFrame->stem)) {
+      selected = stem;
+    }
+  }
+  ImGui::End();
+
+  if (!selected.empty()) {
+    selectFrame(selected);
+  }
+}
+
+void AddFrameState::addSuggested() {
+  Scene &scene = mApp.getScene();
+  const std::vector<KeyframeScorer::Score> &scores = mScorer->getScores();
+  // The poses of the registration are relative to the first frame of their
+  // segment, so they are useful only to start a new scene, and only for the
+  // frames in the segment of the best one, which becomes the reference.
+  const bool setPoses = scene.clouds.empty();
+  const KeyframeScorer::Score *reference = nullptr;
+  Eigen::Matrix4d toReference = Eigen::Matrix4d::Identity();
+
+  std::vector<size_t> selected;
+  std::vector<FramePair> pairs;
+  for (size_t idx : mSuggested) {
+    const std::string &stem = mScorer->getStem(idx);
+    FrameSet::const_iterator it = mFrames.find(stem);
+    if (it != mFrames.end() && !mAlreadyUsed.count(stem)) {
+      selected.push_back(idx);
+      pairs.push_back(*it);
+    }
+  }
+  // Creating the clouds reads or decodes the frames, so we do it in parallel,
+  // like Scene::loadClouds. A frame might have changed or disappeared after
+  // the scoring, so we skip the ones that fail and keep the others.
+  std::vector<std::optional<PointCloud>> loaded(selected.size());
+  std::vector<std::string> errors(selected.size());
+  parallelFor(selected.size(), [&](size_t i) {
+    try {
+      loaded[i].emplace(scene, pairs[i].stem, pairs[i].rgb, pairs[i].d,
+                        mTrunc);
+    } catch (std::exception &e) {
+      errors[i] = e.what();
+    }
+  });
+
+  for (size_t i = 0; i < selected.size(); i++) {
+    const std::string &stem = pairs[i].stem;
+    if (mAlreadyUsed.count(stem)) {
+      // Suggested twice.
+      continue;
+    }
+    if (!loaded[i]) {
+      fprintf(stderr, "Cannot add %s: %s\n", stem.c_str(), errors[i].c_str());
+      continue;
+    }
+    PointCloud &pcd = scene.clouds.emplace_back(std::move(*loaded[i]));
+    const KeyframeScorer::Score &score = scores[selected[i]];
+    if (setPoses && !reference) {
+      reference = &score;
+      toReference = score.pose.inverse();
+    } else if (setPoses && score.segment == reference->segment) {
+      Eigen::Matrix4d pose = toReference * score.pose;
+      pcd.matrix = glm::make_mat4(pose.data());
+    }
+    mAlreadyUsed.insert(stem);
+    FrameSet::const_iterator it = mFrames.find(stem);
+    if (it == mCurrentFrame) {
+      mCurrentFrame = mFrames.erase(it);
+    } else {
+      mFrames.erase(it);
+    }
+  }
+  mApp.refreshBuffer();
+  mSuggested.clear();
+  mSuggestionsDirty = true;
+  if (mCurrentFrame == mFrames.end()) {
+    mCurrentFrame = mFrames.begin();
+  }
+  while (!mFrames.empty() && !updateTexture()) {
+    if (mCurrentFrame == mFrames.end()) {
+      mCurrentFrame = mFrames.begin();
+    }
+  }
+}
+
+void AddFrameState::selectFrame(const std::string &stem) {
+  FrameSet::const_iterator maybeNew = mFrames.find(stem);
+  if (maybeNew == mFrames.end() || maybeNew == mCurrentFrame) {
+    return;
+  }
+  const std::string current = mCurrentFrame->stem;
+  mDirection = *maybeNew < *mCurrentFrame ? -1 : 1;
+  mCurrentFrame = maybeNew;
+  if (!updateTexture()) {
+    // updateTexture deletes invalid entries, so find a new iterator.
+    // The old iterator should be still valid according to the documentation,
+    // but we prefer a safer approach and get a new one.
+    mCurrentFrame = mFrames.find(current);
+  }
+}
+
 void AddFrameState::prevFrame() {
+  mDirection = -1;
   do {
     if (mCurrentFrame == mFrames.begin()) {
       mCurrentFrame = mFrames.end();
@@ -243,6 +523,7 @@ void AddFrameState::prevFrame() {
 void AddFrameState::nextFrame() {
   // When updateTexture remove invalid frames, it already forwards the
   // iterator, so we do it only the first time.
+  mDirection = 1;
   mCurrentFrame++;
   do {
     if (mCurrentFrame == mFrames.end()) {
@@ -256,8 +537,8 @@ AddFrameState::FramePair::FramePair(const fs::path &rgb, const fs::path &d_)
   if (stem.empty()) {
     throw std::invalid_argument("The depth's stem cannot be empty.");
   }
-  if (lowercaseExtension(d_) != ".png") {
-    throw std::invalid_argument("The depth should have .png extension.");
+  if (!isDepthFile(d_)) {
+    throw std::invalid_argument("The depth should be a PNG or a PFM image.");
   }
 }
 
@@ -290,18 +571,3 @@ bool operator<(const std::string &depthStem,
                const AddFrameState::FramePair &fp) {
   return strnatcasecmp(depthStem.c_str(), fp.stem.c_str()) < 0;
 }
-
-static std::string lowercaseExtension(const fs::path &p) {
-  fs::path ext = p.extension();
-  std::string ret;
-  ret.reserve(ext.native().length());
-  for (auto ch : ext.native()) {
-    // No Unicode and no surrogates, since we are ASCII only.
-    if (ch > 0x7F) {
-      return "";
-    }
-    // tolower should be fine with ASCII-only.
-    ret.push_back(static_cast<char>(tolower(static_cast<unsigned char>(ch))));
-  }
-  return ret;
-}
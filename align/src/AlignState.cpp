@@ -22,14 +22,23 @@ AlignState::AlignState(Application &app, size_t reference, size_t toAlign)
   mCriteria.max_iteration_ = 100;
   const auto &clouds = app.getScene().clouds;
   assert(reference < clouds.size() && toAlign < clouds.size());
-  mReference = clouds[reference].getPointCloudCopy();
-  mAlign = clouds[toAlign].getPointCloudCopy();
+  // Use only the region of interest (when enabled), ICP does not need the
+  // background.
+  mReference = clouds[reference].getMaskedPointCloud();
+  mAlign = clouds[toAlign].getMaskedPointCloud();
   mOrigMatrix = clouds[toAlign].matrix;
   assert(mReference && mAlign);
-  estimateNormals();
 }
 
-void AlignState::start() { refreshBuffer(); }
+void AlignState::start() {
+  Renderer &r = mApp.getRenderer();
+  r.mirror = Renderer::MirrorNone;
+  // We render only our geometries, so we release what the previous state
+  // might have left in the main buffer.
+  r.clearBuffer();
+  r.uploadBuffer();
+  refreshGeometries();
+}
 
 void AlignState::createGui() {
   Scene &scene = mApp.getScene();
@@ -46,7 +55,8 @@ void AlignState::createGui() {
     mOrigMatrix = ref.matrix;
     std::swap(mReferenceIndex, mAlignIndex);
     std::swap(mReference, mAlign);
-    refreshBuffer();
+    std::swap(mReferenceIcp, mAlignIcp);
+    std::swap(mReferenceGeometry, mAlignGeometry);
   }
 
   ImGui::InputDouble("Voxel size", &mVoxelSize, 0.001, 0.01);
@@ -57,7 +67,7 @@ void AlignState::createGui() {
   }
   ImGui::EndDisabled();
   if (ImGui::Checkbox("Render voxelized", &mRenderVoxelized)) {
-    refreshBuffer();
+    refreshGeometries();
   }
 
   ImGui::InputDouble("Maximum distance", &mMaxDistance, 0.005);
@@ -92,9 +102,11 @@ void AlignState::render(const glm::mat4 &pv) {
   Renderer &r = mApp.getRenderer();
   const auto &clouds = mApp.getScene().clouds;
   r.beginRendering(pv);
-  r.renderPointCloud(0, clouds[mReferenceIndex].matrix,
-                     clouds[mReferenceIndex].color);
-  r.renderPointCloud(1, clouds[mAlignIndex].matrix, clouds[mAlignIndex].color);
+  // ICP changes only the matrices, so the geometries stay as they are.
+  r.renderGeometry(*mReferenceGeometry, clouds[mReferenceIndex].matrix,
+                   clouds[mReferenceIndex].color);
+  r.renderGeometry(*mAlignGeometry, clouds[mAlignIndex].matrix,
+                   clouds[mAlignIndex].color);
   r.endRendering();
 }
 
@@ -103,7 +115,8 @@ void AlignState::runIcp() {
   PointCloud &ref = scene.clouds[mReferenceIndex];
   PointCloud &align = scene.clouds[mAlignIndex];
 
-  assert(mReference && mAlign);
+  prepareIcp();
+  assert(mReferenceIcp && mAlignIcp);
 
   glm::mat4 matRef = ref.matrix;
   glm::mat4 matAlign = align.matrix;
@@ -124,9 +137,9 @@ void AlignState::runIcp() {
   // Both Eigen and GLM are column-major, we can just pass pointers.
   Eigen::Map<Eigen::Matrix4f> init(glm::value_ptr(T));
   // TODO: Should we add a UI element to choose the estimation method?
-  RegistrationResult result =
-      RegistrationICP(*mAlign, *mReference, mMaxDistance, init.cast<double>(),
-                      TransformationEstimationPointToPlane(), mCriteria);
+  RegistrationResult result = RegistrationICP(
+      *mAlignIcp, *mReferenceIcp, mMaxDistance, init.cast<double>(),
+      TransformationEstimationPointToPlane(), mCriteria);
   // FIXME: Find a way to check if the matrix is valid, instead.
   if (result.fitness_ > 1e-5) {
     mLastResult = result;
@@ -139,41 +152,54 @@ void AlignState::runIcp() {
 
 void AlignState::voxelDown() {
   const Scene &scene = mApp.getScene();
+  // The clouds keep the result, so the renderer can share it.
   mReference =
-      scene.clouds[mReferenceIndex].getPointCloud().VoxelDownSample(mVoxelSize);
-  mAlign =
-      scene.clouds[mAlignIndex].getPointCloud().VoxelDownSample(mVoxelSize);
+      scene.clouds[mReferenceIndex].getDownsampledCloud(mVoxelSize, true);
+  mAlign = scene.clouds[mAlignIndex].getDownsampledCloud(mVoxelSize, true);
   if (!mReference || !mAlign) {
     // I don't expect this to actually happen, but this call depends on external
     // code, so it makes sense to throw, instead of asserting.
     throw std::runtime_error("Failed to down sample the point clouds.");
   }
+  mReferenceIcp.reset();
+  mAlignIcp.reset();
   // I've observed estimating the normals after down sampling yielded us better
   // results than estimating them when we have a lot of data and then averaging
   // when down sampling.
-  estimateNormals();
+  prepareIcp();
   if (mRenderVoxelized) {
-    refreshBuffer();
+    refreshGeometries();
   }
 }
 
-void AlignState::estimateNormals() {
+void AlignState::prepareIcp() {
   assert(mReference && mAlign);
-  mReference->EstimateNormals(mNormalsParam);
-  mAlign->EstimateNormals(mNormalsParam);
+  // ICP needs Open3D's clouds with the normals. We create them only once,
+  // since they do not change until we down sample again.
+  if (!mReferenceIcp) {
+    mReferenceIcp = mReference->toOpen3D();
+    mReferenceIcp->EstimateNormals(mNormalsParam);
+  }
+  if (!mAlignIcp) {
+    mAlignIcp = mAlign->toOpen3D();
+    mAlignIcp->EstimateNormals(mNormalsParam);
+  }
 }
 
-void AlignState::refreshBuffer() {
+void AlignState::refreshGeometries() {
   const auto &clouds = mApp.getScene().clouds;
   Renderer &r = mApp.getRenderer();
-  r.mirror = Renderer::MirrorNone;
-  r.clearBuffer();
-  if (mRenderVoxelized) {
-    r.addPointCloud(*mReference);
-    r.addPointCloud(*mAlign);
-  } else {
-    r.addPointCloud(clouds[mReferenceIndex]);
-    r.addPointCloud(clouds[mAlignIndex]);
-  }
-  r.uploadBuffer();
+  auto upload = [&](std::unique_ptr<Renderer::Geometry> &geometry,
+                    size_t idx, const CompactCloud &voxelized) {
+    if (!geometry) {
+      geometry = r.createGeometry();
+    }
+    if (mRenderVoxelized) {
+      r.setGeometry(*geometry, voxelized);
+    } else {
+      r.setGeometry(*geometry, *clouds[idx].getPointCloud());
+    }
+  };
+  upload(mReferenceGeometry, mReferenceIndex, *mReference);
+  upload(mAlignGeometry, mAlignIndex, *mAlign);
 }
@@ -6,13 +6,20 @@
 
 #include "Application.h"
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <stdexcept>
+#include <unordered_map>
+
 #include <cassert>
 #include <cstdio>
-#include <stdexcept>
 
 #include "imgui.h"
 
 #include "LoadState.h"
+#include "MemoryRegistry.h"
+#include "parallel.h"
 
 const char appTitle[] = "Aligner";
 
@@ -32,11 +39,116 @@ void Application::beginFrame() {
     mCurrentState->start();
   }
   assert(mCurrentState);
+  watchFrames();
+}
+
+void Application::watchFrames() {
+  if (!mScene) {
+    return;
+  }
+  if (mWatchedScene != mScene.get()) {
+    mWatchedScene = mScene.get();
+    mWatcher.reset();
+    mChangedFrames.clear();
+    try {
+      mWatcher = std::make_unique<FrameWatcher>(mScene->getDataDirectory());
+    } catch (std::exception &e) {
+      fprintf(stderr, "Changes to the frames will not be detected: %s\n",
+              e.what());
+    }
+  }
+  // Read the events also when we are not going to reload yet, to avoid
+  // overflowing the kernel queue.
+  if (mWatcher && !mWatcher->poll(mChangedFrames)) {
+    mReloadAll = true;
+  }
 }
 
 void Application::createGui() {
   assert(mCurrentState);
   mCurrentState->createGui();
+  if (mShowMemory) {
+    createMemoryGui();
+  }
+}
+
+void Application::createMemoryGui() {
+  constexpr double mib = 1 << 20;
+  if (!ImGui::Begin("Memory", &mShowMemory)) {
+    ImGui::End();
+    return;
+  }
+  const std::vector<MemoryRegistry::Entry> entries =
+      MemoryRegistry::get().collect();
+  const nlohmann::json report = MemoryRegistry::toJson(entries);
+  auto usageText = [&](const std::string &label,
+                       const nlohmann::json &usage) {
+    char text[128];
+    snprintf(text, sizeof(text), "%s: %.1fMiB RAM, %.1fMiB VRAM",
+             label.c_str(), usage["cpu"].get<double>() / mib,
+             usage["gpu"].get<double>() / mib);
+    return std::string(text);
+  };
+  auto entryText = [&](const MemoryRegistry::Entry &e) {
+    ImGui::BulletText("%s: %.2fMiB%s", e.item.c_str(),
+                      static_cast<double>(e.bytes) / mib,
+                      e.gpu ? " (GPU)" : "");
+  };
+  ImGui::TextUnformatted(usageText("Total", report["total"]).c_str());
+
+  for (const auto &[subsystem, usage] : report["subsystems"].items()) {
+    if (!ImGui::TreeNode(subsystem.c_str(), "%s",
+                         usageText(subsystem, usage).c_str())) {
+      continue;
+    }
+    // Group the entries of the frames, which are usually many.
+    std::vector<std::string> owners;
+    for (const MemoryRegistry::Entry &e : entries) {
+      if (e.subsystem != subsystem) {
+        continue;
+      }
+      if (e.owner.empty()) {
+        entryText(e);
+      } else if (owners.empty() || owners.back() != e.owner) {
+        owners.push_back(e.owner);
+      }
+    }
+    for (const std::string &owner : owners) {
+      if (ImGui::TreeNode(owner.c_str())) {
+        for (const MemoryRegistry::Entry &e : entries) {
+          if (e.subsystem == subsystem && e.owner == owner) {
+            entryText(e);
+          }
+        }
+        ImGui::TreePop();
+      }
+    }
+    ImGui::TreePop();
+  }
+
+  if (ImGui::TreeNode("Frames (all subsystems)")) {
+    for (const auto &[owner, usage] : report["frames"].items()) {
+      ImGui::TextUnformatted(usageText(owner, usage).c_str());
+    }
+    ImGui::TreePop();
+  }
+
+  ImGui::BeginDisabled(!mScene);
+  if (ImGui::Button("Dump")) {
+    std::filesystem::path path =
+        mScene->getDataDirectory() / "cache" / "memory.json";
+    try {
+      MemoryRegistry::get().dump(path);
+      mMemoryDumpStatus = "Saved to " + path.string();
+    } catch (std::exception &e) {
+      mMemoryDumpStatus = e.what();
+    }
+  }
+  ImGui::EndDisabled();
+  if (!mMemoryDumpStatus.empty()) {
+    ImGui::TextWrapped("%s", mMemoryDumpStatus.c_str());
+  }
+  ImGui::End();
 }
 
 void Application::render() {
@@ -54,6 +166,10 @@ void Application::keyCallback(int key, int scancode, int action, int mods) {
   if (ImGui::GetIO().WantCaptureKeyboard) {
     return;
   }
+  if (key == GLFW_KEY_F9 && action == GLFW_PRESS) {
+    mShowMemory = !mShowMemory;
+    return;
+  }
   if (mCurrentState &&
       mCurrentState->keyCallback(key, scancode, action, mods)) {
     return;
@@ -100,12 +216,164 @@ const Scene &Application::getScene() const {
 
 void Application::refreshBuffer(std::optional<double> voxelSize) {
   assert(mRenderer);
+  mVoxelSize = voxelSize;
+  // The states that show the scene do not use the main buffer, so we release
+  // what the previous state might have left there.
   mRenderer->clearBuffer();
+  mRenderer->uploadBuffer();
+  syncClouds();
+}
+
+bool Application::ResidentCloud::isCurrent(
+    const PointCloud &pcd, std::optional<double> voxelSize) const {
+  return geometry && name == pcd.name && version == pcd.getDataVersion() &&
+         trunc == pcd.trunc && filter == pcd.depthFilter &&
+         this->voxelSize == voxelSize;
+}
+
+void Application::syncClouds() {
+  assert(mRenderer);
   const auto &clouds = getScene().clouds;
-  for (const PointCloud &pcd : clouds) {
-    mRenderer->addPointCloud(pcd, voxelSize);
+  // Match the geometries by name, since the clouds might have been added,
+  // removed or reordered. The ones that we do not take are released.
+  std::unordered_multimap<std::string, size_t> previous;
+  for (size_t i = 0; i < mResidentClouds.size(); i++) {
+    previous.emplace(mResidentClouds[i].name, i);
   }
-  mRenderer->uploadBuffer();
+  std::vector<ResidentCloud> resident(clouds.size());
+  std::vector<size_t> stale;
+  for (size_t i = 0; i < clouds.size(); i++) {
+    auto [first, last] = previous.equal_range(clouds[i].name);
+    for (auto it = first; it != last; ++it) {
+      ResidentCloud &old = mResidentClouds[it->second];
+      if (old.geometry) {
+        resident[i] = std::move(old);
+        break;
+      }
+    }
+    if (!resident[i].isCurrent(clouds[i], mVoxelSize)) {
+      stale.push_back(i);
+    }
+  }
+  mResidentClouds = std::move(resident);
+  if (stale.empty()) {
+    return;
+  }
+
+  // Materializing the clouds might decode their frames, so we do it in
+  // parallel, whereas we must upload them on this thread. We go in batches of
+  // the size of the pool, and we drop each cloud after its upload, so that
+  // we do not pin all of them in RAM.
+  const size_t batchSize = getNumWorkers();
+  std::vector<std::shared_ptr<const CompactCloud>> rendered(batchSize);
+  size_t numNew = 0;
+  for (size_t i : stale) {
+    numNew += !mResidentClouds[i].geometry;
+  }
+  for (size_t begin = 0; begin < stale.size(); begin += batchSize) {
+    const size_t count = std::min(batchSize, stale.size() - begin);
+    parallelFor(count, [&](size_t i) {
+      const PointCloud &pcd = clouds[stale[begin + i]];
+      rendered[i] = mVoxelSize ? pcd.getDownsampledCloud(*mVoxelSize)
+                               : pcd.getPointCloud();
+    });
+    // The frames of a scan have similar sizes, so we guess the size of all
+    // the new geometries from the ones of this batch, and we grow the heap
+    // only once, instead of copying it on the GPU at every growth.
+    size_t batchNew = 0;
+    size_t newVertices = 0;
+    for (size_t i = 0; i < count; i++) {
+      if (!mResidentClouds[stale[begin + i]].geometry) {
+        batchNew++;
+        newVertices += rendered[i]->size();
+      }
+    }
+    if (batchNew) {
+      mRenderer->reserveVertices(newVertices * numNew / batchNew);
+      numNew -= batchNew;
+    }
+    for (size_t i = 0; i < count; i++) {
+      const PointCloud &pcd = clouds[stale[begin + i]];
+      ResidentCloud &rc = mResidentClouds[stale[begin + i]];
+      if (!rc.geometry) {
+        rc.geometry = mRenderer->createGeometry();
+      }
+      mRenderer->setGeometry(*rc.geometry, *rendered[i]);
+      rendered[i].reset();
+      rc.name = pcd.name;
+      rc.version = pcd.getDataVersion();
+      rc.trunc = pcd.trunc;
+      rc.filter = pcd.depthFilter;
+      rc.voxelSize = mVoxelSize;
+    }
+  }
+}
+
+void Application::reloadChangedClouds() {
+  if (mReloading.valid()) {
+    if (mReloading.wait_for(std::chrono::seconds(0)) !=
+        std::future_status::ready) {
+      return;
+    }
+    ReloadResult result = mReloading.get();
+    applyReload(result);
+  }
+
+  if (!mReloadAll && mChangedFrames.empty()) {
+    return;
+  }
+  // The workers use copies, so that the clouds can change or be deleted
+  // meanwhile.
+  std::vector<PointCloud> copies;
+  for (const PointCloud &pcd : getScene().clouds) {
+    if (mReloadAll || isChanged(pcd)) {
+      copies.push_back(pcd);
+    }
+  }
+  mReloadAll = false;
+  mChangedFrames.clear();
+  if (copies.empty()) {
+    return;
+  }
+  mReloading =
+      std::async(std::launch::async, [copies = std::move(copies)]() {
+        ReloadResult result(copies.size());
+        parallelFor(copies.size(), [&](size_t i) {
+          try {
+            result[i] = {copies[i].name, copies[i].reloadData()};
+          } catch (std::exception &e) {
+            // Keep the old data, the file might be still being written.
+            fprintf(stderr, "Cannot reload %s: %s\n", copies[i].name.c_str(),
+                    e.what());
+          }
+        });
+        return result;
+      });
+}
+
+bool Application::isChanged(const PointCloud &pcd) const {
+  namespace fs = std::filesystem;
+  return mChangedFrames.count(pcd.name) ||
+         (!pcd.rgb.empty() &&
+          mChangedFrames.count(fs::path(pcd.rgb).stem().string())) ||
+         (!pcd.depth.empty() &&
+          mChangedFrames.count(fs::path(pcd.depth).stem().string()));
+}
+
+void Application::applyReload(ReloadResult &result) {
+  auto &clouds = getScene().clouds;
+  for (auto &[name, data] : result) {
+    if (!data) {
+      continue;
+    }
+    for (size_t i = 0; i < clouds.size(); i++) {
+      if (clouds[i].name == name) {
+        clouds[i].setData(data);
+      }
+    }
+  }
+  // The new data has a new version, so we upload only these clouds.
+  syncClouds();
 }
 
 void Application::renderScene(const glm::mat4 &pv, bool paintUniform) const {
@@ -120,7 +388,18 @@ void Application::renderScene(const glm::mat4 &pv, bool paintUniform) const {
     if (paintUniform) {
       color = clouds[i].color;
     }
-    mRenderer->renderPointCloud(i, clouds[i].matrix, color);
+    renderSceneCloud(i, clouds[i].matrix, color);
   }
   mRenderer->endRendering();
 }
+
+void Application::renderSceneCloud(
+    size_t idx, const glm::mat4 &model,
+    std::optional<glm::vec3> uniformColor) const {
+  assert(mRenderer);
+  // The clouds that have been added after the last refresh are not there.
+  if (idx < mResidentClouds.size() && mResidentClouds[idx].geometry) {
+    mRenderer->renderGeometry(*mResidentClouds[idx].geometry, model,
+                              uniformColor);
+  }
+}
@@ -0,0 +1,232 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "BitMask.h"
+
+#include <algorithm>
+#include <bitset>
+#include <stdexcept>
+
+static size_t numWords(size_t bits) { return (bits + 63) / 64; }
+
+BitMask::BitMask(int width, int height, bool value) {
+  if (width < 0 || height < 0) {
+    throw std::invalid_argument("The size of a mask cannot be negative.");
+  }
+  mWidth = width;
+  mHeight = height;
+  mWords.assign(numWords(size()), value ? ~uint64_t(0) : 0);
+  if (value && (size() & 63)) {
+    mWords.back() = (uint64_t(1) << (size() & 63)) - 1;
+  }
+}
+
+BitMask BitMask::fromImage(const open3d::geometry::Image &img) {
+  if (img.bytes_per_channel_ != 1 || img.width_ <= 0 || img.height_ <= 0 ||
+      (img.num_of_channels_ != 1 && img.num_of_channels_ != 2 &&
+       img.num_of_channels_ != 4)) {
+    throw std::invalid_argument(
+        "A mask must be an 8-bit grayscale, gray-alpha or RGBA image.");
+  }
+  BitMask mask(img.width_, img.height_);
+  const size_t channels = static_cast<size_t>(img.num_of_channels_);
+  // The alpha is the last channel, and grayscale images have only one.
+  const uint8_t *src = img.data_.data() + channels - 1;
+  const size_t n = mask.size();
+  for (size_t w = 0; w < mask.mWords.size(); w++) {
+    uint64_t word = 0;
+    const size_t last = std::min<size_t>(64, n - w * 64);
+    for (size_t b = 0; b < last; b++, src += channels) {
+      word |= static_cast<uint64_t>(*src >= 128) << b;
+    }
+    mask.mWords[w] = word;
+  }
+  return mask;
+}
+
+BitMask BitMask::fromWords(int width, int height, const uint64_t *words) {
+  BitMask mask(width, height);
+  std::copy_n(words, mask.mWords.size(), mask.mWords.begin());
+  if (mask.size() & 63) {
+    mask.mWords.back() &= (uint64_t(1) << (mask.size() & 63)) - 1;
+  }
+  return mask;
+}
+
+void BitMask::set(size_t i, bool value) {
+  const uint64_t bit = uint64_t(1) << (i & 63);
+  if (value) {
+    mWords[i >> 6] |= bit;
+  } else {
+    mWords[i >> 6] &= ~bit;
+  }
+  mPyramidValid = false;
+}
+
+BitMask &BitMask::operator&=(const BitMask &other) {
+  if (other.mWidth != mWidth || other.mHeight != mHeight) {
+    throw std::invalid_argument("The masks do not have the same size.");
+  }
+  for (size_t i = 0; i < mWords.size(); i++) {
+    mWords[i] &= other.mWords[i];
+  }
+  mPyramidValid = false;
+  return *this;
+}
+
+size_t BitMask::count() const {
+  size_t n = 0;
+  for (uint64_t w : mWords) {
+    n += std::bitset<64>(w).count();
+  }
+  return n;
+}
+
+bool BitMask::isAllSet(int x, int y, int width, int height) const {
+  return check(x, y, width, height, true);
+}
+
+bool BitMask::isAnySet(int x, int y, int width, int height) const {
+  return check(x, y, width, height, false);
+}
+
+bool BitMask::check(int x, int y, int width, int height, bool all) const {
+  Rect r{std::max(x, 0), std::max(y, 0), std::min(x + width, mWidth),
+         std::min(y + height, mHeight)};
+  if (r.x0 >= r.x1 || r.y0 >= r.y1) {
+    return all;
+  }
+  if (!mPyramidValid) {
+    return scan(r, all);
+  }
+  return query(mLevels.size() - 1, 0, 0, r, all);
+}
+
+bool BitMask::isRangeSet(size_t first, size_t last, bool all) const {
+  // Check whole words, masking only the first and the last one.
+  const size_t firstWord = first >> 6;
+  const size_t lastWord = (last - 1) >> 6;
+  for (size_t w = firstWord; w <= lastWord; w++) {
+    uint64_t bits = ~uint64_t(0);
+    if (w == firstWord) {
+      bits &= ~uint64_t(0) << (first & 63);
+    }
+    if (w == lastWord && (last & 63)) {
+      bits &= (uint64_t(1) << (last & 63)) - 1;
+    }
+    const uint64_t word = mWords[w] & bits;
+    if (all && word != bits) {
+      return false;
+    }
+    if (!all && word) {
+      return true;
+    }
+  }
+  return all;
+}
+
+bool BitMask::scan(const Rect &r, bool all) const {
+  const size_t width = static_cast<size_t>(mWidth);
+  for (int y = r.y0; y < r.y1; y++) {
+    const size_t row = static_cast<size_t>(y) * width;
+    if (isRangeSet(row + r.x0, row + r.x1, all) != all) {
+      return !all;
+    }
+  }
+  return all;
+}
+
+bool BitMask::query(size_t level, int cx, int cy, const Rect &r,
+                    bool all) const {
+  const int side = tileSize << level;
+  const Rect cell{cx * side, cy * side, std::min((cx + 1) * side, mWidth),
+                  std::min((cy + 1) * side, mHeight)};
+  const Rect in{std::max(cell.x0, r.x0), std::max(cell.y0, r.y0),
+                std::min(cell.x1, r.x1), std::min(cell.y1, r.y1)};
+  if (in.x0 >= in.x1 || in.y0 >= in.y1) {
+    // Neutral for both the queries.
+    return all;
+  }
+  const Level &l = mLevels[level];
+  const uint8_t state = l.cells[static_cast<size_t>(cy) * l.width + cx];
+  if (state & allBit) {
+    return true;
+  }
+  if (!(state & anyBit)) {
+    return false;
+  }
+  // The cell is mixed, so we know the answer if we query all of it.
+  if (in.x0 == cell.x0 && in.y0 == cell.y0 && in.x1 == cell.x1 &&
+      in.y1 == cell.y1) {
+    return !all;
+  }
+  if (!level) {
+    return scan(in, all);
+  }
+  const Level &child = mLevels[level - 1];
+  for (int y = 2 * cy; y < std::min(2 * cy + 2, child.height); y++) {
+    for (int x = 2 * cx; x < std::min(2 * cx + 2, child.width); x++) {
+      if (query(level - 1, x, y, in, all) != all) {
+        return !all;
+      }
+    }
+  }
+  return all;
+}
+
+void BitMask::updatePyramid() {
+  mLevels.clear();
+  if (empty()) {
+    mPyramidValid = false;
+    return;
+  }
+  Level base;
+  base.width = (mWidth + tileSize - 1) / tileSize;
+  base.height = (mHeight + tileSize - 1) / tileSize;
+  base.cells.resize(static_cast<size_t>(base.width) * base.height);
+  for (int ty = 0; ty < base.height; ty++) {
+    for (int tx = 0; tx < base.width; tx++) {
+      Rect r{tx * tileSize, ty * tileSize,
+             std::min((tx + 1) * tileSize, mWidth),
+             std::min((ty + 1) * tileSize, mHeight)};
+      base.cells[static_cast<size_t>(ty) * base.width + tx] =
+          (scan(r, false) ? anyBit : 0) | (scan(r, true) ? allBit : 0);
+    }
+  }
+  mLevels.push_back(std::move(base));
+
+  while (mLevels.back().width > 1 || mLevels.back().height > 1) {
+    const Level &prev = mLevels.back();
+    Level next;
+    next.width = (prev.width + 1) / 2;
+    next.height = (prev.height + 1) / 2;
+    next.cells.resize(static_cast<size_t>(next.width) * next.height);
+    for (int y = 0; y < next.height; y++) {
+      for (int x = 0; x < next.width; x++) {
+        uint8_t any = 0;
+        uint8_t every = allBit;
+        for (int cy = 2 * y; cy < std::min(2 * y + 2, prev.height); cy++) {
+          for (int cx = 2 * x; cx < std::min(2 * x + 2, prev.width); cx++) {
+            uint8_t c = prev.cells[static_cast<size_t>(cy) * prev.width + cx];
+            any |= c & anyBit;
+            every &= c;
+          }
+        }
+        next.cells[static_cast<size_t>(y) * next.width + x] = any | every;
+      }
+    }
+    mLevels.push_back(std::move(next));
+  }
+  mPyramidValid = true;
+}
+
+size_t BitMask::getBytes() const {
+  size_t bytes = mWords.size() * sizeof(uint64_t);
+  for (const Level &l : mLevels) {
+    bytes += l.cells.size();
+  }
+  return bytes;
+}
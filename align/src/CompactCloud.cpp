@@ -0,0 +1,268 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "CompactCloud.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <cmath>
+
+#include "morton.h"
+
+static uint8_t toByte(double c) {
+  return static_cast<uint8_t>(std::lround(std::clamp(c, 0.0, 1.0) * 255.0));
+}
+
+static float signNotZero(float v) { return v >= 0.0f ? 1.0f : -1.0f; }
+
+static uint32_t encodeNormal(const Eigen::Vector3f &n) {
+  float l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+  float u = l1 > 0.0f ? n.x() / l1 : 0.0f;
+  float v = l1 > 0.0f ? n.y() / l1 : 0.0f;
+  if (n.z() < 0.0f) {
+    float pu = (1.0f - std::abs(v)) * signNotZero(u);
+    float pv = (1.0f - std::abs(u)) * signNotZero(v);
+    u = pu;
+    v = pv;
+  }
+  auto snorm = [](float f) {
+    return static_cast<uint16_t>(
+        static_cast<int16_t>(std::lround(std::clamp(f, -1.0f, 1.0f) * 32767)));
+  };
+  return snorm(u) | (static_cast<uint32_t>(snorm(v)) << 16);
+}
+
+static Eigen::Vector3f decodeNormal(uint32_t packed) {
+  float u = static_cast<int16_t>(packed & 0xffff) / 32767.0f;
+  float v = static_cast<int16_t>(packed >> 16) / 32767.0f;
+  float w = 1.0f - std::abs(u) - std::abs(v);
+  if (w < 0.0f) {
+    float pu = (1.0f - std::abs(v)) * signNotZero(u);
+    float pv = (1.0f - std::abs(u)) * signNotZero(v);
+    u = pu;
+    v = pv;
+  }
+  return Eigen::Vector3f(u, v, w).normalized();
+}
+
+template <typename T>
+static std::vector<T> gather(const std::vector<T> &src,
+                             const std::vector<size_t> &indices) {
+  std::vector<T> dst(indices.size());
+  for (size_t i = 0; i < indices.size(); i++) {
+    dst[i] = src[indices[i]];
+  }
+  return dst;
+}
+
+CompactCloud::CompactCloud(const open3d::geometry::PointCloud &pcd) {
+  const size_t n = pcd.points_.size();
+  x.resize(n);
+  y.resize(n);
+  z.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    x[i] = static_cast<float>(pcd.points_[i].x());
+    y[i] = static_cast<float>(pcd.points_[i].y());
+    z[i] = static_cast<float>(pcd.points_[i].z());
+  }
+  if (pcd.HasColors()) {
+    colors.resize(3 * n);
+    for (size_t i = 0; i < n; i++) {
+      for (int c = 0; c < 3; c++) {
+        colors[3 * i + c] = toByte(pcd.colors_[i][c]);
+      }
+    }
+  }
+  if (pcd.HasNormals()) {
+    normals.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      normals[i] = encodeNormal(pcd.normals_[i].cast<float>());
+    }
+  }
+}
+
+void CompactCloud::resize(size_t n) {
+  bool withColors = hasColors();
+  bool withNormals = hasNormals();
+  x.resize(n);
+  y.resize(n);
+  z.resize(n);
+  if (withColors) {
+    colors.resize(3 * n);
+  }
+  if (withNormals) {
+    normals.resize(n);
+  }
+}
+
+Eigen::Vector3f CompactCloud::getNormal(size_t i) const {
+  return decodeNormal(normals.at(i));
+}
+
+void CompactCloud::setNormal(size_t i, const Eigen::Vector3f &normal) {
+  if (normals.size() != size()) {
+    normals.resize(size(), encodeNormal(Eigen::Vector3f::UnitZ()));
+  }
+  normals.at(i) = encodeNormal(normal);
+}
+
+CompactCloud CompactCloud::select(const std::vector<size_t> &indices) const {
+  CompactCloud out;
+  out.x = gather(x, indices);
+  out.y = gather(y, indices);
+  out.z = gather(z, indices);
+  if (hasColors()) {
+    out.colors.resize(3 * indices.size());
+    for (size_t i = 0; i < indices.size(); i++) {
+      std::copy_n(&colors[3 * indices[i]], 3, &out.colors[3 * i]);
+    }
+  }
+  if (hasNormals()) {
+    out.normals = gather(normals, indices);
+  }
+  return out;
+}
+
+void CompactCloud::reorder(const std::vector<uint32_t> &order) {
+  if (order.size() != size()) {
+    throw std::invalid_argument("The order must contain all the points.");
+  }
+  const bool withColors = hasColors();
+  const bool withNormals = hasNormals();
+  applyOrder(x, order);
+  applyOrder(y, order);
+  applyOrder(z, order);
+  if (withColors) {
+    std::vector<uint8_t> sorted(colors.size());
+    for (size_t i = 0; i < order.size(); i++) {
+      std::copy_n(&colors[3 * order[i]], 3, &sorted[3 * i]);
+    }
+    colors.swap(sorted);
+  }
+  if (withNormals) {
+    applyOrder(normals, order);
+  }
+}
+
+CompactCloud CompactCloud::voxelDownSample(double voxelSize) const {
+  if (voxelSize <= 0.0) {
+    throw std::invalid_argument("The voxel size must be positive.");
+  }
+  if (empty()) {
+    return {};
+  }
+  // Like Open3D, start half a voxel before the minimum.
+  const double origin[] = {
+      *std::min_element(x.begin(), x.end()) - voxelSize * 0.5,
+      *std::min_element(y.begin(), y.end()) - voxelSize * 0.5,
+      *std::min_element(z.begin(), z.end()) - voxelSize * 0.5};
+  const double extent[] = {*std::max_element(x.begin(), x.end()) - origin[0],
+                           *std::max_element(y.begin(), y.end()) - origin[1],
+                           *std::max_element(z.begin(), z.end()) - origin[2]};
+  // We pack the coordinates of the voxels in a 64-bit key.
+  constexpr double maxVoxels = 1 << 21;
+  if (*std::max_element(extent, extent + 3) / voxelSize >= maxVoxels) {
+    throw std::invalid_argument("The voxel size is too small.");
+  }
+
+  struct Voxel {
+    double position[3] = {};
+    double normal[3] = {};
+    uint32_t color[3] = {};
+    uint32_t count = 0;
+  };
+  const bool withColors = hasColors();
+  const bool withNormals = hasNormals();
+  std::unordered_map<uint64_t, size_t> keys;
+  std::vector<Voxel> voxels;
+  for (size_t i = 0; i < size(); i++) {
+    uint64_t key = static_cast<uint64_t>((x[i] - origin[0]) / voxelSize) |
+                   static_cast<uint64_t>((y[i] - origin[1]) / voxelSize)
+                       << 21 |
+                   static_cast<uint64_t>((z[i] - origin[2]) / voxelSize)
+                       << 42;
+    auto [it, inserted] = keys.emplace(key, voxels.size());
+    if (inserted) {
+      voxels.emplace_back();
+    }
+    Voxel &v = voxels[it->second];
+    v.position[0] += x[i];
+    v.position[1] += y[i];
+    v.position[2] += z[i];
+    if (withColors) {
+      for (int c = 0; c < 3; c++) {
+        v.color[c] += colors[3 * i + c];
+      }
+    }
+    if (withNormals) {
+      Eigen::Vector3f n = decodeNormal(normals[i]);
+      for (int c = 0; c < 3; c++) {
+        v.normal[c] += n[c];
+      }
+    }
+    v.count++;
+  }
+
+  CompactCloud out;
+  out.x.resize(voxels.size());
+  out.y.resize(voxels.size());
+  out.z.resize(voxels.size());
+  if (withColors) {
+    out.colors.resize(3 * voxels.size());
+  }
+  if (withNormals) {
+    out.normals.resize(voxels.size());
+  }
+  for (size_t i = 0; i < voxels.size(); i++) {
+    const Voxel &v = voxels[i];
+    out.x[i] = static_cast<float>(v.position[0] / v.count);
+    out.y[i] = static_cast<float>(v.position[1] / v.count);
+    out.z[i] = static_cast<float>(v.position[2] / v.count);
+    if (withColors) {
+      for (int c = 0; c < 3; c++) {
+        out.colors[3 * i + c] =
+            static_cast<uint8_t>((v.color[c] + v.count / 2) / v.count);
+      }
+    }
+    if (withNormals) {
+      out.normals[i] = encodeNormal(Eigen::Vector3f(
+          static_cast<float>(v.normal[0]), static_cast<float>(v.normal[1]),
+          static_cast<float>(v.normal[2])));
+    }
+  }
+  return out;
+}
+
+std::shared_ptr<open3d::geometry::PointCloud> CompactCloud::toOpen3D() const {
+  auto pcd = std::make_shared<open3d::geometry::PointCloud>();
+  const size_t n = size();
+  pcd->points_.resize(n);
+  for (size_t i = 0; i < n; i++) {
+    pcd->points_[i] = Eigen::Vector3d(x[i], y[i], z[i]);
+  }
+  if (hasColors()) {
+    pcd->colors_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      pcd->colors_[i] = Eigen::Vector3d(colors[3 * i], colors[3 * i + 1],
+                                        colors[3 * i + 2]) /
+                        255.0;
+    }
+  }
+  if (hasNormals()) {
+    pcd->normals_.resize(n);
+    for (size_t i = 0; i < n; i++) {
+      pcd->normals_[i] = decodeNormal(normals[i]).cast<double>();
+    }
+  }
+  return pcd;
+}
+
+size_t CompactCloud::getBytes() const {
+  return (x.size() + y.size() + z.size()) * sizeof(float) + colors.size() +
+         normals.size() * sizeof(uint32_t);
+}
@@ -6,6 +6,8 @@
 
 #include "EditorState.h"
 
+#include <algorithm>
+
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtx/euler_angles.hpp"
 
@@ -20,6 +22,7 @@
 #include "MergeState.h"
 #include "NoiseRemovalState.h"
 #include "ReorderState.h"
+#include "ScanBrowserState.h"
 #include "TextureLabState.h"
 #include "utilities.h"
 
@@ -32,6 +35,8 @@ void EditorState::start() {
 }
 
 void EditorState::createGui() {
+  mApp.reloadChangedClouds();
+
   ImGuizmo::BeginFrame();
   ImGuiIO &io = ImGui::GetIO();
   ImGuizmo::SetRect(0, 0, io.DisplaySize.x, io.DisplaySize.y);
@@ -194,11 +199,12 @@ void EditorState::createMain() {
     mApp.setState(std::make_unique<ReorderState>(mApp));
   }
   ImGui::SameLine();
+  if (ImGui::Button("Browse scan")) {
+    mApp.setState(std::make_unique<ScanBrowserState>(mApp));
+  }
+  ImGui::SameLine();
   if (ImGui::Button("Reload data")) {
-    for (PointCloud &pcd : clouds) {
-      pcd.loadData(scene);
-    }
-    refreshBuffer();
+    mApp.reloadAllClouds();
   }
 
   if (ImGui::Button("Save")) {
@@ -224,6 +230,8 @@ void EditorState::createMain() {
     ImGui::EndCombo();
   }
 
+  createMemoryGui();
+
   bool voxelChanged =
       ImGui::Checkbox("Voxel down for visualization", &mVoxelDown);
   voxelChanged = ImGui::InputDouble("Voxel size", &mVoxelSize) || voxelChanged;
@@ -237,6 +245,24 @@ void EditorState::createMain() {
   ImGui::End();
 }
 
+void EditorState::createMemoryGui() {
+  FrameCache &cache = *mScene.getFrameCache();
+  constexpr double mib = 1 << 20;
+  ImGui::Text("Frame data: %.1fMiB in %zu frames",
+              static_cast<double>(cache.getUsage()) / mib,
+              cache.getNumResident());
+  ImGui::SameLine();
+  if (ImGui::SmallButton("Details")) {
+    mApp.showMemoryWindow();
+  }
+  int budget = static_cast<int>(static_cast<double>(cache.getBudget()) / mib);
+  if (ImGui::InputInt("Memory budget (MiB)", &budget, 256, 1024,
+                      ImGuiInputTextFlags_EnterReturnsTrue) &&
+      budget > 0) {
+    cache.setBudget(static_cast<size_t>(budget) << 20);
+  }
+}
+
 void EditorState::createEdit() {
   Scene &scene = mApp.getScene();
   if (mEditIndex >= scene.clouds.size()) {
@@ -248,9 +274,64 @@ void EditorState::createEdit() {
   ImGui::PushStyleVar(ImGuiStyleVar_WindowMinSize, ImVec2(400, 120));
   if (ImGui::Begin("Edit", &mEditing)) {
     if (ImGui::InputDouble("Depth max value", &cloud.trunc)) {
-      cloud.loadData(scene);
+      // The cloud creates its data again from the decoded images.
       refreshBuffer();
     }
+    ImGui::Checkbox("Crop the face automatically", &cloud.autoRoi);
+    if (cloud.autoRoi) {
+      if (std::shared_ptr<const FaceRoi> roi = cloud.getRoi()) {
+        ImGui::Text("Region: %dx%d at (%d, %d), %zu/%zu valid pixels",
+                    roi->width, roi->height, roi->x, roi->y, roi->numPixels,
+                    roi->numValid);
+      } else {
+        ImGui::TextUnformatted("Could not find the face in this frame.");
+      }
+    }
+    if (ImGui::Checkbox("Sort the points spatially", &cloud.sortPoints)) {
+      refreshBuffer();
+    }
+    if (ImGui::TreeNode("Depth filter")) {
+      // Every change reads the frame again, and it is filtered when the
+      // buffer is refreshed.
+      DepthFilter &filter = cloud.depthFilter;
+      const DepthFilter before = filter;
+      ImGui::InputInt("Min support (0 = off)", &filter.minSupport);
+      ImGui::InputFloat("Flying threshold", &filter.flyingThreshold, 0.005f,
+                        0.01f, "%.3f");
+      ImGui::InputInt("Hole radius (0 = off)", &filter.holeRadius);
+      ImGui::InputInt("Bilateral radius (0 = off)", &filter.bilateralRadius);
+      ImGui::InputFloat("Sigma space (px)", &filter.sigmaSpace, 0.25f, 1.0f,
+                        "%.2f");
+      ImGui::InputFloat("Sigma depth (m)", &filter.sigmaDepth, 0.001f, 0.005f,
+                        "%.4f");
+      filter.minSupport = std::clamp(filter.minSupport, 0, 8);
+      filter.flyingThreshold = std::max(filter.flyingThreshold, 0.001f);
+      filter.holeRadius = std::clamp(filter.holeRadius, 0, 8);
+      filter.bilateralRadius = std::clamp(filter.bilateralRadius, 0, 8);
+      filter.sigmaSpace = std::max(filter.sigmaSpace, 0.1f);
+      filter.sigmaDepth = std::max(filter.sigmaDepth, 0.0001f);
+      bool changed = filter != before;
+      if (ImGui::Button("Disable")) {
+        filter = DepthFilter::disabled();
+        changed = true;
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Defaults")) {
+        filter = DepthFilter();
+        changed = true;
+      }
+      ImGui::SameLine();
+      if (ImGui::Button("Apply to all frames")) {
+        for (PointCloud &other : scene.clouds) {
+          other.depthFilter = filter;
+        }
+        changed = true;
+      }
+      if (changed) {
+        refreshBuffer();
+      }
+      ImGui::TreePop();
+    }
 
     ImGui::ColorEdit3("Color", glm::value_ptr(cloud.color));
     if (ImGui::Button("New random color")) {
@@ -0,0 +1,138 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "Filmstrip.h"
+
+#include <algorithm>
+
+#include "imgui.h"
+
+#include "ThumbnailAtlas.h"
+
+// Many more than the rows that fit in a window, even on a 4K display.
+static constexpr int slotColumns = 8;
+static constexpr int slotRows = 16;
+// Limit the uploads, so that scrolling fast does not drop frames.
+static constexpr int maxUploadsPerFrame = 16;
+
+Filmstrip::Filmstrip(const ThumbnailAtlas &atlas)
+    : mAtlas(atlas), mSlots(slotColumns * slotRows) {
+  mTextureWidth = atlas.getTileWidth() * slotColumns;
+  mTextureHeight = atlas.getTileHeight() * slotRows;
+  glGenTextures(1, &mTexture);
+  glBindTexture(GL_TEXTURE_2D, mTexture);
+  // Tiles are drawn at their size, and linear filtering would bleed the
+  // neighboring slots.
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB8, mTextureWidth, mTextureHeight, 0,
+               GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+}
+
+Filmstrip::~Filmstrip() {
+  glDeleteTextures(1, &mTexture);
+  mTexture = 0;
+}
+
+std::optional<size_t> Filmstrip::draw(const std::vector<size_t> &items,
+                                      std::optional<size_t> current,
+                                      bool scrollToCurrent) {
+  mFrameCounter++;
+  std::optional<size_t> clicked;
+  const float tileWidth = static_cast<float>(mAtlas.getTileWidth());
+  const float tileHeight = static_cast<float>(mAtlas.getTileHeight());
+  const float rowHeight = tileHeight + ImGui::GetStyle().ItemSpacing.y;
+  const ImVec2 slotSize(tileWidth / mTextureWidth,
+                        tileHeight / mTextureHeight);
+  int uploadBudget = maxUploadsPerFrame;
+
+  ImGui::BeginChild("##filmstrip");
+  if (scrollToCurrent && current) {
+    // Items are in the order of the atlas.
+    auto it = std::lower_bound(items.begin(), items.end(), *current);
+    if (it != items.end() && *it == *current) {
+      float y = static_cast<float>(it - items.begin()) * rowHeight;
+      ImGui::SetScrollY(y - (ImGui::GetWindowHeight() - rowHeight) * 0.5f);
+    }
+  }
+
+  ImGuiListClipper clipper;
+  clipper.Begin(static_cast<int>(items.size()), rowHeight);
+  while (clipper.Step()) {
+    for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+      const size_t tile = items[i];
+      ImGui::PushID(i);
+      ImVec2 pos = ImGui::GetCursorPos();
+      if (ImGui::Selectable("##tile", current == tile, 0,
+                            ImVec2(0, tileHeight))) {
+        clicked = tile;
+      }
+      ImGui::SetCursorPos(pos);
+      if (std::optional<int> slot = getSlot(tile, uploadBudget)) {
+        ImVec2 uv0(static_cast<float>(*slot % slotColumns) * slotSize.x,
+                   static_cast<float>(*slot / slotColumns) * slotSize.y);
+        ImVec2 uv1(uv0.x + slotSize.x, uv0.y + slotSize.y);
+        ImGui::Image((void *)(intptr_t)mTexture, ImVec2(tileWidth, tileHeight),
+                     uv0, uv1);
+      } else {
+        // Not created yet, or we have run out of uploads for this frame.
+        ImGui::Dummy(ImVec2(tileWidth, tileHeight));
+      }
+      ImGui::SameLine();
+      ImGui::TextUnformatted(mAtlas.getStem(tile).c_str());
+      ImGui::PopID();
+    }
+  }
+  clipper.End();
+  ImGui::EndChild();
+  return clicked;
+}
+
+std::optional<int> Filmstrip::getSlot(size_t tile, int &uploadBudget) {
+  auto it = mTileSlots.find(tile);
+  if (it != mTileSlots.end()) {
+    mSlots[it->second].lastUse = mFrameCounter;
+    return it->second;
+  }
+  if (uploadBudget <= 0) {
+    return std::nullopt;
+  }
+  const uint8_t *pixels = mAtlas.getTile(tile);
+  if (!pixels) {
+    return std::nullopt;
+  }
+
+  int lru = -1;
+  for (int i = 0; i < static_cast<int>(mSlots.size()); i++) {
+    // Never recycle a slot that we have already drawn in this frame.
+    if (mSlots[i].lastUse != mFrameCounter &&
+        (lru < 0 || mSlots[i].lastUse < mSlots[lru].lastUse)) {
+      lru = i;
+    }
+  }
+  if (lru < 0) {
+    return std::nullopt;
+  }
+  Slot &slot = mSlots[lru];
+  if (slot.tile != SIZE_MAX) {
+    mTileSlots.erase(slot.tile);
+  }
+  slot.tile = tile;
+  slot.lastUse = mFrameCounter;
+  mTileSlots[tile] = lru;
+  uploadBudget--;
+
+  const int x = (lru % slotColumns) * mAtlas.getTileWidth();
+  const int y = (lru / slotColumns) * mAtlas.getTileHeight();
+  glBindTexture(GL_TEXTURE_2D, mTexture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, mAtlas.getTileWidth(),
+                  mAtlas.getTileHeight(), GL_RGB, GL_UNSIGNED_BYTE, pixels);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  return lru;
+}
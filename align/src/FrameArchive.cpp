@@ -0,0 +1,455 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "FrameArchive.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iterator>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+#include <cassert>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "zstd.h"
+
+#include "open3d/io/ImageIO.h"
+
+#include "strnatcmp.h"
+
+#include "Scene.h"
+#include "StereoRegistration.h"
+#include "imageutils.h"
+#include "parallel.h"
+
+namespace fs = std::filesystem;
+
+static const char archiveMagic[8] = {'F', 'P', 'A', 'R', 'C', 'H', 'V', 0};
+static constexpr uint32_t archiveVersion = 2;
+// Depth images compress quickly also with higher levels, and we pack only
+// once, so we prefer a better ratio.
+static constexpr int compressionLevel = 9;
+
+struct ArchiveHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t indexOffset;
+  uint64_t indexSize;
+};
+
+/**
+ * A frame that has been read and compressed, but not written yet.
+ */
+struct PackedFrame {
+  std::string name;
+  std::string rgb;
+  std::string depth;
+  std::vector<uint8_t> color;
+  std::vector<uint8_t> depthPlanes;
+  std::vector<uint8_t> mask;
+  int32_t width;
+  int32_t height;
+  int32_t depthChannels;
+  int32_t depthBytesPerChannel;
+  double depthUnit;
+};
+
+static std::vector<uint8_t> readFile(const fs::path &path);
+static std::string getImageFormat(const std::string &path);
+static PackedFrame packFrame(const fs::path &dataDirectory,
+                             const std::pair<fs::path, fs::path> &files);
+
+/**
+ * Appends data to the index table.
+ */
+class IndexWriter {
+public:
+  template <typename T> void write(T value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    const uint8_t *ptr = reinterpret_cast<const uint8_t *>(&value);
+    mData.insert(mData.end(), ptr, ptr + sizeof(T));
+  }
+  void write(const std::string &str) {
+    write(static_cast<uint32_t>(str.size()));
+    mData.insert(mData.end(), str.begin(), str.end());
+  }
+  const std::vector<uint8_t> &getData() const { return mData; }
+
+private:
+  std::vector<uint8_t> mData;
+};
+
+/**
+ * Reads the index table and checks we never go past its end.
+ */
+class IndexReader {
+public:
+  IndexReader(const uint8_t *data, size_t size) : mData(data), mSize(size) {}
+  template <typename T> T read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+  std::string readString() {
+    uint32_t length = read<uint32_t>();
+    const char *ptr = reinterpret_cast<const char *>(take(length));
+    return std::string(ptr, length);
+  }
+
+private:
+  const uint8_t *take(size_t length) {
+    if (length > mSize - mPos) {
+      throw std::runtime_error("The index of the archive is truncated.");
+    }
+    const uint8_t *ptr = mData + mPos;
+    mPos += length;
+    return ptr;
+  }
+
+  const uint8_t *mData;
+  size_t mSize;
+  size_t mPos = 0;
+};
+
+FrameArchive::~FrameArchive() {
+  if (mData) {
+    munmap(const_cast<uint8_t *>(mData), mSize);
+    mData = nullptr;
+  }
+}
+
+std::unique_ptr<FrameArchive> FrameArchive::open(const fs::path &path) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    throw std::runtime_error("Cannot open " + path.string() + ".");
+  }
+  struct stat st;
+  if (fstat(fd, &st) ||
+      st.st_size < static_cast<off_t>(sizeof(ArchiveHeader))) {
+    close(fd);
+    throw std::runtime_error(path.string() + " is not a frame archive.");
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after closing the descriptor.
+  close(fd);
+  if (data == MAP_FAILED) {
+    throw std::runtime_error("Cannot map " + path.string() + ".");
+  }
+  // no make_unique, as the constructor is private.
+  std::unique_ptr<FrameArchive> self(new FrameArchive);
+  self->mPath = path;
+  self->mData = static_cast<const uint8_t *>(data);
+  self->mSize = size;
+
+  ArchiveHeader h;
+  memcpy(&h, self->mData, sizeof(h));
+  if (memcmp(h.magic, archiveMagic, sizeof(archiveMagic))) {
+    throw std::runtime_error(path.string() + " is not a frame archive.");
+  }
+  if (h.version != archiveVersion) {
+    throw std::runtime_error(path.string() +
+                             " has an unsupported version, pack it again.");
+  }
+  self->readIndex(h.indexOffset, h.indexSize);
+  // Frames are accessed in any order.
+  madvise(data, size, MADV_RANDOM);
+  return self;
+}
+
+void FrameArchive::readIndex(uint64_t offset, uint64_t size) {
+  if (offset > mSize || size > mSize - offset) {
+    throw std::runtime_error("The index of the archive is out of bounds.");
+  }
+  IndexReader reader(mData + offset, size);
+  uint64_t count = reader.read<uint64_t>();
+  auto readBlob = [&reader, this]() {
+    Blob blob;
+    blob.offset = reader.read<uint64_t>();
+    blob.size = reader.read<uint64_t>();
+    if (blob.offset > mSize || blob.size > mSize - blob.offset) {
+      throw std::runtime_error("A frame of the archive is out of bounds.");
+    }
+    return blob;
+  };
+  // Do not trust count to reserve memory.
+  for (uint64_t i = 0; i < count; i++) {
+    Entry e;
+    e.name = reader.readString();
+    e.rgb = reader.readString();
+    e.depth = reader.readString();
+    e.color = readBlob();
+    e.depthPlanes = readBlob();
+    e.mask = readBlob();
+    e.width = reader.read<int32_t>();
+    e.height = reader.read<int32_t>();
+    e.depthChannels = reader.read<int32_t>();
+    e.depthBytesPerChannel = reader.read<int32_t>();
+    e.depthUnit = reader.read<double>();
+    if (e.width <= 0 || e.height <= 0 || e.depthChannels <= 0 ||
+        e.depthBytesPerChannel <= 0) {
+      throw std::runtime_error("Invalid depth format for " + e.name + ".");
+    }
+    mByDepth[e.depth] = mEntries.size();
+    mByName[e.name] = mEntries.size();
+    mEntries.push_back(std::move(e));
+  }
+}
+
+std::vector<std::pair<std::string, std::string>>
+FrameArchive::listFrames() const {
+  std::vector<std::pair<std::string, std::string>> frames;
+  frames.reserve(mEntries.size());
+  for (const Entry &e : mEntries) {
+    frames.emplace_back(e.rgb, e.depth);
+  }
+  return frames;
+}
+
+bool FrameArchive::contains(const std::string &depth) const {
+  return mByDepth.count(depth);
+}
+
+std::pair<open3d::geometry::Image, open3d::geometry::Image>
+FrameArchive::readFrame(const std::string &depth, int colorScale) const {
+  auto it = mByDepth.find(depth);
+  if (it == mByDepth.end()) {
+    throw std::runtime_error(depth + " is not in the archive.");
+  }
+  const Entry &e = mEntries[it->second];
+
+  std::pair<open3d::geometry::Image, open3d::geometry::Image> pair;
+  if (colorScale > 1 && isJpeg(e.rgb)) {
+    pair.first = decodeJpeg(getBlob(e.color), e.color.size, colorScale);
+  } else {
+    if (!open3d::io::ReadImageFromMemory(getImageFormat(e.rgb),
+                                         getBlob(e.color), e.color.size,
+                                         pair.first)) {
+      throw std::runtime_error("Cannot decode " + e.rgb + ".");
+    }
+    pair.first = subsampleImage(pair.first, colorScale);
+  }
+
+  const size_t bpc = static_cast<size_t>(e.depthBytesPerChannel);
+  const size_t samples = static_cast<size_t>(e.width) *
+                         static_cast<size_t>(e.height) *
+                         static_cast<size_t>(e.depthChannels);
+  std::vector<uint8_t> planes(samples * bpc);
+  size_t res = ZSTD_decompress(planes.data(), planes.size(),
+                               getBlob(e.depthPlanes), e.depthPlanes.size);
+  if (ZSTD_isError(res) || res != planes.size()) {
+    throw std::runtime_error("Cannot decompress " + e.depth + ".");
+  }
+  open3d::geometry::Image &img = pair.second;
+  img.Prepare(e.width, e.height, e.depthChannels, e.depthBytesPerChannel);
+  // Every byte of the samples has its own plane, because the most significant
+  // ones are very similar to each other, and they compress much better.
+  uint8_t *dst = img.data_.data();
+  for (size_t b = 0; b < bpc; b++) {
+    const uint8_t *src = planes.data() + b * samples;
+    for (size_t i = 0; i < samples; i++) {
+      dst[i * bpc + b] = src[i];
+    }
+  }
+  return pair;
+}
+
+double FrameArchive::getDepthUnit(const std::string &depth) const {
+  auto it = mByDepth.find(depth);
+  if (it == mByDepth.end()) {
+    throw std::runtime_error(depth + " is not in the archive.");
+  }
+  return mEntries[it->second].depthUnit;
+}
+
+bool FrameArchive::readMask(const std::string &name,
+                            open3d::geometry::Image &mask) const {
+  auto it = mByName.find(name);
+  if (it == mByName.end() || !mEntries[it->second].mask.size) {
+    return false;
+  }
+  const Blob &blob = mEntries[it->second].mask;
+  return open3d::io::ReadImageFromMemory("png", getBlob(blob), blob.size, mask);
+}
+
+const uint8_t *FrameArchive::getBlob(const Blob &blob) const {
+  assert(blob.offset <= mSize && blob.size <= mSize - blob.offset);
+  return mData + blob.offset;
+}
+
+std::vector<std::string> FrameArchive::pack(const fs::path &dataDirectory,
+                                            const fs::path &output,
+                                            const ProgressCallback &progress) {
+  // The archive stores depth, while these would need to be registered every
+  // time, so it would be slower than the loose files.
+  if (!fs::is_directory(dataDirectory / "depth") &&
+      fs::exists(StereoRegistration::getCalibrationPath(dataDirectory))) {
+    throw std::invalid_argument(
+        "Stereo datasets cannot be packed, create the depth with "
+        "stereo-make-depth.py first.");
+  }
+  std::vector<std::pair<fs::path, fs::path>> files =
+      Scene::listFrameFiles(dataDirectory);
+  if (files.empty()) {
+    throw std::invalid_argument(dataDirectory.string() +
+                                " does not contain any frame.");
+  }
+  std::sort(files.begin(), files.end(), [](const auto &a, const auto &b) {
+    return strnatcasecmp(a.second.stem().c_str(), b.second.stem().c_str()) < 0;
+  });
+
+  fs::path tmpPath = output;
+  tmpPath += ".tmp";
+  std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+  if (!out) {
+    throw std::runtime_error("Cannot create " + tmpPath.string() + ".");
+  }
+  ArchiveHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, archiveMagic, sizeof(archiveMagic));
+  h.version = archiveVersion;
+  // We will write the header again after the index.
+  out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+
+  std::vector<std::string> warnings;
+  IndexWriter index;
+  uint64_t count = 0;
+  auto writeBlob = [&out, &index](const std::vector<uint8_t> &data) {
+    index.write(static_cast<uint64_t>(out.tellp()));
+    index.write(static_cast<uint64_t>(data.size()));
+    out.write(reinterpret_cast<const char *>(data.data()),
+              static_cast<std::streamsize>(data.size()));
+  };
+
+  // Read and compress the frames in parallel, but in batches, to keep the
+  // memory usage bounded.
+  const size_t total = files.size();
+  const size_t batchSize = getNumWorkers() * 4;
+  std::atomic<size_t> done = 0;
+  if (progress) {
+    progress(0, total);
+  }
+  for (size_t first = 0; first < total; first += batchSize) {
+    size_t n = std::min(batchSize, total - first);
+    std::vector<std::optional<PackedFrame>> batch(n);
+    std::vector<std::string> errors(n);
+    parallelFor(n, [&](size_t i) {
+      try {
+        batch[i] = packFrame(dataDirectory, files[first + i]);
+      } catch (std::exception &e) {
+        errors[i] = files[first + i].second.string() + ": " + e.what();
+      }
+      size_t d = ++done;
+      if (progress) {
+        progress(d, total);
+      }
+    });
+
+    for (size_t i = 0; i < n; i++) {
+      if (!batch[i]) {
+        warnings.push_back(std::move(errors[i]));
+        continue;
+      }
+      const PackedFrame &f = *batch[i];
+      index.write(f.name);
+      index.write(f.rgb);
+      index.write(f.depth);
+      writeBlob(f.color);
+      writeBlob(f.depthPlanes);
+      writeBlob(f.mask);
+      index.write(f.width);
+      index.write(f.height);
+      index.write(f.depthChannels);
+      index.write(f.depthBytesPerChannel);
+      index.write(f.depthUnit);
+      count++;
+    }
+  }
+
+  IndexWriter countWriter;
+  countWriter.write(count);
+  h.indexOffset = static_cast<uint64_t>(out.tellp());
+  h.indexSize = countWriter.getData().size() + index.getData().size();
+  out.write(reinterpret_cast<const char *>(countWriter.getData().data()),
+            static_cast<std::streamsize>(countWriter.getData().size()));
+  out.write(reinterpret_cast<const char *>(index.getData().data()),
+            static_cast<std::streamsize>(index.getData().size()));
+  out.seekp(0);
+  out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  out.close();
+  if (!out) {
+    std::error_code ec;
+    fs::remove(tmpPath, ec);
+    throw std::runtime_error("Failed to write " + tmpPath.string() + ".");
+  }
+  fs::rename(tmpPath, output);
+  return warnings;
+}
+
+static std::vector<uint8_t> readFile(const fs::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Cannot open " + path.string() + ".");
+  }
+  return std::vector<uint8_t>(std::istreambuf_iterator<char>(in),
+                              std::istreambuf_iterator<char>());
+}
+
+static std::string getImageFormat(const std::string &path) {
+  return Scene::lowercaseExtension(path) == ".png" ? "png" : "jpg";
+}
+
+static PackedFrame packFrame(const fs::path &dataDirectory,
+                             const std::pair<fs::path, fs::path> &files) {
+  PackedFrame f;
+  f.name = files.second.stem().string();
+  f.rgb = files.first.string();
+  f.depth = files.second.string();
+  f.color = readFile(dataDirectory / files.first);
+
+  fs::path maskPath = dataDirectory / "mask" / (f.name + ".png");
+  std::error_code ec;
+  if (fs::exists(maskPath, ec) && !ec) {
+    f.mask = readFile(maskPath);
+  }
+
+  // We keep the unit of the frame, and Scene applies it when it opens the
+  // frame, like for the loose files.
+  open3d::geometry::Image depth =
+      readDepth(dataDirectory / files.second, f.depthUnit);
+  f.width = depth.width_;
+  f.height = depth.height_;
+  f.depthChannels = depth.num_of_channels_;
+  f.depthBytesPerChannel = depth.bytes_per_channel_;
+  const size_t bpc = static_cast<size_t>(depth.bytes_per_channel_);
+  const size_t samples = depth.data_.size() / bpc;
+  std::vector<uint8_t> planes(depth.data_.size());
+  for (size_t b = 0; b < bpc; b++) {
+    uint8_t *dst = planes.data() + b * samples;
+    for (size_t i = 0; i < samples; i++) {
+      dst[i] = depth.data_[i * bpc + b];
+    }
+  }
+  f.depthPlanes.resize(ZSTD_compressBound(planes.size()));
+  size_t size = ZSTD_compress(f.depthPlanes.data(), f.depthPlanes.size(),
+                              planes.data(), planes.size(), compressionLevel);
+  if (ZSTD_isError(size)) {
+    throw std::runtime_error(std::string("Cannot compress the depth: ") +
+                             ZSTD_getErrorName(size));
+  }
+  f.depthPlanes.resize(size);
+  return f;
+}
@@ -0,0 +1,105 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "FrameCache.h"
+
+#include <cassert>
+
+#include <unistd.h>
+
+FrameCache::FrameCache(size_t budget) : mBudget(budget) {}
+
+size_t FrameCache::defaultBudget() {
+  long pages = sysconf(_SC_PHYS_PAGES);
+  long pageSize = sysconf(_SC_PAGESIZE);
+  if (pages <= 0 || pageSize <= 0) {
+    return size_t(4) << 30;
+  }
+  return static_cast<size_t>(pages) * static_cast<size_t>(pageSize) / 2;
+}
+
+void FrameCache::touch(const std::shared_ptr<Evictable> &item, size_t bytes) {
+  assert(item);
+  std::vector<std::shared_ptr<Evictable>> victims;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mEntries.find(item.get());
+    if (it != mEntries.end()) {
+      mUsage -= it->second->bytes;
+      mLru.erase(it->second);
+      mEntries.erase(it);
+    }
+    mLru.push_front({item.get(), item, bytes});
+    mEntries[item.get()] = mLru.begin();
+    mUsage += bytes;
+    victims = collectVictims(item.get());
+  }
+  evict(victims);
+}
+
+void FrameCache::remove(const Evictable *item) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = mEntries.find(item);
+  if (it != mEntries.end()) {
+    mUsage -= it->second->bytes;
+    mLru.erase(it->second);
+    mEntries.erase(it);
+  }
+}
+
+void FrameCache::setBudget(size_t budget) {
+  std::vector<std::shared_ptr<Evictable>> victims;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mBudget = budget;
+    victims = collectVictims();
+  }
+  evict(victims);
+}
+
+size_t FrameCache::getBudget() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mBudget;
+}
+
+size_t FrameCache::getUsage() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mUsage;
+}
+
+size_t FrameCache::getNumResident() const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return mEntries.size();
+}
+
+std::vector<std::shared_ptr<FrameCache::Evictable>>
+FrameCache::collectVictims(const Evictable *keep) {
+  std::vector<std::shared_ptr<Evictable>> victims;
+  while (mUsage > mBudget && !mLru.empty()) {
+    Entry &last = mLru.back();
+    if (last.key == keep) {
+      break;
+    }
+    std::shared_ptr<Evictable> victim = last.item.lock();
+    mUsage -= last.bytes;
+    mEntries.erase(last.key);
+    mLru.pop_back();
+    // The item might be being destroyed, in that case it will not need to be
+    // evicted.
+    if (victim) {
+      victims.push_back(std::move(victim));
+    }
+  }
+  return victims;
+}
+
+void FrameCache::evict(std::vector<std::shared_ptr<Evictable>> &victims) {
+  for (auto &victim : victims) {
+    victim->evict();
+  }
+  // Release our references here, in case we were the last owners.
+  victims.clear();
+}
@@ -0,0 +1,403 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "FrameCatalog.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_set>
+
+#include <cctype>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/stat.h>
+
+#include "FrameArchive.h"
+#include "Scene.h"
+#include "StereoRegistration.h"
+#include "imageutils.h"
+#include "parallel.h"
+
+namespace fs = std::filesystem;
+
+static const char catalogMagic[8] = {'F', 'P', 'C', 'A', 'T', 'L', 'G', 0};
+static constexpr uint32_t catalogVersion = 2;
+// Enough for any frame number and timestamp.
+static constexpr size_t sortKeyDigits = 20;
+
+struct FrameCatalog::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  int64_t rgbDirectory;
+  int64_t depthDirectory;
+  int64_t archive;
+  uint64_t count;
+};
+
+/**
+ * Return the modification time of a file in nanoseconds since the Unix epoch,
+ * or 0 if it does not exist.
+ */
+static int64_t getModificationTime(const fs::path &path,
+                                   uint64_t *size = nullptr);
+static float computeCoverage(const open3d::geometry::Image &depth);
+
+template <typename T> static void writeValue(std::ostream &out, const T &v) {
+  out.write(reinterpret_cast<const char *>(&v), sizeof(v));
+}
+
+static void writeString(std::ostream &out, const std::string &s) {
+  writeValue(out, static_cast<uint32_t>(s.size()));
+  out.write(s.data(), static_cast<std::streamsize>(s.size()));
+}
+
+template <typename T> static T readValue(std::istream &in) {
+  T v;
+  if (!in.read(reinterpret_cast<char *>(&v), sizeof(v))) {
+    throw std::runtime_error("The catalog is truncated.");
+  }
+  return v;
+}
+
+static std::string readString(std::istream &in) {
+  uint32_t length = readValue<uint32_t>(in);
+  if (length > 4096) {
+    throw std::runtime_error("The catalog is corrupted.");
+  }
+  std::string s(length, '\0');
+  if (!in.read(s.data(), length)) {
+    throw std::runtime_error("The catalog is truncated.");
+  }
+  return s;
+}
+
+bool FrameCatalog::Stamps::operator==(const Stamps &other) const {
+  return rgbDirectory == other.rgbDirectory &&
+         depthDirectory == other.depthDirectory && archive == other.archive;
+}
+
+FrameCatalog::FrameCatalog(const Scene &scene) : mScene(scene) {
+  const fs::path &base = scene.getDataDirectory();
+  mPath = base / "cache" / "frames.catalog";
+  Stamps current;
+  current.rgbDirectory = getModificationTime(base / "rgb");
+  // Stereo datasets without depth create the frames from the disparity.
+  current.depthDirectory = getModificationTime(
+      fs::is_directory(base / "depth") ? base / "depth" : base / "disparity");
+  if (const FrameArchive *archive = scene.getArchive()) {
+    current.archive = getModificationTime(archive->getPath());
+  }
+
+  Stamps saved;
+  bool loaded = false;
+  try {
+    loaded = load(saved);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Cannot load the frame catalog: %s\n", e.what());
+    mEntries.clear();
+  }
+  if (loaded && saved == current) {
+    indexEntries();
+    for (size_t i = 0; i < mEntries.size(); i++) {
+      mScanned[i] = true;
+    }
+    mNumScanned = mEntries.size();
+    return;
+  }
+  scan(current);
+}
+
+FrameCatalog::~FrameCatalog() {
+  mStop = true;
+  wait();
+}
+
+const FrameCatalog::Entry *FrameCatalog::find(const std::string &stem) const {
+  auto it = mByStem.find(stem);
+  if (it == mByStem.end() || !mScanned[it->second]) {
+    return nullptr;
+  }
+  return &mEntries[it->second];
+}
+
+void FrameCatalog::wait() {
+  if (mWorker.joinable()) {
+    mWorker.join();
+  }
+}
+
+std::string FrameCatalog::makeSortKey(const std::string &stem) {
+  std::string key;
+  key.reserve(stem.size() + sortKeyDigits);
+  size_t i = 0;
+  while (i < stem.size()) {
+    unsigned char c = static_cast<unsigned char>(stem[i]);
+    if (!isdigit(c)) {
+      key += static_cast<char>(tolower(c));
+      i++;
+      continue;
+    }
+    size_t end = i;
+    while (end < stem.size() &&
+           isdigit(static_cast<unsigned char>(stem[end]))) {
+      end++;
+    }
+    // Keep at least a digit, for numbers that are only zeros.
+    while (i < end - 1 && stem[i] == '0') {
+      i++;
+    }
+    if (end - i < sortKeyDigits) {
+      key.append(sortKeyDigits - (end - i), '0');
+    }
+    key.append(stem, i, end - i);
+    i = end;
+  }
+  return key;
+}
+
+bool FrameCatalog::load(Stamps &stamps) {
+  std::ifstream in(mPath, std::ios::binary);
+  if (!in) {
+    return false;
+  }
+  Header h;
+  if (!in.read(reinterpret_cast<char *>(&h), sizeof(h)) ||
+      memcmp(h.magic, catalogMagic, sizeof(catalogMagic)) ||
+      h.version != catalogVersion) {
+    return false;
+  }
+  stamps.rgbDirectory = h.rgbDirectory;
+  stamps.depthDirectory = h.depthDirectory;
+  stamps.archive = h.archive;
+
+  mEntries.clear();
+  mEntries.reserve(std::min<uint64_t>(h.count, 1 << 20));
+  for (uint64_t i = 0; i < h.count; i++) {
+    Entry e;
+    e.stem = readString(in);
+    e.rgb = readString(in);
+    e.depth = readString(in);
+    e.sortKey = readString(in);
+    e.rgbTime = readValue<int64_t>(in);
+    e.depthTime = readValue<int64_t>(in);
+    e.rgbSize = readValue<uint64_t>(in);
+    e.depthSize = readValue<uint64_t>(in);
+    e.width = readValue<int32_t>(in);
+    e.height = readValue<int32_t>(in);
+    e.coverage = readValue<float>(in);
+    e.packed = readValue<uint8_t>(in);
+    mEntries.push_back(std::move(e));
+  }
+  return true;
+}
+
+void FrameCatalog::save(const Stamps &stamps) const {
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, catalogMagic, sizeof(catalogMagic));
+  h.version = catalogVersion;
+  h.rgbDirectory = stamps.rgbDirectory;
+  h.depthDirectory = stamps.depthDirectory;
+  h.archive = stamps.archive;
+  h.count = mEntries.size();
+
+  fs::create_directories(mPath.parent_path());
+  fs::path tmpPath = mPath;
+  tmpPath += ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    for (const Entry &e : mEntries) {
+      writeString(out, e.stem);
+      writeString(out, e.rgb);
+      writeString(out, e.depth);
+      writeString(out, e.sortKey);
+      writeValue(out, e.rgbTime);
+      writeValue(out, e.depthTime);
+      writeValue(out, e.rgbSize);
+      writeValue(out, e.depthSize);
+      writeValue(out, e.width);
+      writeValue(out, e.height);
+      writeValue(out, e.coverage);
+      writeValue(out, static_cast<uint8_t>(e.packed));
+    }
+    if (!out) {
+      throw std::runtime_error("Failed to write " + tmpPath.string() + ".");
+    }
+  }
+  fs::rename(tmpPath, mPath);
+}
+
+void FrameCatalog::scan(const Stamps &stamps) {
+  std::unordered_map<std::string, Entry> old;
+  for (Entry &e : mEntries) {
+    std::string stem = e.stem;
+    old.emplace(std::move(stem), std::move(e));
+  }
+  mEntries.clear();
+
+  const fs::path &base = mScene.getDataDirectory();
+  // Like in the rest of the program, loose files win over the packed ones.
+  std::unordered_set<std::string> stems;
+  for (const auto &[rgb, depth] : Scene::listFrameFiles(base)) {
+    Entry e;
+    e.stem = depth.stem().string();
+    e.rgb = rgb.string();
+    e.depth = depth.string();
+    e.rgbTime = getModificationTime(base / rgb, &e.rgbSize);
+    e.depthTime = getModificationTime(base / depth, &e.depthSize);
+    stems.insert(e.stem);
+    mEntries.push_back(std::move(e));
+  }
+  if (const FrameArchive *archive = mScene.getArchive()) {
+    uint64_t size;
+    int64_t time = getModificationTime(archive->getPath(), &size);
+    for (const auto &[rgb, depth] : archive->listFrames()) {
+      Entry e;
+      e.stem = fs::path(depth).stem().string();
+      if (stems.count(e.stem)) {
+        continue;
+      }
+      e.rgb = rgb;
+      e.depth = depth;
+      e.rgbTime = e.depthTime = time;
+      e.rgbSize = e.depthSize = size;
+      e.packed = true;
+      stems.insert(e.stem);
+      mEntries.push_back(std::move(e));
+    }
+  }
+
+  for (Entry &e : mEntries) {
+    e.sortKey = makeSortKey(e.stem);
+  }
+  std::sort(mEntries.begin(), mEntries.end(),
+            [](const Entry &a, const Entry &b) {
+              return std::tie(a.sortKey, a.stem) < std::tie(b.sortKey, b.stem);
+            });
+  indexEntries();
+
+  std::vector<size_t> missing;
+  for (size_t i = 0; i < mEntries.size(); i++) {
+    Entry &e = mEntries[i];
+    auto it = old.find(e.stem);
+    if (it != old.end()) {
+      const Entry &o = it->second;
+      if (o.width > 0 && o.rgb == e.rgb && o.depth == e.depth &&
+          o.rgbTime == e.rgbTime && o.depthTime == e.depthTime &&
+          o.rgbSize == e.rgbSize && o.depthSize == e.depthSize &&
+          o.packed == e.packed) {
+        e.width = o.width;
+        e.height = o.height;
+        e.coverage = o.coverage;
+        mScanned[i] = true;
+        mNumScanned++;
+        continue;
+      }
+    }
+    missing.push_back(i);
+  }
+  // We start the thread also when we could reuse all the entries, because we
+  // still need to save the new stamps.
+  mWorker = std::thread(&FrameCatalog::work, this, std::move(missing), stamps);
+}
+
+void FrameCatalog::work(std::vector<size_t> missing, Stamps stamps) {
+  parallelFor(missing.size(), [&](size_t i) {
+    if (mStop) {
+      return;
+    }
+    readMetadata(mEntries[missing[i]]);
+    mScanned[missing[i]] = true;
+    mNumScanned++;
+  });
+  if (mStop) {
+    // The frames that we did not read would look unreadable in the file.
+    return;
+  }
+  try {
+    save(stamps);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Cannot save the frame catalog: %s\n", e.what());
+  }
+}
+
+void FrameCatalog::readMetadata(Entry &e) const {
+  try {
+    if (!e.packed && StereoRegistration::isDisparityFile(e.depth)) {
+      // The registration to the color camera needs the full resolution of
+      // both images, and it is much more expensive than decoding them, but it
+      // changes only slightly which pixels are valid. So, we measure the
+      // coverage directly on the disparity.
+      open3d::geometry::Image disparity =
+          readPfm(mScene.getDataDirectory() / e.depth);
+      e.coverage = computeCoverage(disparity);
+      e.height = disparity.height_;
+      e.width = disparity.width_;
+      return;
+    }
+    // We need only the depth, so the smallest preview is enough.
+    auto [rgb, depth] = mScene.openFramePreview(e.rgb, e.depth, 8);
+    (void)rgb;
+    e.coverage = computeCoverage(depth);
+    // openFramePreview has checked that the frame has the size of the camera,
+    // whereas the preview is smaller.
+    const open3d::camera::PinholeCameraIntrinsic &intr =
+        mScene.getCameraIntrinsic();
+    e.height = intr.height_;
+    e.width = intr.width_;
+  } catch (std::exception &ex) {
+    fprintf(stderr, "Cannot read %s: %s\n", e.stem.c_str(), ex.what());
+  }
+}
+
+void FrameCatalog::indexEntries() {
+  mByStem.clear();
+  mScanned = std::make_unique<std::atomic<bool>[]>(mEntries.size());
+  for (size_t i = 0; i < mEntries.size(); i++) {
+    mByStem[mEntries[i].stem] = i;
+    mScanned[i] = false;
+  }
+}
+
+static int64_t getModificationTime(const fs::path &path, uint64_t *size) {
+  struct stat st;
+  if (stat(path.c_str(), &st)) {
+    if (size) {
+      *size = 0;
+    }
+    return 0;
+  }
+  if (size) {
+    *size = static_cast<uint64_t>(st.st_size);
+  }
+  return static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 +
+         st.st_mtim.tv_nsec;
+}
+
+static float computeCoverage(const open3d::geometry::Image &depth) {
+  const size_t count =
+      static_cast<size_t>(depth.width_) * static_cast<size_t>(depth.height_);
+  if (!count || depth.num_of_channels_ != 1) {
+    return 0.0f;
+  }
+  size_t valid = 0;
+  if (depth.bytes_per_channel_ == 2) {
+    const uint16_t *data =
+        reinterpret_cast<const uint16_t *>(depth.data_.data());
+    valid = std::count_if(data, data + count, [](uint16_t d) { return d; });
+  } else if (depth.bytes_per_channel_ == 4) {
+    const float *data = reinterpret_cast<const float *>(depth.data_.data());
+    valid = std::count_if(data, data + count,
+                          [](float d) { return std::isfinite(d) && d > 0; });
+  }
+  return static_cast<float>(valid) / static_cast<float>(count);
+}
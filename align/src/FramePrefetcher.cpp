@@ -0,0 +1,153 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "FramePrefetcher.h"
+
+#include <algorithm>
+#include <iterator>
+#include <tuple>
+
+#include <cstdio>
+
+#include "Scene.h"
+#include "colormap.h"
+
+FramePrefetcher::FramePrefetcher(const Scene &scene, size_t capacity,
+                                 size_t numThreads)
+    : mScene(scene), mCapacity(std::max<size_t>(capacity, 1)) {
+  numThreads = std::max<size_t>(numThreads, 1);
+  for (size_t i = 0; i < numThreads; i++) {
+    mThreads.emplace_back(&FramePrefetcher::work, this);
+  }
+}
+
+FramePrefetcher::~FramePrefetcher() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+    mQueue.clear();
+  }
+  mCondition.notify_all();
+  for (std::thread &t : mThreads) {
+    t.join();
+  }
+}
+
+void FramePrefetcher::prefetch(std::vector<Request> requests, float blend,
+                               float trunc, int scale) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mQueue.clear();
+    mWanted.clear();
+    mBlend = blend;
+    mTrunc = trunc;
+    mScale = scale;
+    for (Request &r : requests) {
+      mWanted.insert(r.stem);
+      mQueue.push_back(std::move(r));
+    }
+  }
+  mCondition.notify_all();
+}
+
+std::shared_ptr<const FramePrefetcher::Frame>
+FramePrefetcher::get(const std::string &stem, int scale) const {
+  std::lock_guard<std::mutex> lock(mMutex);
+  return find(stem, scale);
+}
+
+std::shared_ptr<const FramePrefetcher::Frame>
+FramePrefetcher::find(const std::string &stem, int scale) const {
+  for (const auto &frame : mRing) {
+    if (frame->stem == stem && frame->scale == scale) {
+      return frame;
+    }
+  }
+  return nullptr;
+}
+
+std::shared_ptr<const FramePrefetcher::Frame>
+FramePrefetcher::load(const Request &request, float blend, float trunc,
+                      int scale) {
+  std::shared_ptr<const Frame> frame = decode(request, blend, trunc, scale);
+  insert(frame);
+  return frame;
+}
+
+void FramePrefetcher::work() {
+  for (;;) {
+    Request request;
+    float blend, trunc;
+    int scale;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mCondition.wait(lock, [this] { return mStop || !mQueue.empty(); });
+      if (mStop) {
+        return;
+      }
+      request = std::move(mQueue.front());
+      mQueue.pop_front();
+      if (find(request.stem, mScale) ||
+          !mInProgress.insert(request.stem).second) {
+        continue;
+      }
+      blend = mBlend;
+      trunc = mTrunc;
+      scale = mScale;
+    }
+
+    std::shared_ptr<const Frame> frame;
+    try {
+      frame = decode(request, blend, trunc, scale);
+    } catch (std::exception &e) {
+      // The UI will report the error when it tries to load the frame.
+      fprintf(stderr, "Cannot prefetch %s: %s\n", request.stem.c_str(),
+              e.what());
+    }
+    {
+      std::lock_guard<std::mutex> lock(mMutex);
+      mInProgress.erase(request.stem);
+    }
+    if (frame) {
+      insert(std::move(frame));
+    }
+  }
+}
+
+std::shared_ptr<const FramePrefetcher::Frame>
+FramePrefetcher::decode(const Request &request, float blend, float trunc,
+                        int scale) const {
+  auto frame = std::make_shared<Frame>();
+  frame->stem = request.stem;
+  std::tie(frame->rgb, frame->depth) =
+      mScene.openFramePreview(request.rgb, request.depth, scale);
+  frame->colormap =
+      createColormap(frame->rgb, frame->depth, blend,
+                     static_cast<float>(mScene.getDepthScale()), trunc);
+  frame->blend = blend;
+  frame->trunc = trunc;
+  frame->scale = scale;
+  return frame;
+}
+
+void FramePrefetcher::insert(std::shared_ptr<const Frame> frame) {
+  std::lock_guard<std::mutex> lock(mMutex);
+  auto it = std::find_if(
+      mRing.begin(), mRing.end(),
+      [&frame](const auto &f) { return f->stem == frame->stem; });
+  if (it != mRing.end()) {
+    mRing.erase(it);
+  }
+  mRing.push_back(std::move(frame));
+  while (mRing.size() > mCapacity) {
+    // Evict the oldest frame that nobody wants anymore, or the oldest one if
+    // they are all wanted (but then the capacity is too small).
+    auto victim = std::find_if(
+        mRing.begin(), std::prev(mRing.end()),
+        [this](const auto &f) { return !mWanted.count(f->stem); });
+    mRing.erase(victim == std::prev(mRing.end()) ? mRing.begin() : victim);
+  }
+}
@@ -0,0 +1,263 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "FrameSidecar.h"
+
+#include <fstream>
+#include <type_traits>
+
+#include <cassert>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char sidecarMagic[8] = {'F', 'P', 'F', 'R', 'A', 'M', 'E', 0};
+static constexpr uint32_t sidecarVersion = 7;
+static constexpr uint64_t sidecarAlignment = 64;
+
+struct FrameSidecar::Header {
+  char magic[8];
+  uint32_t version;
+  int32_t width;
+  int32_t height;
+  int32_t colorChannels;
+  int32_t colorBytesPerChannel;
+  int32_t depthBytesPerChannel;
+  Key key;
+  uint64_t colorOffset;
+  uint64_t depthOffset;
+  // 0 if the frame does not have a mask, which is packed like BitMask.
+  uint64_t maskOffset;
+  uint64_t pointsOffset;
+  uint64_t pixelsOffset;
+  uint64_t numPoints;
+};
+static_assert(std::is_trivially_copyable_v<FrameSidecar::Key>,
+              "The key must be trivially copyable.");
+static_assert(sizeof(DepthFilter) == 24 && sizeof(FrameSidecar::Key) == 144,
+              "The key must not have padding.");
+
+static uint64_t alignOffset(uint64_t offset) {
+  return (offset + sidecarAlignment - 1) / sidecarAlignment * sidecarAlignment;
+}
+
+static uint64_t maskBytes(uint64_t pixels) {
+  return (pixels + 63) / 64 * sizeof(uint64_t);
+}
+
+bool FrameSidecar::Key::operator==(const Key &other) const {
+  return rgbSize == other.rgbSize && rgbTime == other.rgbTime &&
+         depthSize == other.depthSize && depthTime == other.depthTime &&
+         maskSize == other.maskSize && maskTime == other.maskTime &&
+         trunc == other.trunc && depthScale == other.depthScale &&
+         fx == other.fx && fy == other.fy && cx == other.cx && cy == other.cy &&
+         width == other.width && height == other.height &&
+         depthFilter == other.depthFilter && sortPoints == other.sortPoints;
+}
+
+FrameSidecar::~FrameSidecar() {
+  if (mData) {
+    munmap(const_cast<uint8_t *>(mData), mSize);
+    mData = nullptr;
+  }
+}
+
+std::unique_ptr<FrameSidecar> FrameSidecar::open(const fs::path &path,
+                                                 const Key &key) {
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < static_cast<off_t>(sizeof(Header))) {
+    close(fd);
+    return nullptr;
+  }
+  size_t size = static_cast<size_t>(st.st_size);
+  void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  // The mapping stays valid after closing the descriptor.
+  close(fd);
+  if (data == MAP_FAILED) {
+    return nullptr;
+  }
+  // no make_unique, as the constructor is private.
+  std::unique_ptr<FrameSidecar> self(new FrameSidecar);
+  self->mData = static_cast<const uint8_t *>(data);
+  self->mSize = size;
+
+  const Header &h = self->header();
+  if (memcmp(h.magic, sidecarMagic, sizeof(sidecarMagic)) ||
+      h.version != sidecarVersion || h.key != key || h.width != key.width ||
+      h.height != key.height || h.colorChannels <= 0 ||
+      h.colorBytesPerChannel <= 0 ||
+      (h.depthBytesPerChannel != 2 && h.depthBytesPerChannel != 4)) {
+    return nullptr;
+  }
+  uint64_t pixels = static_cast<uint64_t>(h.width) * h.height;
+  uint64_t colorSize = pixels * h.colorChannels * h.colorBytesPerChannel;
+  auto fits = [size](uint64_t offset, uint64_t length) {
+    return offset % sidecarAlignment == 0 && offset <= size &&
+           length <= size - offset;
+  };
+  if (!fits(h.colorOffset, colorSize) ||
+      !fits(h.depthOffset, pixels * h.depthBytesPerChannel) ||
+      (h.maskOffset && !fits(h.maskOffset, maskBytes(pixels))) ||
+      h.numPoints > pixels ||
+      !fits(h.pointsOffset, h.numPoints * 3 * sizeof(float)) ||
+      !fits(h.pixelsOffset, h.numPoints * sizeof(uint32_t))) {
+    return nullptr;
+  }
+  madvise(data, size, MADV_SEQUENTIAL);
+  return self;
+}
+
+bool FrameSidecar::write(
+    const fs::path &path, const Key &key,
+    const open3d::geometry::Image &color, const open3d::geometry::Image &depth,
+    const BitMask *mask, const CompactCloud &points,
+    const std::vector<Eigen::Vector2<unsigned int>> &pixels) {
+  if (color.width_ != key.width || color.height_ != key.height ||
+      depth.width_ != key.width || depth.height_ != key.height ||
+      depth.num_of_channels_ != 1 ||
+      (depth.bytes_per_channel_ != 2 && depth.bytes_per_channel_ != 4) ||
+      points.size() != pixels.size()) {
+    return false;
+  }
+  if (mask && (mask->getWidth() != key.width ||
+               mask->getHeight() != key.height)) {
+    return false;
+  }
+
+  Header h;
+  // The key has default values, but we want also the padding to be 0.
+  memset(static_cast<void *>(&h), 0, sizeof(h));
+  memcpy(h.magic, sidecarMagic, sizeof(sidecarMagic));
+  h.version = sidecarVersion;
+  h.width = color.width_;
+  h.height = color.height_;
+  h.colorChannels = color.num_of_channels_;
+  h.colorBytesPerChannel = color.bytes_per_channel_;
+  h.depthBytesPerChannel = depth.bytes_per_channel_;
+  h.key = key;
+  h.numPoints = points.size();
+  uint64_t offset = alignOffset(sizeof(Header));
+  h.colorOffset = offset;
+  offset = alignOffset(offset + color.data_.size());
+  h.depthOffset = offset;
+  offset = alignOffset(offset + depth.data_.size());
+  if (mask) {
+    h.maskOffset = offset;
+    offset = alignOffset(offset + maskBytes(mask->size()));
+  }
+  h.pointsOffset = offset;
+  offset = alignOffset(offset + h.numPoints * 3 * sizeof(float));
+  h.pixelsOffset = offset;
+
+  std::vector<uint32_t> pixelData;
+  pixelData.reserve(pixels.size());
+  for (const auto &px : pixels) {
+    pixelData.push_back(px[1] * static_cast<uint32_t>(key.width) + px[0]);
+  }
+
+  std::error_code ec;
+  fs::create_directories(path.parent_path(), ec);
+  fs::path tmpPath = path;
+  tmpPath += ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    auto writeAt = [&out](uint64_t offset, const void *data, size_t length) {
+      static const char zeros[sidecarAlignment] = {};
+      uint64_t pos = static_cast<uint64_t>(out.tellp());
+      assert(pos <= offset && offset - pos < sidecarAlignment);
+      out.write(zeros, static_cast<std::streamsize>(offset - pos));
+      out.write(static_cast<const char *>(data),
+                static_cast<std::streamsize>(length));
+    };
+    writeAt(0, &h, sizeof(h));
+    writeAt(h.colorOffset, color.data_.data(), color.data_.size());
+    writeAt(h.depthOffset, depth.data_.data(), depth.data_.size());
+    if (h.maskOffset) {
+      writeAt(h.maskOffset, mask->getWords().data(),
+              maskBytes(mask->size()));
+    }
+    // The coordinates are in separate arrays, like in CompactCloud.
+    const size_t coordBytes = points.size() * sizeof(float);
+    writeAt(h.pointsOffset, points.x.data(), coordBytes);
+    out.write(reinterpret_cast<const char *>(points.y.data()),
+              static_cast<std::streamsize>(coordBytes));
+    out.write(reinterpret_cast<const char *>(points.z.data()),
+              static_cast<std::streamsize>(coordBytes));
+    writeAt(h.pixelsOffset, pixelData.data(),
+            pixelData.size() * sizeof(uint32_t));
+    if (!out) {
+      out.close();
+      fs::remove(tmpPath, ec);
+      return false;
+    }
+  }
+  fs::rename(tmpPath, path, ec);
+  if (ec) {
+    fs::remove(tmpPath, ec);
+    return false;
+  }
+  return true;
+}
+
+const FrameSidecar::Header &FrameSidecar::header() const {
+  assert(mData && mSize >= sizeof(Header));
+  return *reinterpret_cast<const Header *>(mData);
+}
+
+std::pair<open3d::geometry::Image, open3d::geometry::Image>
+FrameSidecar::getImages() const {
+  const Header &h = header();
+  std::pair<open3d::geometry::Image, open3d::geometry::Image> images;
+  auto &[color, depth] = images;
+  color.Prepare(h.width, h.height, h.colorChannels, h.colorBytesPerChannel);
+  memcpy(color.data_.data(), array<uint8_t>(h.colorOffset),
+         color.data_.size());
+  depth.Prepare(h.width, h.height, 1, h.depthBytesPerChannel);
+  memcpy(depth.data_.data(), array<uint8_t>(h.depthOffset),
+         depth.data_.size());
+  return images;
+}
+
+BitMask FrameSidecar::getMask() const {
+  const Header &h = header();
+  if (!h.maskOffset) {
+    return {};
+  }
+  return BitMask::fromWords(h.width, h.height,
+                            array<uint64_t>(h.maskOffset));
+}
+
+CompactCloud FrameSidecar::getPoints() const {
+  const Header &h = header();
+  const float *data = array<float>(h.pointsOffset);
+  const size_t n = static_cast<size_t>(h.numPoints);
+  CompactCloud points;
+  points.x.assign(data, data + n);
+  points.y.assign(data + n, data + 2 * n);
+  points.z.assign(data + 2 * n, data + 3 * n);
+  return points;
+}
+
+std::vector<Eigen::Vector2<unsigned int>> FrameSidecar::getPixels() const {
+  const Header &h = header();
+  const uint32_t *data = array<uint32_t>(h.pixelsOffset);
+  const uint32_t width = static_cast<uint32_t>(h.width);
+  std::vector<Eigen::Vector2<unsigned int>> pixels;
+  pixels.reserve(h.numPoints);
+  for (uint64_t i = 0; i < h.numPoints; i++) {
+    pixels.emplace_back(data[i] % width, data[i] / width);
+  }
+  return pixels;
+}
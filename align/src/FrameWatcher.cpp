@@ -0,0 +1,108 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "FrameWatcher.h"
+
+#include <stdexcept>
+#include <system_error>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+static const char *watchedDirectories[] = {"rgb", "depth", "disparity",
+                                           "mask"};
+
+// We want to know when a file is complete, not every time it is written.
+static constexpr uint32_t fileEvents =
+    IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+
+FrameWatcher::FrameWatcher(const fs::path &dataDirectory)
+    : mDataDirectory(dataDirectory) {
+  mFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  if (mFd < 0) {
+    throw std::system_error(errno, std::generic_category(),
+                            "Cannot initialize inotify");
+  }
+  // The mask directory is created only when the first mask is exported, so
+  // watch also the base directory to know when we can start watching it.
+  mBaseWatch = inotify_add_watch(mFd, dataDirectory.c_str(),
+                                 IN_CREATE | IN_MOVED_TO | IN_ONLYDIR);
+  for (const char *dir : watchedDirectories) {
+    addWatch(dir);
+  }
+}
+
+FrameWatcher::~FrameWatcher() {
+  if (mFd >= 0) {
+    // Closing the descriptor also removes all the watches.
+    close(mFd);
+    mFd = -1;
+  }
+}
+
+void FrameWatcher::addWatch(const std::string &subdirectory) {
+  fs::path path = mDataDirectory / subdirectory;
+  int wd = inotify_add_watch(mFd, path.c_str(), fileEvents | IN_ONLYDIR);
+  // Missing directories are not an error.
+  if (wd >= 0) {
+    mWatches[wd] = subdirectory;
+  }
+}
+
+bool FrameWatcher::poll(std::unordered_set<std::string> &changed) {
+  bool complete = true;
+  // inotify guarantees to return only whole events, and this buffer is large
+  // enough for at least one with the longest name.
+  alignas(inotify_event) char buffer[4096];
+  for (;;) {
+    ssize_t len = read(mFd, buffer, sizeof(buffer));
+    if (len < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        fprintf(stderr, "Failed to read the inotify events: %s\n",
+                strerror(errno));
+      }
+      break;
+    }
+    if (len == 0) {
+      break;
+    }
+    for (ssize_t i = 0; i < len;) {
+      const inotify_event *ev = reinterpret_cast<const inotify_event *>(
+          buffer + static_cast<size_t>(i));
+      i += static_cast<ssize_t>(sizeof(inotify_event) + ev->len);
+      if (ev->mask & IN_Q_OVERFLOW) {
+        complete = false;
+        continue;
+      }
+      if (ev->mask & IN_IGNORED) {
+        mWatches.erase(ev->wd);
+        continue;
+      }
+      if (!ev->len) {
+        continue;
+      }
+      std::string name = ev->name;
+      if (ev->wd == mBaseWatch) {
+        for (const char *dir : watchedDirectories) {
+          if (name == dir) {
+            addWatch(name);
+            // Files might have been added before we started watching.
+            complete = false;
+          }
+        }
+      } else if (mWatches.count(ev->wd)) {
+        changed.insert(fs::path(name).stem().string());
+      }
+    }
+  }
+  return complete;
+}
@@ -88,7 +88,10 @@ std::shared_ptr<open3d::geometry::PointCloud>
 GlobalAlignState::voxelDown(size_t idx, double voxelSize,
                             std::optional<glm::mat4> m) const {
   const auto &clouds = mApp.getScene().clouds;
-  auto pcd = clouds[idx].getPointCloud().VoxelDownSample(voxelSize);
+  // The downsampled cloud is shared with the frame, and we transform only
+  // the copy that we need for Open3D anyway. Features of the background would
+  // only add wrong matches, so we use the masked cloud.
+  auto pcd = clouds[idx].getDownsampledCloud(voxelSize, true)->toOpen3D();
   if (pcd) {
     if (!m) {
       m = clouds[idx].matrix;
@@ -175,7 +178,7 @@ void GlobalAlignState::render(const glm::mat4 &pv) {
     assert(mMatrices.size() == mIndices.size());
     for (size_t i = 0; i < mMatrices.size(); i++) {
       size_t idx = mIndices[i];
-      r.renderPointCloud(idx, mMatrices[i], clouds[idx].color);
+      mApp.renderSceneCloud(idx, mMatrices[i], clouds[idx].color);
     }
   }
   r.endRendering();
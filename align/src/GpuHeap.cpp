@@ -0,0 +1,131 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "GpuHeap.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+
+// The first allocation, in elements, to avoid growing many times for the
+// first small geometries.
+static constexpr size_t minCapacity = 1 << 16;
+
+GpuHeap::GpuHeap(GLuint buffer, size_t elementSize)
+    : mBuffer(buffer), mElementSize(elementSize) {
+  if (!buffer || !elementSize) {
+    throw std::invalid_argument("The buffer and the element size must be set.");
+  }
+}
+
+size_t GpuHeap::allocate(size_t count) {
+  if (!count) {
+    return 0;
+  }
+  // First fit: the geometries are usually many ranges of similar sizes.
+  for (auto it = mFree.begin(); it != mFree.end(); ++it) {
+    if (it->second < count) {
+      continue;
+    }
+    const size_t offset = it->first;
+    const size_t remaining = it->second - count;
+    mFree.erase(it);
+    if (remaining) {
+      mFree.emplace(offset + count, remaining);
+    }
+    mUsed += count;
+    return offset;
+  }
+  // The new space is merged with the free range at the end, if any, so this
+  // is enough for the next attempt to succeed.
+  grow(mCapacity + count);
+  return allocate(count);
+}
+
+void GpuHeap::release(size_t offset, size_t count) {
+  if (!count) {
+    return;
+  }
+  mUsed -= count;
+  insertFree(offset, count);
+}
+
+void GpuHeap::resize(size_t &offset, size_t &count, size_t newCount) {
+  if (newCount <= count) {
+    release(offset + newCount, count - newCount);
+  } else {
+    release(offset, count);
+    offset = allocate(newCount);
+  }
+  count = newCount;
+  if (!count) {
+    offset = 0;
+  }
+}
+
+void GpuHeap::upload(size_t offset, size_t count, const void *data) {
+  if (!count) {
+    return;
+  }
+  // We use the copy target not to change the bindings of the vertex arrays.
+  glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+  glBufferSubData(GL_COPY_WRITE_BUFFER,
+                  static_cast<GLintptr>(offset * mElementSize),
+                  static_cast<GLsizeiptr>(count * mElementSize), data);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void GpuHeap::reserve(size_t count) {
+  if (mCapacity - mUsed < count) {
+    grow(mUsed + count);
+  }
+}
+
+void GpuHeap::grow(size_t requested) {
+  const size_t capacity = std::max({requested, 2 * mCapacity, minCapacity});
+  const GLsizeiptr oldBytes = static_cast<GLsizeiptr>(mCapacity * mElementSize);
+  // glBufferData discards the content, so we keep it in a temporary buffer,
+  // on the GPU.
+  GLuint temp = 0;
+  if (oldBytes) {
+    glGenBuffers(1, &temp);
+    glBindBuffer(GL_COPY_READ_BUFFER, mBuffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, temp);
+    glBufferData(GL_COPY_WRITE_BUFFER, oldBytes, nullptr, GL_STREAM_COPY);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        oldBytes);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, mBuffer);
+  glBufferData(GL_COPY_WRITE_BUFFER,
+               static_cast<GLsizeiptr>(capacity * mElementSize), nullptr,
+               GL_DYNAMIC_DRAW);
+  if (temp) {
+    glBindBuffer(GL_COPY_READ_BUFFER, temp);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        oldBytes);
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glDeleteBuffers(1, &temp);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  insertFree(mCapacity, capacity - mCapacity);
+  mCapacity = capacity;
+}
+
+void GpuHeap::insertFree(size_t offset, size_t count) {
+  auto next = mFree.lower_bound(offset);
+  if (next != mFree.end() && offset + count == next->first) {
+    count += next->second;
+    next = mFree.erase(next);
+  }
+  if (next != mFree.begin()) {
+    auto prev = std::prev(next);
+    if (prev->first + prev->second == offset) {
+      prev->second += count;
+      return;
+    }
+  }
+  mFree.emplace_hint(next, offset, count);
+}
@@ -0,0 +1,316 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "KeyframeScorer.h"
+
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+
+#include <cmath>
+#include <cstdio>
+
+#include "Eigen/Geometry"
+
+#include "open3d/pipelines/registration/Registration.h"
+
+#include "Scene.h"
+#include "imageutils.h"
+#include "parallel.h"
+#include "roi.h"
+
+// Half resolution keeps enough detail for the blur, and it is decoded much
+// faster, since JPEG can skip part of the IDCT.
+static constexpr int previewScale = 2;
+static constexpr double voxelSize = 0.005;
+static constexpr double icpDistance = 0.02;
+// Consecutive frames whose registration is worse than this break the chain.
+static constexpr double minFitness = 0.6;
+static constexpr size_t minPoints = 100;
+// Larger differences are steps between surfaces, rather than noise.
+static constexpr float maxNoiseStep = 0.01f;
+
+/**
+ * Compute the variance of the Laplacian of the luma inside the mask.
+ */
+static float computeSharpness(const open3d::geometry::Image &rgb,
+                              const BitMask &mask) {
+  const int width = rgb.width_;
+  const int height = rgb.height_;
+  const int channels = rgb.num_of_channels_;
+  if (rgb.bytes_per_channel_ != 1 || mask.getWidth() != width ||
+      mask.getHeight() != height) {
+    return 0.0f;
+  }
+  std::vector<int> luma(static_cast<size_t>(width) * height);
+  const uint8_t *data = rgb.data_.data();
+  for (size_t i = 0; i < luma.size(); i++, data += channels) {
+    luma[i] = channels >= 3 ? (77 * data[0] + 150 * data[1] + 29 * data[2]) >> 8
+                            : data[0];
+  }
+  double sum = 0.0;
+  double sum2 = 0.0;
+  size_t count = 0;
+  for (int y = 1; y + 1 < height; y++) {
+    // Skip the rows without the face quickly.
+    if (!mask.isAnySet(0, y, width, 1)) {
+      continue;
+    }
+    for (int x = 1; x + 1 < width; x++) {
+      if (!mask.test(x, y)) {
+        continue;
+      }
+      const int *p = luma.data() + static_cast<size_t>(y) * width + x;
+      const double l = 4 * p[0] - p[-1] - p[1] - p[-width] - p[width];
+      sum += l;
+      sum2 += l * l;
+      count++;
+    }
+  }
+  if (count < minPoints) {
+    return 0.0f;
+  }
+  const double mean = sum / count;
+  return static_cast<float>(sum2 / count - mean * mean);
+}
+
+template <typename T>
+static float computeNoise(const T *depth, int width, int height, float scale,
+                          const BitMask &mask) {
+  double sum = 0.0;
+  size_t count = 0;
+  for (int y = 1; y + 1 < height; y++) {
+    if (!mask.isAnySet(0, y, width, 1)) {
+      continue;
+    }
+    for (int x = 1; x + 1 < width; x++) {
+      // Only where the face is also on all the neighbors, since the mask
+      // also tells that the depth is valid.
+      if (!mask.test(x, y) || !mask.test(x - 1, y) || !mask.test(x + 1, y) ||
+          !mask.test(x, y - 1) || !mask.test(x, y + 1)) {
+        continue;
+      }
+      const T *p = depth + static_cast<size_t>(y) * width + x;
+      const float avg = (static_cast<float>(p[-1]) + static_cast<float>(p[1]) +
+                         static_cast<float>(p[-width]) +
+                         static_cast<float>(p[width])) *
+                        0.25f;
+      const float diff = std::abs(static_cast<float>(p[0]) - avg) * scale;
+      if (diff < maxNoiseStep) {
+        sum += diff;
+        count++;
+      }
+    }
+  }
+  return count ? static_cast<float>(sum / count) : 0.0f;
+}
+
+KeyframeScorer::KeyframeScorer(const Scene &scene,
+                               std::vector<ThumbnailAtlas::Source> frames,
+                               float trunc)
+    : mScene(scene), mFrames(std::move(frames)), mTrunc(trunc) {
+  const auto &intr = scene.getCameraIntrinsic();
+  if (intr.width_ <= 0 || intr.height_ <= 0) {
+    throw std::invalid_argument("The scene does not have a valid camera.");
+  }
+  // The previews take one pixel every previewScale.
+  const auto [fx, fy] = intr.GetFocalLength();
+  const auto [cx, cy] = intr.GetPrincipalPoint();
+  open3d::camera::PinholeCameraIntrinsic scaled;
+  scaled.SetIntrinsics(getScaledSize(intr.width_, previewScale),
+                       getScaledSize(intr.height_, previewScale),
+                       fx / previewScale, fy / previewScale, cx / previewScale,
+                       cy / previewScale);
+  mRays = CameraRays(scaled);
+  mScores.resize(mFrames.size());
+  mClouds.resize(mFrames.size());
+  mWorker = std::thread(&KeyframeScorer::work, this);
+}
+
+KeyframeScorer::~KeyframeScorer() {
+  mStop = true;
+  if (mWorker.joinable()) {
+    mWorker.join();
+  }
+}
+
+const std::vector<KeyframeScorer::Score> &KeyframeScorer::getScores() const {
+  if (!mDone) {
+    throw std::logic_error("The frames are still being scored.");
+  }
+  return mScores;
+}
+
+void KeyframeScorer::work() {
+  parallelFor(mFrames.size(), [this](size_t i) { scoreFrame(i); });
+  if (!mStop) {
+    registerFrames();
+  }
+  mClouds.clear();
+  rankQuality();
+  mDone = true;
+}
+
+void KeyframeScorer::scoreFrame(size_t idx) {
+  if (mStop) {
+    return;
+  }
+  const ThumbnailAtlas::Source &source = mFrames[idx];
+  Score &score = mScores[idx];
+  try {
+    auto [rgb, depth] =
+        mScene.openFramePreview(source.rgb, source.depth, previewScale);
+    const float depthScale = static_cast<float>(mScene.getDepthScale());
+    std::optional<FaceRoi> roi = findFaceRoi(depth, depthScale, mTrunc);
+    if (roi) {
+      score.sharpness = computeSharpness(rgb, roi->mask);
+      score.coverage = static_cast<float>(roi->numPixels) /
+                       static_cast<float>(roi->width * roi->height);
+      if (depth.bytes_per_channel_ == 2) {
+        score.noise = computeNoise(
+            reinterpret_cast<const uint16_t *>(depth.data_.data()),
+            depth.width_, depth.height_, depthScale, roi->mask);
+      } else {
+        score.noise =
+            computeNoise(reinterpret_cast<const float *>(depth.data_.data()),
+                         depth.width_, depth.height_, depthScale, roi->mask);
+      }
+
+      CompactCloud points;
+      std::vector<Eigen::Vector2<unsigned int>> pixels;
+      unprojectRays(depth, depthScale, mTrunc, mRays,
+                    Eigen::Matrix4d::Identity(), points, pixels, &roi->mask);
+      std::shared_ptr<open3d::geometry::PointCloud> pcd =
+          points.voxelDownSample(voxelSize).toOpen3D();
+      if (pcd->points_.size() >= minPoints) {
+        pcd->EstimateNormals(
+            open3d::geometry::KDTreeSearchParamHybrid(voxelSize * 4, 30));
+        mClouds[idx] = std::move(pcd);
+        score.valid = true;
+      }
+    }
+  } catch (std::exception &e) {
+    fprintf(stderr, "Cannot score %s: %s\n", source.stem.c_str(), e.what());
+  }
+  mNumScored++;
+}
+
+void KeyframeScorer::registerFrames() {
+  using namespace open3d::pipelines::registration;
+  std::vector<size_t> valid;
+  for (size_t i = 0; i < mScores.size(); i++) {
+    if (mScores[i].valid) {
+      valid.push_back(i);
+    }
+  }
+  if (valid.empty()) {
+    return;
+  }
+
+  // Every step registers a frame to the previous valid one, so they are
+  // independent and we can run them in parallel, and chain them later.
+  std::vector<Eigen::Matrix4d> steps(valid.size() - 1);
+  std::vector<char> linked(valid.size() - 1);
+  // The default criteria are fine for clouds of this size.
+  const ICPConvergenceCriteria criteria;
+  parallelFor(steps.size(), [&](size_t k) {
+    if (mStop) {
+      return;
+    }
+    RegistrationResult result = RegistrationICP(
+        *mClouds[valid[k + 1]], *mClouds[valid[k]], icpDistance,
+        Eigen::Matrix4d::Identity(), TransformationEstimationPointToPlane(),
+        criteria);
+    linked[k] = result.fitness_ >= minFitness;
+    steps[k] = result.transformation_;
+    mNumRegistered++;
+  });
+
+  int segment = 0;
+  Eigen::Matrix4d pose = Eigen::Matrix4d::Identity();
+  mScores[valid[0]].segment = segment;
+  for (size_t k = 1; k < valid.size(); k++) {
+    if (linked[k - 1]) {
+      pose = pose * steps[k - 1];
+    } else {
+      segment++;
+      pose.setIdentity();
+    }
+    mScores[valid[k]].segment = segment;
+    mScores[valid[k]].pose = pose;
+  }
+}
+
+void KeyframeScorer::rankQuality() {
+  std::vector<size_t> valid;
+  for (size_t i = 0; i < mScores.size(); i++) {
+    if (mScores[i].valid) {
+      valid.push_back(i);
+    }
+  }
+  if (valid.size() < 2) {
+    for (size_t i : valid) {
+      mScores[i].quality = 1.0f;
+    }
+    return;
+  }
+  // The average of the percentile ranks, where higher is better.
+  const float norm = 1.0f / (3.0f * static_cast<float>(valid.size() - 1));
+  auto addRanks = [&](auto key) {
+    std::vector<size_t> order = valid;
+    std::sort(order.begin(), order.end(),
+              [&](size_t a, size_t b) { return key(a) < key(b); });
+    for (size_t r = 0; r < order.size(); r++) {
+      mScores[order[r]].quality += static_cast<float>(r) * norm;
+    }
+  };
+  addRanks([this](size_t i) { return mScores[i].sharpness; });
+  addRanks([this](size_t i) { return mScores[i].coverage; });
+  addRanks([this](size_t i) { return -mScores[i].noise; });
+}
+
+std::vector<size_t>
+KeyframeScorer::suggest(size_t maxCount, double minAngle,
+                        const std::vector<size_t> &accepted) const {
+  const std::vector<Score> &scores = getScores();
+  std::vector<size_t> order;
+  for (size_t i = 0; i < scores.size(); i++) {
+    if (scores[i].valid &&
+        std::find(accepted.begin(), accepted.end(), i) == accepted.end()) {
+      order.push_back(i);
+    }
+  }
+  std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+    return scores[a].quality > scores[b].quality;
+  });
+
+  const double minRadians = minAngle * M_PI / 180.0;
+  std::vector<size_t> taken;
+  auto isFarFrom = [&](size_t i, const std::vector<size_t> &others) {
+    const Score &s = scores[i];
+    for (size_t j : others) {
+      const Score &o = scores.at(j);
+      if (!o.valid || o.segment != s.segment) {
+        continue;
+      }
+      Eigen::Matrix3d rel = o.pose.topLeftCorner<3, 3>().transpose() *
+                            s.pose.topLeftCorner<3, 3>();
+      if (Eigen::AngleAxisd(rel).angle() < minRadians) {
+        return false;
+      }
+    }
+    return true;
+  };
+  for (size_t i : order) {
+    if (taken.size() >= maxCount) {
+      break;
+    }
+    if (isFarFrom(i, accepted) && isFarFrom(i, taken)) {
+      taken.push_back(i);
+    }
+  }
+  return taken;
+}
@@ -6,6 +6,11 @@
 
 #include "LoadState.h"
 
+#include <chrono>
+
+#include <cassert>
+#include <cstdio>
+
 #include "imgui.h"
 #include "imgui_stdlib.h"
 
@@ -20,7 +25,12 @@ LoadState::LoadState(Application &app, std::unique_ptr<Scene> &scene,
 }
 
 void LoadState::createGui() {
-  if (!mError.empty()) {
+  if (mLoading.valid()) {
+    finishLoading();
+  }
+  if (mLoading.valid()) {
+    createProgressGui();
+  } else if (!mError.empty()) {
     const char title[] = "Load Error";
     ImGui::OpenPopup(title);
     bool open = true;
@@ -65,13 +75,51 @@ void LoadState::createGui() {
   }
 }
 
+void LoadState::createProgressGui() {
+  size_t total = mTotalFrames;
+  size_t loaded = mLoadedFrames;
+  ImGui::Begin("Load dataset", nullptr, ImGuiWindowFlags_NoTitleBar);
+  ImGui::Text("Loading %s...", mDirectory.c_str());
+  if (total) {
+    char overlay[50];
+    snprintf(overlay, sizeof(overlay), "%zu/%zu frames", loaded, total);
+    ImGui::ProgressBar(static_cast<float>(loaded) / total, ImVec2(-1.0f, 0.0f),
+                       overlay);
+  } else {
+    ImGui::TextUnformatted("Reading the scene data...");
+  }
+  ImGui::End();
+}
+
 void LoadState::load() {
   if (mDirectory.empty()) {
     mError = "The data directory is empty.";
     return;
   }
+  if (mLoading.valid()) {
+    return;
+  }
+  mLoadedFrames = 0;
+  mTotalFrames = 0;
+  // Load on another thread to keep the UI responsive. The scene loads the
+  // frames in parallel anyway, so this thread will mostly wait for them.
+  mLoading = std::async(std::launch::async, [this, dir = mDirectory]() {
+    return Scene::load(dir, [this](size_t done, size_t total) {
+      mTotalFrames = total;
+      mLoadedFrames = done;
+    });
+  });
+}
+
+void LoadState::finishLoading() {
+  assert(mLoading.valid());
+  if (mLoading.wait_for(std::chrono::seconds(0)) !=
+      std::future_status::ready) {
+    return;
+  }
   try {
-    std::tie(mScene, mWarnings) = Scene::load(mDirectory);
+    // get also invalidates the future.
+    std::tie(mScene, mWarnings) = mLoading.get();
     if (mWarnings.empty()) {
       switchToEditor();
     }
@@ -0,0 +1,142 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "MemoryRegistry.h"
+
+#include <fstream>
+#include <iomanip>
+#include <stdexcept>
+#include <utility>
+
+using json = nlohmann::json;
+
+MemoryRegistry::Registration::Registration(Registration &&other) noexcept
+    : mId(std::exchange(other.mId, 0)) {}
+
+MemoryRegistry::Registration &
+MemoryRegistry::Registration::operator=(Registration &&other) noexcept {
+  if (this != &other) {
+    reset();
+    mId = std::exchange(other.mId, 0);
+  }
+  return *this;
+}
+
+MemoryRegistry::Registration::~Registration() { reset(); }
+
+void MemoryRegistry::Registration::reset() {
+  if (mId) {
+    MemoryRegistry::get().remove(mId);
+    mId = 0;
+  }
+}
+
+MemoryRegistry &MemoryRegistry::get() {
+  static MemoryRegistry registry;
+  return registry;
+}
+
+MemoryRegistry::Registration MemoryRegistry::add(Reporter reporter) {
+  if (!reporter) {
+    throw std::invalid_argument("The reporter cannot be empty.");
+  }
+  std::lock_guard<std::mutex> lock(mMutex);
+  const uint64_t id = mNextId++;
+  mReporters.emplace(id, std::move(reporter));
+  return Registration(id);
+}
+
+void MemoryRegistry::remove(uint64_t id) {
+  // Wait for a collect in progress, which might be using the reporter.
+  std::lock_guard<std::mutex> calling(mCallMutex);
+  std::lock_guard<std::mutex> lock(mMutex);
+  mReporters.erase(id);
+}
+
+std::vector<MemoryRegistry::Entry> MemoryRegistry::collect() const {
+  std::lock_guard<std::mutex> calling(mCallMutex);
+  // We call the reporters without holding mMutex, so that the owners created
+  // meanwhile (e.g., by a worker thread) can register without waiting.
+  std::vector<Reporter> reporters;
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    reporters.reserve(mReporters.size());
+    for (const auto &[id, reporter] : mReporters) {
+      reporters.push_back(reporter);
+    }
+  }
+  std::vector<Entry> entries;
+  for (const Reporter &reporter : reporters) {
+    reporter(entries);
+  }
+  return entries;
+}
+
+json MemoryRegistry::toJson(const std::vector<Entry> &entries) {
+  // Group with std::map, so that the output is sorted and stable.
+  struct Usage {
+    size_t cpu = 0;
+    size_t gpu = 0;
+    void add(const Entry &e) { (e.gpu ? gpu : cpu) += e.bytes; }
+  };
+  auto usageJson = [](const Usage &u) {
+    return json{{"cpu", u.cpu}, {"gpu", u.gpu}};
+  };
+  Usage total;
+  std::map<std::string, Usage> subsystems;
+  std::map<std::string, Usage> frames;
+  json items = json::array();
+  for (const Entry &e : entries) {
+    total.add(e);
+    subsystems[e.subsystem].add(e);
+    if (!e.owner.empty()) {
+      frames[e.owner].add(e);
+    }
+    items.push_back({{"subsystem", e.subsystem},
+                     {"owner", e.owner},
+                     {"item", e.item},
+                     {"bytes", e.bytes},
+                     {"gpu", e.gpu}});
+  }
+
+  json j = {{"total", usageJson(total)},
+            {"subsystems", json::object()},
+            {"frames", json::object()},
+            {"entries", std::move(items)}};
+  for (const auto &[name, usage] : subsystems) {
+    j["subsystems"][name] = usageJson(usage);
+  }
+  for (const auto &[name, usage] : frames) {
+    j["frames"][name] = usageJson(usage);
+  }
+  return j;
+}
+
+void MemoryRegistry::dump(const std::filesystem::path &path) const {
+  json j = toJson(collect());
+  std::filesystem::create_directories(path.parent_path());
+  std::ofstream o(path);
+  if (!o) {
+    throw std::runtime_error("Could not open " + path.string() +
+                             " for writing.");
+  }
+  o << std::setw(2) << j;
+}
+
+template <typename T> static size_t vectorBytes(const std::vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+size_t MemoryRegistry::getBytes(const open3d::geometry::PointCloud &pcd) {
+  return vectorBytes(pcd.points_) + vectorBytes(pcd.normals_) +
+         vectorBytes(pcd.colors_);
+}
+
+size_t MemoryRegistry::getBytes(const open3d::geometry::TriangleMesh &mesh) {
+  return vectorBytes(mesh.vertices_) + vectorBytes(mesh.vertex_normals_) +
+         vectorBytes(mesh.vertex_colors_) + vectorBytes(mesh.triangles_) +
+         vectorBytes(mesh.triangle_uvs_);
+}
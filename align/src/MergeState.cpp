@@ -30,11 +30,43 @@ MergeState::MergeState(Application &app, const std::set<size_t> &indices)
   const auto &clouds = app.getScene().clouds;
   mColorType = open3d::pipelines::integration::TSDFVolumeColorType::RGB8;
   for (size_t idx : indices) {
-    if (clouds[idx].getRgbdImage().color_.num_of_channels_ < 2) {
+    if (clouds[idx].getColorImage()->num_of_channels_ < 2) {
       mColorType = open3d::pipelines::integration::TSDFVolumeColorType::Gray32;
       break;
     }
   }
+  mMemory = MemoryRegistry::get().add(
+      [this](std::vector<MemoryRegistry::Entry> &entries) {
+        entries.push_back({"Merge", "", "TSDF volume", getVolumeBytes()});
+        if (mPointCloud) {
+          entries.push_back({"Merge", "", "point cloud",
+                             MemoryRegistry::getBytes(*mPointCloud)});
+        }
+        if (mMesh) {
+          entries.push_back(
+              {"Merge", "", "mesh", MemoryRegistry::getBytes(*mMesh)});
+        }
+      });
+}
+
+size_t MergeState::getVolumeBytes() const {
+  using namespace open3d::pipelines::integration;
+  using open3d::geometry::TSDFVoxel;
+  if (auto *uniform = dynamic_cast<const UniformTSDFVolume *>(mVolume.get())) {
+    return uniform->voxels_.capacity() * sizeof(TSDFVoxel);
+  }
+  if (auto *scalable =
+          dynamic_cast<const ScalableTSDFVolume *>(mVolume.get())) {
+    // The units are allocated only where we integrate something.
+    size_t bytes = 0;
+    for (const auto &[index, unit] : scalable->volume_units_) {
+      if (unit.volume_) {
+        bytes += unit.volume_->voxels_.capacity() * sizeof(TSDFVoxel);
+      }
+    }
+    return bytes;
+  }
+  return 0;
 }
 
 void MergeState::start() {
@@ -75,6 +107,10 @@ void MergeState::createGui() {
     ImGui::InputDouble("SDF truncation value", &mSdfTrunc);
     ImGui::Checkbox("Align frames before merging", &mAlignBeforeMerge);
     ImGui::EndDisabled();
+    if (mVolume) {
+      ImGui::Text("Volume memory: %.1fMiB",
+                  static_cast<double>(getVolumeBytes()) / (1 << 20));
+    }
 
     ImGui::InputDouble("Align maximum distance", &mIcpDistance);
     ImGui::InputInt("Align maximum iterations", &mIcpCriteria.max_iteration_);
@@ -181,9 +217,11 @@ void MergeState::integrateFrame(size_t idx) {
   using namespace Eigen;
   const PointCloud &pcd = mApp.getScene().clouds.at(idx);
   Matrix4d matrix = pcd.getMatrixEigen().inverse().eval();
-  auto maybeMasked = pcd.getMaskedRgbd();
+  // Open3D wants float depth, so we create it only for the time of the
+  // integration.
+  auto rgbd = pcd.createRgbdImage();
   assert(mVolume);
-  mVolume->Integrate(maybeMasked ? *maybeMasked : pcd.getRgbdImage(),
+  mVolume->Integrate(*rgbd,
                      mApp.getScene().getCameraIntrinsic(), matrix);
 }
 
@@ -195,7 +233,7 @@ void MergeState::alignFrame(size_t idx) {
   PointCloud &pcd = clouds[idx];
   Matrix4d init = pcd.getMatrixEigen();
   RegistrationResult res = RegistrationICP(
-      pcd.getMaskedPointCloud(), *mPointCloud, mIcpDistance, init,
+      *pcd.getMaskedPointCloud()->toOpen3D(), *mPointCloud, mIcpDistance, init,
       TransformationEstimationPointToPlane(), mIcpCriteria);
   mIcpLastFitness = res.fitness_;
   if (mIcpLastFitness >= mIcpMinFitness) {
@@ -205,24 +243,31 @@ void MergeState::alignFrame(size_t idx) {
 
 void MergeState::updateGraphics() {
   Renderer &r = mApp.getRenderer();
-  r.clearBuffer();
   if (mVolume) {
     mPointCloud = mVolume->ExtractPointCloud();
     mMesh = mVolume->ExtractTriangleMesh();
   }
+  // The geometries are replaced in place, so the interactive merge does not
+  // upload the other ones at every step.
+  auto update = [&r](std::unique_ptr<Renderer::Geometry> &geometry,
+                     const auto &source) {
+    if (!geometry) {
+      geometry = r.createGeometry();
+    }
+    r.setGeometry(*geometry, source);
+  };
   if (mPointCloud && mMesh) {
-    r.addPointCloud(*mPointCloud);
-    r.addTriangleMesh(*mMesh);
+    update(mCloudGeometry, *mPointCloud);
+    update(mMeshGeometry, *mMesh);
   }
   if (mInteractiveMerge && mInteractiveNextIdx < mIndices.size()) {
     const auto &clouds = mApp.getScene().clouds;
     assert(mIndices[mInteractiveNextIdx] < clouds.size());
-    mTempCloud = r.addPointCloud(
-        clouds[mIndices[mInteractiveNextIdx]].getMaskedPointCloud());
+    update(mNextGeometry,
+           *clouds[mIndices[mInteractiveNextIdx]].getMaskedPointCloud());
   } else {
-    mTempCloud = std::numeric_limits<size_t>::max();
+    mNextGeometry.reset();
   }
-  r.uploadBuffer();
 }
 
 void MergeState::integrateNext() {
@@ -322,6 +367,7 @@ void MergeState::createInteractiveGui() {
   ImGui::End();
   if (!mInteractiveMerge) {
     mVolume.reset();
+    mNextGeometry.reset();
     mShowFitness = false;
   }
 }
@@ -412,13 +458,14 @@ void MergeState::runColormapOptimizer() {
   assert(mMesh);
   camera::PinholeCameraTrajectory trajectory;
   trajectory.parameters_.resize(mIndices.size());
-  std::vector<geometry::RGBDImage> images;
+  // Open3D wants a vector of images, and it would copy them if we pushed them,
+  // so we create them in place.
+  std::vector<geometry::RGBDImage> images(mIndices.size());
   camera::PinholeCameraIntrinsic intr = mApp.getScene().getCameraIntrinsic();
   const auto &clouds = mApp.getScene().clouds;
   for (size_t i = 0; i < mIndices.size(); i++) {
     const PointCloud &pcd = clouds[mIndices[i]];
-    images.push_back(pcd.hasMaskedRgbd() ? *pcd.getMaskedRgbd()
-                                         : pcd.getRgbdImage());
+    pcd.createRgbdImage(images[i]);
     camera::PinholeCameraParameters &params = trajectory.parameters_[i];
     params.intrinsic_ = intr;
     params.extrinsic_ = pcd.getMatrixEigen().inverse().eval();
@@ -433,23 +480,23 @@ void MergeState::runColormapOptimizer() {
 void MergeState::render(const glm::mat4 &pv) {
   Renderer &r = mApp.getRenderer();
   r.beginRendering(pv);
-  if (mMesh && (mRenderMode == RM_Mesh || mRenderMode == RM_Wireframe)) {
+  if (mMeshGeometry &&
+      (mRenderMode == RM_Mesh || mRenderMode == RM_Wireframe)) {
     GLint polygonMode;
     glGetIntegerv(GL_POLYGON_MODE, &polygonMode);
     if (mRenderMode == RM_Wireframe) {
       glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     }
-    r.renderIndexedMesh(1, mMatrix);
+    r.renderGeometry(*mMeshGeometry, mMatrix);
     glPolygonMode(GL_FRONT_AND_BACK, polygonMode);
-  } else if (mPointCloud) {
-    r.renderPointCloud(0, mMatrix);
+  } else if (mCloudGeometry) {
+    r.renderGeometry(*mCloudGeometry, mMatrix);
   }
 
   const auto &clouds = mApp.getScene().clouds;
-  if (mInteractiveMerge && mInteractiveNextIdx < mIndices.size()) {
-    assert(mTempCloud != std::numeric_limits<size_t>::max());
+  if (mNextGeometry && mInteractiveNextIdx < mIndices.size()) {
     const PointCloud &cloud = clouds[mIndices[mInteractiveNextIdx]];
-    r.renderPointCloud(mTempCloud, cloud.matrix, cloud.color);
+    r.renderGeometry(*mNextGeometry, cloud.matrix, cloud.color);
   }
 
   r.endRendering();
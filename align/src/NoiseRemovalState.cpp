@@ -8,11 +8,13 @@
 
 #include <unordered_set>
 
-#include "imgui.h"
+#include <cstdio>
 
-#include "open3d/io/ImageIO.h"
+#include "imgui.h"
 
 #include "EditorState.h"
+#include "imageutils.h"
+#include "morton.h"
 
 NoiseRemovalState::NoiseRemovalState(Application &app, PointCloud &pcd)
     : mApp(app), mPcd(pcd) {}
@@ -78,6 +80,10 @@ void NoiseRemovalState::createGui() {
 
 void NoiseRemovalState::resetInitial() {
   auto [points, pixels] = mApp.getScene().unprojectDepth(mPcd, mUseMask);
+  // The outlier removal runs a radius search for every point.
+  if (mPcd.sortPoints) {
+    sortMorton(points, pixels);
+  }
   mInitialCloud.points_ = std::move(points);
   mInitialCloud.PaintUniformColor(Eigen::Vector3d(0.0, 0.7, 0.0));
   mInitialPixels = std::move(pixels);
@@ -119,54 +125,39 @@ void NoiseRemovalState::applyResults(
 }
 
 bool NoiseRemovalState::exportMask() const {
-  namespace fs = std::filesystem;
-
   if (mOutliers.empty()) {
     return false;
   }
 
-  open3d::geometry::Image mask;
-
-  fs::path maskPath = mApp.getScene().getDataDirectory();
-  maskPath /= "mask";
-  maskPath /= mPcd.name + ".png";
-  std::string maskPathStr = maskPath.string();
-  std::error_code ec;
-  if (std::filesystem::exists(maskPath, ec)) {
-    open3d::io::ReadImage(maskPathStr, mask);
-  }
-
-  if (mask.IsEmpty()) {
-    mask = mPcd.getRgbdImage().color_;
-  } else if (mask.bytes_per_channel_ != 1) {
-    return false;
-  }
-  if (mask.num_of_channels_ == 3) {
-    // This will override any existing mask! We should warn about this...
-    assert(mask.bytes_per_channel_ == 1 && mask.height_ > 0);
-    using namespace Eigen;
-    std::vector<uint8_t> origData = std::move(mask.data_);
-    mask.num_of_channels_ = 4;
-    mask.data_.resize(static_cast<size_t>(mask.height_) * mask.BytesPerLine());
-    Map<const Matrix<uint8_t, Dynamic, 3, RowMajor>> origMat(
-        origData.data(), mask.height_ * mask.width_, 3);
-    Map<Matrix<uint8_t, Dynamic, 4, RowMajor>> maskMat(mask.data_.data(),
-                                                       origMat.rows(), 4);
-    maskMat << origMat, Vector<uint8_t, Dynamic>::Constant(origMat.rows(), 255);
-  } else if (mask.num_of_channels_ != 4) {
-    return false;
+  // We start from the mask file, not from getMask, which might include also
+  // the automatic region of interest.
+  const Scene &scene = mApp.getScene();
+  std::shared_ptr<const open3d::geometry::Image> color = mPcd.getColorImage();
+  BitMask mask;
+  open3d::geometry::Image existing;
+  if (scene.openMask(mPcd.name, existing)) {
+    if (existing.width_ != color->width_ ||
+        existing.height_ != color->height_) {
+      return false;
+    }
+    try {
+      mask = BitMask::fromImage(existing);
+    } catch (const std::invalid_argument &e) {
+      fprintf(stderr, "Cannot update the mask of %s: %s\n", mPcd.name.c_str(),
+              e.what());
+      return false;
+    }
+  } else {
+    mask = BitMask(color->width_, color->height_, true);
   }
 
-  assert(mask.BytesPerLine() > 0 && mask.num_of_channels_ == 4);
-  unsigned int stride = static_cast<unsigned int>(mask.BytesPerLine());
   for (size_t out : mOutliers) {
     assert(out < mInitialPixels.size());
     auto coords = mInitialPixels[out];
-    size_t offset = coords[1] * stride + 4 * coords[0];
-    mask.data_[offset + 3] = 0;
+    mask.set(static_cast<int>(coords[0]), static_cast<int>(coords[1]), false);
   }
 
-  return open3d::io::WriteImageToPNG(maskPathStr, mask);
+  return writeMaskPng(scene.getMaskPath(mPcd.name), mask);
 }
 
 void NoiseRemovalState::render(const glm::mat4 &pv) {
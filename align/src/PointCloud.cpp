@@ -6,18 +6,125 @@
 
 #include "PointCloud.h"
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
 #include <random>
 
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtx/euler_angles.hpp"
 
-#include "open3d/io/ImageIO.h"
-
+#include "FrameCache.h"
 #include "Scene.h"
+#include "morton.h"
 #include "utilities.h"
 
 using json = nlohmann::json;
 
+// Starts from 1, so that 0 never matches any data.
+static std::atomic<uint64_t> nextDataVersion = 1;
+
+struct PointCloud::FrameData : public FrameCache::Evictable {
+  FrameData(std::shared_ptr<FrameCache> cache) : cache(std::move(cache)) {}
+  ~FrameData() override { cache->remove(this); }
+  void evict() override;
+  size_t getBytes() const;
+
+  std::shared_ptr<FrameCache> cache;
+  std::mutex mutex;
+  // Unlike the address, it is never reused by other data.
+  const uint64_t version = nextDataVersion++;
+  // The result of getBytes at the last touch, for the memory reports, which
+  // do not wait for the mutex while a worker decodes the frame.
+  std::atomic<size_t> touchedBytes = 0;
+
+  // The images as they have been read from the disk (or from the sidecar),
+  // also to avoid reading them again when trunc changes.
+  // We keep the depth in its native format, which usually takes half of the
+  // memory of a float32 image, and the kernels that use it convert it on the
+  // fly. Both are nullptr when the frame has been evicted.
+  std::shared_ptr<const open3d::geometry::Image> color;
+  std::shared_ptr<const open3d::geometry::Image> depth;
+  // The filter that has been applied to depth.
+  DepthFilter filter;
+  // The images have been decoded from the source files, so the sidecar is
+  // missing or stale.
+  bool sidecarStale = false;
+  // The pixels to keep, or nullptr if the frame does not have a mask file.
+  // It is also set when we read the data from the sidecar.
+  std::shared_ptr<const BitMask> mask;
+  // The automatic region of interest, for roiTrunc and roiEnabled, or nullptr
+  // if it is disabled or we could not find it.
+  std::shared_ptr<const FaceRoi> roi;
+  double roiTrunc = 0.0;
+  bool roiEnabled = false;
+  bool roiValid = false;
+  // The mask that we apply: the mask file, the region of interest, or both
+  // combined. nullptr if the frame does not have either.
+  std::shared_ptr<const BitMask> activeMask;
+
+  // The trunc value used to create the data below.
+  double trunc = 0.0;
+  // Sorted by their Morton code if sorted is set, see sortMorton.
+  std::shared_ptr<const CompactCloud> cloud;
+  bool sorted = false;
+  // The pixel of each point of cloud (y * width + x), to map the points back
+  // to the images after the sort.
+  std::vector<uint32_t> pixels;
+  // The points of cloud that the active mask keeps.
+  std::vector<size_t> maskedIndices;
+  // Created only when requested, from the data above.
+  std::shared_ptr<const CompactCloud> maskedCloud;
+  // The last voxel size requested, shared by all the states that need it.
+  double voxelSize = 0.0;
+  bool downsampledMasked = false;
+  std::shared_ptr<const CompactCloud> downsampled;
+};
+
+static size_t imageBytes(const open3d::geometry::Image *img) {
+  return img ? img->data_.size() : 0;
+}
+
+static size_t cloudBytes(const CompactCloud *pcd) {
+  return pcd ? pcd->getBytes() : 0;
+}
+
+/**
+ * Convert the pixels of the points to indices in the images.
+ */
+static std::vector<uint32_t>
+getPixelIndices(const std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                int width);
+
+/**
+ * Find the points whose pixel is kept by the mask.
+ */
+static std::vector<size_t> getMaskedIndices(const std::vector<uint32_t> &pixels,
+                                            const BitMask &mask);
+
+/**
+ * Create the point cloud from points unprojected from a depth image, with the
+ * same colors as open3d::geometry::PointCloud::CreateFromRGBDImage.
+ */
+static std::shared_ptr<CompactCloud>
+createCloud(const open3d::geometry::Image &color, CompactCloud points,
+            const std::vector<Eigen::Vector2<unsigned int>> &pixels);
+
+/**
+ * Get the size and the modification time of a file, or 0 if it does not exist.
+ */
+static bool statFile(const std::filesystem::path &path, uint64_t &size,
+                     int64_t &time);
+
+/**
+ * Read the mask of a frame and pack it, with its pyramid.
+ *
+ * Returns nullptr if the mask does not exist or cannot be used.
+ */
+static std::shared_ptr<const BitMask>
+readMask(const Scene &scene, const std::string &name,
+         const open3d::geometry::Image &color);
+
 namespace glm {
 void to_json(json &j, const vec3 &v) { j = json{v.x, v.y, v.z}; }
 
@@ -53,12 +160,31 @@ PointCloud::PointCloud(const Scene &scene, const std::string &name,
   loadData(scene);
 }
 
+PointCloud::PointCloud(
+    const Scene &scene, const std::string &name, const std::string &rgb,
+    const std::string depth, double trunc,
+    std::pair<open3d::geometry::Image, open3d::geometry::Image> images)
+    : name(name), rgb(rgb), depth(depth), color(randomColor()), matrix(1.0f),
+      hidden(false), trunc(trunc), mScene(&scene),
+      mData(std::make_shared<FrameData>(scene.getFrameCache())) {
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    setImages(*mData, std::move(images));
+  }
+  touch();
+}
+
 PointCloud::PointCloud(const Scene &scene, const json &j) {
   j.at("name").get_to(name);
   j.at("matrix").get_to(matrix);
   j.at("hidden").get_to(hidden);
   j.at("color").get_to(color);
   j.at("trunc").get_to(trunc);
+  // Older scenes did not crop the frames, and we keep them as they were.
+  autoRoi = j.value("autoRoi", false);
+  // The same for the depth filter.
+  depthFilter = j.value("depthFilter", DepthFilter::disabled());
+  sortPoints = j.value("sortPoints", true);
 
   auto maybeRgb = j.find("rgb");
   auto maybeDepth = j.find("depth");
@@ -92,77 +218,421 @@ Eigen::Matrix4d PointCloud::getMatrixEigen() const {
 }
 
 void PointCloud::loadData(const Scene &scene) {
+  mScene = &scene;
+  // Always use new data, also in case some copy of this cloud shares them.
+  mData = std::make_shared<FrameData>(scene.getFrameCache());
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    if (!readSidecar(*mData)) {
+      decode(*mData);
+    }
+  }
+  touch();
+}
+
+std::shared_ptr<PointCloud::FrameData> PointCloud::reloadData() const {
+  if (!mScene) {
+    throw std::logic_error("The data of the point cloud was never loaded.");
+  }
+  auto data = std::make_shared<FrameData>(mScene->getFrameCache());
+  std::lock_guard<std::mutex> lock(data->mutex);
+  materialize(*data);
+  return data;
+}
+
+void PointCloud::setData(std::shared_ptr<FrameData> data) {
+  if (!data) {
+    throw std::invalid_argument("The frame data cannot be null.");
+  }
+  mData = std::move(data);
+  touch();
+}
+
+void PointCloud::decode(FrameData &data) const {
+  assert(mScene);
   std::pair<open3d::geometry::Image, open3d::geometry::Image> pair;
   // Should we sanitize these data?
   if (rgb.empty() || depth.empty()) {
-    pair = scene.openFrame(name);
+    pair = mScene->openFrame(name);
   } else {
-    pair = scene.openFrame(rgb, depth);
+    pair = mScene->openFrame(rgb, depth);
   }
-  mRGBD = open3d::geometry::RGBDImage::CreateFromColorAndDepth(
-      pair.first, pair.second, 1.0 / scene.getDepthScale(), trunc,
-      pair.first.num_of_channels_ < 2);
-  if (!mRGBD) {
-    throw std::runtime_error("Failed to create the RGBD image");
+  setImages(data, std::move(pair));
+}
+
+void PointCloud::setImages(
+    FrameData &data,
+    std::pair<open3d::geometry::Image, open3d::geometry::Image> images) const {
+  assert(mScene);
+  data.color = std::make_shared<const open3d::geometry::Image>(
+      std::move(images.first));
+  if (depthFilter.isEnabled()) {
+    data.depth = std::make_shared<const open3d::geometry::Image>(
+        filterDepth(images.second, static_cast<float>(mScene->getDepthScale()),
+                    depthFilter));
+  } else {
+    data.depth = std::make_shared<const open3d::geometry::Image>(
+        std::move(images.second));
   }
-  makeMasked(scene);
-  mPointCloud = open3d::geometry::PointCloud::CreateFromRGBDImage(
-      *mRGBD, scene.getCameraIntrinsic());
-  if (!mPointCloud) {
-    throw std::runtime_error("Failed to create the point cloud");
+  data.filter = depthFilter;
+  data.sidecarStale = true;
+  data.mask = readMask(*mScene, name, *data.color);
+  data.roiValid = false;
+  refreshMask(data);
+  data.cloud.reset();
+  data.pixels.clear();
+  data.maskedIndices.clear();
+  data.maskedCloud.reset();
+  data.downsampled.reset();
+}
+
+void PointCloud::materialize(FrameData &data) const {
+  if (!mScene) {
+    throw std::logic_error("The data of the point cloud was never loaded.");
+  }
+  if (data.cloud && data.trunc == trunc && isFilterCurrent(data) &&
+      data.sorted == sortPoints) {
+    // At most the mask changed, and loadImages selects the points again.
+    loadImages(data);
+    return;
+  }
+  if (readSidecar(data)) {
+    return;
+  }
+  if (!data.color || !isFilterCurrent(data)) {
+    decode(data);
+  }
+  refreshMask(data);
+
+  // We unproject on our own, instead of using CreateFromRGBDImage, because we
+  // need also the pixels to save the sidecar and to apply the mask, and
+  // because we can convert the native depth on the fly.
+  auto [points, pixels] = mScene->unprojectCompact(*data.depth, trunc);
+  // We keep this cloud for a long time and we build KD-trees and draw it many
+  // times, so it is usually worth sorting it. The sidecar stores it already
+  // sorted, and its key tells whether it is.
+  if (sortPoints) {
+    sortMorton(points, pixels);
+  }
+  // We write the sidecar only after decoding the images. When only trunc
+  // changed, it would contain the same images, and unprojecting them is cheap,
+  // so we accept that the next load decodes the frame once more.
+  std::optional<FrameSidecar::Key> key = getSidecarKey();
+  if (key && data.sidecarStale) {
+    SidecarWriter::Job job;
+    job.path = mScene->getSidecarPath(name);
+    job.key = *key;
+    job.color = data.color;
+    job.depth = data.depth;
+    job.mask = data.mask;
+    job.points = points;
+    job.pixels = pixels;
+    mScene->getSidecarWriter().write(std::move(job));
+    data.sidecarStale = false;
+  }
+  data.cloud = createCloud(*data.color, std::move(points), pixels);
+  data.pixels = getPixelIndices(pixels, data.depth->width_);
+  data.maskedIndices = data.activeMask
+                           ? getMaskedIndices(data.pixels, *data.activeMask)
+                           : std::vector<size_t>();
+  data.trunc = trunc;
+  data.sorted = sortPoints;
+  data.maskedCloud.reset();
+  data.downsampled.reset();
+}
+
+void PointCloud::loadImages(FrameData &data) const {
+  if (!mScene) {
+    throw std::logic_error("The data of the point cloud was never loaded.");
+  }
+  if (data.color && !isFilterCurrent(data)) {
+    // The filtered depth replaces the one we read, so we need to read the
+    // frame again, and the cloud is outdated, too.
+    data.color.reset();
+    data.depth.reset();
+    data.cloud.reset();
+    data.pixels.clear();
+    data.maskedIndices.clear();
+    data.maskedCloud.reset();
+    data.downsampled.reset();
+  }
+  if (!data.color && !readSidecar(data)) {
+    decode(data);
+  }
+  if (refreshMask(data)) {
+    // The points do not depend on the mask, so we only need to select them
+    // again, with their pixels.
+    data.maskedIndices = data.cloud && data.activeMask
+                             ? getMaskedIndices(data.pixels, *data.activeMask)
+                             : std::vector<size_t>();
+    data.maskedCloud.reset();
+    data.downsampled.reset();
+  }
+}
+
+bool PointCloud::isMaskCurrent(const FrameData &data) const {
+  return data.roiValid && data.roiEnabled == autoRoi && data.roiTrunc == trunc;
+}
+
+bool PointCloud::isFilterCurrent(const FrameData &data) const {
+  return data.filter == depthFilter;
+}
+
+bool PointCloud::refreshMask(FrameData &data) const {
+  assert(mScene && data.depth);
+  if (isMaskCurrent(data)) {
+    return false;
+  }
+  data.roi.reset();
+  if (autoRoi) {
+    std::optional<FaceRoi> roi =
+        findFaceRoi(*data.depth, static_cast<float>(mScene->getDepthScale()),
+                    static_cast<float>(trunc));
+    if (roi) {
+      data.roi = std::make_shared<const FaceRoi>(std::move(*roi));
+    }
+  }
+  if (data.roi && data.mask) {
+    auto combined = std::make_shared<BitMask>(*data.mask);
+    *combined &= data.roi->mask;
+    combined->updatePyramid();
+    data.activeMask = std::move(combined);
+  } else if (data.roi) {
+    // Share the mask of the region, rather than copying it.
+    data.activeMask =
+        std::shared_ptr<const BitMask>(data.roi, &data.roi->mask);
+  } else {
+    data.activeMask = data.mask;
+  }
+  data.roiTrunc = trunc;
+  data.roiEnabled = autoRoi;
+  data.roiValid = true;
+  return true;
+}
+
+std::pair<std::filesystem::path, std::filesystem::path>
+PointCloud::getSourcePaths() const {
+  assert(mScene);
+  if (rgb.empty() || depth.empty()) {
+    auto [rgbFile, depthFile] = Scene::getFrameFiles(name);
+    return mScene->getSourcePaths(rgbFile, depthFile);
   }
+  return mScene->getSourcePaths(rgb, depth);
 }
 
-void PointCloud::makeMasked(const Scene &scene) {
-  std::filesystem::path maskPath = scene.getDataDirectory();
-  maskPath = maskPath / "mask" / (name + ".png");
+std::optional<FrameSidecar::Key> PointCloud::getSidecarKey() const {
+  assert(mScene);
+  auto [rgbPath, depthPath] = getSourcePaths();
+  FrameSidecar::Key key;
+  if (!statFile(rgbPath, key.rgbSize, key.rgbTime) ||
+      !statFile(depthPath, key.depthSize, key.depthTime)) {
+    return std::nullopt;
+  }
+  statFile(mScene->getMaskPath(name), key.maskSize, key.maskTime);
+  key.trunc = trunc;
+  key.depthScale = mScene->getDepthScale();
+  const open3d::camera::PinholeCameraIntrinsic &intr =
+      mScene->getCameraIntrinsic();
+  std::tie(key.fx, key.fy) = intr.GetFocalLength();
+  std::tie(key.cx, key.cy) = intr.GetPrincipalPoint();
+  key.width = intr.width_;
+  key.height = intr.height_;
+  key.depthFilter = depthFilter;
+  key.sortPoints = sortPoints;
+  return key;
+}
+
+bool PointCloud::readSidecar(FrameData &data) const {
+  std::optional<FrameSidecar::Key> key = getSidecarKey();
+  if (!key) {
+    return false;
+  }
+  std::unique_ptr<FrameSidecar> sidecar =
+      FrameSidecar::open(mScene->getSidecarPath(name), *key);
+  if (!sidecar) {
+    return false;
+  }
+  try {
+    auto [color, depth] = sidecar->getImages();
+    BitMask mask = sidecar->getMask();
+    std::vector<Eigen::Vector2<unsigned int>> pixels = sidecar->getPixels();
+    CompactCloud points = sidecar->getPoints();
+    data.color =
+        std::make_shared<const open3d::geometry::Image>(std::move(color));
+    data.depth =
+        std::make_shared<const open3d::geometry::Image>(std::move(depth));
+    // The key includes the filter.
+    data.filter = depthFilter;
+    data.sidecarStale = false;
+    if (mask.empty()) {
+      data.mask.reset();
+    } else {
+      mask.updatePyramid();
+      data.mask = std::make_shared<const BitMask>(std::move(mask));
+    }
+    data.roiValid = false;
+    refreshMask(data);
+    data.cloud = createCloud(*data.color, std::move(points), pixels);
+    data.pixels = getPixelIndices(pixels, data.depth->width_);
+    data.maskedIndices = data.activeMask
+                             ? getMaskedIndices(data.pixels, *data.activeMask)
+                             : std::vector<size_t>();
+  } catch (std::exception &e) {
+    fprintf(stderr, "%s: invalid sidecar cache: %s\n", name.c_str(),
+            e.what());
+    data.cloud.reset();
+    data.pixels.clear();
+    data.maskedIndices.clear();
+    return false;
+  }
+  data.trunc = trunc;
+  data.sorted = sortPoints;
+  data.maskedCloud.reset();
+  data.downsampled.reset();
+  return true;
+}
+
+static std::vector<uint32_t>
+getPixelIndices(const std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                int width) {
+  std::vector<uint32_t> indices(pixels.size());
+  for (size_t i = 0; i < pixels.size(); i++) {
+    indices[i] = pixels[i][1] * static_cast<uint32_t>(width) + pixels[i][0];
+  }
+  return indices;
+}
+
+static std::vector<size_t> getMaskedIndices(const std::vector<uint32_t> &pixels,
+                                            const BitMask &mask) {
+  std::vector<size_t> indices;
+  indices.reserve(pixels.size());
+  for (size_t i = 0; i < pixels.size(); i++) {
+    assert(pixels[i] < mask.size());
+    if (mask.test(pixels[i])) {
+      indices.push_back(i);
+    }
+  }
+  indices.shrink_to_fit();
+  return indices;
+}
+
+static std::shared_ptr<CompactCloud>
+createCloud(const open3d::geometry::Image &color, CompactCloud points,
+            const std::vector<Eigen::Vector2<unsigned int>> &pixels) {
+  auto pcd = std::make_shared<CompactCloud>(std::move(points));
+  gatherColors(color, pixels, *pcd);
+  return pcd;
+}
+
+static bool statFile(const std::filesystem::path &path, uint64_t &size,
+                     int64_t &time) {
   std::error_code ec;
-  if (!std::filesystem::exists(maskPath, ec) || ec) {
-    return;
+  size = std::filesystem::file_size(path, ec);
+  if (!ec) {
+    time = static_cast<int64_t>(
+        std::filesystem::last_write_time(path, ec).time_since_epoch().count());
   }
+  if (ec) {
+    size = 0;
+    time = 0;
+    return false;
+  }
+  return true;
+}
 
-  std::string maskFilename = maskPath.string();
-  open3d::geometry::Image mask;
-  if (!open3d::io::ReadImage(maskFilename, mask)) {
-    return;
+void PointCloud::touch() const {
+  size_t bytes;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    bytes = mData->getBytes();
   }
-  if (mask.num_of_channels_ != 4 || mask.width_ != mRGBD->color_.width_ ||
-      mask.height_ != mRGBD->color_.height_ || mask.bytes_per_channel_ != 1) {
+  mData->touchedBytes = bytes;
+  mScene->getFrameCache()->touch(mData, bytes);
+}
+
+static std::shared_ptr<const BitMask>
+readMask(const Scene &scene, const std::string &name,
+         const open3d::geometry::Image &color) {
+  open3d::geometry::Image image;
+  if (!scene.openMask(name, image)) {
+    return nullptr;
+  }
+  std::string maskFilename = scene.getMaskPath(name).string();
+  if (image.width_ != color.width_ || image.height_ != color.height_) {
     fprintf(stderr,
-            "%s was opened, but it cannot be used as a mask (wrong size or it "
-            "does not have an alpha channel).\n",
+            "%s was opened, but it cannot be used as a mask (wrong size).\n",
             maskFilename.c_str());
-    return;
-  }
-
-  if (mRGBD->depth_.bytes_per_channel_ != 4) {
-    fprintf(stderr, "The depth image %s is not a float. Giving up.\n",
-            name.c_str());
-    return;
+    return nullptr;
   }
-  // Additional sanity checks that should never happen, since they are already
-  // verified earlier, so add them as an assertion.
-  assert(mRGBD->depth_.num_of_channels_ == 1 &&
-         mRGBD->depth_.width_ == mask.width_ &&
-         mRGBD->depth_.height_ == mask.height_);
-  assert(mask.width_ > 0 && mask.height_ > 0);
-  mMaskedRgbd = std::make_shared<open3d::geometry::RGBDImage>(*mRGBD);
-  if (!mMaskedRgbd) {
-    fprintf(stderr, "%s: will not create the mask RGBD (out of memory).\n",
-            name.c_str());
-    return;
+  // We accept the RGBA masks of the old versions, and the 1-bit ones that we
+  // write now.
+  try {
+    auto mask = std::make_shared<BitMask>(BitMask::fromImage(image));
+    mask->updatePyramid();
+    return mask;
+  } catch (const std::invalid_argument &e) {
+    fprintf(stderr, "%s was opened, but it cannot be used as a mask: %s\n",
+            maskFilename.c_str(), e.what());
+    return nullptr;
   }
+}
+
+void PointCloud::FrameData::evict() {
+  std::lock_guard<std::mutex> lock(mutex);
+  color.reset();
+  depth.reset();
+  mask.reset();
+  roi.reset();
+  roiValid = false;
+  activeMask.reset();
+  cloud.reset();
+  pixels = std::vector<uint32_t>();
+  maskedIndices = std::vector<size_t>();
+  maskedCloud.reset();
+  downsampled.reset();
+}
 
-  size_t pixels = static_cast<size_t>(mask.width_ * mask.height_);
-  const uint8_t *maskPtr = mask.data_.data() + 3;
-  float *depthPtr = reinterpret_cast<float *>(mMaskedRgbd->depth_.data_.data());
-  for (size_t i = 0; i < pixels; i++, maskPtr += 4, depthPtr++) {
-    if (*maskPtr < 128) {
-      *depthPtr = 0;
+size_t PointCloud::FrameData::getBytes() const {
+  // The active mask is counted only when it is a combination of the others.
+  const bool combined = activeMask && activeMask != mask &&
+                        (!roi || activeMask.get() != &roi->mask);
+  return imageBytes(color.get()) + imageBytes(depth.get()) +
+         (mask ? mask->getBytes() : 0) + (roi ? roi->mask.getBytes() : 0) +
+         (combined ? activeMask->getBytes() : 0) + cloudBytes(cloud.get()) +
+         pixels.size() * sizeof(uint32_t) +
+         maskedIndices.size() * sizeof(size_t) + cloudBytes(maskedCloud.get()) +
+         cloudBytes(downsampled.get());
+}
+
+uint64_t PointCloud::getDataVersion() const { return mData->version; }
+
+void PointCloud::reportMemory(
+    std::vector<MemoryRegistry::Entry> &entries) const {
+  auto add = [&](const char *item, size_t bytes) {
+    if (bytes) {
+      entries.push_back({"Frames", name, item, bytes, false});
     }
+  };
+  // The GUI asks for the report every frame, so it cannot wait for a decode.
+  std::unique_lock<std::mutex> lock(mData->mutex, std::try_to_lock);
+  if (!lock) {
+    add("data (being loaded)", mData->touchedBytes);
+    return;
   }
-  mMaskedCloud = open3d::geometry::PointCloud::CreateFromRGBDImage(
-      *mMaskedRgbd, scene.getCameraIntrinsic());
+  const FrameData &d = *mData;
+  // Count the shared masks only once, like getBytes.
+  const bool combined = d.activeMask && d.activeMask != d.mask &&
+                        (!d.roi || d.activeMask.get() != &d.roi->mask);
+  add("color image", imageBytes(d.color.get()));
+  add("depth image", imageBytes(d.depth.get()));
+  add("mask", d.mask ? d.mask->getBytes() : 0);
+  add("region of interest", d.roi ? d.roi->mask.getBytes() : 0);
+  add("combined mask", combined ? d.activeMask->getBytes() : 0);
+  add("cloud", cloudBytes(d.cloud.get()));
+  add("pixel indices", d.pixels.size() * sizeof(uint32_t));
+  add("masked indices", d.maskedIndices.size() * sizeof(size_t));
+  add("masked cloud", cloudBytes(d.maskedCloud.get()));
+  add("downsampled cloud", cloudBytes(d.downsampled.get()));
 }
 
 json PointCloud::toJson() const {
@@ -170,7 +640,10 @@ json PointCloud::toJson() const {
             {"matrix", matrix},
             {"hidden", hidden},
             {"color", color},
-            {"trunc", trunc}};
+            {"trunc", trunc},
+            {"autoRoi", autoRoi},
+            {"depthFilter", depthFilter},
+            {"sortPoints", sortPoints}};
   if (!rgb.empty() && !depth.empty()) {
     j["rgb"] = rgb;
     j["depth"] = depth;
@@ -178,37 +651,199 @@ json PointCloud::toJson() const {
   return j;
 }
 
-const open3d::geometry::PointCloud &PointCloud::getPointCloud() const {
-  // This should never be nullptr, since we create it on the constructor and
-  // throw if creating it failed.
-  assert(mPointCloud);
-  return *mPointCloud;
+std::shared_ptr<const CompactCloud> PointCloud::getPointCloud() const {
+  std::shared_ptr<const CompactCloud> cloud;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    materialize(*mData);
+    // materialize always creates the point cloud together with the RGBD image.
+    assert(mData->cloud);
+    cloud = mData->cloud;
+  }
+  touch();
+  return cloud;
 }
 
 std::shared_ptr<open3d::geometry::PointCloud>
 PointCloud::getPointCloudCopy() const {
-  // Should throw std::bad_alloc in case of error.
-  auto copy = std::make_shared<open3d::geometry::PointCloud>(getPointCloud());
-  assert(copy);
-  return copy;
+  return getPointCloud()->toOpen3D();
+}
+
+std::shared_ptr<const CompactCloud>
+PointCloud::getDownsampledCloud(double voxelSize, bool masked) const {
+  std::shared_ptr<const CompactCloud> source =
+      masked ? getMaskedPointCloud() : getPointCloud();
+  std::shared_ptr<const CompactCloud> cloud;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    if (mData->downsampled && mData->voxelSize == voxelSize &&
+        mData->downsampledMasked == masked) {
+      cloud = mData->downsampled;
+    }
+  }
+  if (!cloud) {
+    cloud = std::make_shared<const CompactCloud>(
+        source->voxelDownSample(voxelSize));
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    // The source might have been evicted or changed meanwhile, in that case we
+    // return the result without keeping it.
+    if (mData->cloud == source || mData->maskedCloud == source) {
+      mData->downsampled = cloud;
+      mData->voxelSize = voxelSize;
+      mData->downsampledMasked = masked;
+    }
+  }
+  touch();
+  return cloud;
+}
+
+std::shared_ptr<const FaceRoi> PointCloud::getRoi() const {
+  std::shared_ptr<const FaceRoi> roi;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    loadImages(*mData);
+    roi = mData->roi;
+  }
+  touch();
+  return roi;
+}
+
+std::shared_ptr<const open3d::geometry::Image>
+PointCloud::getColorImage() const {
+  std::shared_ptr<const open3d::geometry::Image> color;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    loadImages(*mData);
+    color = mData->color;
+  }
+  touch();
+  return color;
+}
+
+std::shared_ptr<const open3d::geometry::Image>
+PointCloud::getDepthImage() const {
+  std::shared_ptr<const open3d::geometry::Image> depth;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    loadImages(*mData);
+    depth = mData->depth;
+  }
+  touch();
+  return depth;
+}
+
+std::shared_ptr<open3d::geometry::RGBDImage>
+PointCloud::createRgbdImage(bool useMask) const {
+  std::shared_ptr<const open3d::geometry::Image> color;
+  std::shared_ptr<const open3d::geometry::Image> depth;
+  std::shared_ptr<const BitMask> mask;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    loadImages(*mData);
+    color = mData->color;
+    depth = mData->depth;
+    if (useMask) {
+      mask = mData->activeMask;
+    }
+  }
+  touch();
+
+  auto rgbd = open3d::geometry::RGBDImage::CreateFromColorAndDepth(
+      *color, *depth, 1.0 / mScene->getDepthScale(), trunc,
+      color->num_of_channels_ < 2);
+  if (!rgbd) {
+    throw std::runtime_error("Failed to create the RGBD image");
+  }
+  if (mask) {
+    // readMask and the sidecar already checked the size.
+    assert(rgbd->depth_.bytes_per_channel_ == 4 &&
+           mask->size() == rgbd->depth_.data_.size() / sizeof(float));
+    float *depthPtr = reinterpret_cast<float *>(rgbd->depth_.data_.data());
+    const std::vector<uint64_t> &words = mask->getWords();
+    const size_t n = mask->size();
+    for (size_t w = 0; w < words.size(); w++) {
+      const size_t first = w * 64;
+      const size_t count = std::min<size_t>(64, n - first);
+      // Most words are either entirely kept or entirely removed.
+      if (words[w] == ~uint64_t(0)) {
+        continue;
+      } else if (!words[w]) {
+        std::fill_n(depthPtr + first, count, 0.0f);
+        continue;
+      }
+      for (size_t b = 0; b < count; b++) {
+        if (!((words[w] >> b) & 1)) {
+          depthPtr[first + b] = 0;
+        }
+      }
+    }
+  }
+  return rgbd;
+}
+
+/**
+ * Move the buffer of an image, which Open3D would copy, since Image does not
+ * have a move constructor.
+ */
+static void moveImage(open3d::geometry::Image &dst,
+                      open3d::geometry::Image &src) {
+  dst.width_ = src.width_;
+  dst.height_ = src.height_;
+  dst.num_of_channels_ = src.num_of_channels_;
+  dst.bytes_per_channel_ = src.bytes_per_channel_;
+  dst.data_.swap(src.data_);
+  src.Clear();
 }
 
-const open3d::geometry::RGBDImage &PointCloud::getRgbdImage() const {
-  // See getPointCloud.
-  assert(mRGBD);
-  return *mRGBD;
+void PointCloud::createRgbdImage(open3d::geometry::RGBDImage &rgbd,
+                                 bool useMask) const {
+  std::shared_ptr<open3d::geometry::RGBDImage> created =
+      createRgbdImage(useMask);
+  moveImage(rgbd.color_, created->color_);
+  moveImage(rgbd.depth_, created->depth_);
 }
 
-std::shared_ptr<const open3d::geometry::RGBDImage>
-PointCloud::getMaskedRgbd() const {
-  return std::const_pointer_cast<const open3d::geometry::RGBDImage>(
-      mMaskedRgbd);
+bool PointCloud::hasMask() const {
+  bool hasMask;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    loadImages(*mData);
+    hasMask = static_cast<bool>(mData->activeMask);
+  }
+  touch();
+  return hasMask;
 }
 
-const open3d::geometry::PointCloud &
+std::shared_ptr<const BitMask> PointCloud::getMask() const {
+  std::shared_ptr<const BitMask> mask;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    loadImages(*mData);
+    mask = mData->activeMask;
+  }
+  touch();
+  return mask;
+}
+
+std::shared_ptr<const CompactCloud>
 PointCloud::getMaskedPointCloud(bool allowFallback) const {
-  if (!mMaskedCloud && !allowFallback) {
-    throw std::runtime_error("We don't have a masked cloud.");
+  std::shared_ptr<const CompactCloud> cloud;
+  {
+    std::lock_guard<std::mutex> lock(mData->mutex);
+    materialize(*mData);
+    if (mData->activeMask && !mData->maskedCloud) {
+      // Gather the points we already have, rather than unprojecting again.
+      mData->maskedCloud = std::make_shared<const CompactCloud>(
+          mData->cloud->select(mData->maskedIndices));
+    }
+    cloud = mData->maskedCloud;
+  }
+  if (!cloud) {
+    if (!allowFallback) {
+      throw std::runtime_error("We don't have a masked cloud.");
+    }
+    return getPointCloud();
   }
-  return mMaskedCloud ? *mMaskedCloud : *mPointCloud;
+  touch();
+  return cloud;
 }
@@ -24,76 +24,107 @@ static const Eigen::Matrix<float, 6, 8, Eigen::RowMajor> axes {
 };
 // clang-format on
 
-Renderer::Renderer() : mShader(createShader()) {
+Renderer::Renderer()
+    : mShader(createShader()),
+      mVertexHeap(mHeapObjects.vbo, VA_MAX * sizeof(float)),
+      mIndexHeap(mHeapObjects.ebo, sizeof(uint32_t)) {
   static const char *uniformNames[U_Max] = {
       "pv",           "model",        "mirror",     "mirrorDraw",
       "paintUniform", "uniformColor", "useTexture", "theTexture"};
   mShader.getUniformLocations(uniformNames, mUniforms, U_Max);
+  setupVertexArray(mGlObjects);
+  setupVertexArray(mHeapObjects);
+  clearBuffer();
+  uploadBuffer();
+  mMemory = MemoryRegistry::get().add(
+      [this](std::vector<MemoryRegistry::Entry> &entries) {
+        const size_t indexBytes = mIndices.capacity() * sizeof(uint32_t);
+        entries.push_back({"Renderer", "", "vertices",
+                           mVertices.capacity() * sizeof(float)});
+        entries.push_back({"Renderer", "", "indices", indexBytes});
+        entries.push_back(
+            {"Renderer", "", "vertex buffer", mUploadedVertexBytes, true});
+        entries.push_back(
+            {"Renderer", "", "index buffer", mUploadedIndexBytes, true});
+        entries.push_back({"Renderer", "", "geometry vertex heap",
+                           mVertexHeap.getCapacityBytes(), true});
+        entries.push_back({"Renderer", "", "geometry index heap",
+                           mIndexHeap.getCapacityBytes(), true});
+      });
+}
 
-  glBindVertexArray(mGlObjects.vao);
-  glBindBuffer(GL_ARRAY_BUFFER, mGlObjects.vbo);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-                        mBuffer.cols() * sizeof(float), nullptr);
+Renderer::~Renderer() {}
+
+void Renderer::setupVertexArray(const GLObjects &objects) {
+  const GLsizei stride = VA_MAX * sizeof(float);
+  glBindVertexArray(objects.vao);
+  glBindBuffer(GL_ARRAY_BUFFER, objects.vbo);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, nullptr);
   glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-                        mBuffer.cols() * sizeof(float),
+  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride,
                         (void *)(3 * sizeof(float)));
   glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-                        mBuffer.cols() * sizeof(float),
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
                         (void *)(6 * sizeof(float)));
   glEnableVertexAttribArray(2);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mGlObjects.ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, objects.ebo);
   glBindVertexArray(0);
-
-  clearBuffer();
-  uploadBuffer();
 }
 
-Renderer::~Renderer() {}
-
-size_t Renderer::addPointCloud(const PointCloud &pcd,
-                               std::optional<double> voxelSize) {
-  if (voxelSize) {
-    auto downSampled = pcd.getPointCloud().VoxelDownSample(*voxelSize);
-    if (!downSampled) {
-      throw std::runtime_error("Failed to sample the point cloud down");
-    }
-    addPointCloud(*downSampled);
-  } else {
-    addPointCloud(pcd.getPointCloud());
-  }
-  return mOffsets.size() - 2;
+GLsizei Renderer::getNumVertices() const {
+  return static_cast<GLsizei>(mVertices.size() / VA_MAX);
 }
 
-void Renderer::addVertices(const VertexMatrix &vertices) {
-  Eigen::Index n = vertices.rows();
-  mBuffer.conservativeResize(mBuffer.rows() + n, Eigen::NoChange);
-  mBuffer.block(mBuffer.rows() - n, 0, n, mBuffer.cols()) = vertices;
-  mOffsets.push_back(static_cast<GLsizei>(mBuffer.rows()));
+float *Renderer::appendVertices(size_t n) {
+  // std::vector grows geometrically, so adding many clouds one by one takes
+  // linear time, too.
+  const size_t size = mVertices.size();
+  mVertices.resize(size + n * VA_MAX);
+  return mVertices.data() + size;
 }
 
 void Renderer::addPoints(const std::vector<Eigen::Vector3d> &points,
                          const std::vector<Eigen::Vector3d> &colors) {
-  using namespace Eigen;
+  writeVertices(points, colors, appendVertices(points.size()));
+  mOffsets.push_back(getNumVertices());
+}
+
+void Renderer::writeVertices(const std::vector<Eigen::Vector3d> &points,
+                             const std::vector<Eigen::Vector3d> &colors,
+                             float *dst) {
   const size_t n = points.size();
-  // The caller should have already checked this.
-  assert(colors.size() == n);
-  // We access the first element.
-  if (!n) {
-    // Be coherent, and add the offset anyway.
-    mOffsets.push_back(static_cast<GLsizei>(mBuffer.rows()));
-    return;
+  const bool hasColors = colors.size() == n;
+  for (size_t i = 0; i < n; i++, dst += VA_MAX) {
+    for (int c = 0; c < 3; c++) {
+      dst[VA_X + c] = static_cast<float>(points[i][c]);
+      dst[VA_R + c] = hasColors ? static_cast<float>(colors[i][c]) : 0.0f;
+    }
+    dst[VA_U] = 0.0f;
+    dst[VA_V] = 0.0f;
   }
+}
 
-  static_assert(sizeof(Vector3d) == 3 * sizeof(double),
-                "Cannot map Vector3d to 3 double");
-  Map<const Matrix<double, Dynamic, 3, RowMajor>> pos(points[0].data(), n, 3);
-  Map<const Matrix<double, Dynamic, 3, RowMajor>> col(colors[0].data(), n, 3);
-  Matrix<double, Dynamic, VertexMatrix::ColsAtCompileTime, RowMajor> vertices(
-      n, mBuffer.cols());
-  vertices << pos, col, MatrixXd::Zero(n, mBuffer.cols() - 6);
-  addVertices(vertices.cast<float>());
+void Renderer::writeVertices(const CompactCloud &pcd, float *dst) {
+  const size_t n = pcd.size();
+  const bool hasColors = pcd.hasColors();
+  constexpr float toFloat = 1.0f / 255.0f;
+  for (size_t i = 0; i < n; i++, dst += VA_MAX) {
+    dst[VA_X] = pcd.x[i];
+    dst[VA_Y] = pcd.y[i];
+    dst[VA_Z] = pcd.z[i];
+    for (int c = 0; c < 3; c++) {
+      dst[VA_R + c] = hasColors ? pcd.colors[3 * i + c] * toFloat : 0.0f;
+    }
+    dst[VA_U] = 0.0f;
+    dst[VA_V] = 0.0f;
+  }
+}
+
+size_t Renderer::addPointCloud(const CompactCloud &pcd) {
+  writeVertices(pcd, appendVertices(pcd.size()));
+  mOffsets.push_back(getNumVertices());
+  mIndexOffsets.push_back(static_cast<GLsizei>(mIndices.size()));
+  return mOffsets.size() - 2;
 }
 
 size_t Renderer::addPointCloud(const open3d::geometry::PointCloud &pcd) {
@@ -105,7 +136,7 @@ size_t Renderer::addPointCloud(const open3d::geometry::PointCloud &pcd) {
 size_t Renderer::addTriangleMesh(const open3d::geometry::TriangleMesh &mesh) {
   if (mesh.triangles_.empty()) {
     // We always add a new entry in the offsets.
-    mOffsets.push_back(static_cast<GLsizei>(mBuffer.rows()));
+    mOffsets.push_back(getNumVertices());
     mIndexOffsets.push_back(static_cast<GLsizei>(mIndices.size()));
     return mOffsets.size() - 2;
   }
@@ -128,7 +159,10 @@ size_t Renderer::addTriangleMesh(const open3d::geometry::TriangleMesh &mesh) {
 
 size_t Renderer::addTriangleMesh(const VertexMatrix &vertices,
                                  const std::vector<uint32_t> &indices) {
-  addVertices(vertices);
+  // Row-major, so we can copy the rows as they are.
+  std::copy_n(vertices.data(), vertices.size(),
+              appendVertices(static_cast<size_t>(vertices.rows())));
+  mOffsets.push_back(getNumVertices());
   // Should we use C++20's ranges instead?
   mIndices.insert(mIndices.end(), indices.begin(), indices.end());
   mIndexOffsets.push_back(static_cast<GLsizei>(mIndices.size()));
@@ -138,23 +172,100 @@ size_t Renderer::addTriangleMesh(const VertexMatrix &vertices,
 void Renderer::uploadBuffer() const {
   assert(mOffsets.size() == mIndexOffsets.size());
   glBindVertexArray(mGlObjects.vao);
-  glBufferData(GL_ARRAY_BUFFER, mBuffer.size() * sizeof(float), mBuffer.data(),
+  glBindBuffer(GL_ARRAY_BUFFER, mGlObjects.vbo);
+  mUploadedVertexBytes = mVertices.size() * sizeof(float);
+  glBufferData(GL_ARRAY_BUFFER, mUploadedVertexBytes, mVertices.data(),
                GL_STATIC_DRAW);
   if (!mIndices.empty()) {
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, mIndices.size() * sizeof(int),
                  mIndices.data(), GL_STATIC_DRAW);
+    mUploadedIndexBytes = mIndices.size() * sizeof(int);
   }
   glBindVertexArray(0);
 }
 
 void Renderer::clearBuffer() {
-  mBuffer = axes;
+  // assign keeps the capacity, so refreshing the buffer does not allocate it
+  // again.
+  mVertices.assign(axes.data(), axes.data() + axes.size());
   mOffsets.assign({static_cast<GLsizei>(axes.rows())});
   mIndices.clear();
   // No indices used by the axes
   mIndexOffsets.assign({0});
 }
 
+std::unique_ptr<Renderer::PointChunk>
+Renderer::createChunk(const CompactCloud &pcd) const {
+  // no make_unique, as the constructor is private.
+  std::unique_ptr<PointChunk> chunk(new PointChunk);
+  setupVertexArray(chunk->mGlObjects);
+  std::vector<float> vertices(pcd.size() * VA_MAX);
+  writeVertices(pcd, vertices.data());
+  chunk->mCount = static_cast<GLsizei>(pcd.size());
+  glBindBuffer(GL_ARRAY_BUFFER, chunk->mGlObjects.vbo);
+  glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float),
+               vertices.data(), GL_STATIC_DRAW);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+  return chunk;
+}
+
+Renderer::Geometry::~Geometry() { mRenderer.releaseGeometry(*this); }
+
+std::unique_ptr<Renderer::Geometry> Renderer::createGeometry() {
+  // no make_unique, as the constructor is private.
+  return std::unique_ptr<Geometry>(new Geometry(*this));
+}
+
+void Renderer::setGeometry(Geometry &geometry, const CompactCloud &pcd) {
+  std::vector<float> vertices(pcd.size() * VA_MAX);
+  writeVertices(pcd, vertices.data());
+  setGeometry(geometry, vertices, nullptr, 0);
+}
+
+void Renderer::setGeometry(Geometry &geometry,
+                           const open3d::geometry::PointCloud &pcd) {
+  std::vector<float> vertices(pcd.points_.size() * VA_MAX);
+  writeVertices(pcd.points_, pcd.colors_, vertices.data());
+  setGeometry(geometry, vertices, nullptr, 0);
+}
+
+void Renderer::setGeometry(Geometry &geometry,
+                           const open3d::geometry::TriangleMesh &mesh) {
+  std::vector<float> vertices(mesh.vertices_.size() * VA_MAX);
+  writeVertices(mesh.vertices_, mesh.vertex_colors_, vertices.data());
+  static_assert(sizeof(Eigen::Vector3i) == 3 * sizeof(uint32_t),
+                "Cannot copy indices as they were raw data.");
+  // The indices are never negative, so we can read them as unsigned.
+  const uint32_t *indices =
+      mesh.triangles_.empty()
+          ? nullptr
+          : reinterpret_cast<const uint32_t *>(mesh.triangles_[0].data());
+  setGeometry(geometry, vertices, indices, mesh.triangles_.size() * 3);
+}
+
+void Renderer::setGeometry(Geometry &geometry,
+                           const std::vector<float> &vertices,
+                           const uint32_t *indices, size_t numIndices) {
+  assert(&geometry.mRenderer == this);
+  mVertexHeap.resize(geometry.mFirstVertex, geometry.mNumVertices,
+                     vertices.size() / VA_MAX);
+  mVertexHeap.upload(geometry.mFirstVertex, geometry.mNumVertices,
+                     vertices.data());
+  mIndexHeap.resize(geometry.mFirstIndex, geometry.mNumIndices, numIndices);
+  mIndexHeap.upload(geometry.mFirstIndex, geometry.mNumIndices, indices);
+}
+
+void Renderer::reserveVertices(size_t numVertices) {
+  mVertexHeap.reserve(numVertices);
+}
+
+void Renderer::releaseGeometry(Geometry &geometry) {
+  mVertexHeap.release(geometry.mFirstVertex, geometry.mNumVertices);
+  mIndexHeap.release(geometry.mFirstIndex, geometry.mNumIndices);
+  geometry.mNumVertices = 0;
+  geometry.mNumIndices = 0;
+}
+
 void Renderer::beginRendering(const glm::mat4 &pv) const {
   mShader.use();
   glUniformMatrix4fv(mUniforms[U_PV], 1, GL_FALSE, glm::value_ptr(pv));
@@ -189,6 +300,61 @@ void Renderer::renderPointCloud(size_t idx, const glm::mat4 &model,
   }
 }
 
+void Renderer::renderChunk(const PointChunk &chunk,
+                           const glm::mat4 &model) const {
+  if (!chunk.mCount) {
+    return;
+  }
+  glUniformMatrix4fv(mUniforms[U_Model], 1, GL_FALSE, glm::value_ptr(model));
+  glUniform1i(mUniforms[U_PaintUniform], 0);
+  glUniform1i(mUniforms[U_UseTexture], 0);
+  glUniform1i(mUniforms[U_Mirror], static_cast<int>(mirror));
+  glBindVertexArray(chunk.mGlObjects.vao);
+  glDrawArrays(GL_POINTS, 0, chunk.mCount);
+  if (mirror != MirrorNone) {
+    glUniform1i(mUniforms[U_MirrorDraw], 1);
+    glDrawArrays(GL_POINTS, 0, chunk.mCount);
+    glUniform1i(mUniforms[U_MirrorDraw], 0);
+  }
+  // Other draws expect the main buffer.
+  glBindVertexArray(mGlObjects.vao);
+}
+
+void Renderer::renderGeometry(const Geometry &geometry, const glm::mat4 &model,
+                              std::optional<glm::vec3> uniformColor) const {
+  if (!geometry.mNumVertices) {
+    return;
+  }
+  glUniformMatrix4fv(mUniforms[U_Model], 1, GL_FALSE, glm::value_ptr(model));
+  glUniform1i(mUniforms[U_PaintUniform], uniformColor ? 1 : 0);
+  if (uniformColor) {
+    glUniform3fv(mUniforms[U_UniformColor], 1, glm::value_ptr(*uniformColor));
+  }
+  glUniform1i(mUniforms[U_UseTexture], 0);
+  glBindVertexArray(mHeapObjects.vao);
+  const GLint first = static_cast<GLint>(geometry.mFirstVertex);
+  if (geometry.mNumIndices) {
+    // Like renderIndexedMesh, meshes are never mirrored.
+    glUniform1i(mUniforms[U_Mirror], 0);
+    glUniform1i(mUniforms[U_MirrorDraw], 0);
+    glDrawElementsBaseVertex(
+        GL_TRIANGLES, static_cast<GLsizei>(geometry.mNumIndices),
+        GL_UNSIGNED_INT,
+        (void *)(uintptr_t)(geometry.mFirstIndex * sizeof(uint32_t)), first);
+  } else {
+    const GLsizei count = static_cast<GLsizei>(geometry.mNumVertices);
+    glUniform1i(mUniforms[U_Mirror], static_cast<int>(mirror));
+    glDrawArrays(GL_POINTS, first, count);
+    if (mirror != MirrorNone) {
+      glUniform1i(mUniforms[U_MirrorDraw], 1);
+      glDrawArrays(GL_POINTS, first, count);
+      glUniform1i(mUniforms[U_MirrorDraw], 0);
+    }
+  }
+  // Other draws expect the main buffer.
+  glBindVertexArray(mGlObjects.vao);
+}
+
 void Renderer::renderIndexedMesh(size_t idx, const glm::mat4 &model,
                                  bool textured, GLsizei offset,
                                  GLsizei count) const {
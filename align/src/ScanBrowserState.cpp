@@ -0,0 +1,297 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "ScanBrowserState.h"
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include <cassert>
+#include <cstdio>
+
+#include "imgui.h"
+#include "imgui_stdlib.h"
+
+#include "open3d/io/PointCloudIO.h"
+
+#include "EditorState.h"
+#include "FrameCatalog.h"
+
+// Creating the GPU buffers takes some time, so we spread them over several
+// frames.
+static constexpr int maxUploadsPerFrame = 16;
+
+ScanBrowserState::ScanBrowserState(Application &app)
+    : mApp(app), mScene(app.getScene()) {
+  double trunc = 0.0;
+  for (const PointCloud &pcd : mScene.clouds) {
+    trunc = std::max(trunc, pcd.trunc);
+  }
+  if (trunc > 0.0) {
+    mTrunc = static_cast<float>(trunc);
+  }
+  mMemory = MemoryRegistry::get().add(
+      [this](std::vector<MemoryRegistry::Entry> &entries) {
+        if (mOctree) {
+          entries.push_back({"Scan browser", "", "octree chunks",
+                             mOctree->getCache().getUsage()});
+        }
+        size_t gpuBytes = 0;
+        for (const auto &[node, chunk] : mGpuChunks) {
+          gpuBytes += chunk.chunk->getBytes();
+        }
+        entries.push_back({"Scan browser", "", "GPU chunks", gpuBytes, true});
+      });
+}
+
+ScanBrowserState::~ScanBrowserState() {
+  // The future waits for the build anyway, but we can make it faster.
+  mStop = true;
+}
+
+void ScanBrowserState::start() {
+  // We do not need the clouds of the scene in this state.
+  Renderer &r = mApp.getRenderer();
+  r.clearBuffer();
+  r.uploadBuffer();
+  build();
+}
+
+void ScanBrowserState::build() {
+  if (mBuilding.valid()) {
+    return;
+  }
+  mGpuChunks.clear();
+  mGpuLru.clear();
+  mGpuPoints = 0;
+  mOctree.reset();
+  mError.clear();
+  mPhase = nullptr;
+  mDone = 0;
+  mTotal = 0;
+  mStop = false;
+
+  // Use the poses of the frames that are already in the scene.
+  std::unordered_map<std::string, Eigen::Matrix4d> poses;
+  for (const PointCloud &pcd : mScene.clouds) {
+    poses[pcd.depth.empty() ? pcd.name : pcd.depth] = pcd.getMatrixEigen();
+  }
+  mBuilding = std::async(
+      std::launch::async,
+      [this, poses = std::move(poses), trunc = mTrunc, spacing = mSpacing]() {
+        FrameCatalog catalog(mScene);
+        // We are already in a worker, and we need to know which frames we
+        // can read.
+        catalog.wait();
+        std::vector<ScanOctree::Frame> frames;
+        for (const FrameCatalog::Entry &e : catalog.getEntries()) {
+          if (!e.width) {
+            continue;
+          }
+          ScanOctree::Frame frame{e.stem, e.rgb, e.depth};
+          auto it = poses.find(e.depth);
+          if (it == poses.end()) {
+            it = poses.find(e.stem);
+          }
+          if (it != poses.end()) {
+            frame.pose = it->second;
+          }
+          frames.push_back(std::move(frame));
+        }
+        return std::make_unique<ScanOctree>(
+            mScene, std::move(frames), trunc, spacing,
+            [this](const char *phase, size_t done, size_t total) {
+              mPhase = phase;
+              mTotal = total;
+              mDone = done;
+            },
+            &mStop);
+      });
+}
+
+void ScanBrowserState::finishBuilding() {
+  assert(mBuilding.valid());
+  if (mBuilding.wait_for(std::chrono::seconds(0)) !=
+      std::future_status::ready) {
+    return;
+  }
+  try {
+    mOctree = mBuilding.get();
+    mCacheBudgetMiB = static_cast<int>(mOctree->getCache().getBudget() >> 20);
+  } catch (std::exception &e) {
+    mError = e.what();
+  }
+}
+
+void ScanBrowserState::createGui() {
+  if (mBuilding.valid()) {
+    finishBuilding();
+  }
+  if (mBuilding.valid()) {
+    createProgressGui();
+    return;
+  }
+
+  ImGui::Begin("Scan browser");
+  if (!mError.empty()) {
+    ImGui::TextWrapped("Failed to create the octree: %s", mError.c_str());
+  }
+  if (mOctree) {
+    const FrameCache &cache = mOctree->getCache();
+    ImGui::Text("%zu frames, %zu nodes, %llu points", mOctree->getNumFrames(),
+                mOctree->getNodes().size(),
+                static_cast<unsigned long long>(mOctree->getNumPoints()));
+    ImGui::Text("Memory: %zu chunks, %.1f/%.1f MiB", cache.getNumResident(),
+                static_cast<double>(cache.getUsage()) / (1 << 20),
+                static_cast<double>(cache.getBudget()) / (1 << 20));
+    ImGui::Text("GPU: %zu chunks, %zu points, %zu rendered",
+                mGpuChunks.size(), mGpuPoints, mRenderedPoints);
+    ImGui::InputInt("Point budget", &mPointBudget, 100'000, 1'000'000);
+    mPointBudget = std::max(mPointBudget, 100'000);
+    if (ImGui::InputInt("Memory budget (MiB)", &mCacheBudgetMiB, 64, 512)) {
+      mCacheBudgetMiB = std::max(mCacheBudgetMiB, 64);
+      mOctree->getCache().setBudget(static_cast<size_t>(mCacheBudgetMiB)
+                                    << 20);
+    }
+  }
+
+  ImGui::Separator();
+  ImGui::InputFloat("Truncation (m)", &mTrunc, 0.1f, 0.5f);
+  ImGui::InputFloat("Spacing (m)", &mSpacing, 0.0005f, 0.001f, "%.4f");
+  mTrunc = std::max(mTrunc, 0.1f);
+  mSpacing = std::max(mSpacing, 0.0005f);
+  if (ImGui::Button("Rebuild")) {
+    build();
+  }
+
+  if (mOctree) {
+    createExportGui();
+  }
+
+  ImGui::Separator();
+  if (ImGui::Button("Close")) {
+    mApp.setState(std::make_unique<EditorState>(mApp));
+  }
+  ImGui::End();
+}
+
+void ScanBrowserState::createProgressGui() {
+  const char *phase = mPhase;
+  size_t total = mTotal;
+  size_t done = mDone;
+  ImGui::Begin("Scan browser");
+  if (phase && total) {
+    ImGui::Text("%s...", phase);
+    char overlay[50];
+    snprintf(overlay, sizeof(overlay), "%zu/%zu", done, total);
+    ImGui::ProgressBar(static_cast<float>(done) / total, ImVec2(-1.0f, 0.0f),
+                       overlay);
+  } else {
+    ImGui::TextUnformatted("Opening the octree...");
+  }
+  if (ImGui::Button("Cancel")) {
+    mStop = true;
+  }
+  ImGui::End();
+}
+
+void ScanBrowserState::createExportGui() {
+  ImGui::Separator();
+  ImGui::TextUnformatted("Export region");
+  ImGui::InputFloat3("Min", mExportMin);
+  ImGui::InputFloat3("Max", mExportMax);
+  ImGui::InputFloat("Export spacing (m)", &mExportSpacing, 0.0005f, 0.001f,
+                    "%.4f");
+  mExportSpacing = std::max(mExportSpacing, 0.0f);
+  if (ImGui::Button("Export pointcloud...")) {
+    ImGui::OpenPopup("Export region");
+  }
+  if (ImGui::BeginPopupModal("Export region", nullptr,
+                             ImGuiWindowFlags_AlwaysAutoResize)) {
+    ImGui::InputText("Filename", &mExportFilename);
+    ImGui::BeginDisabled(mExportFilename.empty());
+    if (ImGui::Button("Export")) {
+      assert(mOctree);
+      Eigen::Vector3f min(mExportMin[0], mExportMin[1], mExportMin[2]);
+      Eigen::Vector3f max(mExportMax[0], mExportMax[1], mExportMax[2]);
+      Eigen::AlignedBox3f box(min, max);
+      try {
+        CompactCloud points = mOctree->collect(box, mExportSpacing);
+        if (!open3d::io::WritePointCloud(mExportFilename,
+                                         *points.toOpen3D())) {
+          mError = "Cannot write " + mExportFilename + ".";
+        }
+      } catch (std::exception &e) {
+        mError = e.what();
+      }
+      ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndDisabled();
+    ImGui::SameLine();
+    if (ImGui::Button("Cancel")) {
+      ImGui::CloseCurrentPopup();
+    }
+    ImGui::EndPopup();
+  }
+}
+
+void ScanBrowserState::render(const glm::mat4 &pv) {
+  if (!mOctree) {
+    return;
+  }
+  Renderer &r = mApp.getRenderer();
+  std::vector<uint32_t> nodes =
+      mOctree->selectNodes(pv, static_cast<size_t>(mPointBudget));
+
+  // Upload first, as creating a chunk changes the bound vertex array.
+  std::vector<uint32_t> missing;
+  int uploads = 0;
+  for (uint32_t node : nodes) {
+    auto it = mGpuChunks.find(node);
+    if (it != mGpuChunks.end()) {
+      mGpuLru.splice(mGpuLru.end(), mGpuLru, it->second.lru);
+      continue;
+    }
+    std::shared_ptr<const CompactCloud> points = mOctree->findChunk(node);
+    if (!points) {
+      missing.push_back(node);
+    } else if (uploads < maxUploadsPerFrame) {
+      uploads++;
+      mGpuLru.push_back(node);
+      GpuChunk &chunk = mGpuChunks[node];
+      chunk.chunk = r.createChunk(*points);
+      chunk.lru = std::prev(mGpuLru.end());
+      mGpuPoints += chunk.chunk->size();
+    }
+  }
+  mOctree->request(missing);
+
+  mRenderedPoints = 0;
+  r.beginRendering(pv);
+  for (uint32_t node : nodes) {
+    auto it = mGpuChunks.find(node);
+    if (it != mGpuChunks.end()) {
+      r.renderChunk(*it->second.chunk);
+      mRenderedPoints += it->second.chunk->size();
+    }
+  }
+  r.endRendering();
+
+  // Keep some more chunks than the ones we render, to move the camera back
+  // and forth without uploading them again.
+  releaseGpuChunks(2 * static_cast<size_t>(mPointBudget));
+}
+
+void ScanBrowserState::releaseGpuChunks(size_t budget) {
+  while (mGpuPoints > budget && !mGpuLru.empty()) {
+    auto it = mGpuChunks.find(mGpuLru.front());
+    assert(it != mGpuChunks.end());
+    mGpuPoints -= it->second.chunk->size();
+    mGpuChunks.erase(it);
+    mGpuLru.pop_front();
+  }
+}
@@ -0,0 +1,821 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "ScanOctree.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <queue>
+#include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+
+#include <cassert>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Scene.h"
+#include "morton.h"
+#include "parallel.h"
+#include "unproject.h"
+
+namespace fs = std::filesystem;
+
+static const char octreeMagic[8] = {'F', 'P', 'O', 'C', 'T', 'R', 'E', 0};
+static constexpr uint32_t octreeVersion = 1;
+// Leaves are at most this deep, so their codes fit in 30 bits.
+static constexpr uint32_t maxDepth = 10;
+// While reading the frames, we bin this many points in memory, at most, then
+// we move them to the spill file.
+static constexpr size_t spillThreshold = 1 << 22;
+// x, y and z as float32, and RGB8.
+static constexpr size_t pointBytes = 3 * sizeof(float) + 3;
+
+struct ScanOctree::Header {
+  char magic[8];
+  uint32_t version;
+  uint32_t reserved;
+  uint64_t key;
+  uint64_t numNodes;
+  uint64_t nodesOffset;
+  uint64_t numPoints;
+};
+static_assert(std::is_trivially_copyable_v<ScanOctree::Node>,
+              "The nodes must be trivially copyable.");
+
+struct ScanOctree::Chunk : public FrameCache::Evictable {
+  Chunk(std::shared_ptr<FrameCache> cache) : cache(std::move(cache)) {}
+  ~Chunk() override { cache->remove(this); }
+  void evict() override {
+    std::lock_guard<std::mutex> lock(mutex);
+    points.reset();
+  }
+
+  std::shared_ptr<FrameCache> cache;
+  std::mutex mutex;
+  std::shared_ptr<const CompactCloud> points;
+};
+
+namespace {
+// FNV-1a, we only need to detect changes.
+class Hasher {
+public:
+  void add(const void *data, size_t length) {
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < length; i++) {
+      mHash = (mHash ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+  template <typename T> void add(const T &v) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    add(&v, sizeof(v));
+  }
+  void add(const std::string &s) {
+    add(s.size());
+    add(s.data(), s.size());
+  }
+  uint64_t get() const { return mHash; }
+
+private:
+  uint64_t mHash = 14695981039346656037ull;
+};
+} // namespace
+
+static void readAt(int fd, void *data, size_t length, uint64_t offset) {
+  uint8_t *dst = static_cast<uint8_t *>(data);
+  while (length) {
+    ssize_t n = pread(fd, dst, length, static_cast<off_t>(offset));
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      throw std::runtime_error("The octree is truncated.");
+    }
+    dst += n;
+    offset += static_cast<uint64_t>(n);
+    length -= static_cast<size_t>(n);
+  }
+}
+
+static void appendPoint(CompactCloud &dst, const CompactCloud &src,
+                        size_t i) {
+  dst.x.push_back(src.x[i]);
+  dst.y.push_back(src.y[i]);
+  dst.z.push_back(src.z[i]);
+  dst.colors.insert(dst.colors.end(), &src.colors[3 * i],
+                    &src.colors[3 * i + 3]);
+}
+
+/**
+ * Builds the octree file, in two passes.
+ *
+ * First, we read the frames and we put their points in bins, one for each
+ * leaf. The bins are moved to a spill file when they become too large, so we
+ * need only a bounded amount of memory.
+ * Then, we visit the tree in post-order: every node chooses its points among
+ * the ones its children pass it, and we write the remaining ones of each child
+ * to the octree file.
+ */
+class ScanOctree::Builder {
+public:
+  Builder(ScanOctree &octree, uint64_t key, const ProgressCallback &progress,
+          const std::atomic<bool> *stop);
+  Builder(const Builder &other) = delete;
+  Builder(Builder &&other) = delete;
+  Builder &operator=(const Builder &other) = delete;
+  Builder &operator=(Builder &&other) = delete;
+  ~Builder();
+
+  void build();
+
+private:
+  struct Segment {
+    uint64_t offset;
+    uint32_t count;
+  };
+
+  void computeBounds();
+  void readFrames();
+  CompactCloud readFrame(const Frame &frame) const;
+  uint64_t getLeafCode(float x, float y, float z) const;
+  void spill();
+  uint32_t buildNode(uint32_t level, uint64_t code, const Eigen::Vector3f &min,
+                     size_t begin, size_t end, CompactCloud &candidates);
+  CompactCloud readLeaf(uint64_t code);
+  void writeChunk(uint32_t node, const CompactCloud &points);
+  void report(const char *phase, size_t done, size_t total) const;
+  void checkStop() const;
+
+  ScanOctree &mOctree;
+  const uint64_t mKey;
+  const ProgressCallback &mProgress;
+  const std::atomic<bool> *mStop;
+
+  Eigen::Vector3f mMin;
+  float mSize = 0.0f;
+  uint32_t mDepth = 0;
+
+  std::unordered_map<uint64_t, CompactCloud> mBins;
+  size_t mNumBinned = 0;
+  fs::path mSpillPath;
+  std::fstream mSpill;
+  uint64_t mSpillSize = 0;
+  std::unordered_map<uint64_t, std::vector<Segment>> mSegments;
+  std::vector<uint64_t> mLeaves;
+  size_t mNumLeavesDone = 0;
+
+  fs::path mTmpPath;
+  std::ofstream mOut;
+  uint64_t mOutSize = 0;
+  std::vector<Node> mNodes;
+  uint64_t mNumPoints = 0;
+  bool mDone = false;
+};
+
+ScanOctree::Builder::Builder(ScanOctree &octree, uint64_t key,
+                             const ProgressCallback &progress,
+                             const std::atomic<bool> *stop)
+    : mOctree(octree), mKey(key), mProgress(progress), mStop(stop) {
+  mSpillPath = mOctree.mPath;
+  mSpillPath += ".spill";
+  mTmpPath = mOctree.mPath;
+  mTmpPath += ".tmp";
+}
+
+ScanOctree::Builder::~Builder() {
+  std::error_code ec;
+  if (mSpill.is_open()) {
+    mSpill.close();
+  }
+  fs::remove(mSpillPath, ec);
+  if (!mDone) {
+    if (mOut.is_open()) {
+      mOut.close();
+    }
+    fs::remove(mTmpPath, ec);
+  }
+}
+
+void ScanOctree::Builder::build() {
+  fs::create_directories(mOctree.mPath.parent_path());
+  computeBounds();
+  mSpill.open(mSpillPath, std::ios::binary | std::ios::in | std::ios::out |
+                              std::ios::trunc);
+  if (!mSpill) {
+    throw std::runtime_error("Cannot create " + mSpillPath.string() + ".");
+  }
+  readFrames();
+  if (mLeaves.empty()) {
+    throw std::runtime_error("The frames do not have any valid points.");
+  }
+
+  mOut.open(mTmpPath, std::ios::binary | std::ios::trunc);
+  Header h;
+  memset(&h, 0, sizeof(h));
+  mOut.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  mOutSize = sizeof(h);
+  CompactCloud rootPoints;
+  uint32_t root = buildNode(0, 0, mMin, 0, mLeaves.size(), rootPoints);
+  assert(root == 0);
+  writeChunk(root, rootPoints);
+
+  memcpy(h.magic, octreeMagic, sizeof(octreeMagic));
+  h.version = octreeVersion;
+  h.key = mKey;
+  h.numNodes = mNodes.size();
+  h.nodesOffset = mOutSize;
+  h.numPoints = mNumPoints;
+  mOut.write(reinterpret_cast<const char *>(mNodes.data()),
+             static_cast<std::streamsize>(mNodes.size() * sizeof(Node)));
+  mOut.seekp(0);
+  mOut.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  mOut.close();
+  if (!mOut) {
+    throw std::runtime_error("Failed to write " + mTmpPath.string() + ".");
+  }
+  fs::rename(mTmpPath, mOctree.mPath);
+  mDone = true;
+}
+
+void ScanOctree::Builder::computeBounds() {
+  // Points are in the frustum of the cameras, until trunc, so we can compute
+  // the bounds without reading the frames.
+  const open3d::camera::PinholeCameraIntrinsic &intr =
+      mOctree.mScene.getCameraIntrinsic();
+  auto [fx, fy] = intr.GetFocalLength();
+  auto [cx, cy] = intr.GetPrincipalPoint();
+  const double trunc = mOctree.mTrunc;
+  const double xs[] = {-cx / fx, (intr.width_ - cx) / fx};
+  const double ys[] = {-cy / fy, (intr.height_ - cy) / fy};
+  Eigen::AlignedBox3d box;
+  for (const Frame &frame : mOctree.mFrames) {
+    box.extend((frame.pose * Eigen::Vector4d(0, 0, 0, 1)).head<3>());
+    for (double x : xs) {
+      for (double y : ys) {
+        Eigen::Vector4d corner(x * trunc, y * trunc, trunc, 1.0);
+        box.extend((frame.pose * corner).head<3>());
+      }
+    }
+  }
+  // Leave some margin for rounding.
+  const double margin = mOctree.mSpacing;
+  mMin = (box.min().array() - margin).cast<float>();
+  mSize = static_cast<float>(box.sizes().maxCoeff() + 2 * margin);
+
+  const double leafSize = static_cast<double>(mOctree.mSpacing) * gridSize;
+  double depth = std::ceil(std::log2(mSize / leafSize));
+  mDepth = static_cast<uint32_t>(std::clamp(depth, 0.0, double(maxDepth)));
+}
+
+void ScanOctree::Builder::readFrames() {
+  const std::vector<Frame> &frames = mOctree.mFrames;
+  const size_t batchSize = getNumWorkers() * 2;
+  std::vector<CompactCloud> clouds;
+  for (size_t first = 0; first < frames.size(); first += batchSize) {
+    checkStop();
+    report("Reading the frames", first, frames.size());
+    const size_t n = std::min(batchSize, frames.size() - first);
+    clouds.assign(n, CompactCloud());
+    parallelFor(n, [&](size_t i) {
+      const Frame &frame = frames[first + i];
+      try {
+        clouds[i] = readFrame(frame);
+      } catch (std::exception &e) {
+        fprintf(stderr, "Skipping %s in the octree: %s\n", frame.name.c_str(),
+                e.what());
+      }
+    });
+
+    for (const CompactCloud &cloud : clouds) {
+      for (size_t i = 0; i < cloud.size(); i++) {
+        appendPoint(mBins[getLeafCode(cloud.x[i], cloud.y[i], cloud.z[i])],
+                    cloud, i);
+      }
+      mNumBinned += cloud.size();
+    }
+    if (mNumBinned >= spillThreshold) {
+      spill();
+    }
+  }
+  spill();
+  report("Reading the frames", frames.size(), frames.size());
+
+  mLeaves.reserve(mSegments.size());
+  for (const auto &[code, segments] : mSegments) {
+    mLeaves.push_back(code);
+  }
+  std::sort(mLeaves.begin(), mLeaves.end());
+}
+
+CompactCloud ScanOctree::Builder::readFrame(const Frame &frame) const {
+  const Scene &scene = mOctree.mScene;
+  auto [color, depth] = frame.rgb.empty() || frame.depth.empty()
+                            ? scene.openFrame(frame.name)
+                            : scene.openFrame(frame.rgb, frame.depth);
+  auto [points, pixels] =
+      scene.unprojectCompact(depth, mOctree.mTrunc, frame.pose);
+  if (points.empty()) {
+    return points;
+  }
+  gatherColors(color, pixels, points);
+  // Frames are much denser than the leaves, and this makes the bins smaller.
+  return points.voxelDownSample(mOctree.mSpacing);
+}
+
+uint64_t ScanOctree::Builder::getLeafCode(float x, float y, float z) const {
+  const float cells = static_cast<float>(1u << mDepth);
+  const float p[] = {x - mMin.x(), y - mMin.y(), z - mMin.z()};
+  uint32_t c[3];
+  for (int i = 0; i < 3; i++) {
+    float v = std::floor(p[i] / mSize * cells);
+    c[i] = static_cast<uint32_t>(std::clamp(v, 0.0f, cells - 1.0f));
+  }
+  // The leaves of a node have consecutive codes.
+  return encodeMorton(c[0], c[1], c[2]);
+}
+
+void ScanOctree::Builder::spill() {
+  mSpill.seekp(static_cast<std::streamoff>(mSpillSize));
+  for (const auto &[code, bin] : mBins) {
+    const size_t n = bin.size();
+    mSegments[code].push_back({mSpillSize, static_cast<uint32_t>(n)});
+    const std::streamsize coordBytes =
+        static_cast<std::streamsize>(n * sizeof(float));
+    mSpill.write(reinterpret_cast<const char *>(bin.x.data()), coordBytes);
+    mSpill.write(reinterpret_cast<const char *>(bin.y.data()), coordBytes);
+    mSpill.write(reinterpret_cast<const char *>(bin.z.data()), coordBytes);
+    mSpill.write(reinterpret_cast<const char *>(bin.colors.data()),
+                 static_cast<std::streamsize>(n * 3));
+    mSpillSize += n * pointBytes;
+  }
+  if (!mSpill) {
+    throw std::runtime_error("Failed to write " + mSpillPath.string() + ".");
+  }
+  mBins.clear();
+  mNumBinned = 0;
+}
+
+CompactCloud ScanOctree::Builder::readLeaf(uint64_t code) {
+  CompactCloud points;
+  for (const Segment &segment : mSegments.at(code)) {
+    const size_t first = points.size();
+    const size_t n = segment.count;
+    points.x.resize(first + n);
+    points.y.resize(first + n);
+    points.z.resize(first + n);
+    points.colors.resize((first + n) * 3);
+    mSpill.seekg(static_cast<std::streamoff>(segment.offset));
+    const std::streamsize coordBytes =
+        static_cast<std::streamsize>(n * sizeof(float));
+    mSpill.read(reinterpret_cast<char *>(&points.x[first]), coordBytes);
+    mSpill.read(reinterpret_cast<char *>(&points.y[first]), coordBytes);
+    mSpill.read(reinterpret_cast<char *>(&points.z[first]), coordBytes);
+    mSpill.read(reinterpret_cast<char *>(&points.colors[first * 3]),
+                static_cast<std::streamsize>(n * 3));
+  }
+  if (!mSpill) {
+    throw std::runtime_error("Failed to read " + mSpillPath.string() + ".");
+  }
+  // Different frames see the same surfaces, so we merge their points.
+  return points.voxelDownSample(mOctree.mSpacing);
+}
+
+uint32_t ScanOctree::Builder::buildNode(uint32_t level, uint64_t code,
+                                        const Eigen::Vector3f &min,
+                                        size_t begin, size_t end,
+                                        CompactCloud &candidates) {
+  checkStop();
+  const uint32_t idx = static_cast<uint32_t>(mNodes.size());
+  const float size = mSize / static_cast<float>(1u << level);
+  {
+    Node node;
+    memset(&node, 0, sizeof(node));
+    std::copy_n(min.data(), 3, node.min);
+    node.size = size;
+    node.level = level;
+    mNodes.push_back(node);
+  }
+
+  if (level == mDepth) {
+    assert(end - begin == 1 && mLeaves[begin] == code);
+    candidates = readLeaf(code);
+    report("Building the octree", ++mNumLeavesDone, mLeaves.size());
+    return idx;
+  }
+
+  const uint32_t shift = 3 * (mDepth - level - 1);
+  std::array<uint32_t, 8> children = {};
+  std::array<CompactCloud, 8> childPoints;
+  for (uint32_t c = 0; c < 8; c++) {
+    const uint64_t childCode = (code << 3) | c;
+    auto first = std::lower_bound(mLeaves.begin() + begin,
+                                  mLeaves.begin() + end, childCode << shift);
+    auto last = std::lower_bound(first, mLeaves.begin() + end,
+                                 (childCode + 1) << shift);
+    if (first == last) {
+      continue;
+    }
+    const float half = size * 0.5f;
+    Eigen::Vector3f childMin =
+        min + Eigen::Vector3f(c & 1 ? half : 0.0f, c & 2 ? half : 0.0f,
+                              c & 4 ? half : 0.0f);
+    children[c] = buildNode(level + 1, childCode, childMin,
+                            first - mLeaves.begin(), last - mLeaves.begin(),
+                            childPoints[c]);
+  }
+  mNodes[idx].children = children;
+
+  // Take a point for each cell of our grid, and leave the others to the
+  // children. A cell is always inside a single child.
+  const float cellsPerMeter = gridSize / size;
+  std::unordered_set<uint32_t> taken;
+  for (uint32_t c = 0; c < 8; c++) {
+    if (!children[c]) {
+      continue;
+    }
+    const CompactCloud &points = childPoints[c];
+    CompactCloud remaining;
+    for (size_t i = 0; i < points.size(); i++) {
+      uint32_t cell[3];
+      const float p[] = {points.x[i] - min.x(), points.y[i] - min.y(),
+                         points.z[i] - min.z()};
+      for (int j = 0; j < 3; j++) {
+        float v = std::floor(p[j] * cellsPerMeter);
+        cell[j] = static_cast<uint32_t>(
+            std::clamp(v, 0.0f, static_cast<float>(gridSize - 1)));
+      }
+      uint32_t key = (cell[0] * gridSize + cell[1]) * gridSize + cell[2];
+      if (taken.insert(key).second) {
+        appendPoint(candidates, points, i);
+      } else {
+        appendPoint(remaining, points, i);
+      }
+    }
+    childPoints[c] = CompactCloud();
+    writeChunk(children[c], remaining);
+  }
+  return idx;
+}
+
+void ScanOctree::Builder::writeChunk(uint32_t node,
+                                     const CompactCloud &points) {
+  const size_t n = points.size();
+  mNodes.at(node).offset = mOutSize;
+  mNodes[node].count = static_cast<uint32_t>(n);
+  const std::streamsize coordBytes =
+      static_cast<std::streamsize>(n * sizeof(float));
+  mOut.write(reinterpret_cast<const char *>(points.x.data()), coordBytes);
+  mOut.write(reinterpret_cast<const char *>(points.y.data()), coordBytes);
+  mOut.write(reinterpret_cast<const char *>(points.z.data()), coordBytes);
+  mOut.write(reinterpret_cast<const char *>(points.colors.data()),
+             static_cast<std::streamsize>(n * 3));
+  if (!mOut) {
+    throw std::runtime_error("Failed to write " + mTmpPath.string() + ".");
+  }
+  mOutSize += n * pointBytes;
+  mNumPoints += n;
+}
+
+void ScanOctree::Builder::report(const char *phase, size_t done,
+                                 size_t total) const {
+  if (mProgress) {
+    mProgress(phase, done, total);
+  }
+}
+
+void ScanOctree::Builder::checkStop() const {
+  if (mStop && *mStop) {
+    throw std::runtime_error("The creation of the octree was canceled.");
+  }
+}
+
+ScanOctree::ScanOctree(const Scene &scene, std::vector<Frame> frames,
+                       float trunc, float spacing,
+                       const ProgressCallback &progress,
+                       const std::atomic<bool> *stop)
+    : mScene(scene), mFrames(std::move(frames)), mTrunc(trunc),
+      mSpacing(spacing),
+      mCache(std::make_shared<FrameCache>(FrameCache::defaultBudget() / 4)) {
+  if (mFrames.empty()) {
+    throw std::invalid_argument("The scan does not have any frames.");
+  }
+  if (!(trunc > 0.0f) || !(spacing > 0.0f)) {
+    throw std::invalid_argument(
+        "The truncation and the spacing must be positive.");
+  }
+  mPath = scene.getDataDirectory() / "cache" / "scan.octree";
+
+  const uint64_t key = computeKey();
+  bool loaded = false;
+  try {
+    loaded = load(key);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Cannot load the octree of the scan: %s\n", e.what());
+  }
+  if (!loaded) {
+    Builder(*this, key, progress, stop).build();
+    if (!load(key)) {
+      throw std::runtime_error("Cannot open the octree that was just built.");
+    }
+  }
+
+  mChunks.reserve(mNodes.size());
+  for (size_t i = 0; i < mNodes.size(); i++) {
+    mChunks.push_back(std::make_shared<Chunk>(mCache));
+  }
+  mWorker = std::thread(&ScanOctree::work, this);
+}
+
+ScanOctree::~ScanOctree() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+  }
+  mCondition.notify_all();
+  if (mWorker.joinable()) {
+    mWorker.join();
+  }
+  if (mFd >= 0) {
+    close(mFd);
+  }
+}
+
+uint64_t ScanOctree::computeKey() const {
+  Hasher hasher;
+  hasher.add(mTrunc);
+  hasher.add(mSpacing);
+  hasher.add(gridSize);
+  hasher.add(mScene.getDepthScale());
+  const open3d::camera::PinholeCameraIntrinsic &intr =
+      mScene.getCameraIntrinsic();
+  hasher.add(intr.width_);
+  hasher.add(intr.height_);
+  hasher.add(intr.intrinsic_matrix_.data(), sizeof(double) * 9);
+  hasher.add(mFrames.size());
+  for (const Frame &frame : mFrames) {
+    hasher.add(frame.name);
+    hasher.add(frame.rgb);
+    hasher.add(frame.depth);
+    hasher.add(frame.pose.data(), sizeof(double) * 16);
+    auto [rgb, depth] = frame.rgb.empty() || frame.depth.empty()
+                            ? Scene::getFrameFiles(frame.name)
+                            : std::make_pair(frame.rgb, frame.depth);
+    auto [rgbPath, depthPath] = mScene.getSourcePaths(rgb, depth);
+    for (const fs::path &path : {rgbPath, depthPath}) {
+      struct stat st;
+      if (!stat(path.c_str(), &st)) {
+        hasher.add(static_cast<int64_t>(st.st_size));
+        hasher.add(static_cast<int64_t>(st.st_mtim.tv_sec));
+        hasher.add(static_cast<int64_t>(st.st_mtim.tv_nsec));
+      }
+    }
+  }
+  return hasher.get();
+}
+
+bool ScanOctree::load(uint64_t key) {
+  int fd = open(mPath.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return false;
+  }
+  // Close the descriptor also when we throw.
+  std::unique_ptr<int, void (*)(int *)> guard(&fd, [](int *fd) {
+    if (*fd >= 0) {
+      close(*fd);
+    }
+  });
+  struct stat st;
+  if (fstat(fd, &st)) {
+    return false;
+  }
+  const uint64_t size = static_cast<uint64_t>(st.st_size);
+  Header h;
+  if (size < sizeof(h)) {
+    return false;
+  }
+  readAt(fd, &h, sizeof(h), 0);
+  if (memcmp(h.magic, octreeMagic, sizeof(octreeMagic)) ||
+      h.version != octreeVersion || h.key != key) {
+    // Outdated, we will overwrite it.
+    return false;
+  }
+  if (!h.numNodes || h.nodesOffset > size ||
+      (size - h.nodesOffset) / sizeof(Node) < h.numNodes) {
+    throw std::runtime_error("The octree is corrupted.");
+  }
+  std::vector<Node> nodes(h.numNodes);
+  readAt(fd, nodes.data(), nodes.size() * sizeof(Node), h.nodesOffset);
+  // The builder adds a node before its children, so they always come after
+  // it. Checking this is enough to reject the cycles, which would make the
+  // traversals loop forever. A node with two parents would be visited twice.
+  std::vector<bool> hasParent(nodes.size(), false);
+  for (size_t i = 0; i < nodes.size(); i++) {
+    const Node &node = nodes[i];
+    bool valid = node.offset <= h.nodesOffset &&
+                 node.count <= (h.nodesOffset - node.offset) / pointBytes;
+    for (uint32_t child : node.children) {
+      if (!child) {
+        continue;
+      }
+      valid = valid && child > i && child < nodes.size() && !hasParent[child];
+      if (valid) {
+        hasParent[child] = true;
+      }
+    }
+    if (!valid) {
+      throw std::runtime_error("The octree is corrupted.");
+    }
+  }
+
+  mNodes = std::move(nodes);
+  mNumPoints = h.numPoints;
+  if (mFd >= 0) {
+    close(mFd);
+  }
+  mFd = fd;
+  fd = -1;
+  return true;
+}
+
+std::vector<uint32_t> ScanOctree::selectNodes(const glm::mat4 &pv,
+                                              size_t pointBudget) const {
+  struct Candidate {
+    float priority;
+    uint32_t node;
+    bool operator<(const Candidate &other) const {
+      return priority < other.priority;
+    }
+  };
+  std::priority_queue<Candidate> queue;
+  auto visit = [&](uint32_t idx) {
+    const Node &node = mNodes[idx];
+    // Cull the nodes whose corners are all outside the same clip plane.
+    int outside[6] = {};
+    for (int i = 0; i < 8; i++) {
+      glm::vec4 c = pv * glm::vec4(node.min[0] + (i & 1 ? node.size : 0.0f),
+                                   node.min[1] + (i & 2 ? node.size : 0.0f),
+                                   node.min[2] + (i & 4 ? node.size : 0.0f),
+                                   1.0f);
+      outside[0] += c.x < -c.w;
+      outside[1] += c.x > c.w;
+      outside[2] += c.y < -c.w;
+      outside[3] += c.y > c.w;
+      outside[4] += c.z < -c.w;
+      outside[5] += c.z > c.w;
+    }
+    if (std::find(outside, outside + 6, 8) != outside + 6) {
+      return;
+    }
+    // The size of the node on the screen, more or less.
+    const float half = node.size * 0.5f;
+    glm::vec4 center = pv * glm::vec4(node.min[0] + half, node.min[1] + half,
+                                      node.min[2] + half, 1.0f);
+    float radius = half * 1.7320508f;
+    float priority = radius / std::max(center.w - radius, 1e-3f);
+    queue.push({priority, idx});
+  };
+
+  std::vector<uint32_t> selected;
+  if (mNodes.empty()) {
+    return selected;
+  }
+  visit(0);
+  size_t numPoints = 0;
+  while (!queue.empty() && numPoints < pointBudget) {
+    uint32_t idx = queue.top().node;
+    queue.pop();
+    selected.push_back(idx);
+    numPoints += mNodes[idx].count;
+    for (uint32_t child : mNodes[idx].children) {
+      if (child) {
+        visit(child);
+      }
+    }
+  }
+  return selected;
+}
+
+std::shared_ptr<const CompactCloud>
+ScanOctree::findChunk(uint32_t node) const {
+  Chunk &chunk = *mChunks.at(node);
+  std::lock_guard<std::mutex> lock(chunk.mutex);
+  return chunk.points;
+}
+
+std::shared_ptr<const CompactCloud> ScanOctree::getChunk(uint32_t node) const {
+  Chunk &chunk = *mChunks.at(node);
+  std::shared_ptr<const CompactCloud> points;
+  {
+    std::lock_guard<std::mutex> lock(chunk.mutex);
+    points = chunk.points;
+  }
+  if (!points) {
+    // Do not hold the lock while reading. In the worst case, two threads read
+    // the same chunk, and we keep the first one.
+    points = readChunk(node);
+    std::lock_guard<std::mutex> lock(chunk.mutex);
+    if (chunk.points) {
+      points = chunk.points;
+    } else {
+      chunk.points = points;
+    }
+  }
+  mCache->touch(mChunks[node], points->getBytes());
+  return points;
+}
+
+std::shared_ptr<const CompactCloud>
+ScanOctree::readChunk(uint32_t node) const {
+  const Node &n = mNodes.at(node);
+  auto points = std::make_shared<CompactCloud>();
+  points->x.resize(n.count);
+  points->y.resize(n.count);
+  points->z.resize(n.count);
+  points->colors.resize(n.count * 3);
+  const size_t coordBytes = n.count * sizeof(float);
+  uint64_t offset = n.offset;
+  readAt(mFd, points->x.data(), coordBytes, offset);
+  readAt(mFd, points->y.data(), coordBytes, offset += coordBytes);
+  readAt(mFd, points->z.data(), coordBytes, offset += coordBytes);
+  readAt(mFd, points->colors.data(), n.count * 3, offset += coordBytes);
+  return points;
+}
+
+void ScanOctree::request(const std::vector<uint32_t> &nodes) {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mQueue.clear();
+    for (uint32_t node : nodes) {
+      if (node < mNodes.size() && !findChunk(node)) {
+        mQueue.push_back(node);
+      }
+    }
+  }
+  mCondition.notify_one();
+}
+
+void ScanOctree::work() {
+  for (;;) {
+    uint32_t node;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mCondition.wait(lock, [this] { return mStop || !mQueue.empty(); });
+      if (mStop) {
+        return;
+      }
+      node = mQueue.front();
+      mQueue.pop_front();
+    }
+    try {
+      getChunk(node);
+    } catch (std::exception &e) {
+      fprintf(stderr, "Cannot read a chunk of the octree: %s\n", e.what());
+    }
+  }
+}
+
+CompactCloud ScanOctree::collect(const Eigen::AlignedBox3f &box,
+                                 float spacing) const {
+  CompactCloud out;
+  if (mNodes.empty()) {
+    return out;
+  }
+  std::vector<uint32_t> stack = {0};
+  while (!stack.empty()) {
+    const Node &node = mNodes[stack.back()];
+    std::shared_ptr<const CompactCloud> points = getChunk(stack.back());
+    stack.pop_back();
+    for (size_t i = 0; i < points->size(); i++) {
+      if (box.contains(points->getPoint(i))) {
+        appendPoint(out, *points, i);
+      }
+    }
+    // The node and its ancestors already have the requested resolution.
+    if (node.size / gridSize <= spacing) {
+      continue;
+    }
+    for (uint32_t child : node.children) {
+      if (!child) {
+        continue;
+      }
+      const Node &c = mNodes[child];
+      Eigen::AlignedBox3f childBox(
+          Eigen::Vector3f(c.min[0], c.min[1], c.min[2]),
+          Eigen::Vector3f(c.min[0] + c.size, c.min[1] + c.size,
+                          c.min[2] + c.size));
+      if (box.intersects(childBox)) {
+        stack.push_back(child);
+      }
+    }
+  }
+  return out;
+}
@@ -6,31 +6,41 @@
 
 #include "Scene.h"
 
+#include <atomic>
+#include <cassert>
 #include <fstream>
 #include <iterator>
+#include <optional>
 #include <random>
 #include <stdexcept>
+#include <unordered_map>
+
+#include <cmath>
 
 #include "nlohmann/json.hpp"
 
 #include "open3d/io/ImageIO.h"
 
+#include "imageutils.h"
+#include "parallel.h"
+
 using json = nlohmann::json;
 namespace fs = std::filesystem;
 
 Scene::Scene(const std::filesystem::path &dataDirectory,
-             std::vector<std::string> &warnings)
+             std::vector<std::string> &warnings,
+             const ProgressCallback &progress)
     : mDataDirectory(dataDirectory) {
   if (!fs::exists(dataDirectory) || !fs::is_directory(dataDirectory)) {
     throw std::invalid_argument(dataDirectory.string() +
                                 " does not exist or is not a directory.");
   }
 
+  // Stereo datasets can be used directly, without stereo-make-depth.py, in
+  // which case we take the camera from the calibration.
+  mStereo = StereoRegistration::load(dataDirectory);
   fs::path cameraConfig = dataDirectory / "camera.json";
-  if (!fs::exists(cameraConfig)) {
-    throw std::invalid_argument(dataDirectory.string() + " does not exist.");
-  }
-  {
+  if (fs::exists(cameraConfig)) {
     int width, height;
     double fx, fy, ppx, ppy;
     std::ifstream cameraStream(cameraConfig);
@@ -47,6 +57,24 @@ Scene::Scene(const std::filesystem::path &dataDirectory,
     camera.at("ppy").get_to(ppy);
     mIntrinsic.SetIntrinsics(width, height, fx, fy, ppx, ppy);
     camera.at("scale").get_to(mDepthScale);
+  } else if (mStereo) {
+    mIntrinsic = mStereo->getIntrinsic();
+    // registerFrame creates the depth in meters.
+    mDepthScale = 1.0;
+  } else {
+    throw std::invalid_argument(cameraConfig.string() + " does not exist.");
+  }
+  mRays = CameraRays(mIntrinsic);
+
+  fs::path archivePath = getArchivePath(dataDirectory);
+  if (fs::exists(archivePath)) {
+    try {
+      mArchive = FrameArchive::open(archivePath);
+      mArchiveTime = fs::last_write_time(archivePath);
+    } catch (std::exception &e) {
+      warnings.push_back(std::string("Cannot use the frame archive: ") +
+                         e.what());
+    }
   }
 
   fs::path dataPath = getDataFile();
@@ -54,12 +82,55 @@ Scene::Scene(const std::filesystem::path &dataDirectory,
     std::ifstream data(dataPath);
     json j;
     data >> j;
-    for (const auto &p : j) {
-      try {
-        clouds.emplace_back(*this, p);
-      } catch (std::exception &e) {
-        warnings.push_back(e.what());
-      }
+    loadClouds(j, warnings, progress);
+  }
+
+  // Register only now, as the clouds are loaded in worker threads, whereas
+  // they are changed only by the main thread afterwards.
+  mMemory = MemoryRegistry::get().add(
+      [this](std::vector<MemoryRegistry::Entry> &entries) {
+        for (const PointCloud &pcd : clouds) {
+          pcd.reportMemory(entries);
+        }
+      });
+}
+
+void Scene::loadClouds(const json &j, std::vector<std::string> &warnings,
+                       const ProgressCallback &progress) {
+  std::vector<const json *> entries;
+  for (const auto &p : j) {
+    entries.push_back(&p);
+  }
+  const size_t total = entries.size();
+  if (progress) {
+    progress(0, total);
+  }
+
+  // Frames are independent from each other, and decoding them is by far the
+  // most expensive part of loading a scene. So, we load them in parallel, but
+  // we collect both the results and the errors in slots, to keep the order of
+  // the JSON file.
+  std::vector<std::optional<PointCloud>> loaded(total);
+  std::vector<std::string> errors(total);
+  std::atomic<size_t> done = 0;
+  parallelFor(total, [&](size_t i) {
+    try {
+      loaded[i].emplace(*this, *entries[i]);
+    } catch (std::exception &e) {
+      errors[i] = e.what();
+    }
+    size_t n = ++done;
+    if (progress) {
+      progress(n, total);
+    }
+  });
+
+  clouds.reserve(clouds.size() + total);
+  for (size_t i = 0; i < total; i++) {
+    if (loaded[i]) {
+      clouds.push_back(std::move(*loaded[i]));
+    } else {
+      warnings.push_back(std::move(errors[i]));
     }
   }
 }
@@ -70,89 +141,312 @@ open3d::geometry::Image Scene::openImage(const std::string &path) const {
   if (!io::ReadImage(path, img)) {
     throw std::runtime_error("Cannot open " + path + ".");
   }
-  if (img.width_ != mIntrinsic.width_ || img.height_ != mIntrinsic.height_) {
+  checkImageSize(img, path);
+  return img;
+}
+
+open3d::geometry::Image Scene::openDepth(const std::string &path) const {
+  double unit;
+  open3d::geometry::Image img = readDepth(path, unit);
+  checkImageSize(img, path);
+  applyDepthUnit(img, unit);
+  return img;
+}
+
+std::pair<open3d::geometry::Image, open3d::geometry::Image>
+Scene::openStereoFrame(const std::string &rgb,
+                       const std::string &disparity) const {
+  open3d::geometry::Image disp = readPfm(mDataDirectory / disparity);
+  checkImageSize(disp, disparity);
+  // The color camera can have another resolution, registerFrame resamples it
+  // to the size of the disparity.
+  open3d::geometry::Image color;
+  const std::string colorPath = (mDataDirectory / rgb).string();
+  if (!open3d::io::ReadImage(colorPath, color)) {
+    throw std::runtime_error("Cannot open " + colorPath + ".");
+  }
+  auto frame = mStereo->registerFrame(disp, color);
+  applyDepthUnit(frame.second, 1.0);
+  return frame;
+}
+
+void Scene::applyDepthUnit(open3d::geometry::Image &depth, double unit) const {
+  if (unit <= 0.0 || std::abs(unit / mDepthScale - 1.0) < 1e-6) {
+    return;
+  }
+  const float factor = static_cast<float>(unit / mDepthScale);
+  const size_t count = static_cast<size_t>(depth.width_) *
+                       static_cast<size_t>(depth.height_);
+  if (depth.bytes_per_channel_ == 4) {
+    float *data = reinterpret_cast<float *>(depth.data_.data());
+    for (size_t i = 0; i < count; i++) {
+      data[i] *= factor;
+    }
+  } else if (depth.bytes_per_channel_ == 2) {
+    // Rescaling in uint16 would add another quantization, so we switch to
+    // float. This happens with the frames of stereo-make-depth.py without a
+    // fixed scale, since each has its own.
+    open3d::geometry::Image converted;
+    converted.Prepare(depth.width_, depth.height_, 1, 4);
+    const uint16_t *src =
+        reinterpret_cast<const uint16_t *>(depth.data_.data());
+    float *dst = reinterpret_cast<float *>(converted.data_.data());
+    for (size_t i = 0; i < count; i++) {
+      dst[i] = static_cast<float>(src[i]) * factor;
+    }
+    depth.data_.swap(converted.data_);
+    depth.bytes_per_channel_ = 4;
+  }
+}
+
+void Scene::checkImageSize(const open3d::geometry::Image &img,
+                           const std::string &path, int scale) const {
+  int width = getScaledSize(mIntrinsic.width_, scale);
+  int height = getScaledSize(mIntrinsic.height_, scale);
+  if (img.width_ != width || img.height_ != height) {
     char error[100];
     snprintf(error, sizeof(error), " has a wrong size (%dx%d, expected %dx%d).",
-             img.width_, img.height_, mIntrinsic.width_, mIntrinsic.height_);
+             img.width_, img.height_, width, height);
     throw std::runtime_error(path + error);
   }
-  return img;
+}
+
+void Scene::checkFrameFormat(
+    const std::pair<open3d::geometry::Image, open3d::geometry::Image> &frame) {
+  // We do not force the number of channels for now.
+  if (frame.first.bytes_per_channel_ != 1) {
+    throw std::runtime_error("Unsupported format of the RGB image.");
+  }
+  if (frame.second.num_of_channels_ != 1) {
+    throw std::runtime_error("The depth image has more than one channel.");
+  }
+}
+
+std::pair<std::string, std::string>
+Scene::getFrameFiles(const std::filesystem::path &basename) {
+  return {("rgb" / fs::path(basename).concat(".jpg")).string(),
+          ("depth" / fs::path(basename).concat(".png")).string()};
+}
+
+fs::path Scene::getMaskPath(const std::string &name) const {
+  return mDataDirectory / "mask" / (name + ".png");
+}
+
+fs::path Scene::getSidecarPath(const std::string &name) const {
+  return mDataDirectory / "cache" / (name + ".frame");
+}
+
+fs::path Scene::getArchivePath(const fs::path &dataDirectory) {
+  return dataDirectory / "frames.fpa";
+}
+
+std::pair<fs::path, fs::path>
+Scene::getSourcePaths(const std::string &rgb, const std::string &depth) const {
+  if (isPacked(rgb, depth)) {
+    return {mArchive->getPath(), mArchive->getPath()};
+  }
+  return {mDataDirectory / rgb, mDataDirectory / depth};
+}
+
+bool Scene::isPacked(const std::string &rgb, const std::string &depth) const {
+  if (!mArchive || !mArchive->contains(depth)) {
+    return false;
+  }
+  // We need both the loose files, since we read a frame from a single source.
+  bool newer = false;
+  for (const std::string &file : {rgb, depth}) {
+    std::error_code ec;
+    fs::file_time_type time = fs::last_write_time(mDataDirectory / file, ec);
+    if (ec) {
+      return true;
+    }
+    newer = newer || time > mArchiveTime;
+  }
+  return !newer;
+}
+
+std::vector<std::pair<fs::path, fs::path>>
+Scene::listFrameFiles(const fs::path &base) {
+  const fs::path rgbPath = base / "rgb";
+  const fs::path depthPath = base / "depth";
+  // The depth created by stereo-make-depth.py takes the precedence over the
+  // disparity, which we would need to register again every time.
+  if (!fs::is_directory(depthPath) &&
+      fs::exists(StereoRegistration::getCalibrationPath(base))) {
+    return StereoRegistration::listFrameFiles(base);
+  }
+  // directory_iterator throws if the directory isn't valid, so we need to check
+  // before calling it.
+  if (!fs::exists(rgbPath) || !fs::is_directory(rgbPath) ||
+      !fs::exists(depthPath) || !fs::is_directory(depthPath)) {
+    return {};
+  }
+
+  // The following steps should not hurt a healthy dataset: we enable
+  // case-insensitivity on the extension (and maybe also on the stem, in the
+  // future), which however means that some frames might be discarded (and the
+  // one that will be taken depends on the order on which we iterate).
+  std::unordered_map<fs::path, fs::path> depthStems;
+  for (const fs::directory_entry &entry : fs::directory_iterator(depthPath)) {
+    fs::path p = entry.path().lexically_proximate(base);
+    if (!isDepthFile(p)) {
+      continue;
+    }
+    auto res = depthStems.insert(std::make_pair(p.stem(), p));
+    // In debug mode, assert about unhealthy datasets.
+    assert(res.second && "Duplicated depth stem.");
+  }
+
+  // We support mulitple extensions (jpg, png and various variants in
+  // case-sensitive filesystems), so multiple color frames could be associated
+  // to the same depth frame.
+  // Callers usually check only the depth name (which has already been forced
+  // to be unique), so only the first entry will be taken into account.
+  // However, which one will be taken depends on the order of iteration.
+  // This should not be a problem for healthy dataset, but not a completely
+  // correct solution either.
+  std::vector<std::pair<fs::path, fs::path>> frames;
+  for (const fs::directory_entry &entry : fs::directory_iterator(rgbPath)) {
+    fs::path p = entry.path().lexically_proximate(base);
+    std::string ext = lowercaseExtension(p);
+    if (ext != ".jpg" && ext != ".png") {
+      continue;
+    }
+    auto maybeDepth = depthStems.find(p.stem());
+    if (maybeDepth != depthStems.end()) {
+      frames.emplace_back(p, maybeDepth->second);
+    }
+  }
+  return frames;
+}
+
+std::string Scene::lowercaseExtension(const fs::path &p) {
+  fs::path ext = p.extension();
+  std::string ret;
+  ret.reserve(ext.native().length());
+  for (auto ch : ext.native()) {
+    // No Unicode and no surrogates, since we are ASCII only.
+    if (ch > 0x7F) {
+      return "";
+    }
+    // tolower should be fine with ASCII-only.
+    ret.push_back(static_cast<char>(tolower(static_cast<unsigned char>(ch))));
+  }
+  return ret;
 }
 
 std::pair<open3d::geometry::Image, open3d::geometry::Image>
 Scene::openFrame(const std::filesystem::path &basename) const {
-  std::string rgb = ("rgb" / fs::path(basename).concat(".jpg")).string();
-  std::string depth = ("depth" / fs::path(basename).concat(".png")).string();
+  auto [rgb, depth] = getFrameFiles(basename);
   return openFrame(rgb, depth);
 }
 
 std::pair<open3d::geometry::Image, open3d::geometry::Image>
 Scene::openFrame(std::string rgb, std::string depth) const {
-  std::string prefix =
-      mDataDirectory.string() + std::filesystem::path::preferred_separator;
-  rgb = prefix + rgb;
-  depth = prefix + depth;
-  auto pair = std::make_pair(openImage(rgb), openImage(depth));
-  // We do not force the number of channels for now.
-  if (pair.first.bytes_per_channel_ != 1) {
-    throw std::runtime_error("Unsupported format of the RGB image.");
+  std::pair<open3d::geometry::Image, open3d::geometry::Image> pair;
+  if (isPacked(rgb, depth)) {
+    pair = mArchive->readFrame(depth);
+    checkImageSize(pair.first, rgb);
+    checkImageSize(pair.second, depth);
+    applyDepthUnit(pair.second, mArchive->getDepthUnit(depth));
+  } else if (mStereo && StereoRegistration::isDisparityFile(depth)) {
+    pair = openStereoFrame(rgb, depth);
+  } else {
+    std::string prefix =
+        mDataDirectory.string() + std::filesystem::path::preferred_separator;
+    pair = std::make_pair(openImage(prefix + rgb), openDepth(prefix + depth));
   }
-  if (pair.second.num_of_channels_ != 1) {
-    throw std::runtime_error("The depth image has more than one channel.");
+  checkFrameFormat(pair);
+  return pair;
+}
+
+std::pair<open3d::geometry::Image, open3d::geometry::Image>
+Scene::openFramePreview(const std::string &rgb, const std::string &depth,
+                        int scale) const {
+  // The registration needs the full resolution of both images, so stereo
+  // frames only save the upload.
+  if (scale == 1 ||
+      (mStereo && StereoRegistration::isDisparityFile(depth) &&
+       !isPacked(rgb, depth))) {
+    auto pair = openFrame(rgb, depth);
+    if (scale != 1) {
+      pair.first = subsampleImage(pair.first, scale);
+      pair.second = subsampleImage(pair.second, scale);
+    }
+    return pair;
   }
+  std::pair<open3d::geometry::Image, open3d::geometry::Image> pair;
+  if (isPacked(rgb, depth)) {
+    pair = mArchive->readFrame(depth, scale);
+    checkImageSize(pair.second, depth);
+    applyDepthUnit(pair.second, mArchive->getDepthUnit(depth));
+  } else {
+    fs::path rgbPath = mDataDirectory / rgb;
+    if (isJpeg(rgbPath)) {
+      pair.first = readJpeg(rgbPath, scale);
+    } else {
+      pair.first = subsampleImage(openImage(rgbPath.string()), scale);
+    }
+    pair.second = openDepth((mDataDirectory / depth).string());
+  }
+  checkImageSize(pair.first, rgb, scale);
+  pair.second = subsampleImage(pair.second, scale);
+  checkFrameFormat(pair);
   return pair;
 }
 
+bool Scene::openMask(const std::string &name,
+                     open3d::geometry::Image &mask) const {
+  // Masks are edited by the noise removal, so the loose files take the
+  // precedence over the archive.
+  fs::path maskPath = getMaskPath(name);
+  std::error_code ec;
+  if (fs::exists(maskPath, ec) && !ec) {
+    return open3d::io::ReadImage(maskPath.string(), mask);
+  }
+  return mArchive && mArchive->readMask(name, mask);
+}
+
 std::pair<std::vector<Eigen::Vector3d>,
           std::vector<Eigen::Vector2<unsigned int>>>
-Scene::unprojectDepth(const open3d::geometry::Image &depth,
-                      const Eigen::Matrix4d &transform) const {
-  if (depth.width_ <= 0 || depth.height_ <= 0) {
-    throw std::invalid_argument("The depth image cannot be empty.");
-  }
-  if (depth.bytes_per_channel_ != 4 || depth.num_of_channels_ != 1) {
-    throw std::invalid_argument(
-        "The depth image should be a float32 single-channel image.");
-  }
+Scene::unprojectDepth(const open3d::geometry::Image &depth, double trunc,
+                      const Eigen::Matrix4d &transform,
+                      const BitMask *mask) const {
   std::vector<Eigen::Vector3d> points;
   std::vector<Eigen::Vector2<unsigned int>> pixels;
-  double principal[] = {mIntrinsic.GetPrincipalPoint().first,
-                        mIntrinsic.GetPrincipalPoint().second};
-  double focal[] = {mIntrinsic.GetFocalLength().first,
-                    mIntrinsic.GetFocalLength().second};
-  unsigned int width = static_cast<unsigned int>(depth.width_);
-  unsigned int height = static_cast<unsigned int>(depth.height_);
-  const float *z = reinterpret_cast<const float *>(depth.data_.data());
-  for (unsigned int y = 0; y < height; y++) {
-    for (unsigned int x = 0; x < width; x++, z++) {
-      if (*z <= 0) {
-        continue;
-      }
-      Eigen::Vector4d point((x - principal[0]) * *z / focal[0],
-                            (y - principal[1]) * *z / focal[1], *z, 1.0);
-      point = transform * point;
-      assert(fabs(point[3] - 1.0) < 1e-5);
-      points.emplace_back(point[0], point[1], point[2]);
-      pixels.emplace_back(x, y);
-    }
-  }
+  unprojectRays(depth, static_cast<float>(mDepthScale),
+                static_cast<float>(trunc), mRays, transform, points, pixels,
+                mask);
+  return {std::move(points), std::move(pixels)};
+}
+
+std::pair<CompactCloud, std::vector<Eigen::Vector2<unsigned int>>>
+Scene::unprojectCompact(const open3d::geometry::Image &depth, double trunc,
+                        const Eigen::Matrix4d &transform) const {
+  CompactCloud points;
+  std::vector<Eigen::Vector2<unsigned int>> pixels;
+  unprojectRays(depth, static_cast<float>(mDepthScale),
+                static_cast<float>(trunc), mRays, transform, points, pixels);
   return {std::move(points), std::move(pixels)};
 }
 
 std::pair<std::vector<Eigen::Vector3d>,
           std::vector<Eigen::Vector2<unsigned int>>>
 Scene::unprojectDepth(const PointCloud &pcd, bool useMask) const {
-  const open3d::geometry::RGBDImage &rgbd = useMask && pcd.hasMaskedRgbd()
-                                                ? *pcd.getMaskedRgbd()
-                                                : pcd.getRgbdImage();
-  return unprojectDepth(rgbd.depth_, pcd.getMatrixEigen());
+  // Apply the mask while unprojecting, to avoid creating the masked RGBD.
+  std::shared_ptr<const BitMask> mask;
+  if (useMask) {
+    mask = pcd.getMask();
+  }
+  return unprojectDepth(*pcd.getDepthImage(), pcd.trunc, pcd.getMatrixEigen(),
+                        mask.get());
 }
 
 std::pair<std::unique_ptr<Scene>, std::vector<std::string>>
-Scene::load(const fs::path &dataDirectory) {
+Scene::load(const fs::path &dataDirectory, const ProgressCallback &progress) {
   std::vector<std::string> warnings;
   // no make_unique, as the constructor is private.
-  std::unique_ptr<Scene> self(new Scene(dataDirectory, warnings));
+  std::unique_ptr<Scene> self(new Scene(dataDirectory, warnings, progress));
   return {std::move(self), warnings};
 }
 
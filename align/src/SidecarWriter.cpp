@@ -0,0 +1,69 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "SidecarWriter.h"
+
+#include <algorithm>
+
+#include <cstdio>
+
+SidecarWriter::SidecarWriter(size_t capacity)
+    : mCapacity(std::max<size_t>(capacity, 1)) {
+  mThread = std::thread(&SidecarWriter::work, this);
+}
+
+SidecarWriter::~SidecarWriter() {
+  {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mStop = true;
+    mQueue.clear();
+  }
+  mAdded.notify_all();
+  mTaken.notify_all();
+  mThread.join();
+}
+
+void SidecarWriter::write(Job job) {
+  {
+    std::unique_lock<std::mutex> lock(mMutex);
+    auto it = std::find_if(mQueue.begin(), mQueue.end(), [&job](const Job &j) {
+      return j.path == job.path;
+    });
+    if (it != mQueue.end()) {
+      // A newer version of the frame, e.g., with another truncation.
+      *it = std::move(job);
+      return;
+    }
+    mTaken.wait(lock,
+                [this] { return mStop || mQueue.size() < mCapacity; });
+    if (mStop) {
+      return;
+    }
+    mQueue.push_back(std::move(job));
+  }
+  mAdded.notify_one();
+}
+
+void SidecarWriter::work() {
+  for (;;) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(mMutex);
+      mAdded.wait(lock, [this] { return mStop || !mQueue.empty(); });
+      if (mStop) {
+        return;
+      }
+      job = std::move(mQueue.front());
+      mQueue.pop_front();
+    }
+    mTaken.notify_one();
+    if (!FrameSidecar::write(job.path, job.key, *job.color, *job.depth,
+                             job.mask.get(), job.points, job.pixels)) {
+      fprintf(stderr, "%s: could not write the sidecar cache.\n",
+              job.path.stem().c_str());
+    }
+  }
+}
@@ -0,0 +1,506 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "StereoRegistration.h"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include <cfloat>
+#include <cmath>
+
+#include "Eigen/Geometry"
+
+#include "nlohmann/json.hpp"
+
+#include "Scene.h"
+#include "parallel.h"
+#include "simd.h"
+
+using json = nlohmann::json;
+namespace fs = std::filesystem;
+
+// Rows are distributed to the workers in blocks of this size.
+static constexpr size_t rowsPerBlock = 16;
+// The Lanczos filter uses 4 pixels on each side.
+static constexpr int lanczosRadius = 4;
+
+/**
+ * The weights of the Lanczos filter for a fractional position, normalized,
+ * computed like OpenCV's interpolateLanczos4.
+ */
+static std::array<float, 8> lanczosWeights(double x) {
+  std::array<float, 8> coeffs = {};
+  if (x < FLT_EPSILON) {
+    coeffs[3] = 1.0f;
+    return coeffs;
+  }
+  constexpr double s45 = 0.70710678118654752440084436210485;
+  static const double cs[8][2] = {{1, 0},     {-s45, -s45}, {0, 1},
+                                  {s45, -s45}, {-1, 0},     {s45, s45},
+                                  {0, -1},    {-s45, s45}};
+  const double y0 = -(x + 3) * M_PI * 0.25;
+  const double s0 = std::sin(y0);
+  const double c0 = std::cos(y0);
+  double sum = 0.0;
+  double w[8];
+  for (int i = 0; i < 8; i++) {
+    double y = -(x + 3 - i) * M_PI * 0.25;
+    w[i] = (cs[i][0] * s0 + cs[i][1] * c0) / (y * y);
+    sum += w[i];
+  }
+  for (int i = 0; i < 8; i++) {
+    coeffs[i] = static_cast<float>(w[i] / sum);
+  }
+  return coeffs;
+}
+
+/**
+ * Collect all the numbers of a JSON value, flattening nested arrays, since
+ * NumPy matrices become lists of lists.
+ */
+static void flatten(const json &j, std::vector<double> &out) {
+  if (j.is_array()) {
+    for (const json &v : j) {
+      flatten(v, out);
+    }
+  } else {
+    out.push_back(j.get<double>());
+  }
+}
+
+static std::vector<double> readNumbers(const json &j, const char *key,
+                                       size_t minCount, size_t maxCount) {
+  std::vector<double> values;
+  flatten(j.at(key), values);
+  if (values.size() < minCount || values.size() > maxCount) {
+    throw std::runtime_error(std::string("Invalid ") + key +
+                             " in the stereo calibration.");
+  }
+  return values;
+}
+
+std::unique_ptr<StereoRegistration>
+StereoRegistration::load(const fs::path &dataDirectory) {
+  fs::path path = getCalibrationPath(dataDirectory);
+  std::error_code ec;
+  if (!fs::exists(path, ec)) {
+    return nullptr;
+  }
+  std::ifstream in(path);
+  json j;
+  in >> j;
+
+  // no make_unique, as the constructor is private.
+  std::unique_ptr<StereoRegistration> self(new StereoRegistration);
+  std::vector<double> size = readNumbers(j, "im_size", 2, 2);
+  std::vector<double> k = readNumbers(j, "intrinsic", 9, 9);
+  if (size[0] <= 0 || size[1] <= 0) {
+    throw std::runtime_error("Invalid size in the stereo calibration.");
+  }
+  self->mIntrinsic.SetIntrinsics(static_cast<int>(size[0]),
+                                 static_cast<int>(size[1]), k[0], k[4], k[2],
+                                 k[5]);
+
+  std::vector<double> q = readNumbers(j, "Q", 16, 16);
+  Eigen::Matrix4d qMat =
+      Eigen::Map<Eigen::Matrix<double, 4, 4, Eigen::RowMajor>>(q.data());
+  // OpenCV accepts both rotation matrices and Rodrigues vectors.
+  std::vector<double> r = readNumbers(j, "color_r", 3, 9);
+  Eigen::Matrix3d rMat;
+  if (r.size() == 9) {
+    rMat = Eigen::Map<Eigen::Matrix<double, 3, 3, Eigen::RowMajor>>(r.data());
+  } else if (r.size() == 3) {
+    Eigen::Vector3d rodrigues(r[0], r[1], r[2]);
+    double angle = rodrigues.norm();
+    rMat = angle > 0.0
+               ? Eigen::AngleAxisd(angle, rodrigues / angle).toRotationMatrix()
+               : Eigen::Matrix3d::Identity();
+  } else {
+    throw std::runtime_error("Invalid color_r in the stereo calibration.");
+  }
+  std::vector<double> t = readNumbers(j, "color_t", 3, 3);
+  Eigen::Matrix<double, 3, 4> rt;
+  rt << rMat, Eigen::Vector3d(t[0], t[1], t[2]);
+  Eigen::Matrix<double, 3, 4> toColor = rt * qMat;
+  for (int row = 0; row < 3; row++) {
+    for (int col = 0; col < 4; col++) {
+      self->mToColor[row * 4 + col] = static_cast<float>(toColor(row, col));
+    }
+  }
+  for (int col = 0; col < 4; col++) {
+    self->mW[col] = static_cast<float>(qMat(3, col));
+  }
+
+  std::vector<double> ck = readNumbers(j, "color_intrinsic", 9, 9);
+  self->mColorK = {static_cast<float>(ck[0]), static_cast<float>(ck[1]),
+                   static_cast<float>(ck[2]), static_cast<float>(ck[4]),
+                   static_cast<float>(ck[5])};
+  // We support the rational model, but not the thin prism and the tilted
+  // ones (12 and 14 coefficients).
+  std::vector<double> dist = readNumbers(j, "color_distortion", 4, 8);
+  self->mDistortion.fill(0.0f);
+  for (size_t i = 0; i < dist.size(); i++) {
+    self->mDistortion[i] = static_cast<float>(dist[i]);
+  }
+  self->mBf = static_cast<float>(j.at("Bf").get<double>());
+  self->mKeepInvalidColor = j.value("keep_invalid_color", false);
+
+  self->mLanczos.resize(tableSize + 1);
+  for (int i = 0; i <= tableSize; i++) {
+    self->mLanczos[i] = lanczosWeights(static_cast<double>(i) / tableSize);
+  }
+  return self;
+}
+
+fs::path StereoRegistration::getCalibrationPath(const fs::path &dataDirectory) {
+  return dataDirectory / "stereo.json";
+}
+
+bool StereoRegistration::isDisparityFile(const fs::path &path) {
+  const std::string stem = path.stem().string();
+  static const std::string suffix = "_disp";
+  return Scene::lowercaseExtension(path) == ".pfm" &&
+         stem.size() > suffix.size() &&
+         !stem.compare(stem.size() - suffix.size(), suffix.size(), suffix);
+}
+
+/**
+ * Return the part of a name that identifies the instant of a frame, i.e.,
+ * before the first dash, like stereo-make-depth.py.
+ */
+static std::string getFrameIndex(std::string stem) {
+  static const std::string suffix = "_disp";
+  if (stem.size() > suffix.size() &&
+      !stem.compare(stem.size() - suffix.size(), suffix.size(), suffix)) {
+    stem.resize(stem.size() - suffix.size());
+  }
+  return stem.substr(0, stem.find('-'));
+}
+
+std::vector<std::pair<fs::path, fs::path>>
+StereoRegistration::listFrameFiles(const fs::path &base) {
+  const fs::path rgbPath = base / "rgb";
+  const fs::path disparityPath = base / "disparity";
+  if (!fs::is_directory(rgbPath) || !fs::is_directory(disparityPath)) {
+    return {};
+  }
+  std::unordered_map<std::string, fs::path> disparities;
+  for (const fs::directory_entry &entry :
+       fs::directory_iterator(disparityPath)) {
+    fs::path p = entry.path().lexically_proximate(base);
+    if (isDisparityFile(p)) {
+      disparities.emplace(getFrameIndex(p.stem().string()), p);
+    }
+  }
+  std::vector<std::pair<fs::path, fs::path>> frames;
+  for (const fs::directory_entry &entry : fs::directory_iterator(rgbPath)) {
+    fs::path p = entry.path().lexically_proximate(base);
+    std::string ext = Scene::lowercaseExtension(p);
+    if (ext != ".jpg" && ext != ".png") {
+      continue;
+    }
+    auto it = disparities.find(getFrameIndex(p.stem().string()));
+    if (it != disparities.end()) {
+      frames.emplace_back(p, it->second);
+      // Like for the depth, only one color frame for each disparity map.
+      disparities.erase(it);
+    }
+  }
+  return frames;
+}
+
+#ifdef SIMD_AVX2
+SIMD_AVX2_TARGET static inline __m256 splat(float v) {
+  return _mm256_set1_ps(v);
+}
+
+/**
+ * The AVX2 part of projectRow: it processes blocks of 8 pixels, and returns
+ * the number of processed pixels.
+ */
+SIMD_AVX2_TARGET static size_t
+projectRowAvx2(const float *disp, const float *m, const float *w,
+               const float *k, const float *d, float bf, size_t width,
+               const float *rowC, float rowW, float *mapX, float *mapY,
+               float *depth) {
+  size_t i = 0;
+  const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 one = _mm256_set1_ps(1.0f);
+  const __m256 two = _mm256_set1_ps(2.0f);
+  const __m256 invalid = _mm256_set1_ps(-1.0f);
+  for (; i + 8 <= width; i += 8) {
+    __m256 x = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(i)), lanes);
+    __m256 dv = _mm256_loadu_ps(disp + i);
+    __m256 cx = _mm256_fmadd_ps(
+        splat(m[0]), x, _mm256_fmadd_ps(splat(m[2]), dv, splat(rowC[0])));
+    __m256 cy = _mm256_fmadd_ps(
+        splat(m[4]), x, _mm256_fmadd_ps(splat(m[6]), dv, splat(rowC[1])));
+    __m256 cz = _mm256_fmadd_ps(
+        splat(m[8]), x, _mm256_fmadd_ps(splat(m[10]), dv, splat(rowC[2])));
+    __m256 hw = _mm256_fmadd_ps(
+        splat(w[0]), x, _mm256_fmadd_ps(splat(w[2]), dv, splat(rowW)));
+    __m256 inv = _mm256_div_ps(one, cz);
+    __m256 xn = _mm256_mul_ps(cx, inv);
+    __m256 yn = _mm256_mul_ps(cy, inv);
+    __m256 r2 = _mm256_fmadd_ps(xn, xn, _mm256_mul_ps(yn, yn));
+    __m256 num = _mm256_fmadd_ps(
+        r2,
+        _mm256_fmadd_ps(r2, _mm256_fmadd_ps(r2, splat(d[4]), splat(d[1])),
+                        splat(d[0])),
+        one);
+    __m256 den = _mm256_fmadd_ps(
+        r2,
+        _mm256_fmadd_ps(r2, _mm256_fmadd_ps(r2, splat(d[7]), splat(d[6])),
+                        splat(d[5])),
+        one);
+    __m256 radial = _mm256_div_ps(num, den);
+    __m256 xy2 = _mm256_mul_ps(two, _mm256_mul_ps(xn, yn));
+    __m256 xd = _mm256_fmadd_ps(
+        xn, radial,
+        _mm256_fmadd_ps(
+            splat(d[2]), xy2,
+            _mm256_mul_ps(splat(d[3]),
+                          _mm256_fmadd_ps(two, _mm256_mul_ps(xn, xn), r2))));
+    __m256 yd = _mm256_fmadd_ps(
+        yn, radial,
+        _mm256_fmadd_ps(
+            splat(d[3]), xy2,
+            _mm256_mul_ps(splat(d[2]),
+                          _mm256_fmadd_ps(two, _mm256_mul_ps(yn, yn), r2))));
+    __m256 u = _mm256_fmadd_ps(
+        splat(k[0]), xd, _mm256_fmadd_ps(splat(k[1]), yd, splat(k[2])));
+    __m256 v = _mm256_fmadd_ps(splat(k[3]), yd, splat(k[4]));
+    // The comparisons are false also for NaNs.
+    __m256 hasDisp = _mm256_cmp_ps(dv, zero, _CMP_GT_OQ);
+    __m256 valid = _mm256_and_ps(
+        hasDisp, _mm256_cmp_ps(_mm256_mul_ps(cz, hw), zero, _CMP_GT_OQ));
+    _mm256_storeu_ps(mapX + i, _mm256_blendv_ps(invalid, u, valid));
+    _mm256_storeu_ps(mapY + i, _mm256_blendv_ps(invalid, v, valid));
+    _mm256_storeu_ps(depth + i,
+                     _mm256_and_ps(_mm256_div_ps(splat(bf), dv), hasDisp));
+  }
+  return i;
+}
+#endif
+
+/**
+ * Compute the depth and the position on the color image of a row of the
+ * disparity map, without branches. Invalid pixels get 0 depth and a negative
+ * position, which is outside of the color image.
+ *
+ * m is mToColor, w the last row of Q, k the color intrinsics and d the
+ * distortion coefficients, see StereoRegistration.
+ */
+static void projectRow(const float *disp, float y, const float *m,
+                       const float *w, const float *k, const float *d,
+                       float bf, size_t width, float *mapX, float *mapY,
+                       float *depth) {
+  // The terms that do not depend on x and on the disparity.
+  const float rowC[3] = {m[1] * y + m[3], m[5] * y + m[7], m[9] * y + m[11]};
+  const float rowW = w[1] * y + w[3];
+  size_t i = 0;
+#ifdef SIMD_AVX2
+  if (isSimdEnabled()) {
+    i = projectRowAvx2(disp, m, w, k, d, bf, width, rowC, rowW, mapX, mapY,
+                       depth);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  if (isSimdEnabled()) {
+    const float lanesData[4] = {0, 1, 2, 3};
+    const float32x4_t lanes = vld1q_f32(lanesData);
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const float32x4_t one = vdupq_n_f32(1.0f);
+    const float32x4_t invalid = vdupq_n_f32(-1.0f);
+    auto s = [](float v) { return vdupq_n_f32(v); };
+    for (; i + 4 <= width; i += 4) {
+      float32x4_t x = vaddq_f32(vdupq_n_f32(static_cast<float>(i)), lanes);
+      float32x4_t dv = vld1q_f32(disp + i);
+      float32x4_t cx = vfmaq_n_f32(vfmaq_n_f32(s(rowC[0]), dv, m[2]), x, m[0]);
+      float32x4_t cy = vfmaq_n_f32(vfmaq_n_f32(s(rowC[1]), dv, m[6]), x, m[4]);
+      float32x4_t cz = vfmaq_n_f32(vfmaq_n_f32(s(rowC[2]), dv, m[10]), x, m[8]);
+      float32x4_t hw = vfmaq_n_f32(vfmaq_n_f32(s(rowW), dv, w[2]), x, w[0]);
+      float32x4_t xn = vdivq_f32(cx, cz);
+      float32x4_t yn = vdivq_f32(cy, cz);
+      float32x4_t r2 = vfmaq_f32(vmulq_f32(yn, yn), xn, xn);
+      float32x4_t num = vfmaq_f32(
+          one, r2, vfmaq_f32(s(d[0]), r2, vfmaq_n_f32(s(d[1]), r2, d[4])));
+      float32x4_t den = vfmaq_f32(
+          one, r2, vfmaq_f32(s(d[5]), r2, vfmaq_n_f32(s(d[6]), r2, d[7])));
+      float32x4_t radial = vdivq_f32(num, den);
+      float32x4_t xy2 = vmulq_n_f32(vmulq_f32(xn, yn), 2.0f);
+      float32x4_t xd = vfmaq_f32(
+          vfmaq_n_f32(
+              vmulq_n_f32(vfmaq_n_f32(r2, vmulq_f32(xn, xn), 2.0f), d[3]),
+              xy2, d[2]),
+          xn, radial);
+      float32x4_t yd = vfmaq_f32(
+          vfmaq_n_f32(
+              vmulq_n_f32(vfmaq_n_f32(r2, vmulq_f32(yn, yn), 2.0f), d[2]),
+              xy2, d[3]),
+          yn, radial);
+      float32x4_t u = vfmaq_n_f32(vfmaq_n_f32(s(k[2]), yd, k[1]), xd, k[0]);
+      float32x4_t v = vfmaq_n_f32(s(k[4]), yd, k[3]);
+      uint32x4_t hasDisp = vcgtq_f32(dv, zero);
+      uint32x4_t valid = vandq_u32(hasDisp, vcgtq_f32(vmulq_f32(cz, hw), zero));
+      vst1q_f32(mapX + i, vbslq_f32(valid, u, invalid));
+      vst1q_f32(mapY + i, vbslq_f32(valid, v, invalid));
+      vst1q_f32(depth + i, vbslq_f32(hasDisp, vdivq_f32(s(bf), dv), zero));
+    }
+  }
+#endif
+  // The tail, or the whole row without SIMD.
+  for (; i < width; i++) {
+    const float x = static_cast<float>(i);
+    const float dv = disp[i];
+    const float cx = m[0] * x + m[2] * dv + rowC[0];
+    const float cy = m[4] * x + m[6] * dv + rowC[1];
+    const float cz = m[8] * x + m[10] * dv + rowC[2];
+    const float hw = w[0] * x + w[2] * dv + rowW;
+    const float xn = cx / cz;
+    const float yn = cy / cz;
+    const float r2 = xn * xn + yn * yn;
+    const float radial = (1.0f + r2 * (d[0] + r2 * (d[1] + r2 * d[4]))) /
+                         (1.0f + r2 * (d[5] + r2 * (d[6] + r2 * d[7])));
+    const float xy2 = 2.0f * xn * yn;
+    const float xd = xn * radial + d[2] * xy2 + d[3] * (r2 + 2.0f * xn * xn);
+    const float yd = yn * radial + d[3] * xy2 + d[2] * (r2 + 2.0f * yn * yn);
+    const bool hasDisp = dv > 0.0f;
+    const bool valid = hasDisp && cz * hw > 0.0f;
+    mapX[i] = valid ? k[0] * xd + k[1] * yd + k[2] : -1.0f;
+    mapY[i] = valid ? k[3] * yd + k[4] : -1.0f;
+    depth[i] = hasDisp ? bf / dv : 0.0f;
+  }
+}
+
+/**
+ * Resample the color at a position with the Lanczos filter, with black
+ * outside of the image (like cv2.remap with the default border).
+ */
+static void sampleLanczos(const open3d::geometry::Image &color, float u,
+                          float v,
+                          const std::vector<std::array<float, 8>> &table,
+                          int tableSize, uint8_t *out) {
+  const int width = color.width_;
+  const int height = color.height_;
+  const int channels = color.num_of_channels_;
+  // Written like this, it is false also for NaNs.
+  if (!(u > -lanczosRadius && v > -lanczosRadius &&
+        u < width + lanczosRadius && v < height + lanczosRadius)) {
+    std::fill_n(out, channels, 0);
+    return;
+  }
+  int x0 = static_cast<int>(std::floor(u));
+  int y0 = static_cast<int>(std::floor(v));
+  int fx = static_cast<int>(std::lround((u - x0) * tableSize));
+  int fy = static_cast<int>(std::lround((v - y0) * tableSize));
+  // The last entry is the same as the first one of the next pixel.
+  if (fx == tableSize) {
+    x0++;
+    fx = 0;
+  }
+  if (fy == tableSize) {
+    y0++;
+    fy = 0;
+  }
+  const std::array<float, 8> &wx = table[fx];
+  const std::array<float, 8> &wy = table[fy];
+  x0 -= lanczosRadius - 1;
+  y0 -= lanczosRadius - 1;
+  const bool inside =
+      x0 >= 0 && y0 >= 0 && x0 + 8 <= width && y0 + 8 <= height;
+
+  float acc[4] = {};
+  const uint8_t *data = color.data_.data();
+  for (int j = 0; j < 8; j++) {
+    const int yy = y0 + j;
+    if (!inside && (yy < 0 || yy >= height)) {
+      continue;
+    }
+    float rowAcc[4] = {};
+    for (int i = 0; i < 8; i++) {
+      const int xx = x0 + i;
+      if (!inside && (xx < 0 || xx >= width)) {
+        continue;
+      }
+      const uint8_t *p =
+          data + (static_cast<size_t>(yy) * width + xx) * channels;
+      for (int c = 0; c < channels; c++) {
+        rowAcc[c] += wx[i] * p[c];
+      }
+    }
+    for (int c = 0; c < channels; c++) {
+      acc[c] += wy[j] * rowAcc[c];
+    }
+  }
+  for (int c = 0; c < channels; c++) {
+    out[c] = static_cast<uint8_t>(std::clamp(std::lround(acc[c]), 0L, 255L));
+  }
+}
+
+void StereoRegistration::computeRows(
+    const open3d::geometry::Image &disparity,
+    const open3d::geometry::Image &color, size_t first, size_t last,
+    open3d::geometry::Image &depth, open3d::geometry::Image &registered) const {
+  const size_t width = static_cast<size_t>(disparity.width_);
+  const size_t channels = static_cast<size_t>(color.num_of_channels_);
+  const float colorWidth = static_cast<float>(color.width_);
+  const float colorHeight = static_cast<float>(color.height_);
+  std::vector<float> mapX(width);
+  std::vector<float> mapY(width);
+  for (size_t y = first; y < last; y++) {
+    const float *disp =
+        reinterpret_cast<const float *>(disparity.data_.data()) + y * width;
+    float *z = reinterpret_cast<float *>(depth.data_.data()) + y * width;
+    projectRow(disp, static_cast<float>(y), mToColor.data(), mW.data(),
+               mColorK.data(), mDistortion.data(), mBf, width, mapX.data(),
+               mapY.data(), z);
+    uint8_t *out = registered.data_.data() + y * width * channels;
+    for (size_t x = 0; x < width; x++, out += channels) {
+      const float u = mapX[x];
+      const float v = mapY[x];
+      if (!mKeepInvalidColor &&
+          (u < 0.0f || v < 0.0f || u > colorWidth || v > colorHeight)) {
+        z[x] = 0.0f;
+      }
+      sampleLanczos(color, u, v, mLanczos, tableSize, out);
+    }
+  }
+}
+
+std::pair<open3d::geometry::Image, open3d::geometry::Image>
+StereoRegistration::registerFrame(const open3d::geometry::Image &disparity,
+                                  const open3d::geometry::Image &color) const {
+  if (disparity.num_of_channels_ != 1 || disparity.bytes_per_channel_ != 4) {
+    throw std::invalid_argument("The disparity must be a float32 image.");
+  }
+  if (disparity.width_ != mIntrinsic.width_ ||
+      disparity.height_ != mIntrinsic.height_) {
+    throw std::invalid_argument(
+        "The disparity does not have the size of the calibration.");
+  }
+  if (color.bytes_per_channel_ != 1 || color.num_of_channels_ < 1 ||
+      color.num_of_channels_ > 4 || color.width_ <= 0 || color.height_ <= 0) {
+    throw std::invalid_argument("Unsupported format of the color image.");
+  }
+
+  std::pair<open3d::geometry::Image, open3d::geometry::Image> frame;
+  auto &[registered, depth] = frame;
+  registered.Prepare(disparity.width_, disparity.height_,
+                     color.num_of_channels_, 1);
+  depth.Prepare(disparity.width_, disparity.height_, 1, 4);
+  const size_t height = static_cast<size_t>(disparity.height_);
+  parallelFor((height + rowsPerBlock - 1) / rowsPerBlock, [&](size_t block) {
+    const size_t first = block * rowsPerBlock;
+    computeRows(disparity, color, first,
+                std::min(first + rowsPerBlock, height), depth, registered);
+  });
+  return frame;
+}
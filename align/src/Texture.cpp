@@ -56,15 +56,20 @@ Texture::Texture(const open3d::geometry::Image &image) {
                type, buffer.data());
   glGenerateMipmap(GL_TEXTURE_2D);
   glBindTexture(GL_TEXTURE_2D, 0);
+  // The mipmaps add a third of the base level.
+  mBytes = image.data_.size() + image.data_.size() / 3;
 }
 
 Texture::Texture(Texture &&other) noexcept {
   mTexture = other.mTexture;
+  mBytes = other.mBytes;
   other.mTexture = 0;
+  other.mBytes = 0;
 }
 
 Texture &Texture::operator=(Texture &&other) noexcept {
   std::swap(mTexture, other.mTexture);
+  std::swap(mBytes, other.mBytes);
   return *this;
 }
 
@@ -72,6 +77,7 @@ Texture::~Texture() {
   // "glDeleteTextures silently ignores 0's"
   glDeleteTextures(1, &mTexture);
   mTexture = 0;
+  mBytes = 0;
 }
 
 void Texture::bind() const { glBindTexture(GL_TEXTURE_2D, mTexture); }
@@ -17,6 +17,7 @@
 #include "open3d/io/TriangleMeshIO.h"
 
 #include "EditorState.h"
+#include "morton.h"
 
 TextureLabState::TextureLabState(Application &app,
                                  const std::set<size_t> &indices)
@@ -32,6 +33,29 @@ TextureLabState::TextureLabState(Application &app,
     // std::bad_alloc instead.
     assert(mTextures.back());
   }
+  mMemory = MemoryRegistry::get().add(
+      [this](std::vector<MemoryRegistry::Entry> &entries) {
+        reportMemory(entries);
+      });
+}
+
+void TextureLabState::reportMemory(
+    std::vector<MemoryRegistry::Entry> &entries) const {
+  // KDTreeFlann does not expose its data: it keeps a copy of the points and
+  // an index with a permutation of them, plus the nodes, which we ignore.
+  constexpr size_t treePointBytes = 3 * sizeof(double) + sizeof(size_t);
+  for (const auto &tex : mTextures) {
+    entries.push_back(
+        {"Texture lab", tex->name, "texture", tex->texture.getBytes(), true});
+    entries.push_back({"Texture lab", tex->name, "UVs",
+                       tex->uv.capacity() * sizeof(Eigen::Vector2f)});
+    if (tex->tree) {
+      entries.push_back({"Texture lab", tex->name, "KD-tree (estimate)",
+                         tex->uv.size() * treePointBytes});
+    }
+  }
+  entries.push_back(
+      {"Texture lab", "", "mesh", MemoryRegistry::getBytes(mMesh)});
 }
 
 void TextureLabState::start() {
@@ -155,7 +179,8 @@ bool TextureLabState::exportTexture() {
   open3d::geometry::Image texture;
   {
     assert(!clouds.empty());
-    const open3d::geometry::Image &color = clouds[0].getRgbdImage().color_;
+    auto colorPtr = clouds[0].getColorImage();
+    const open3d::geometry::Image &color = *colorPtr;
     texture.Prepare(color.width_, 0, color.num_of_channels_,
                     color.bytes_per_channel_);
   }
@@ -166,8 +191,8 @@ bool TextureLabState::exportTexture() {
       continue;
     }
 
-    const open3d::geometry::Image &color =
-        clouds[tex->index].getRgbdImage().color_;
+    auto colorPtr = clouds[tex->index].getColorImage();
+    const open3d::geometry::Image &color = *colorPtr;
     if (color.width_ != texture.width_ ||
         color.num_of_channels_ != texture.num_of_channels_ ||
         color.bytes_per_channel_ != texture.bytes_per_channel_) {
@@ -316,7 +341,7 @@ TextureLabState::TextureData::TextureData(const Scene &scene, size_t idx,
     : index(idx) {
   const PointCloud &pcd = scene.clouds.at(idx);
   name = pcd.name;
-  texture = Texture(pcd.getRgbdImage().color_);
+  texture = Texture(*pcd.getColorImage());
   updateTree(scene, useMask);
 }
 
@@ -333,6 +358,11 @@ void TextureLabState::TextureData::updateTree(const Scene &scene,
   if (points.empty()) {
     return;
   }
+  // We query the tree for every vertex of the mesh, and they are usually in
+  // spatial order, too.
+  if (pcd.sortPoints) {
+    sortMorton(points, pixels);
+  }
 
   const open3d::camera::PinholeCameraIntrinsic &camera =
       scene.getCameraIntrinsic();
@@ -0,0 +1,272 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "ThumbnailAtlas.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <tuple>
+#include <unordered_map>
+
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "Scene.h"
+#include "colormap.h"
+#include "imageutils.h"
+#include "parallel.h"
+
+namespace fs = std::filesystem;
+
+static const char atlasMagic[8] = {'F', 'P', 'T', 'H', 'U', 'M', 'B', 0};
+static constexpr uint32_t atlasVersion = 2;
+
+struct ThumbnailAtlas::Header {
+  char magic[8];
+  uint32_t version;
+  int32_t tileWidth;
+  int32_t tileHeight;
+  float trunc;
+  uint64_t count;
+};
+
+bool ThumbnailAtlas::Stamp::operator==(const Stamp &other) const {
+  return rgbTime == other.rgbTime && depthTime == other.depthTime;
+}
+
+ThumbnailAtlas::ThumbnailAtlas(const Scene &scene, std::vector<Source> frames,
+                               float trunc)
+    : mScene(scene), mFrames(std::move(frames)), mTrunc(trunc) {
+  const auto &intr = scene.getCameraIntrinsic();
+  if (intr.width_ <= 0 || intr.height_ <= 0) {
+    throw std::invalid_argument("The scene does not have a valid camera.");
+  }
+  mTileWidth = thumbnailWidth * 2;
+  mTileHeight = std::max(
+      1, static_cast<int>(std::lround(static_cast<double>(thumbnailWidth) *
+                                      intr.height_ / intr.width_)));
+  mPath = scene.getDataDirectory() / "cache" / "thumbnails.atlas";
+  mPixels.resize(mFrames.size() * getTileBytes());
+  mReady = std::make_unique<std::atomic<bool>[]>(mFrames.size());
+  for (size_t i = 0; i < mFrames.size(); i++) {
+    mReady[i] = false;
+  }
+  mWorker = std::thread(&ThumbnailAtlas::work, this);
+  mMemory = MemoryRegistry::get().add(
+      [this](std::vector<MemoryRegistry::Entry> &entries) {
+        entries.push_back({"Thumbnails", "", "tiles", mPixels.size()});
+      });
+}
+
+ThumbnailAtlas::~ThumbnailAtlas() {
+  mStop = true;
+  if (mWorker.joinable()) {
+    mWorker.join();
+  }
+}
+
+const uint8_t *ThumbnailAtlas::getTile(size_t idx) const {
+  if (idx >= mFrames.size() || !mReady[idx]) {
+    return nullptr;
+  }
+  return mPixels.data() + idx * getTileBytes();
+}
+
+size_t ThumbnailAtlas::getTileBytes() const {
+  return static_cast<size_t>(mTileWidth) * static_cast<size_t>(mTileHeight) *
+         3;
+}
+
+void ThumbnailAtlas::work() {
+  // Checking the stamps is cheaper than decoding the frames, but it still
+  // needs to stat all the files, so we do it here rather than in the UI.
+  std::vector<Stamp> stamps(mFrames.size());
+  for (size_t i = 0; i < mFrames.size() && !mStop; i++) {
+    stamps[i] = getStamp(mFrames[i]);
+  }
+  try {
+    load(stamps);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Cannot load the thumbnails: %s\n", e.what());
+  }
+
+  std::vector<size_t> missing;
+  for (size_t i = 0; i < mFrames.size(); i++) {
+    if (!mReady[i]) {
+      missing.push_back(i);
+    }
+  }
+  if (missing.empty()) {
+    return;
+  }
+  parallelFor(missing.size(), [&](size_t i) { createTile(missing[i]); });
+  try {
+    save(stamps);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Cannot save the thumbnails: %s\n", e.what());
+  }
+}
+
+void ThumbnailAtlas::load(const std::vector<Stamp> &stamps) {
+  std::ifstream in(mPath, std::ios::binary);
+  if (!in) {
+    return;
+  }
+  Header h;
+  if (!in.read(reinterpret_cast<char *>(&h), sizeof(h)) ||
+      memcmp(h.magic, atlasMagic, sizeof(atlasMagic)) ||
+      h.version != atlasVersion || h.tileWidth != mTileWidth ||
+      h.tileHeight != mTileHeight || h.trunc != mTrunc) {
+    // Outdated, we will overwrite it.
+    return;
+  }
+
+  std::unordered_map<std::string, size_t> indices;
+  for (size_t i = 0; i < mFrames.size(); i++) {
+    indices[mFrames[i].stem] = i;
+  }
+  // The tile of each entry of the file, or SIZE_MAX to skip it.
+  std::vector<size_t> destinations;
+  for (uint64_t i = 0; i < h.count && in; i++) {
+    uint32_t length;
+    in.read(reinterpret_cast<char *>(&length), sizeof(length));
+    if (!in || length > 4096) {
+      throw std::runtime_error("The thumbnail index is corrupted.");
+    }
+    std::string stem(length, '\0');
+    Stamp stamp;
+    in.read(stem.data(), length);
+    in.read(reinterpret_cast<char *>(&stamp.rgbTime), sizeof(stamp.rgbTime));
+    in.read(reinterpret_cast<char *>(&stamp.depthTime),
+            sizeof(stamp.depthTime));
+    auto it = indices.find(stem);
+    bool valid = it != indices.end() && stamp.isValid() &&
+                 stamps[it->second] == stamp;
+    destinations.push_back(valid ? it->second : SIZE_MAX);
+  }
+
+  const size_t tileBytes = getTileBytes();
+  for (size_t dst : destinations) {
+    if (dst == SIZE_MAX) {
+      in.seekg(static_cast<std::streamoff>(tileBytes), std::ios::cur);
+      continue;
+    }
+    if (!in.read(reinterpret_cast<char *>(mPixels.data() + dst * tileBytes),
+                 static_cast<std::streamsize>(tileBytes))) {
+      throw std::runtime_error("The thumbnail file is truncated.");
+    }
+    mReady[dst] = true;
+    mNumReady++;
+  }
+}
+
+void ThumbnailAtlas::save(const std::vector<Stamp> &stamps) const {
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, atlasMagic, sizeof(atlasMagic));
+  h.version = atlasVersion;
+  h.tileWidth = mTileWidth;
+  h.tileHeight = mTileHeight;
+  h.trunc = mTrunc;
+  h.count = mFrames.size();
+
+  fs::create_directories(mPath.parent_path());
+  fs::path tmpPath = mPath;
+  tmpPath += ".tmp";
+  {
+    std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char *>(&h), sizeof(h));
+    for (size_t i = 0; i < mFrames.size(); i++) {
+      const std::string &stem = mFrames[i].stem;
+      uint32_t length = static_cast<uint32_t>(stem.size());
+      // Tiles that are not ready (e.g., we have been stopped) get an invalid
+      // stamp, so that we will create them again.
+      const Stamp stamp = mReady[i] ? stamps[i] : Stamp();
+      out.write(reinterpret_cast<const char *>(&length), sizeof(length));
+      out.write(stem.data(), length);
+      out.write(reinterpret_cast<const char *>(&stamp.rgbTime),
+                sizeof(stamp.rgbTime));
+      out.write(reinterpret_cast<const char *>(&stamp.depthTime),
+                sizeof(stamp.depthTime));
+    }
+    out.write(reinterpret_cast<const char *>(mPixels.data()),
+              static_cast<std::streamsize>(mPixels.size()));
+    if (!out) {
+      throw std::runtime_error("Failed to write " + tmpPath.string() + ".");
+    }
+  }
+  fs::rename(tmpPath, mPath);
+}
+
+void ThumbnailAtlas::createTile(size_t idx) {
+  if (mStop) {
+    return;
+  }
+  const Source &source = mFrames[idx];
+  const auto &intr = mScene.getCameraIntrinsic();
+  // The smallest preview that is still larger than the thumbnail.
+  int scale = 1;
+  while (scale < 8 &&
+         getScaledSize(intr.width_, scale * 2) >= thumbnailWidth) {
+    scale *= 2;
+  }
+
+  open3d::geometry::Image rgb, depth, colormap;
+  try {
+    std::tie(rgb, depth) =
+        mScene.openFramePreview(source.rgb, source.depth, scale);
+    colormap = createColormap(rgb, depth, 1.0f,
+                              static_cast<float>(mScene.getDepthScale()),
+                              mTrunc);
+  } catch (std::exception &e) {
+    fprintf(stderr, "Cannot create the thumbnail of %s: %s\n",
+            source.stem.c_str(), e.what());
+    return;
+  }
+  assert(rgb.width_ == colormap.width_ && rgb.height_ == colormap.height_);
+
+  // Nearest neighbor is enough for thumbnails.
+  uint8_t *tile = mPixels.data() + idx * getTileBytes();
+  const int channels = rgb.num_of_channels_;
+  const float *cmap = reinterpret_cast<const float *>(colormap.data_.data());
+  for (int y = 0; y < mTileHeight; y++) {
+    int sy = std::min(y * rgb.height_ / mTileHeight, rgb.height_ - 1);
+    uint8_t *row = tile + static_cast<size_t>(y) * mTileWidth * 3;
+    for (int x = 0; x < thumbnailWidth; x++) {
+      int sx = std::min(x * rgb.width_ / thumbnailWidth, rgb.width_ - 1);
+      size_t src = static_cast<size_t>(sy) * rgb.width_ + sx;
+      const uint8_t *px = rgb.data_.data() + src * channels;
+      uint8_t *left = row + x * 3;
+      uint8_t *right = row + (thumbnailWidth + x) * 3;
+      for (int c = 0; c < 3; c++) {
+        left[c] = px[channels >= 3 ? c : 0];
+        float v = std::clamp(cmap[src * 3 + c], 0.0f, 1.0f);
+        right[c] = static_cast<uint8_t>(v * 255.0f);
+      }
+    }
+  }
+  mReady[idx] = true;
+  mNumReady++;
+}
+
+ThumbnailAtlas::Stamp
+ThumbnailAtlas::getStamp(const Source &source) const {
+  auto [rgbPath, depthPath] = mScene.getSourcePaths(source.rgb, source.depth);
+  std::error_code ec1, ec2;
+  auto rgbTime = fs::last_write_time(rgbPath, ec1);
+  auto depthTime = fs::last_write_time(depthPath, ec2);
+  if (ec1 || ec2) {
+    return {};
+  }
+  // We keep both times, because any combination of them could collide.
+  Stamp stamp;
+  stamp.rgbTime = static_cast<int64_t>(rgbTime.time_since_epoch().count());
+  stamp.depthTime = static_cast<int64_t>(depthTime.time_since_epoch().count());
+  return stamp;
+}
@@ -128,10 +128,41 @@ static_assert(sizeof(plasmaR) == sizeof(float) * 256 &&
                   sizeof(plasmaB) == sizeof(float) * 256,
               "Unexpected colormap size.");
 
+/**
+ * Blend the colormap of the depth with the RGB image.
+ *
+ * We convert the depth on the fly, to avoid creating a float copy of it.
+ */
+template <typename T>
+static void blendColormap(const Image &rgb, const T *depth, float blend,
+                          float factor, float *out) {
+  const size_t count =
+      static_cast<size_t>(rgb.width_) * static_cast<size_t>(rgb.height_);
+  const size_t channels = static_cast<size_t>(rgb.num_of_channels_);
+  const uint8_t *rgbP = rgb.data_.data();
+  float alpha = 1 - blend;
+  float beta = blend;
+  for (size_t i = 0; i < count; i++, rgbP += channels) {
+    float val = static_cast<float>(depth[i]) * factor;
+    uint8_t idx =
+        val > 0.0f && val <= 1.0f ? static_cast<uint8_t>(val * 255.0f) : 0;
+    // We don't really care of the correctness of the color at this point,
+    // so we don't apply the gamma correction.
+    if (channels >= 3) {
+      *out++ = alpha * rgbP[0] / 255.0f + beta * plasmaR[idx];
+      *out++ = alpha * rgbP[1] / 255.0f + beta * plasmaG[idx];
+      *out++ = alpha * rgbP[2] / 255.0f + beta * plasmaB[idx];
+    } else {
+      float brightness = *rgbP / 255.0f;
+      *out++ = alpha * brightness + beta * plasmaR[idx];
+      *out++ = alpha * brightness + beta * plasmaG[idx];
+      *out++ = alpha * brightness + beta * plasmaB[idx];
+    }
+  }
+}
+
 Image createColormap(const Image &rgb, const Image &depth, float blend,
                      float scale, float trunc) {
-  using namespace Eigen;
-
   if (rgb.width_ != depth.width_ || rgb.height_ != depth.height_) {
     throw std::invalid_argument("RGB and depth must have the same size");
   }
@@ -151,51 +182,16 @@ Image createColormap(const Image &rgb, const Image &depth, float blend,
     throw std::invalid_argument(error);
   }
 
-  Matrix<float, Dynamic, Dynamic, RowMajor> vals;
-  if (depth.bytes_per_channel_ == 2) {
-    using SrcMap = Map<const Matrix<uint16_t, Dynamic, Dynamic, RowMajor>>;
-    SrcMap src(reinterpret_cast<const uint16_t *>(depth.data_.data()),
-               depth.height_, depth.width_);
-    vals = src.cast<float>() * (scale / trunc);
-  } else if (depth.bytes_per_channel_ == 4) {
-    using SrcMap = Map<const Matrix<float, Dynamic, Dynamic, RowMajor>>;
-    SrcMap src(reinterpret_cast<const float *>(depth.data_.data()),
-               depth.height_, depth.width_);
-    vals = src * (scale / trunc);
-  }
-
   Image out;
   out.Prepare(depth.width_, depth.height_, 3, 4);
   float *data = reinterpret_cast<float *>(out.data_.data());
-  const uint8_t *rgbP = rgb.data_.data();
-  const float *valP = vals.data();
-  float alpha = 1 - blend;
-  float beta = blend;
-  if (rgb.num_of_channels_ >= 3) {
-    for (int r = 0; r < depth.height_; r++) {
-      for (int c = 0; c < depth.width_; c++, rgbP += rgb.num_of_channels_) {
-        uint8_t idx =
-            static_cast<uint8_t>(*valP > 1.0f ? 0.0f : *valP * 255.0f);
-        valP++;
-        // We don't really care of the correctness of the color at this point,
-        // so we don't apply the gamma correction.
-        *data++ = alpha * *rgbP / 255.0f + beta * plasmaR[idx];
-        *data++ = alpha * *(rgbP + 1) / 255.0f + beta * plasmaG[idx];
-        *data++ = alpha * *(rgbP + 2) / 255.0f + beta * plasmaB[idx];
-      }
-    }
+  const float factor = scale / trunc;
+  if (depth.bytes_per_channel_ == 2) {
+    blendColormap(rgb, reinterpret_cast<const uint16_t *>(depth.data_.data()),
+                  blend, factor, data);
   } else {
-    for (int r = 0; r < depth.height_; r++) {
-      for (int c = 0; c < depth.width_; c++, rgbP += rgb.num_of_channels_) {
-        uint8_t idx =
-            static_cast<uint8_t>(*valP > 1.0f ? 0.0f : *valP * 255.0f);
-        valP++;
-        float brightness = *rgbP / 255.0f;
-        *data++ = alpha * brightness + beta * plasmaR[idx];
-        *data++ = alpha * brightness + beta * plasmaG[idx];
-        *data++ = alpha * brightness + beta * plasmaB[idx];
-      }
-    }
+    blendColormap(rgb, reinterpret_cast<const float *>(depth.data_.data()),
+                  blend, factor, data);
   }
   return out;
 }
@@ -0,0 +1,466 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "depthfilter.h"
+
+#include <algorithm>
+#include <functional>
+#include <stdexcept>
+#include <vector>
+
+#include <cmath>
+#include <cstddef>
+
+#include "parallel.h"
+#include "simd.h"
+
+using json = nlohmann::json;
+
+// Rows are distributed to the workers in bands of this size.
+static constexpr size_t rowsPerBand = 16;
+
+DepthFilter DepthFilter::disabled() {
+  DepthFilter filter;
+  filter.minSupport = 0;
+  filter.holeRadius = 0;
+  filter.bilateralRadius = 0;
+  return filter;
+}
+
+bool DepthFilter::isEnabled() const {
+  return minSupport > 0 || holeRadius > 0 || bilateralRadius > 0;
+}
+
+bool DepthFilter::operator==(const DepthFilter &other) const {
+  return minSupport == other.minSupport &&
+         flyingThreshold == other.flyingThreshold &&
+         holeRadius == other.holeRadius &&
+         bilateralRadius == other.bilateralRadius &&
+         sigmaSpace == other.sigmaSpace && sigmaDepth == other.sigmaDepth;
+}
+
+void to_json(json &j, const DepthFilter &filter) {
+  j = json{{"minSupport", filter.minSupport},
+           {"flyingThreshold", filter.flyingThreshold},
+           {"holeRadius", filter.holeRadius},
+           {"bilateralRadius", filter.bilateralRadius},
+           {"sigmaSpace", filter.sigmaSpace},
+           {"sigmaDepth", filter.sigmaDepth}};
+}
+
+void from_json(const json &j, DepthFilter &filter) {
+  // Missing values take the defaults, so that we can add new parameters.
+  const DepthFilter defaults;
+  filter.minSupport = j.value("minSupport", defaults.minSupport);
+  filter.flyingThreshold = j.value("flyingThreshold", defaults.flyingThreshold);
+  filter.holeRadius = j.value("holeRadius", defaults.holeRadius);
+  filter.bilateralRadius = j.value("bilateralRadius", defaults.bilateralRadius);
+  filter.sigmaSpace = j.value("sigmaSpace", defaults.sigmaSpace);
+  filter.sigmaDepth = j.value("sigmaDepth", defaults.sigmaDepth);
+}
+
+/**
+ * The images of the stages, in meters and with a border of zeros, so that
+ * the kernels can read the neighbors without checking the bounds.
+ */
+struct PaddedDepth {
+  size_t width;
+  size_t height;
+  size_t pad;
+  size_t stride;
+
+  size_t index(size_t x, size_t y) const {
+    return (y + pad) * stride + pad + x;
+  }
+};
+
+template <typename T>
+static void decodeRow(const T *src, size_t width, float scale, float *out) {
+  for (size_t x = 0; x < width; x++) {
+    const float z = static_cast<float>(src[x]) * scale;
+    // Also NaNs are invalid.
+    out[x] = z > 0.0f && std::isfinite(z) ? z : 0.0f;
+  }
+}
+
+#ifdef SIMD_AVX2
+/**
+ * exp(x) for x <= 0, with a relative error around 1e-6, which is more than
+ * enough for the weights.
+ */
+SIMD_AVX2_TARGET static inline __m256 expNegative(__m256 x) {
+  const __m256 t = _mm256_mul_ps(_mm256_max_ps(x, _mm256_set1_ps(-80.0f)),
+                                 _mm256_set1_ps(1.44269504f));
+  const __m256 fi = _mm256_floor_ps(t);
+  const __m256 f = _mm256_sub_ps(t, fi);
+  // 2^f on [0, 1).
+  __m256 p = _mm256_set1_ps(1.33336e-3f);
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(9.61813e-3f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(5.55041e-2f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(2.40227e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(6.93147e-1f));
+  p = _mm256_fmadd_ps(p, f, _mm256_set1_ps(1.0f));
+  const __m256i e = _mm256_slli_epi32(
+      _mm256_add_epi32(_mm256_cvtps_epi32(fi), _mm256_set1_epi32(127)), 23);
+  return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+static inline float32x4_t expNegative(float32x4_t x) {
+  const float32x4_t t =
+      vmulq_n_f32(vmaxq_f32(x, vdupq_n_f32(-80.0f)), 1.44269504f);
+  const float32x4_t fi = vrndmq_f32(t);
+  const float32x4_t f = vsubq_f32(t, fi);
+  float32x4_t p = vdupq_n_f32(1.33336e-3f);
+  p = vfmaq_f32(vdupq_n_f32(9.61813e-3f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(5.55041e-2f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(2.40227e-1f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(6.93147e-1f), p, f);
+  p = vfmaq_f32(vdupq_n_f32(1.0f), p, f);
+  const int32x4_t e =
+      vshlq_n_s32(vaddq_s32(vcvtq_s32_f32(fi), vdupq_n_s32(127)), 23);
+  return vmulq_f32(p, vreinterpretq_f32_s32(e));
+}
+#endif
+
+#ifdef SIMD_AVX2
+/**
+ * The AVX2 part of rejectFlyingRow: it processes blocks of 8 pixels, and
+ * returns the number of processed pixels.
+ */
+SIMD_AVX2_TARGET static size_t
+rejectFlyingRowAvx2(const float *src, float *dst, size_t width,
+                    const ptrdiff_t (&offsets)[8], float threshold,
+                    int32_t minSupport) {
+  size_t x = 0;
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFFFF));
+  const __m256i minCount = _mm256_set1_epi32(minSupport - 1);
+  for (; x + 8 <= width; x += 8) {
+    const __m256 c = _mm256_loadu_ps(src + x);
+    const __m256 limit = _mm256_mul_ps(c, _mm256_set1_ps(threshold));
+    __m256i support = _mm256_setzero_si256();
+    for (ptrdiff_t offset : offsets) {
+      const __m256 n = _mm256_loadu_ps(src + x + offset);
+      const __m256 diff = _mm256_and_ps(_mm256_sub_ps(n, c), absMask);
+      const __m256 same =
+          _mm256_and_ps(_mm256_cmp_ps(n, zero, _CMP_GT_OQ),
+                        _mm256_cmp_ps(diff, limit, _CMP_LE_OQ));
+      // The comparisons are -1 when they are true.
+      support = _mm256_sub_epi32(support, _mm256_castps_si256(same));
+    }
+    const __m256 keep =
+        _mm256_castsi256_ps(_mm256_cmpgt_epi32(support, minCount));
+    _mm256_storeu_ps(dst + x, _mm256_and_ps(c, keep));
+  }
+  return x;
+}
+#endif
+
+/**
+ * Keep only the pixels with enough neighbors on the same surface, which
+ * drops the flying pixels between the foreground and the background, and
+ * the isolated speckles.
+ */
+static void rejectFlyingRow(const float *src, float *dst, size_t width,
+                            ptrdiff_t stride, float threshold,
+                            int32_t minSupport) {
+  const ptrdiff_t offsets[8] = {-stride - 1, -stride, -stride + 1, -1,
+                                1,           stride - 1, stride,   stride + 1};
+  size_t x = 0;
+#ifdef SIMD_AVX2
+  if (isSimdEnabled()) {
+    x = rejectFlyingRowAvx2(src, dst, width, offsets, threshold, minSupport);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  if (isSimdEnabled()) {
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    const int32x4_t minCount = vdupq_n_s32(minSupport);
+    for (; x + 4 <= width; x += 4) {
+      const float32x4_t c = vld1q_f32(src + x);
+      const float32x4_t limit = vmulq_n_f32(c, threshold);
+      int32x4_t support = vdupq_n_s32(0);
+      for (ptrdiff_t offset : offsets) {
+        const float32x4_t n = vld1q_f32(src + x + offset);
+        const uint32x4_t same =
+            vandq_u32(vcgtq_f32(n, zero), vcleq_f32(vabdq_f32(n, c), limit));
+        support = vsubq_s32(support, vreinterpretq_s32_u32(same));
+      }
+      const uint32x4_t keep = vcgeq_s32(support, minCount);
+      vst1q_f32(dst + x, vreinterpretq_f32_u32(
+                             vandq_u32(vreinterpretq_u32_f32(c), keep)));
+    }
+  }
+#endif
+  for (; x < width; x++) {
+    const float c = src[x];
+    int32_t support = 0;
+    for (ptrdiff_t offset : offsets) {
+      const float n = src[x + offset];
+      support += n > 0.0f && std::abs(n - c) <= c * threshold;
+    }
+    dst[x] = support >= minSupport ? c : 0.0f;
+  }
+}
+
+/**
+ * Fill the invalid pixels that have valid neighbors on opposite sides, all
+ * on the same surface. Holes are rare, so this is not vectorized.
+ */
+static void fillHolesRow(const float *src, float *dst, size_t width,
+                         ptrdiff_t stride, int radius, float threshold) {
+  for (size_t x = 0; x < width; x++) {
+    if (src[x] > 0.0f) {
+      dst[x] = src[x];
+      continue;
+    }
+    dst[x] = 0.0f;
+    float sum = 0.0f;
+    float minZ = INFINITY;
+    float maxZ = 0.0f;
+    int count = 0;
+    // Bits for left, right, above and below.
+    unsigned sides = 0;
+    for (int dy = -radius; dy <= radius; dy++) {
+      const float *row = src + x + dy * stride;
+      for (int dx = -radius; dx <= radius; dx++) {
+        const float n = row[dx];
+        if (n <= 0.0f) {
+          continue;
+        }
+        sum += n;
+        minZ = std::min(minZ, n);
+        maxZ = std::max(maxZ, n);
+        count++;
+        sides |= (dx < 0 ? 1u : 0u) | (dx > 0 ? 2u : 0u) |
+                 (dy < 0 ? 4u : 0u) | (dy > 0 ? 8u : 0u);
+      }
+    }
+    const bool enclosed = (sides & 3u) == 3u || (sides & 12u) == 12u;
+    if (count && enclosed) {
+      const float mean = sum / static_cast<float>(count);
+      if (maxZ - minZ <= 2.0f * threshold * mean) {
+        dst[x] = mean;
+      }
+    }
+  }
+}
+
+struct BilateralKernel {
+  int radius;
+  // The spatial weights, row by row.
+  std::vector<float> spatial;
+  // -1 / (2 sigma_depth^2).
+  float rangeCoeff;
+};
+
+#ifdef SIMD_AVX2
+/**
+ * The AVX2 part of bilateralRow, like rejectFlyingRowAvx2.
+ */
+SIMD_AVX2_TARGET static size_t
+bilateralRowAvx2(const float *src, float *dst, size_t width, ptrdiff_t stride,
+                 const BilateralKernel &kernel) {
+  const int r = kernel.radius;
+  size_t x = 0;
+  const __m256 zero = _mm256_setzero_ps();
+  const __m256 rangeCoeff = _mm256_set1_ps(kernel.rangeCoeff);
+  for (; x + 8 <= width; x += 8) {
+    const __m256 c = _mm256_loadu_ps(src + x);
+    __m256 sum = zero;
+    __m256 weights = zero;
+    const float *spatial = kernel.spatial.data();
+    for (int dy = -r; dy <= r; dy++) {
+      const float *row = src + x + dy * stride;
+      for (int dx = -r; dx <= r; dx++, spatial++) {
+        const __m256 n = _mm256_loadu_ps(row + dx);
+        const __m256 diff = _mm256_sub_ps(n, c);
+        __m256 w = _mm256_mul_ps(
+            _mm256_set1_ps(*spatial),
+            expNegative(_mm256_mul_ps(_mm256_mul_ps(diff, diff), rangeCoeff)));
+        w = _mm256_and_ps(w, _mm256_cmp_ps(n, zero, _CMP_GT_OQ));
+        sum = _mm256_fmadd_ps(w, n, sum);
+        weights = _mm256_add_ps(weights, w);
+      }
+    }
+    // The center has always weight 1 when it is valid, so we divide by 0 only
+    // for invalid pixels, which we discard anyway.
+    const __m256 valid = _mm256_cmp_ps(c, zero, _CMP_GT_OQ);
+    _mm256_storeu_ps(dst + x,
+                     _mm256_and_ps(_mm256_div_ps(sum, weights), valid));
+  }
+  return x;
+}
+#endif
+
+static void bilateralRow(const float *src, float *dst, size_t width,
+                         ptrdiff_t stride, const BilateralKernel &kernel) {
+  const int r = kernel.radius;
+  size_t x = 0;
+#ifdef SIMD_AVX2
+  if (isSimdEnabled()) {
+    x = bilateralRowAvx2(src, dst, width, stride, kernel);
+  }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+  if (isSimdEnabled()) {
+    const float32x4_t zero = vdupq_n_f32(0.0f);
+    for (; x + 4 <= width; x += 4) {
+      const float32x4_t c = vld1q_f32(src + x);
+      float32x4_t sum = zero;
+      float32x4_t weights = zero;
+      const float *spatial = kernel.spatial.data();
+      for (int dy = -r; dy <= r; dy++) {
+        const float *row = src + x + dy * stride;
+        for (int dx = -r; dx <= r; dx++, spatial++) {
+          const float32x4_t n = vld1q_f32(row + dx);
+          const float32x4_t diff = vsubq_f32(n, c);
+          float32x4_t w = vmulq_n_f32(
+              expNegative(
+                  vmulq_n_f32(vmulq_f32(diff, diff), kernel.rangeCoeff)),
+              *spatial);
+          w = vreinterpretq_f32_u32(
+              vandq_u32(vreinterpretq_u32_f32(w), vcgtq_f32(n, zero)));
+          sum = vfmaq_f32(sum, w, n);
+          weights = vaddq_f32(weights, w);
+        }
+      }
+      const uint32x4_t valid = vcgtq_f32(c, zero);
+      const float32x4_t result = vdivq_f32(sum, weights);
+      vst1q_f32(dst + x, vreinterpretq_f32_u32(vandq_u32(
+                             vreinterpretq_u32_f32(result), valid)));
+    }
+  }
+#endif
+  for (; x < width; x++) {
+    const float c = src[x];
+    if (c <= 0.0f) {
+      dst[x] = 0.0f;
+      continue;
+    }
+    float sum = 0.0f;
+    float weights = 0.0f;
+    const float *spatial = kernel.spatial.data();
+    for (int dy = -r; dy <= r; dy++) {
+      const float *row = src + x + dy * stride;
+      for (int dx = -r; dx <= r; dx++, spatial++) {
+        const float n = row[dx];
+        if (n > 0.0f) {
+          const float diff = n - c;
+          const float w =
+              *spatial * std::exp(diff * diff * kernel.rangeCoeff);
+          sum += w * n;
+          weights += w;
+        }
+      }
+    }
+    dst[x] = sum / weights;
+  }
+}
+
+/**
+ * Run a function on all the rows, in parallel bands.
+ */
+static void forEachRow(size_t height,
+                       const std::function<void(size_t)> &rowFunc) {
+  parallelFor((height + rowsPerBand - 1) / rowsPerBand, [&](size_t band) {
+    const size_t last = std::min((band + 1) * rowsPerBand, height);
+    for (size_t y = band * rowsPerBand; y < last; y++) {
+      rowFunc(y);
+    }
+  });
+}
+
+open3d::geometry::Image filterDepth(const open3d::geometry::Image &depth,
+                                    float depthScale,
+                                    const DepthFilter &filter) {
+  if ((depth.bytes_per_channel_ != 2 && depth.bytes_per_channel_ != 4) ||
+      depth.num_of_channels_ != 1) {
+    throw std::invalid_argument(
+        "The depth image should be a uint16 or float32 single-channel image.");
+  }
+  if (!filter.isEnabled() || depth.width_ <= 0 || depth.height_ <= 0) {
+    return depth;
+  }
+  if (depthScale <= 0.0f || filter.flyingThreshold <= 0.0f ||
+      (filter.bilateralRadius > 0 &&
+       (filter.sigmaSpace <= 0.0f || filter.sigmaDepth <= 0.0f))) {
+    throw std::invalid_argument("Invalid parameters for the depth filter.");
+  }
+
+  PaddedDepth layout;
+  layout.width = static_cast<size_t>(depth.width_);
+  layout.height = static_cast<size_t>(depth.height_);
+  layout.pad = static_cast<size_t>(
+      std::max({1, filter.holeRadius, filter.bilateralRadius}));
+  layout.stride = layout.width + 2 * layout.pad;
+  const ptrdiff_t stride = static_cast<ptrdiff_t>(layout.stride);
+  // The borders stay 0 in both buffers, since the stages write only the
+  // pixels of the image.
+  std::vector<float> a(layout.stride * (layout.height + 2 * layout.pad));
+  std::vector<float> b(a.size());
+  float *src = a.data();
+  float *dst = b.data();
+
+  forEachRow(layout.height, [&](size_t y) {
+    float *out = src + layout.index(0, y);
+    if (depth.bytes_per_channel_ == 2) {
+      decodeRow(reinterpret_cast<const uint16_t *>(depth.data_.data()) +
+                    y * layout.width,
+                layout.width, depthScale, out);
+    } else {
+      decodeRow(reinterpret_cast<const float *>(depth.data_.data()) +
+                    y * layout.width,
+                layout.width, depthScale, out);
+    }
+  });
+
+  if (filter.minSupport > 0) {
+    forEachRow(layout.height, [&](size_t y) {
+      const size_t i = layout.index(0, y);
+      rejectFlyingRow(src + i, dst + i, layout.width, stride,
+                      filter.flyingThreshold, filter.minSupport);
+    });
+    std::swap(src, dst);
+  }
+  if (filter.holeRadius > 0) {
+    forEachRow(layout.height, [&](size_t y) {
+      const size_t i = layout.index(0, y);
+      fillHolesRow(src + i, dst + i, layout.width, stride, filter.holeRadius,
+                   filter.flyingThreshold);
+    });
+    std::swap(src, dst);
+  }
+  if (filter.bilateralRadius > 0) {
+    BilateralKernel kernel;
+    kernel.radius = filter.bilateralRadius;
+    const float spaceCoeff =
+        -0.5f / (filter.sigmaSpace * filter.sigmaSpace);
+    for (int dy = -kernel.radius; dy <= kernel.radius; dy++) {
+      for (int dx = -kernel.radius; dx <= kernel.radius; dx++) {
+        kernel.spatial.push_back(
+            std::exp(static_cast<float>(dx * dx + dy * dy) * spaceCoeff));
+      }
+    }
+    kernel.rangeCoeff = -0.5f / (filter.sigmaDepth * filter.sigmaDepth);
+    forEachRow(layout.height, [&](size_t y) {
+      const size_t i = layout.index(0, y);
+      bilateralRow(src + i, dst + i, layout.width, stride, kernel);
+    });
+    std::swap(src, dst);
+  }
+
+  open3d::geometry::Image filtered;
+  filtered.Prepare(depth.width_, depth.height_, 1, 4);
+  const float toNative = 1.0f / depthScale;
+  forEachRow(layout.height, [&](size_t y) {
+    const float *in = src + layout.index(0, y);
+    float *out =
+        reinterpret_cast<float *>(filtered.data_.data()) + y * layout.width;
+    for (size_t x = 0; x < layout.width; x++) {
+      out[x] = in[x] * toNative;
+    }
+  });
+  return filtered;
+}
@@ -0,0 +1,313 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "imageutils.h"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <csetjmp>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <jpeglib.h>
+#include <png.h>
+
+#include "open3d/io/ImageIO.h"
+
+#include "Scene.h"
+
+struct JpegError {
+  jpeg_error_mgr mgr;
+  jmp_buf jump;
+  char message[JMSG_LENGTH_MAX];
+};
+
+static void jpegErrorExit(j_common_ptr cinfo) {
+  JpegError *err = reinterpret_cast<JpegError *>(cinfo->err);
+  cinfo->err->format_message(cinfo, err->message);
+  // The default handler calls exit, and we cannot throw across C code.
+  longjmp(err->jump, 1);
+}
+
+/**
+ * Do the actual decoding.
+ *
+ * We use setjmp for the errors, so no object with a non-trivial destructor
+ * can be created in this function.
+ */
+static bool decodeJpegImpl(const uint8_t *data, size_t size, int scale,
+                           open3d::geometry::Image &img, JpegError &err) {
+  jpeg_decompress_struct cinfo;
+  cinfo.err = jpeg_std_error(&err.mgr);
+  err.mgr.error_exit = jpegErrorExit;
+  if (setjmp(err.jump)) {
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_mem_src(&cinfo, data, static_cast<unsigned long>(size));
+  jpeg_read_header(&cinfo, TRUE);
+  cinfo.scale_num = 1;
+  cinfo.scale_denom = static_cast<unsigned int>(scale);
+  // We are decoding previews, so prefer speed.
+  cinfo.dct_method = scale > 1 ? JDCT_IFAST : JDCT_ISLOW;
+  cinfo.out_color_space =
+      cinfo.num_components == 1 ? JCS_GRAYSCALE : JCS_RGB;
+  jpeg_start_decompress(&cinfo);
+  img.Prepare(static_cast<int>(cinfo.output_width),
+              static_cast<int>(cinfo.output_height),
+              cinfo.output_components, 1);
+  const size_t stride = static_cast<size_t>(img.BytesPerLine());
+  while (cinfo.output_scanline < cinfo.output_height) {
+    JSAMPROW row = img.data_.data() + cinfo.output_scanline * stride;
+    jpeg_read_scanlines(&cinfo, &row, 1);
+  }
+  jpeg_finish_decompress(&cinfo);
+  jpeg_destroy_decompress(&cinfo);
+  return true;
+}
+
+open3d::geometry::Image decodeJpeg(const uint8_t *data, size_t size,
+                                   int scale) {
+  if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+    throw std::invalid_argument("The JPEG scale must be 1, 2, 4 or 8.");
+  }
+  open3d::geometry::Image img;
+  JpegError err;
+  err.message[0] = 0;
+  if (!decodeJpegImpl(data, size, scale, img, err)) {
+    throw std::runtime_error(std::string("Cannot decode the JPEG image: ") +
+                             err.message);
+  }
+  return img;
+}
+
+open3d::geometry::Image readJpeg(const std::filesystem::path &path,
+                                 int scale) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Cannot open " + path.string() + ".");
+  }
+  std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)),
+                            std::istreambuf_iterator<char>());
+  try {
+    return decodeJpeg(data.data(), data.size(), scale);
+  } catch (std::runtime_error &e) {
+    throw std::runtime_error(path.string() + ": " + e.what());
+  }
+}
+
+struct PngError {
+  jmp_buf jump;
+};
+
+static void pngErrorExit(png_structp png, png_const_charp message) {
+  fprintf(stderr, "libpng: %s\n", message);
+  // Like for libjpeg, we cannot throw across C code.
+  longjmp(static_cast<PngError *>(png_get_error_ptr(png))->jump, 1);
+}
+
+/**
+ * Do the actual encoding of rows that are already packed.
+ *
+ * Like decodeJpegImpl, no object with a non-trivial destructor can be created
+ * in this function.
+ */
+static bool writeMaskPngImpl(FILE *fp, int width, int height,
+                             const uint8_t *rows, size_t stride,
+                             PngError &err) {
+  png_structp png =
+      png_create_write_struct(PNG_LIBPNG_VER_STRING, &err, pngErrorExit,
+                              nullptr);
+  if (!png) {
+    return false;
+  }
+  png_infop info = png_create_info_struct(png);
+  if (!info || setjmp(err.jump)) {
+    png_destroy_write_struct(&png, &info);
+    return false;
+  }
+  png_init_io(png, fp);
+  // Masks compress well also with the fastest level.
+  png_set_compression_level(png, 1);
+  png_set_IHDR(png, info, static_cast<png_uint_32>(width),
+               static_cast<png_uint_32>(height), 1, PNG_COLOR_TYPE_GRAY,
+               PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+               PNG_FILTER_TYPE_DEFAULT);
+  png_write_info(png, info);
+  for (int y = 0; y < height; y++) {
+    png_write_row(png, rows + static_cast<size_t>(y) * stride);
+  }
+  png_write_end(png, nullptr);
+  png_destroy_write_struct(&png, &info);
+  return true;
+}
+
+bool writeMaskPng(const std::filesystem::path &path, const BitMask &mask) {
+  if (mask.empty()) {
+    return false;
+  }
+  // PNG packs the leftmost pixel in the most significant bit of each byte,
+  // and each row starts on a new byte.
+  const int width = mask.getWidth();
+  const int height = mask.getHeight();
+  const size_t stride = (static_cast<size_t>(width) + 7) / 8;
+  std::vector<uint8_t> rows(stride * static_cast<size_t>(height));
+  for (int y = 0; y < height; y++) {
+    uint8_t *row = rows.data() + static_cast<size_t>(y) * stride;
+    for (int x = 0; x < width; x++) {
+      if (mask.test(x, y)) {
+        row[x >> 3] |= static_cast<uint8_t>(0x80 >> (x & 7));
+      }
+    }
+  }
+
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (!fp) {
+    return false;
+  }
+  PngError err;
+  bool ok = writeMaskPngImpl(fp, width, height, rows.data(), stride, err);
+  ok = !fclose(fp) && ok;
+  return ok;
+}
+
+bool isJpeg(const std::filesystem::path &path) {
+  std::string ext = Scene::lowercaseExtension(path);
+  return ext == ".jpg" || ext == ".jpeg";
+}
+
+open3d::geometry::Image readPfm(const std::filesystem::path &path) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    throw std::runtime_error("Cannot open " + path.string() + ".");
+  }
+  std::string magic;
+  int width = 0, height = 0;
+  double scale = 0.0;
+  in >> magic >> width >> height >> scale;
+  // A single whitespace separates the header from the data.
+  in.get();
+  if (!in || magic != "Pf" || width <= 0 || height <= 0 || scale == 0.0) {
+    throw std::runtime_error(path.string() +
+                             " is not a grayscale PFM image.");
+  }
+
+  open3d::geometry::Image img;
+  img.Prepare(width, height, 1, 4);
+  const size_t stride = static_cast<size_t>(img.BytesPerLine());
+  for (int y = height - 1; y >= 0; y--) {
+    in.read(reinterpret_cast<char *>(img.data_.data() + y * stride),
+            static_cast<std::streamsize>(stride));
+  }
+  if (!in) {
+    throw std::runtime_error(path.string() + " is truncated.");
+  }
+  // A negative scale means little endian.
+  const uint32_t one = 1;
+  const bool littleEndian = *reinterpret_cast<const uint8_t *>(&one) == 1;
+  if ((scale < 0.0) != littleEndian) {
+    for (size_t i = 0; i < img.data_.size(); i += 4) {
+      std::swap(img.data_[i], img.data_[i + 3]);
+      std::swap(img.data_[i + 1], img.data_[i + 2]);
+    }
+  }
+  return img;
+}
+
+double readPngDepthScale(const std::filesystem::path &path) {
+  static const char keyword[] = "depth-scale";
+  // The value is a short number, so longer chunks are something else.
+  constexpr uint32_t maxLength = 256;
+  std::ifstream in(path, std::ios::binary);
+  char signature[8];
+  if (!in.read(signature, sizeof(signature)) ||
+      memcmp(signature, "\x89PNG\r\n\x1a\n", sizeof(signature))) {
+    return 0.0;
+  }
+  uint8_t header[8];
+  while (in.read(reinterpret_cast<char *>(header), sizeof(header))) {
+    const uint32_t length = static_cast<uint32_t>(header[0]) << 24 |
+                            static_cast<uint32_t>(header[1]) << 16 |
+                            static_cast<uint32_t>(header[2]) << 8 | header[3];
+    const char *type = reinterpret_cast<const char *>(header + 4);
+    // Text chunks that come after the image data are possible, but we do not
+    // want to read the whole file for them.
+    if (!memcmp(type, "IDAT", 4) || !memcmp(type, "IEND", 4)) {
+      break;
+    }
+    if (memcmp(type, "tEXt", 4) || length > maxLength) {
+      in.seekg(static_cast<std::streamoff>(length) + 4, std::ios::cur);
+      continue;
+    }
+    // Keyword, null separator and the value, which is not terminated.
+    char text[maxLength + 1] = {};
+    if (!in.read(text, length) || !in.seekg(4, std::ios::cur)) {
+      break;
+    }
+    if (!strcmp(text, keyword) && length > sizeof(keyword)) {
+      double scale = strtod(text + sizeof(keyword), nullptr);
+      return scale > 0.0 ? scale : 0.0;
+    }
+  }
+  return 0.0;
+}
+
+open3d::geometry::Image readDepth(const std::filesystem::path &path,
+                                  double &unit) {
+  const std::string ext = Scene::lowercaseExtension(path);
+  if (ext == ".pfm") {
+    unit = 1.0;
+    return readPfm(path);
+  } else if (ext != ".png") {
+    throw std::runtime_error(path.string() +
+                             " does not have a supported depth format.");
+  }
+  open3d::geometry::Image img;
+  if (!open3d::io::ReadImage(path.string(), img)) {
+    throw std::runtime_error("Cannot open " + path.string() + ".");
+  }
+  double scale = readPngDepthScale(path);
+  unit = scale > 0.0 ? 1.0 / scale : 0.0;
+  return img;
+}
+
+bool isDepthFile(const std::filesystem::path &path) {
+  std::string ext = Scene::lowercaseExtension(path);
+  return ext == ".png" || ext == ".pfm";
+}
+
+open3d::geometry::Image subsampleImage(const open3d::geometry::Image &img,
+                                       int scale) {
+  if (scale < 1) {
+    throw std::invalid_argument("The scale must be positive.");
+  }
+  if (scale == 1) {
+    return img;
+  }
+  open3d::geometry::Image out;
+  out.Prepare(getScaledSize(img.width_, scale),
+              getScaledSize(img.height_, scale), img.num_of_channels_,
+              img.bytes_per_channel_);
+  const size_t pixelSize = static_cast<size_t>(img.num_of_channels_) *
+                           static_cast<size_t>(img.bytes_per_channel_);
+  const size_t srcStride = static_cast<size_t>(img.BytesPerLine());
+  const size_t dstStride = static_cast<size_t>(out.BytesPerLine());
+  for (int y = 0; y < out.height_; y++) {
+    const uint8_t *src = img.data_.data() + y * scale * srcStride;
+    uint8_t *dst = out.data_.data() + y * dstStride;
+    for (int x = 0; x < out.width_; x++) {
+      memcpy(dst + x * pixelSize, src + x * scale * pixelSize, pixelSize);
+    }
+  }
+  return out;
+}
@@ -7,10 +7,35 @@
 #include <memory>
 
 #include <cstdio>
+#include <cstring>
 
 #include "Application.h"
+#include "FrameArchive.h"
+#include "Scene.h"
+
+static int packFrames(const char *dataDirectory) {
+  try {
+    std::vector<std::string> warnings = FrameArchive::pack(
+        dataDirectory, Scene::getArchivePath(dataDirectory),
+        [](size_t done, size_t total) {
+          fprintf(stderr, "\rPacked %zu/%zu frames", done, total);
+        });
+    fprintf(stderr, "\n");
+    for (const std::string &w : warnings) {
+      fprintf(stderr, "Skipped %s\n", w.c_str());
+    }
+  } catch (std::exception &e) {
+    fprintf(stderr, "\nFailed to pack the frames: %s\n", e.what());
+    return -1;
+  }
+  return 0;
+}
 
 int main(int argc, char *argv[]) {
+  if (argc == 3 && !strcmp(argv[1], "--pack")) {
+    return packFrames(argv[2]);
+  }
+
   std::unique_ptr<Application> app;
   try {
     app = std::make_unique<Application>();
@@ -0,0 +1,117 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "morton.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+
+#include <cmath>
+
+#include "CompactCloud.h"
+#include "parallel.h"
+
+// We parallelize the computation of the codes in blocks of this size.
+static constexpr size_t blockSize = 1 << 16;
+static constexpr uint32_t mortonBits = 21;
+
+/**
+ * Insert two zero bits between each of the lowest 21 bits of v.
+ */
+static uint64_t spreadBits(uint32_t v) {
+  uint64_t x = v & 0x1fffff;
+  x = (x | x << 32) & 0x1f00000000ffffull;
+  x = (x | x << 16) & 0x1f0000ff0000ffull;
+  x = (x | x << 8) & 0x100f00f00f00f00full;
+  x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+  x = (x | x << 2) & 0x1249249249249249ull;
+  return x;
+}
+
+uint64_t encodeMorton(uint32_t x, uint32_t y, uint32_t z) {
+  return spreadBits(x) | spreadBits(y) << 1 | spreadBits(z) << 2;
+}
+
+/**
+ * Compute the order with a function that returns the coordinates of the
+ * points, so that we can share it between the two point formats.
+ */
+template <typename GetPoint>
+static std::vector<uint32_t> computeOrder(size_t n, GetPoint getPoint) {
+  if (n > std::numeric_limits<uint32_t>::max()) {
+    throw std::length_error("Too many points to sort.");
+  }
+  Eigen::Vector3f min = Eigen::Vector3f::Constant(
+      std::numeric_limits<float>::infinity());
+  Eigen::Vector3f max = -min;
+  for (size_t i = 0; i < n; i++) {
+    Eigen::Vector3f p = getPoint(i);
+    min = min.cwiseMin(p);
+    max = max.cwiseMax(p);
+  }
+  const float cells = static_cast<float>(1u << mortonBits);
+  const float extent = (max - min).maxCoeff();
+  const float scale = extent > 0.0f ? cells / extent : 0.0f;
+
+  std::vector<std::pair<uint64_t, uint32_t>> codes(n);
+  parallelFor((n + blockSize - 1) / blockSize, [&](size_t block) {
+    const size_t last = std::min(n, (block + 1) * blockSize);
+    for (size_t i = block * blockSize; i < last; i++) {
+      Eigen::Vector3f p = (getPoint(i) - min) * scale;
+      uint32_t c[3];
+      for (int j = 0; j < 3; j++) {
+        c[j] = static_cast<uint32_t>(
+            std::clamp(std::floor(p[j]), 0.0f, cells - 1.0f));
+      }
+      codes[i] = {encodeMorton(c[0], c[1], c[2]), static_cast<uint32_t>(i)};
+    }
+  });
+  // Sorting the pairs also keeps the original order for equal codes, which
+  // makes the result deterministic.
+  std::sort(codes.begin(), codes.end());
+
+  std::vector<uint32_t> order(n);
+  for (size_t i = 0; i < n; i++) {
+    order[i] = codes[i].second;
+  }
+  return order;
+}
+
+std::vector<uint32_t> getMortonOrder(const CompactCloud &points) {
+  return computeOrder(points.size(),
+                      [&](size_t i) { return points.getPoint(i); });
+}
+
+std::vector<uint32_t>
+getMortonOrder(const std::vector<Eigen::Vector3d> &points) {
+  return computeOrder(points.size(), [&](size_t i) -> Eigen::Vector3f {
+    return points[i].cast<float>();
+  });
+}
+
+void sortMorton(CompactCloud &points,
+                std::vector<Eigen::Vector2<unsigned int>> &pixels) {
+  if (pixels.size() != points.size()) {
+    throw std::invalid_argument(
+        "The number of pixels and of points do not match.");
+  }
+  std::vector<uint32_t> order = getMortonOrder(points);
+  points.reorder(order);
+  applyOrder(pixels, order);
+}
+
+void sortMorton(std::vector<Eigen::Vector3d> &points,
+                std::vector<Eigen::Vector2<unsigned int>> &pixels) {
+  if (pixels.size() != points.size()) {
+    throw std::invalid_argument(
+        "The number of pixels and of points do not match.");
+  }
+  std::vector<uint32_t> order = getMortonOrder(points);
+  applyOrder(points, order);
+  applyOrder(pixels, order);
+}
@@ -0,0 +1,61 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+size_t getNumWorkers() {
+  unsigned int n = std::thread::hardware_concurrency();
+  return n ? static_cast<size_t>(n) : 1;
+}
+
+void parallelFor(size_t count, const std::function<void(size_t)> &func) {
+  size_t numThreads = std::min(getNumWorkers(), count);
+  if (numThreads <= 1) {
+    for (size_t i = 0; i < count; i++) {
+      func(i);
+    }
+    return;
+  }
+
+  std::atomic<size_t> next = 0;
+  std::atomic<bool> failed = false;
+  std::exception_ptr error;
+  std::mutex errorMutex;
+  auto worker = [&]() {
+    for (size_t i = next++; i < count && !failed; i = next++) {
+      try {
+        func(i);
+      } catch (...) {
+        std::lock_guard<std::mutex> lock(errorMutex);
+        if (!error) {
+          error = std::current_exception();
+        }
+        failed = true;
+      }
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(numThreads - 1);
+  for (size_t i = 1; i < numThreads; i++) {
+    threads.emplace_back(worker);
+  }
+  // Use also the calling thread, instead of just waiting.
+  worker();
+  for (std::thread &t : threads) {
+    t.join();
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
@@ -0,0 +1,216 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "roi.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+#include <cmath>
+
+// The width of the bins of the histogram, in meters.
+static constexpr float binSize = 0.005f;
+// A head is about 25cm deep, we allow some margin for the neck.
+static constexpr float maxExtent = 0.35f;
+// Surfaces farther than this from the previous ones are background.
+static constexpr float minGap = 0.03f;
+// Bins with fewer pixels than this fraction of the peak are empty.
+static constexpr float valleyRatio = 0.05f;
+// The nearest surface must have at least this fraction of the valid pixels,
+// to skip the flying pixels and other noise.
+static constexpr float nearFraction = 0.005f;
+static constexpr size_t minValidPixels = 500;
+
+template <typename T>
+static void decodeDepth(const T *src, size_t count, float scale, float trunc,
+                        std::vector<float> &out) {
+  out.resize(count);
+  for (size_t i = 0; i < count; i++) {
+    float z = static_cast<float>(src[i]) * scale;
+    out[i] = z > 0.0f && z < trunc ? z : 0.0f;
+  }
+}
+
+/**
+ * Return the depth where the foreground ends, or 0 if we cannot find it.
+ */
+static float findForegroundCut(const std::vector<float> &z, float trunc) {
+  const size_t numBins =
+      static_cast<size_t>(std::ceil(trunc / binSize)) + 1;
+  std::vector<size_t> hist(numBins);
+  size_t numValid = 0;
+  for (float v : z) {
+    if (v > 0.0f) {
+      hist[std::min(static_cast<size_t>(v / binSize), numBins - 1)]++;
+      numValid++;
+    }
+  }
+  if (numValid < minValidPixels) {
+    return 0.0f;
+  }
+  // Smooth with a box filter, to avoid stopping at holes in the histogram
+  // caused by the quantization of the depth.
+  std::vector<float> smooth(numBins);
+  for (size_t i = 0; i < numBins; i++) {
+    size_t first = i ? i - 1 : 0;
+    size_t last = std::min(i + 2, numBins);
+    size_t sum = 0;
+    for (size_t j = first; j < last; j++) {
+      sum += hist[j];
+    }
+    smooth[i] = static_cast<float>(sum) / static_cast<float>(last - first);
+  }
+
+  size_t nearBin = 0;
+  size_t cumulative = 0;
+  const size_t nearCount = static_cast<size_t>(numValid * nearFraction);
+  while (nearBin < numBins && (cumulative += hist[nearBin]) <= nearCount) {
+    nearBin++;
+  }
+  const size_t lastBin = std::min(
+      numBins, nearBin + static_cast<size_t>(maxExtent / binSize) + 1);
+  size_t peakBin = nearBin;
+  for (size_t i = nearBin; i < lastBin; i++) {
+    if (smooth[i] > smooth[peakBin]) {
+      peakBin = i;
+    }
+  }
+
+  const float threshold = smooth[peakBin] * valleyRatio;
+  const size_t gapBins = static_cast<size_t>(std::ceil(minGap / binSize));
+  size_t emptyBins = 0;
+  for (size_t i = peakBin; i < lastBin; i++) {
+    if (smooth[i] < threshold) {
+      if (++emptyBins == gapBins) {
+        return static_cast<float>(i + 1 - gapBins) * binSize;
+      }
+    } else {
+      emptyBins = 0;
+    }
+  }
+  return static_cast<float>(lastBin) * binSize;
+}
+
+std::optional<FaceRoi> findFaceRoi(const open3d::geometry::Image &depth,
+                                   float depthScale, float trunc) {
+  if ((depth.bytes_per_channel_ != 2 && depth.bytes_per_channel_ != 4) ||
+      depth.num_of_channels_ != 1) {
+    throw std::invalid_argument(
+        "The depth image should be a uint16 or float32 single-channel image.");
+  }
+  if (depth.width_ <= 0 || depth.height_ <= 0) {
+    return std::nullopt;
+  }
+  const size_t width = static_cast<size_t>(depth.width_);
+  const size_t height = static_cast<size_t>(depth.height_);
+  const size_t count = width * height;
+  std::vector<float> z;
+  if (depth.bytes_per_channel_ == 2) {
+    decodeDepth(reinterpret_cast<const uint16_t *>(depth.data_.data()), count,
+                depthScale, trunc, z);
+  } else {
+    decodeDepth(reinterpret_cast<const float *>(depth.data_.data()), count,
+                depthScale, trunc, z);
+  }
+  const float cut = findForegroundCut(z, trunc);
+  if (cut <= 0.0f) {
+    return std::nullopt;
+  }
+
+  BitMask foreground(depth.width_, depth.height_);
+  size_t numValid = 0;
+  for (size_t i = 0; i < count; i++) {
+    numValid += z[i] > 0.0f;
+    if (z[i] > 0.0f && z[i] < cut) {
+      foreground.set(i);
+    }
+  }
+
+  // Find the largest 4-connected component, clearing the pixels we visit in
+  // a copy of the foreground, so that finding the next seed skips whole words
+  // of pixels that are background or that we have already visited.
+  BitMask remaining = foreground;
+  const std::vector<uint64_t> &words = remaining.getWords();
+  std::vector<size_t> stack;
+  auto fill = [&](size_t seed, BitMask &visited, BitMask *out) {
+    size_t size = 0;
+    visited.set(seed, false);
+    stack.push_back(seed);
+    while (!stack.empty()) {
+      size_t i = stack.back();
+      stack.pop_back();
+      size++;
+      if (out) {
+        out->set(i);
+      }
+      const size_t x = i % width;
+      const size_t y = i / width;
+      auto visit = [&](size_t j) {
+        if (visited.test(j)) {
+          visited.set(j, false);
+          stack.push_back(j);
+        }
+      };
+      if (x > 0) {
+        visit(i - 1);
+      }
+      if (x + 1 < width) {
+        visit(i + 1);
+      }
+      if (y > 0) {
+        visit(i - width);
+      }
+      if (y + 1 < height) {
+        visit(i + width);
+      }
+    }
+    return size;
+  };
+  size_t bestSeed = 0;
+  size_t bestSize = 0;
+  for (size_t w = 0; w < words.size(); w++) {
+    // fill clears the bits of this word, too.
+    while (words[w]) {
+      const size_t seed =
+          w * 64 + static_cast<size_t>(__builtin_ctzll(words[w]));
+      const size_t size = fill(seed, remaining, nullptr);
+      if (size > bestSize) {
+        bestSize = size;
+        bestSeed = seed;
+      }
+    }
+  }
+  if (bestSize < minValidPixels) {
+    return std::nullopt;
+  }
+
+  FaceRoi roi;
+  roi.mask = BitMask(depth.width_, depth.height_);
+  fill(bestSeed, foreground, &roi.mask);
+  roi.mask.updatePyramid();
+  // Find the bounding box with the pyramid, which skips the empty areas.
+  int minX = 0, minY = 0, maxX = depth.width_, maxY = depth.height_;
+  while (!roi.mask.isAnySet(0, minY, depth.width_, 1)) {
+    minY++;
+  }
+  while (!roi.mask.isAnySet(0, maxY - 1, depth.width_, 1)) {
+    maxY--;
+  }
+  while (!roi.mask.isAnySet(minX, minY, 1, maxY - minY)) {
+    minX++;
+  }
+  while (!roi.mask.isAnySet(maxX - 1, minY, 1, maxY - minY)) {
+    maxX--;
+  }
+  roi.x = minX;
+  roi.y = minY;
+  roi.width = maxX - minX;
+  roi.height = maxY - minY;
+  roi.numPixels = bestSize;
+  roi.numValid = numValid;
+  return roi;
+}
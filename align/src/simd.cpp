@@ -0,0 +1,30 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "simd.h"
+
+#include <atomic>
+
+static bool isSimdSupported() {
+#ifdef SIMD_AVX2
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#else
+  return true;
+#endif
+}
+
+// We check the CPU only once, since the kernels ask for every row.
+static std::atomic<bool> &getEnabled() {
+  static std::atomic<bool> enabled = isSimdSupported();
+  return enabled;
+}
+
+bool isSimdEnabled() { return getEnabled().load(std::memory_order_relaxed); }
+
+void setSimdEnabled(bool enabled) {
+  getEnabled() = enabled && isSimdSupported();
+}
@@ -0,0 +1,266 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include "unproject.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <cassert>
+
+#include "simd.h"
+
+CameraRays::CameraRays(
+    const open3d::camera::PinholeCameraIntrinsic &intrinsic) {
+  auto [fx, fy] = intrinsic.GetFocalLength();
+  auto [cx, cy] = intrinsic.GetPrincipalPoint();
+  x.resize(static_cast<size_t>(std::max(intrinsic.width_, 0)));
+  y.resize(static_cast<size_t>(std::max(intrinsic.height_, 0)));
+  for (size_t i = 0; i < x.size(); i++) {
+    x[i] = static_cast<float>((static_cast<double>(i) - cx) / fx);
+  }
+  for (size_t i = 0; i < y.size(); i++) {
+    y[i] = static_cast<float>((static_cast<double>(i) - cy) / fy);
+  }
+}
+
+/**
+ * Convert a row of a native depth image to meters, with 0 for the invalid
+ * pixels (including NaNs).
+ */
+template <typename T>
+static void decodeRow(const T *src, size_t width, float scale, float trunc,
+                      float *out) {
+  for (size_t i = 0; i < width; i++) {
+    float z = static_cast<float>(src[i]) * scale;
+    out[i] = z > 0.0f && z < trunc ? z : 0.0f;
+  }
+}
+
+#ifdef SIMD_AVX2
+/**
+ * The AVX2 part of transformRow: it processes blocks of 8 pixels, and returns
+ * the number of processed pixels.
+ */
+SIMD_AVX2_TARGET static size_t transformRowAvx2(const float *z,
+                                                const float *rayX, float rayY,
+                                                const float *m, size_t width,
+                                                float *out) {
+  float *outX = out;
+  float *outY = out + width;
+  float *outZ = out + 2 * width;
+  size_t i = 0;
+  const __m256 ry = _mm256_set1_ps(rayY);
+  __m256 r[12];
+  for (int j = 0; j < 12; j++) {
+    r[j] = _mm256_set1_ps(m[j]);
+  }
+  for (; i + 8 <= width; i += 8) {
+    __m256 pz = _mm256_loadu_ps(z + i);
+    __m256 px = _mm256_mul_ps(_mm256_loadu_ps(rayX + i), pz);
+    __m256 py = _mm256_mul_ps(ry, pz);
+    _mm256_storeu_ps(
+        outX + i,
+        _mm256_fmadd_ps(r[0], px,
+                        _mm256_fmadd_ps(r[1], py,
+                                        _mm256_fmadd_ps(r[2], pz, r[3]))));
+    _mm256_storeu_ps(
+        outY + i,
+        _mm256_fmadd_ps(r[4], px,
+                        _mm256_fmadd_ps(r[5], py,
+                                        _mm256_fmadd_ps(r[6], pz, r[7]))));
+    _mm256_storeu_ps(
+        outZ + i,
+        _mm256_fmadd_ps(r[8], px,
+                        _mm256_fmadd_ps(r[9], py,
+                                        _mm256_fmadd_ps(r[10], pz, r[11]))));
+  }
+  return i;
+}
+#endif
+
+/**
+ * Unproject and transform a whole row, including the invalid pixels, to keep
+ * the loop free of branches.
+ *
+ * m is the top 3x4 part of the transform, in row-major order.
+ */
+static void transformRow(const float *z, const float *rayX, float rayY,
+                         const float *m, size_t width, float *out) {
+  float *outX = out;
+  float *outY = out + width;
+  float *outZ = out + 2 * width;
+  size_t i = 0;
+#ifdef SIMD_AVX2
+  if (isSimdEnabled()) {
+    i = transformRowAvx2(z, rayX, rayY, m, width, out);
+  }
+#elif defined(__ARM_NEON)
+  if (isSimdEnabled()) {
+    const float32x4_t ry = vdupq_n_f32(rayY);
+    for (; i + 4 <= width; i += 4) {
+      float32x4_t pz = vld1q_f32(z + i);
+      float32x4_t px = vmulq_f32(vld1q_f32(rayX + i), pz);
+      float32x4_t py = vmulq_f32(ry, pz);
+      float32x4_t tx = vmlaq_n_f32(vdupq_n_f32(m[3]), px, m[0]);
+      float32x4_t ty = vmlaq_n_f32(vdupq_n_f32(m[7]), px, m[4]);
+      float32x4_t tz = vmlaq_n_f32(vdupq_n_f32(m[11]), px, m[8]);
+      tx = vmlaq_n_f32(vmlaq_n_f32(tx, py, m[1]), pz, m[2]);
+      ty = vmlaq_n_f32(vmlaq_n_f32(ty, py, m[5]), pz, m[6]);
+      tz = vmlaq_n_f32(vmlaq_n_f32(tz, py, m[9]), pz, m[10]);
+      vst1q_f32(outX + i, tx);
+      vst1q_f32(outY + i, ty);
+      vst1q_f32(outZ + i, tz);
+    }
+  }
+#endif
+  // The tail, or the whole row without SIMD (the compiler might still
+  // vectorize it).
+  for (; i < width; i++) {
+    float px = rayX[i] * z[i];
+    float py = rayY * z[i];
+    float pz = z[i];
+    outX[i] = m[0] * px + m[1] * py + m[2] * pz + m[3];
+    outY[i] = m[4] * px + m[5] * py + m[6] * pz + m[7];
+    outZ[i] = m[8] * px + m[9] * py + m[10] * pz + m[11];
+  }
+}
+
+void unprojectRays(const open3d::geometry::Image &depth, float depthScale,
+                   float trunc, const CameraRays &rays,
+                   const Eigen::Matrix4d &transform, CompactCloud &points,
+                   std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                   const BitMask *mask) {
+  if (depth.width_ <= 0 || depth.height_ <= 0) {
+    throw std::invalid_argument("The depth image cannot be empty.");
+  }
+  if ((depth.bytes_per_channel_ != 2 && depth.bytes_per_channel_ != 4) ||
+      depth.num_of_channels_ != 1) {
+    throw std::invalid_argument(
+        "The depth image should be a uint16 or float32 single-channel image.");
+  }
+  const size_t width = static_cast<size_t>(depth.width_);
+  const size_t height = static_cast<size_t>(depth.height_);
+  if (rays.x.size() != width || rays.y.size() != height) {
+    throw std::invalid_argument(
+        "The depth image does not have the size of the camera.");
+  }
+  if (mask && (static_cast<size_t>(mask->getWidth()) != width ||
+               static_cast<size_t>(mask->getHeight()) != height)) {
+    throw std::invalid_argument(
+        "The mask does not have the size of the depth image.");
+  }
+  auto skipRow = [&](size_t y) {
+    return mask &&
+           !mask->isAnySet(0, static_cast<int>(y), depth.width_, 1);
+  };
+  auto keep = [&](size_t x, size_t y) {
+    return !mask || mask->test(y * width + x);
+  };
+
+  // We decode a row at a time, so that it stays in the cache, rather than
+  // creating a float copy of the whole image.
+  std::vector<float> z(width);
+  auto decode = [&](size_t y) {
+    if (depth.bytes_per_channel_ == 2) {
+      decodeRow(reinterpret_cast<const uint16_t *>(depth.data_.data()) +
+                    y * width,
+                width, depthScale, trunc, z.data());
+    } else {
+      decodeRow(reinterpret_cast<const float *>(depth.data_.data()) +
+                    y * width,
+                width, depthScale, trunc, z.data());
+    }
+  };
+
+  size_t count = 0;
+  for (size_t y = 0; y < height; y++) {
+    if (skipRow(y)) {
+      continue;
+    }
+    decode(y);
+    for (size_t x = 0; x < width; x++) {
+      count += z[x] > 0 && keep(x, y);
+    }
+  }
+  points.colors.clear();
+  points.normals.clear();
+  points.resize(count);
+  pixels.resize(count);
+
+  float m[12];
+  for (int r = 0; r < 3; r++) {
+    for (int c = 0; c < 4; c++) {
+      m[r * 4 + c] = static_cast<float>(transform(r, c));
+    }
+  }
+  assert(transform.row(3).isApprox(Eigen::RowVector4d(0, 0, 0, 1)));
+
+  std::vector<float> row(width * 3);
+  size_t n = 0;
+  for (size_t y = 0; y < height; y++) {
+    if (skipRow(y)) {
+      continue;
+    }
+    decode(y);
+    transformRow(z.data(), rays.x.data(), rays.y[y], m, width, row.data());
+    // Compact the valid pixels.
+    for (size_t x = 0; x < width; x++) {
+      if (z[x] > 0 && keep(x, y)) {
+        points.x[n] = row[x];
+        points.y[n] = row[width + x];
+        points.z[n] = row[2 * width + x];
+        pixels[n] = Eigen::Vector2<unsigned int>(static_cast<unsigned int>(x),
+                                                 static_cast<unsigned int>(y));
+        n++;
+      }
+    }
+  }
+  assert(n == count);
+}
+
+void unprojectRays(const open3d::geometry::Image &depth, float depthScale,
+                   float trunc, const CameraRays &rays,
+                   const Eigen::Matrix4d &transform,
+                   std::vector<Eigen::Vector3d> &points,
+                   std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                   const BitMask *mask) {
+  CompactCloud compact;
+  unprojectRays(depth, depthScale, trunc, rays, transform, compact, pixels,
+                mask);
+  points.resize(compact.size());
+  for (size_t i = 0; i < points.size(); i++) {
+    points[i] = Eigen::Vector3d(compact.x[i], compact.y[i], compact.z[i]);
+  }
+}
+
+void gatherColors(const open3d::geometry::Image &color,
+                  const std::vector<Eigen::Vector2<unsigned int>> &pixels,
+                  CompactCloud &points) {
+  assert(points.size() == pixels.size());
+  bool isRgb = color.bytes_per_channel_ == 1 && color.num_of_channels_ >= 3;
+  bool isGray = color.bytes_per_channel_ == 1 && color.num_of_channels_ == 1;
+  if (!isRgb && !isGray) {
+    throw std::runtime_error("Unsupported format of the color image.");
+  }
+
+  points.colors.resize(pixels.size() * 3);
+  const size_t width = static_cast<size_t>(color.width_);
+  const size_t pixelBytes = static_cast<size_t>(color.num_of_channels_);
+  uint8_t *dst = points.colors.data();
+  for (const auto &px : pixels) {
+    const uint8_t *c =
+        color.data_.data() + (px[1] * width + px[0]) * pixelBytes;
+    if (isRgb) {
+      dst[0] = c[0];
+      dst[1] = c[1];
+      dst[2] = c[2];
+    } else {
+      dst[0] = dst[1] = dst[2] = c[0];
+    }
+    dst += 3;
+  }
+}
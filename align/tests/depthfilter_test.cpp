@@ -0,0 +1,77 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include <random>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "open3d/geometry/Image.h"
+
+#include "depthfilter.h"
+#include "simd.h"
+
+/**
+ * Check that the SIMD kernels of the depth filter give the same result as the
+ * scalar ones, on a background plane with a foreground square, noise, holes
+ * and speckles, so that all the stages have something to do.
+ */
+int main() {
+  constexpr int width = 61;
+  constexpr int height = 29;
+  std::mt19937 rng(42);
+  std::normal_distribution<float> noise(0.0f, 3.0f);
+  std::uniform_int_distribution<int> percent(0, 99);
+
+  open3d::geometry::Image depth;
+  depth.Prepare(width, height, 1, 2);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const bool foreground = x > 20 && x < 40 && y > 8 && y < 20;
+      float z = (foreground ? 600.0f : 1500.0f + 4.0f * static_cast<float>(x));
+      z += noise(rng);
+      const int p = percent(rng);
+      if (p < 5) {
+        z = 0.0f;
+      } else if (p < 7) {
+        z = 3000.0f;
+      }
+      const uint16_t native = static_cast<uint16_t>(z);
+      memcpy(depth.data_.data() + (y * width + x) * 2, &native, 2);
+    }
+  }
+
+  const DepthFilter filter;
+  setSimdEnabled(false);
+  const open3d::geometry::Image scalar = filterDepth(depth, 0.001f, filter);
+  setSimdEnabled(true);
+  const open3d::geometry::Image simd = filterDepth(depth, 0.001f, filter);
+  fprintf(stderr, "SIMD %s\n", isSimdEnabled() ? "enabled" : "not supported");
+
+  const float *a = reinterpret_cast<const float *>(scalar.data_.data());
+  const float *b = reinterpret_cast<const float *>(simd.data_.data());
+  size_t valid = 0;
+  for (int i = 0; i < width * height; i++) {
+    if ((a[i] > 0.0f) != (b[i] > 0.0f)) {
+      fprintf(stderr, "Pixel %d is valid only for one of the kernels\n", i);
+      return 1;
+    }
+    // The SIMD exponential is an approximation.
+    if (!(std::abs(a[i] - b[i]) <= 1e-4f * a[i])) {
+      fprintf(stderr, "Pixel %d differs: %g vs %g\n", i, a[i], b[i]);
+      return 1;
+    }
+    valid += a[i] > 0.0f;
+  }
+  // Make sure that the filter did not discard everything.
+  if (valid < static_cast<size_t>(width * height / 2)) {
+    fprintf(stderr, "Only %zu valid pixels\n", valid);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,136 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <unistd.h>
+
+#include "open3d/geometry/Image.h"
+#include "open3d/io/ImageIO.h"
+
+#include "ScanOctree.h"
+#include "Scene.h"
+
+namespace fs = std::filesystem;
+
+// The fields of the header of the octree file that we need.
+static constexpr std::streamoff numNodesOffset = 24;
+static constexpr std::streamoff nodesOffsetOffset = 32;
+
+static void writeScan(const fs::path &dir) {
+  constexpr int width = 64;
+  constexpr int height = 48;
+  fs::create_directories(dir / "rgb");
+  fs::create_directories(dir / "depth");
+  std::ofstream(dir / "camera.json")
+      << "{\"width\": 64, \"height\": 48, \"fx\": 50.0, \"fy\": 50.0, "
+         "\"ppx\": 32.0, \"ppy\": 24.0, \"scale\": 0.001}";
+
+  open3d::geometry::Image rgb;
+  rgb.Prepare(width, height, 3, 1);
+  open3d::geometry::Image depth;
+  depth.Prepare(width, height, 1, 2);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      uint8_t *color = rgb.data_.data() + (y * width + x) * 3;
+      color[0] = static_cast<uint8_t>(x * 4);
+      color[1] = static_cast<uint8_t>(y * 5);
+      color[2] = 128;
+      // A slanted plane around 1m.
+      const uint16_t z = static_cast<uint16_t>(900 + x + y);
+      memcpy(depth.data_.data() + (y * width + x) * 2, &z, 2);
+    }
+  }
+  if (!open3d::io::WriteImage((dir / "rgb" / "0.png").string(), rgb) ||
+      !open3d::io::WriteImage((dir / "depth" / "0.png").string(), depth)) {
+    throw std::runtime_error("Cannot write the frame.");
+  }
+}
+
+/**
+ * Make the first node after the root its own child, keeping the key of the
+ * file, so that only the validation can reject it.
+ */
+static void makeCycle(const fs::path &path) {
+  std::fstream f(path, std::ios::in | std::ios::out | std::ios::binary);
+  uint64_t numNodes = 0;
+  uint64_t nodesOffset = 0;
+  f.seekg(numNodesOffset);
+  f.read(reinterpret_cast<char *>(&numNodes), sizeof(numNodes));
+  f.seekg(nodesOffsetOffset);
+  f.read(reinterpret_cast<char *>(&nodesOffset), sizeof(nodesOffset));
+  if (!f || numNodes < 2) {
+    throw std::runtime_error("The octree does not have enough nodes.");
+  }
+  const uint32_t self = 1;
+  f.seekp(static_cast<std::streamoff>(nodesOffset + sizeof(ScanOctree::Node) +
+                                      offsetof(ScanOctree::Node, children)));
+  f.write(reinterpret_cast<const char *>(&self), sizeof(self));
+  if (!f) {
+    throw std::runtime_error("Cannot write the octree.");
+  }
+}
+
+static bool isTree(const ScanOctree &octree) {
+  const std::vector<ScanOctree::Node> &nodes = octree.getNodes();
+  for (size_t i = 0; i < nodes.size(); i++) {
+    for (uint32_t child : nodes[i].children) {
+      if (child && (child <= i || child >= nodes.size())) {
+        return false;
+      }
+    }
+  }
+  return !nodes.empty();
+}
+
+/**
+ * Check that an octree file whose nodes have a cycle is rejected and built
+ * again, instead of making the traversals loop forever.
+ */
+int main() {
+  const fs::path dir = fs::temp_directory_path() /
+                       ("scanoctree_test-" + std::to_string(getpid()));
+  int ret = 0;
+  try {
+    writeScan(dir);
+    auto [scene, warnings] = Scene::load(dir);
+    const std::vector<ScanOctree::Frame> frames = {
+        {"0", "rgb/0.png", "depth/0.png"}};
+    // Small enough to need a few levels.
+    const float spacing = 0.001f;
+    {
+      ScanOctree octree(*scene, frames, 2.0f, spacing);
+      if (!isTree(octree) || octree.getNodes().size() < 2) {
+        fprintf(stderr, "The octree that we built is not valid\n");
+        ret = 1;
+      }
+    }
+    if (!ret) {
+      makeCycle(dir / "cache" / "scan.octree");
+      ScanOctree octree(*scene, frames, 2.0f, spacing);
+      if (!isTree(octree) || !octree.getNumPoints()) {
+        fprintf(stderr, "We loaded the octree with a cycle\n");
+        ret = 1;
+      }
+    }
+  } catch (std::exception &e) {
+    fprintf(stderr, "%s\n", e.what());
+    ret = 1;
+  }
+  std::error_code ec;
+  fs::remove_all(dir, ec);
+  return ret;
+}
@@ -0,0 +1,81 @@
+/**
+ * To the extent possible under law, the author has dedicated all copyright
+ * and related and neighboring rights to this software to the public domain
+ * worldwide. This software is distributed without any warranty.
+ */
+
+#include <random>
+#include <vector>
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "Eigen/Geometry"
+
+#include "open3d/geometry/Image.h"
+
+#include "CompactCloud.h"
+#include "simd.h"
+#include "unproject.h"
+
+/**
+ * Check that the SIMD kernels give the same points as the scalar ones, on
+ * rows whose width is not a multiple of the SIMD width, so that the tails are
+ * tested, too.
+ */
+int main() {
+  constexpr int width = 37;
+  constexpr int height = 23;
+  std::mt19937 rng(42);
+  std::uniform_int_distribution<int> mm(0, 4000);
+
+  open3d::geometry::Image depth;
+  depth.Prepare(width, height, 1, 2);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      // Also some invalid pixels.
+      const uint16_t z = (x + y) % 7 ? static_cast<uint16_t>(mm(rng)) : 0;
+      memcpy(depth.data_.data() + (y * width + x) * 2, &z, 2);
+    }
+  }
+  CameraRays rays;
+  for (int x = 0; x < width; x++) {
+    rays.x.push_back(static_cast<float>(x - width / 2) / 30.0f);
+  }
+  for (int y = 0; y < height; y++) {
+    rays.y.push_back(static_cast<float>(y - height / 2) / 30.0f);
+  }
+  Eigen::Affine3d transform(
+      Eigen::AngleAxisd(0.3, Eigen::Vector3d(1, 2, 3).normalized()));
+  transform.translation() = Eigen::Vector3d(0.1, -0.2, 0.3);
+
+  auto unproject = [&](bool simd, CompactCloud &points,
+                       std::vector<Eigen::Vector2<unsigned int>> &pixels) {
+    setSimdEnabled(simd);
+    unprojectRays(depth, 0.001f, 3.5f, rays, transform.matrix(), points,
+                  pixels);
+  };
+  CompactCloud scalar, simd;
+  std::vector<Eigen::Vector2<unsigned int>> scalarPixels, simdPixels;
+  unproject(false, scalar, scalarPixels);
+  unproject(true, simd, simdPixels);
+  fprintf(stderr, "SIMD %s, %zu points\n",
+          isSimdEnabled() ? "enabled" : "not supported", simd.size());
+
+  if (scalar.empty() || scalar.size() != simd.size() ||
+      scalarPixels != simdPixels) {
+    fprintf(stderr, "The SIMD and scalar kernels kept different pixels\n");
+    return 1;
+  }
+  for (size_t i = 0; i < scalar.size(); i++) {
+    // FMA rounds only once, so the results can differ in the last bits.
+    const float error = (scalar.getPoint(i) - simd.getPoint(i)).norm();
+    if (!(error <= 1e-5f)) {
+      fprintf(stderr, "Point %zu differs by %g\n", i, error);
+      return 1;
+    }
+  }
+  return 0;
+}
@@ -23,6 +23,7 @@ and related and neighboring rights to this software to the public domain
 worldwide. This software is distributed without any warranty.
 """
 import argparse
+import json
 from collections import namedtuple
 from pathlib import Path
 
@@ -172,22 +173,32 @@ class Calibrator:
         )
 
     def save(self):
+        params = {
+            "im_size": np.array(self.im_size),
+            "intrinsic": self.rectify[2][:, :3],
+            "Q": self.rectify[4],
+            "Bf": -self.rectify[3][0, 3],
+            "color_intrinsic": self.calibrations["rgb"].intrinsic,
+            "color_distortion": self.calibrations["rgb"].distortion,
+            "color_r": self.color_r,
+            "color_t": self.color_t,
+        }
         np.savez_compressed(
             self.dir / "calibration.npz",
-            im_size=np.array(self.im_size),
-            intrinsic=self.rectify[2][:, :3],
-            Q=self.rectify[4],
-            Bf=-self.rectify[3][0, 3],
             map_l_x=self.map_l_x,
             map_l_y=self.map_l_y,
             map_r_x=self.map_r_x,
             map_r_y=self.map_r_y,
-            color_intrinsic=self.calibrations["rgb"].intrinsic,
-            color_distortion=self.calibrations["rgb"].distortion,
-            color_r=self.color_r,
-            color_t=self.color_t,
+            **params,
         )
-
+        # align reads the parameters to register the disparity from this file,
+        # so that it does not need to parse NumPy files.
+        with open(self.dir / "stereo.json", "w") as f:
+            json.dump(
+                {k: np.asarray(v).tolist() for k, v in params.items()},
+                f,
+                indent=2,
+            )
 
 parser = argparse.ArgumentParser()
 parser.add_argument(
@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+"""Export the calibration of a stereo camera for the align program.
+
+align can create the RGBD frames directly from the disparity maps, without
+running stereo-make-depth.py, but it reads the calibration from a
+stereo.json file, rather than from calibration.npz.
+stereo-calibrate.py writes both, this script creates stereo.json for the
+calibrations made before it did.
+
+Set keep_invalid_color to true in the output to keep the depth of the pixels
+that the color camera does not see, like the --keep-invalid-color option of
+stereo-make-depth.py.
+
+To the extent possible under law, the author has dedicated all copyright
+and related and neighboring rights to this software to the public domain
+worldwide. This software is distributed without any warranty.
+"""
+import argparse
+import json
+from pathlib import Path
+
+import numpy as np
+
+keys = [
+    "im_size",
+    "intrinsic",
+    "Q",
+    "Bf",
+    "color_intrinsic",
+    "color_distortion",
+    "color_r",
+    "color_t",
+]
+
+parser = argparse.ArgumentParser()
+parser.add_argument(
+    "calibration",
+    type=Path,
+    help="The path to a calibration file produced with stereo-calibrate.py.",
+)
+parser.add_argument(
+    "destination",
+    type=Path,
+    nargs="?",
+    help="The dataset directory where stereo.json will be saved. By default, "
+    "the directory of the calibration.",
+)
+parser.add_argument(
+    "--keep-invalid-color",
+    action="store_true",
+    help="Do not set depth to 0 if color data is not available.",
+)
+args = parser.parse_args()
+
+calibration = np.load(args.calibration)
+stereo = {k: np.asarray(calibration[k]).tolist() for k in keys}
+if args.keep_invalid_color:
+    stereo["keep_invalid_color"] = True
+destination = args.destination if args.destination else args.calibration.parent
+with open(destination / "stereo.json", "w") as f:
+    json.dump(stereo, f, indent=2)
@@ -14,6 +14,9 @@ It uses PIL to save images rather than cv2.imwrite because PIL allows to
 add text to PNG images, which we use to use a per-frame scale factor,
 which in turn allows us to use the whole 16-bit space and reduce the
 quantization error.
+Alternatively, it can save the depth as float32 PFM images in meters, which
+avoid the quantization entirely, and are much faster to both write and read
+than compressed PNGs.
 
 To the extent possible under law, the author has dedicated all copyright
 and related and neighboring rights to this software to the public domain
@@ -67,6 +70,14 @@ parser.add_argument(
 parser.add_argument(
     "-f", "--color-format", choices=["jpg", "png", "bmp"], default="png"
 )
+parser.add_argument(
+    "-d",
+    "--depth-format",
+    choices=["png", "pfm"],
+    default="png",
+    help="Save the depth as uint16 PNG images, or as float32 PFM images in "
+    "meters. The scale is ignored for PFM images.",
+)
 parser.add_argument(
     "--optimize",
     action=argparse.BooleanOptionalAction,
@@ -110,7 +121,12 @@ with (destination / "camera.json").open("w") as f:
             "fy": intrinsic[1, 1],
             "ppx": intrinsic[0, 2],
             "ppy": intrinsic[1, 2],
-            "scale": args.scale if args.scale else 1.0,
+            # The factor to convert the values of the images to meters.
+            # Frames with their own scale in the PNG are converted to this
+            # one when they are opened.
+            "scale": 1.0 / args.scale
+            if args.scale and args.depth_format == "png"
+            else 1.0,
         },
         f,
         indent=2,
@@ -159,16 +175,19 @@ for disp_fn, color_fn in frames:
         reg_depth[rep[:, :, 1] < 0] = 0
         reg_depth[rep[:, :, 0] > color.shape[1]] = 0
         reg_depth[rep[:, :, 1] > color.shape[0]] = 0
-    scale = args.scale if args.scale else (65535 / reg_depth.max())
-    reg_depth = (reg_depth * scale).astype(np.uint16)
     reg_color = cv2.remap(color, rep, None, cv2.INTER_LANCZOS4)
 
     # -9 is to remove _disp.pfm.
-    reg_depth_fn = depth_dest / (disp_fn.name[:-9] + ".png")
-    reg_image = Image.fromarray(reg_depth)
-    pnginfo = PngImagePlugin.PngInfo()
-    pnginfo.add_text("depth-scale", str(scale))
-    reg_image.save(reg_depth_fn, pnginfo=pnginfo, optimize=args.optimize)
+    reg_depth_fn = depth_dest / (disp_fn.name[:-9] + "." + args.depth_format)
+    if args.depth_format == "pfm":
+        cv2.imwrite(str(reg_depth_fn), reg_depth)
+    else:
+        scale = args.scale if args.scale else (65535 / reg_depth.max())
+        reg_depth = (reg_depth * scale).astype(np.uint16)
+        reg_image = Image.fromarray(reg_depth)
+        pnginfo = PngImagePlugin.PngInfo()
+        pnginfo.add_text("depth-scale", str(scale))
+        reg_image.save(reg_depth_fn, pnginfo=pnginfo, optimize=args.optimize)
     reg_color_fn = (color_dest / color_fn.name).with_suffix(
         "." + args.color_format
     )